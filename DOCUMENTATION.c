@@ -43,6 +43,154 @@ Validates file sizes and extensions before encoding/decoding.
 
 Stores magic string #* to identify stego images.
 
+Optional 2, 3 or 4 bit embedding depth (-k N): stored after the magic string #+ in a
+32-bit format word, so decoding picks the depth up automatically.
+
+Real BMP header parsing (bmp.c): CORE, INFO and V2-V5 headers, 24-bit and 32-bit pixels,
+bottom-up and top-down rows. The payload starts at the pixel array offset from the header
+and skips row padding and the alpha byte of 32-bit pixels (-a embeds in alpha too).
+Covers where this differs from the plain byte run set FORMAT_FLAG_ROWS / FORMAT_FLAG_ALPHA
+in the format word; 24-bit covers without padding keep the original format.
+
+Optional payload compression (-z, lz.c): the secret is cut into 64 KB blocks, each
+compressed with a fast LZ4-style codec (kept raw when it does not shrink), on -j threads.
+FORMAT_FLAG_LZ in the format word marks it and a packed size field follows the secret
+size. If the whole secret does not shrink, it is embedded uncompressed without the flag.
+The compressed secret is held in memory while encoding.
+
+Serial stdio encoding is pipelined (pipeline.c): a reader thread reads the cover ahead in
+1 MB blocks, the payload is embedded into those blocks in place and a writer thread writes
+them behind, so reading, embedding and writing overlap. The cover is read once and the
+stego image written once; the bytes after the payload stream through the same ring.
+
+Tile transfers (-j and batch mode) go through an I/O queue per worker thread (iobackend.c):
+large reads and writes are cut into 256 KB requests and up to --qd of them are kept in
+flight through io_uring, or through a pool of pread/pwrite threads where the kernel does
+not allow io_uring (--io=auto picks, --io=uring|threads|sync forces one). The cover window
+and the secret of a tile are read together, and the image bytes after the payload are
+copied in 4 MB steps with the next read overlapping the last write.
+
+Patch-only output (--clone, reflink.c): the stego image is first made a copy of the cover
+with the FICLONE ioctl (shared extents on btrfs/XFS, no data written), else
+copy_file_range (copied inside the kernel), else plain pread/pwrite. The encoder then
+writes only the image bytes that carry the header and payload and leaves the header and
+tail alone, so a 2 GB cover with a 1 MB payload costs about 8 MB of writes.
+--inplace does the same on the cover itself; a failure half way leaves it partly embedded.
+
+Optional payload encryption (-K keyfile, chacha.c): ChaCha20 (RFC 8439) with a 256-bit
+key read from the key file and a random 96-bit nonce per image. The keystream is XORed
+into each 4 KB chunk inside the embed/extract loops, so there is no extra pass over the
+payload; SSE2, AVX2 and AVX-512 kernels are picked at startup like the LSB kernels.
+FORMAT_FLAG_CHACHA marks it; the nonce and a key check word follow the size fields, so a
+wrong key is reported. With -z the compressed bytes are encrypted. This hides the
+content only: there is no authentication tag (the checksum below catches accidental
+damage, not a forger who knows the key).
+
+Payload checksum (--crc, crc32c.c): a CRC32C of the secret as written follows
+the payload as a 4-byte trailer, marked by FORMAT_FLAG_CRC. It is computed inline while
+the payload streams (per tile with -j and per block with -z, the pieces joined with
+crc32c_combine()), with the SSE4.2 crc32 instruction or slicing-by-8 tables, and is
+encrypted with the payload under -K. Decoding fails with "Checksum mismatch" on a damaged
+payload and removes the output file (every mode, batch jobs too). -i --verify reads
+every payload back without writing it (4 MB in about 6 ms) and reports it verified or
+BROKEN (checksum mismatch); encrypted payloads need -K.
+It is opt-in: the trailer needs the extended #+ format, which older versions of the tool
+cannot read, so without --crc a depth 1 encode stays byte-identical to the original #*
+format.
+--range slices are not checked.
+
+Keyed scattering (--scatter, needs -K, bmp.c): the payload no longer fills the top rows
+in order. From the first payload slot on, the image is cut into runs of 12288 slots (3
+pages of a 24-bit image without padding, a whole number of payload bytes at every
+depth) and logical run i is stored at run perm(i), a 4-round Feistel permutation over
+all whole runs keyed from the ChaCha20 keystream. Covers with fewer than 16 runs after
+the header fields halve the run length (down to 24 slots) until there are 16, so small
+images are scattered too; one without even two 24-slot runs refuses --scatter. The
+header fields stay in place, so decoding finds FORMAT_FLAG_SCATTER and switches to the
+mapped image by itself. Every run is a contiguous span for the LSB kernels, so the
+throughput matches sequential embedding (steg_bench mmap_K_scatter against mmap_K). A
+scattered encode always uses the mapped path, with --clone / --inplace too.
+
+Cover formats (cover.c): besides BMP, covers and stego images may be binary PGM / PPM
+(P5 / P6, maxval 255, # comments allowed) and uncompressed TGA (24-bit, 32-bit BGRA and
+8-bit grey, bottom-up or top-down, id field and colour map skipped). Every format is a
+header span plus rows of packed pixels, so the parser only fills in the same BmpInfo
+(pixel offset, stride, bits per pixel, alpha byte) and the slot layouts, LSB kernels,
+mapped and tiled paths, --scatter, -i and the library run on the file bytes unchanged:
+a renderer's PPM frame is embedded into directly, with no conversion to BMP first. The
+format comes from the header bytes; on the command line the image names need a .bmp,
+.pgm, .ppm, .pnm or .tga extension and the stego image keeps the cover's format
+(default.ppm etc. when no name is given). PGM and 8-bit TGA carry 1 slot per pixel,
+PPM and 24-bit TGA 3, 32-bit TGA 3 or 4 with -a.
+
+PNG covers (png.c, zlib): 8-bit grey, RGB and RGBA PNGs (not interlaced) are embedded
+into as a stream, never as a whole image. The IDAT data is inflated one scanline at a
+time and unfiltered into a window of a few rows; the payload goes into those rows with
+the slot layout of a BMP of the same pixel format (the raw rows are its pixel array, so
+-k, -a, -z, -K, the CRC32C trailer and --range work as usual) and every row the payload
+has passed is filtered again with its original filter type and deflated into new IDAT
+chunks. After the payload and the row below it, the filtered bytes of the rest of the
+image are passed from inflate to deflate in 64 KB blocks without being unfiltered. Other
+chunks are copied unchanged. IHDR, the chunks before the image data and every IDAT read
+are checked against their chunk CRC (zlib crc32); a mismatch refuses the image. Decoding
+inflates only the rows the payload occupies (up to the last byte of a --range slice). Memory is the row window, two zlib states and
+64 KB buffers whatever the image size. Palette, grey + alpha and 16-bit PNGs,
+interlaced images, --scatter, --clone / --inplace, -m and -j do not apply (the stego
+image is a new zlib stream written in row order); the library and shards stay on the
+uncompressed formats.
+
+Library (steg.h, libsteg.a / libsteg.so): steg_encode() embeds a payload from a caller
+buffer into a copy of a cover buffer (or into the cover itself), steg_decode() extracts
+straight from a stego buffer into a caller buffer; steg_capacity(), steg_encoded_size()
+and steg_decode_info() size the buffers first. StegParams carries the depth, -a, -z, the
+raw 32-byte key and the stored extension. No FILE*, file names or globals are involved,
+so the calls are reentrant; the images are the same as the tool writes. The decoder no
+longer edits the output name it is given: the file written is DecodeInfo.output_path.
+
+Partial extraction (--range offset:length, steg_decode_range()): once the header fields
+are read, secret byte i lives at layout slot first + i * (8 / depth) rounded up, so the
+decoder seeks straight to it and decodes only the slice (the cipher keystream is seekable
+too). -z payloads are stored as independent blocks: the 4-byte header of every block
+before the slice is decoded and its body skipped, only the blocks overlapping the slice
+are extracted and decompressed. The first or last 4 KB of a 4 MB secret in a 16 MP image
+takes about 0.5 ms instead of 9 ms for the whole payload.
+
+Archives (-c / -t / -x, archive.c): many secret files go into one cover with one encode,
+so the cover is read and copied once instead of once per file. The files are staged in a
+temporary file as a table of contents (name, offset and size of every entry) followed by
+the contents, and embedded as an ordinary payload with the extension .sar, so -k, -a, -z,
+-K, -j, -m and --clone all apply. The staging is not free: archive_create() copies every
+file once into an unlinked tmpfile() in /tmp before the encode starts, so -c reads the
+secrets twice, writes them once more and needs their total size free in /tmp (at most
+4 GB, the payload limit). The encoder is built around one secret file descriptor
+(mapping, pread tiles, the read-ahead pipeline), which is why the archive is not
+streamed from the files themselves. -t decodes only the TOC; -x decodes only the entries
+asked for, each straight from its own slots with steg_decode_range(). Entry names are the
+base names of the files; names with '/' or "." / ".." are refused on both sides. A plain
+-d writes the whole archive as output.sar.
+
+Shards (-s / -r, shard.c, erasure.c): one secret spread over many covers when no single
+cover is large enough. The secret is cut into k equal data shards and --parity M adds M
+Reed-Solomon parity shards over GF(2^8) (Cauchy rows), one per cover, so any k of the
+n = k + M stego images rebuild it. Each shard is an ordinary payload with the extension
+.shd that starts with a 40 byte header (set id, index, n, k, extension, sizes), so -k,
+-a, -z and -K apply per cover. Covers are encoded and images decoded one per worker
+(-j); data shards are decoded straight into the mapped output file and only the missing
+ones are rebuilt from parity. Shards are equal sized, so the smallest cover bounds the
+shard size. Images of another secret are ignored by their random set id.
+
+Daemon (-D socket, daemon.c): stegd keeps the process, the CPU kernel choice and a pool
+of worker threads alive between jobs. Clients connect to a Unix SOCK_SEQPACKET socket and
+send one StegdRequest per job with the cover, payload and output as file descriptors
+(SCM_RIGHTS), so files and memfd/shm buffers both work and no image data goes through the
+socket. Each worker owns two 1 MB buffers allocated at start: images up to that size are
+read into them with one pread and written back with one pwrite, larger ones are memory
+mapped. Small jobs are always taken before large ones, so a queue of big images does not
+delay thumbnails. A small encode round trip takes about 60 us against about 2 ms for a
+steg process per file. stegd_connect() and stegd_call() in daemon.h are the client side.
+The socket file is created 0600 whatever the umask, and stegd_shutdown is refused unless
+the peer (SO_PEERCRED) runs as the daemon's user or root.
+
 
 2. Project Files
 
@@ -54,7 +202,32 @@ decode.c	Decoding functions implementation
 types.h	Custom types for encoding (Status, OperationType, uint)
 types1.h	Custom types for decoding (Status1, uint)
 common.h	Common definitions (e.g., MAGIC_STRING)
+bmp.h / bmp.c	BMP header parser and slot layout (usable pixel bytes, row padding and alpha skipped)
+cover.h / cover.c	Cover formats: BMP, binary PGM / PPM and TGA headers parsed into one BmpInfo, image names
+png.h / png.c	PNG covers: scanline-streamed inflate, unfilter, embed, refilter and deflate (zlib)
+lz.h / lz.c	Block LZ codec of -z (independent 64 KB blocks, raw fallback)
+chacha.h / chacha.c	ChaCha20 keystream of -K (scalar, SSE2, AVX2, AVX-512), key file reader
+pipeline.h / pipeline.c	Read-ahead / write-behind block ring of the serial stdio encode
+iobackend.h / iobackend.c	Asynchronous tile I/O: io_uring (raw syscalls) or pread/pwrite thread pool
+reflink.h / reflink.c	Cover clone of --clone: FICLONE, copy_file_range or a plain copy
+steg.h / steg.c	In-memory library API (buffers in, buffers out, thread safe)
+daemon.h / daemon.c	stegd (-D): Unix socket protocol, fd passing, warm worker pool, client calls
+archive.h / archive.c	Archive payloads (-c / -t / -x): TOC layout, staging, selective extraction
+shard.h / shard.c	Sharded payloads (-s / -r): shard header, parallel split and rebuild
+erasure.h / erasure.c	Reed-Solomon k-of-n erasure code over GF(2^8) of the parity shards
+crc32c.h / crc32c.c	CRC32C payload checksum (SSE4.2 or slicing-by-8), crc32c_combine() of tile pieces
 main.c	Main driver to handle command-line arguments and call encode/decode
+lsb.h / lsb.c	Bulk LSB embed/extract kernels (scalar, SSE2, BMI2, AVX2, AVX-512) chosen at startup by CPUID
+mapping.h / mapping.c	Memory mapped file views for the -m (zero-copy) encode/decode path
+parallel.h / parallel.c	Tile runner (thread pool) for -j N and work-stealing task pool for batch mode
+batch.h / batch.c	Manifest driven batch mode (-b manifest.csv), one status line per job
+inspect.h / inspect.c	-i inspect mode: header-only payload check of files and directory trees
+stats.h / stats.c	--stats=json: per-stage wall time, I/O bytes/syscalls (/proc/self/io), peak RSS
+CMakeLists.txt	Build: steg (the tool), steg_corpus, steg_bench and steg_tests
+tools/corpus.h / corpus.c	Deterministic BMP (PGM / PPM, TGA, PNG) covers and CSV payloads (same seed, same bytes)
+tools/steg_corpus.c	Writes the benchmark corpus: covers 1-500 MP, payloads 1 KB-1 GB
+bench/steg_bench.c	Kernel, stage and end-to-end benchmarks, one JSON line per result
+tests/steg_tests.c	Kernel byte-exactness, round trips in every mode, on-image format checks
 
 3. Header File Documentation
 
@@ -72,12 +245,19 @@ typedef enum { d_failure, d_success } Status1;      // Return status for decode
 3.3 common.h
 
 #define MAGIC_STRING "#*"           // Magic string to identify stego images
+#define MAGIC_STRING_EXT "#+"       // Magic string followed by a format word (bit depth, flags)
+#define FORMAT_FLAG_ROWS 0x100      // Payload follows the pixel rows (padding / alpha skipped)
+#define FORMAT_FLAG_ALPHA 0x200     // Alpha bytes of 32-bit pixels carry payload too
+#define FORMAT_FLAG_LZ 0x400        // Payload is the -z block compressed secret
+#define FORMAT_FLAG_CHACHA 0x800    // Payload is -K ChaCha20 encrypted
+#define FORMAT_FLAG_CRC 0x1000      // CRC32C trailer of the secret follows the payload
+#define FORMAT_FLAG_SCATTER 0x2000  // Payload runs stored in keyed order (--scatter)
 
 3.4 encode.h
 
 Contains all encoding function declarations:
 
-get_image_size_for_bmp()
+get_image_size_for_cover()
 
 get_file_size()
 
@@ -87,7 +267,7 @@ open_files()
 
 check_capacity()
 
-copy_bmp_header()
+copy_cover_header()
 
 encode_byte_to_lsb()
 
@@ -118,7 +298,7 @@ do_decoding()
 
 open_files_decode()
 
-skip_bmp_header()
+skip_cover_header()
 
 decode_byte_from_lsb()
 
@@ -126,14 +306,22 @@ decode_size_from_lsb()
 
 decode_magic_string()
 
-decode_secret_file_extn_size()
+decode_format_word()
+
+decode_header_fields()
 
-decode_secret_file_extn()
+decode_cipher_fields()
 
-decode_secret_file_size()
+open_output_decode()
 
 decode_secret_file_data()
 
+decode_bytes_from_lsb()
+
+close_files_decode()
+
+abort_decoding()
+
 
 4. Main Program Flow (main.c)
 
@@ -166,14 +354,19 @@ Print usage instructions if arguments are invalid.
 
 Open files: Source image, secret file, and stego image.
 
-Check capacity: Ensure BMP can store all secret data + header + magic string.
+Check capacity: Parse the BMP headers and ensure the usable pixel bytes can store all
+secret data + header + magic string (uncompressed 24/32-bit BMPs only).
 
-Copy BMP header: First 54 bytes remain unchanged.
+Copy BMP header: Everything before the pixel array (bfOffBits) remains unchanged.
 
 Encode magic string: Store #* in LSBs to identify stego images.
 
 Encode secret file extension and size: Store .txt/.c/.csv length and file size in LSBs.
 
+Encode packed size (-z only): Stored bytes of the compressed secret.
+
+Encode nonce and key check (-K only): 12 nonce bytes and the first keystream word of block 0.
+
 Encode secret data: Each byte of secret file is stored using 8 image bytes.
 
 Copy remaining image bytes: Preserve rest of the image without modification.
@@ -185,15 +378,26 @@ Close all files.
 
 Open stego image and prepare output file.
 
-Skip BMP header: First 54 bytes are skipped.
+Skip BMP header: Parse the headers and find the layout holding the magic string:
+pixel rows without alpha, with alpha, the plain byte run at the pixel offset, then at 54.
 
 Check magic string: Ensure #* exists to confirm stego image.
 
 Read secret file extension size and extension.
 
-Read secret file size.
+Read secret file size (and the packed size when FORMAT_FLAG_LZ is set).
+
+Read the nonce and key check when FORMAT_FLAG_CHACHA is set; stop unless -K gives the right key.
+With FORMAT_FLAG_SCATTER the payload runs are read in the order the key gives.
+These fields are parsed by bmp_read_fields() (bmp.c) for the decoder, -i, libsteg and PNG
+covers alike; each passes its own reader of the next field bytes.
+
+Create the output file only now, once every field fits the image and the key matched.
 
-Decode secret data: Extract each byte from 8 image bytes.
+Decode secret data: Extract each byte from 8 image bytes. Compressed payloads are
+decompressed block by block (serial) or extracted first and decompressed per tile (-j).
+
+Read the CRC32C trailer when FORMAT_FLAG_CRC is set and compare it with the secret decoded.
 
 Write secret data to output file.
 
@@ -220,15 +424,76 @@ Magic string mismatch during decoding.
 9. Encoding
 
 ./stego -e source_image.bmp secret_file.txt [stego_image.bmp]
+./stego -e -m source_image.bmp secret_file.txt [stego_image.bmp]   ->Cover, secret and stego image are memory mapped
+./stego -e -k 2 source_image.bmp secret_file.txt [stego_image.bmp] ->2 bits per cover byte (1-4), 4x capacity at -k 4
+./stego -e -a rgba_image.bmp secret_file.txt [stego_image.bmp]     ->32-bit covers: alpha bytes carry payload too
+./stego -e -z source_image.bmp secret_file.txt [stego_image.bmp]   ->Compress the secret first (text shrinks ~35-40%)
+./stego -e -K secret.key source_image.bmp secret_file.txt ->Encrypt (key file: 32 raw bytes or 64 hex digits)
+./stego -e -q --stats=json source_image.bmp secret_file.txt        ->No stage messages, JSON stats on stderr
+./stego -e --clone source_image.bmp secret_file.txt stego_image.bmp ->Clone the cover, write only the payload span
+./stego -e --inplace source_image.bmp secret_file.txt               ->Embed into the cover itself (no output file)
+./stego -e --crc source_image.bmp secret_file.txt                  ->CRC32C trailer, checked on decode and -i --verify (#+ format)
+./stego -e -K secret.key --scatter source_image.bmp secret_file.txt ->Payload spread over the whole image in keyed 12 KB runs
+./stego -d -q --stats=json:run.json stego_image.bmp output_file   ->JSON stats written to run.json
+
+Stats stages: open_files, check_capacity (encode), compress (encode), bmp_header, header_fields, payload,
+copy_remaining (encode), close_files. Each has "us" and read/write bytes and calls.
 
 10. Decoding
 
 ./stego -d stego_image.bmp output_file.txt
+./stego -d -K secret.key stego_image.bmp output_file.txt   ->Encrypted payloads need the same key file
+./stego -d --range 65536:4096 stego_image.bmp part.txt     ->Only secret bytes 65536..69631 (offset: for the rest)
+
+Inspect mode (nothing is written, only the first 512 bytes of each file are read):
+
+./stego -i [-j N] [-q] image.bmp dir/ ...   ->One line per *.bmp: STEGO (depth, extension, size), CLEAN,
+                                              BROKEN (magic string but impossible fields) or ERROR
+                                              -q prints only the STEGO lines and the summary
+./stego -i --verify [-K key] dir/           ->Also read every payload back and check its CRC32C,
+                                              exit status 1 if any file is BROKEN or unreadable
+
+Batch mode:
+
+./stego -b manifest.csv [-j N] [--io=uring] [--qd 32]   ->I/O backend and requests in flight per worker
+./stego -b manifest.csv [-j N]   ->One job per line: e,cover.bmp,secret.txt[,stego.bmp] or d,stego.bmp,output.txt
+                                   Exit status is non-zero if any job failed
+
+Archive mode:
+
+./stego -c [-z] [-K key] cover.bmp stego.bmp a.csv b.txt c.bin   ->All files in one payload (one cover copy)
+./stego -t [-K key] stego.bmp                                   ->List entries (only the TOC is decoded)
+./stego -x [-K key] stego.bmp outdir [b.txt ...]                ->Extract all or only the named entries
+
+Shard mode:
+
+./stego -s [-z] [-K key] --parity 2 secret.bin outdir c1.bmp c2.bmp c3.bmp c4.bmp c5.bmp
+                                                                ->3 data + 2 parity shards, outdir/c1.bmp ...
+./stego -r [-K key] [-j N] rebuilt.out outdir/c1.bmp outdir/c3.bmp outdir/c5.bmp
+                                                                ->Any 3 of the 5 images give rebuilt.bin
+
+Daemon mode:
+
+./stego -D /run/stegd.sock [-j N] [-q]   ->Serve encode / decode / inspect requests with N workers
+                                          until a client sends stegd_shutdown
 
 11. Example:
 
 a.   ./stego -e cover.bmp secret.txt secret_stego.bmp   ->Encode
 b.   ./stego -d secret_stego.bmp recovered_secret.txt   ->Decode
+
+12. Build, tests and benchmarks
+
+cmake -S . -B build && cmake --build build -j      ->build/steg, steg_corpus, steg_bench, steg_tests,
+                                                       libsteg.a and libsteg.so
+cmake --install build --prefix /usr/local           ->steg, the libraries, include/steg/steg.h
+ctest --test-dir build --output-on-failure           ->Test groups: kernels, legacy, roundtrip, format, stats,
+                                                       inspect, bmp, lz, cipher, pipeline, io, patch,
+                                                       library, daemon, range, archive, shard, checksum,
+                                                       scatter
+build/steg_corpus corpus --max-cover 500 --max-payload 1G   ->Full corpus (default stops at 16 MP / 4 MB)
+build/steg_bench --cover 64 --payload 16M -j 4 > after.json ->MB/s and p50/p90/p99 latency per benchmark
+                                                              "revision" is the commit the build was configured at
 */
 
 
@@ -0,0 +1,351 @@
+#include <stdio.h>                  // Temporary archive file, listing
+#include <stdlib.h>                 // Entries, copy buffer
+#include <string.h>                 // Names
+#include <limits.h>                 // UINT_MAX (the payload size field is 32 bits wide)
+#include <sys/stat.h>               // File sizes
+#include "archive.h"                // Archive declarations
+#include "steg.h"                   // steg_decode_info, steg_decode_range
+#include "chacha.h"                 // Key file
+#include "mapping.h"                // Mapped stego image and entry files
+#include "common.h"                 // COPY_BLOCK
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+static void put_be(unsigned char *p, uint value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        p[i] = (unsigned char)(value >> (8 * (bytes - 1 - i)));
+}
+
+static uint get_be(const unsigned char *p, int bytes)
+{
+    uint value = 0;
+    for (int i = 0; i < bytes; i++)
+        value = value << 8 | p[i];
+    return value;
+}
+
+/* File name without its directories */
+static const char *base_name(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+/* An entry name that cannot leave the extraction directory */
+static int valid_name(const char *name, size_t len)
+{
+    return len > 0 && len <= ARCHIVE_NAME_MAX && memchr(name, '/', len) == NULL && memchr(name, '\0', len) == NULL &&
+           !(len == 1 && name[0] == '.') && !(len == 2 && name[0] == '.' && name[1] == '.');
+}
+
+/* Append size bytes of the file fname to out */
+static Status copy_into(FILE *out, const char *fname, size_t size, char *buf)
+{
+    FILE *in = fopen(fname, "rb");
+    Status res = in ? e_success : e_failure;
+
+    while (res == e_success && size > 0)
+    {
+        size_t count = size < COPY_BLOCK ? size : COPY_BLOCK;
+        if (fread(buf, 1, count, in) != count || fwrite(buf, 1, count, out) != count)
+            res = e_failure;                                // Shrank while archiving, or the disk is full
+        size -= count;
+    }
+    if (in) fclose(in);
+    return res;
+}
+
+/* Check every file and its name, fill sizes and the TOC size */
+static Status archive_sizes(char *files[], int count, size_t *sizes, size_t *toc_size)
+{
+    size_t data_size = 0;
+
+    *toc_size = ARCHIVE_HEADER;
+    for (int i = 0; i < count; i++)                         // Every file must exist with a usable, unique name
+    {
+        const char *name = base_name(files[i]);
+        struct stat st;
+        if (stat(files[i], &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            printf("Error: Cannot archive %s (not a readable file)\n", files[i]);
+            return e_failure;
+        }
+        if (strlen(name) > ARCHIVE_NAME_MAX)
+        {
+            printf("Error: Cannot archive %s (name longer than %d bytes)\n", files[i], ARCHIVE_NAME_MAX);
+            return e_failure;
+        }
+        if (!valid_name(name, strlen(name)))                // Empty, "." or ".."
+        {
+            printf("Error: Cannot archive %s (invalid archive name \"%s\")\n", files[i], name);
+            return e_failure;
+        }
+        for (int j = 0; j < i; j++)
+        {
+            if (strcmp(base_name(files[j]), name) == 0)
+            {
+                printf("Error: %s and %s have the same archive name\n", files[j], files[i]);
+                return e_failure;
+            }
+        }
+        sizes[i] = st.st_size;
+        *toc_size += 2 + strlen(name) + 8;
+        data_size += sizes[i];
+    }
+    if (count < 1 || *toc_size + data_size > UINT_MAX)
+    {
+        printf("Error: Archive must hold 1 or more files and less than 4 GB\n");
+        return e_failure;
+    }
+    return e_success;
+}
+
+/* Write the TOC and the file contents to out */
+static Status archive_write(FILE *out, char *files[], int count, const size_t *sizes, size_t toc_size)
+{
+    unsigned char field[ARCHIVE_HEADER];
+    char *buf = malloc(COPY_BLOCK);
+    size_t offset = 0;
+
+    memcpy(field, ARCHIVE_MAGIC, 4);
+    put_be(field + 4, (uint)count, 4);
+    put_be(field + 8, (uint)toc_size, 4);
+    int ok = buf && fwrite(field, 1, ARCHIVE_HEADER, out) == ARCHIVE_HEADER;
+    for (int i = 0; ok && i < count; i++)                   // Table of contents
+    {
+        const char *name = base_name(files[i]);
+        size_t len = strlen(name);
+        put_be(field, (uint)len, 2);
+        ok = fwrite(field, 1, 2, out) == 2 && fwrite(name, 1, len, out) == len;
+        put_be(field, (uint)offset, 4);
+        put_be(field + 4, (uint)sizes[i], 4);
+        ok = ok && fwrite(field, 1, 8, out) == 8;
+        offset += sizes[i];
+    }
+    for (int i = 0; ok && i < count; i++)                   // File contents in TOC order
+    {
+        if (copy_into(out, files[i], sizes[i], buf) == e_failure)
+        {
+            printf("Error: Cannot read all of %s\n", files[i]);
+            free(buf);
+            return e_failure;
+        }
+    }
+    free(buf);
+    if (!ok || fflush(out) != 0)
+    {
+        printf("Error: Cannot write the archive\n");
+        return e_failure;
+    }
+    rewind(out);
+    return e_success;
+}
+
+FILE *archive_create(char *files[], int count)
+{
+    size_t *sizes = calloc(count > 0 ? count : 1, sizeof(size_t));
+    size_t toc_size;
+    FILE *out = NULL;
+
+    if (sizes && archive_sizes(files, count, sizes, &toc_size) == e_success)
+    {
+        out = tmpfile();                                    // Staged once, then embedded like a single secret
+        if (out == NULL)
+            perror("tmpfile");
+        else if (archive_write(out, files, count, sizes, toc_size) == e_failure)
+        {
+            fclose(out);
+            out = NULL;
+        }
+    }
+    free(sizes);
+    return out;
+}
+
+Status archive_read(const char *stego, size_t stego_size, const unsigned char *key, Archive *archive)
+{
+    StegPayloadInfo info;
+    unsigned char head[ARCHIVE_HEADER];
+    size_t got;
+
+    memset(archive, 0, sizeof(*archive));
+    if (steg_decode_info(stego, stego_size, &info) == e_failure || strcmp(info.extn, ARCHIVE_EXTN) != 0 ||
+        info.payload_size < ARCHIVE_HEADER ||
+        steg_decode_range(stego, stego_size, key, 0, ARCHIVE_HEADER, (char *)head, sizeof(head), &got) == e_failure ||
+        memcmp(head, ARCHIVE_MAGIC, 4) != 0)
+        return e_failure;
+
+    size_t count = get_be(head + 4, 4), toc_size = get_be(head + 8, 4);
+    if (toc_size < ARCHIVE_HEADER || toc_size > info.payload_size || count > (toc_size - ARCHIVE_HEADER) / 11)
+        return e_failure;                                   // Every entry takes at least 11 bytes
+    unsigned char *toc = malloc(toc_size);
+    archive->entries = calloc(count ? count : 1, sizeof(ArchiveEntry));
+    archive->count = count;
+    archive->payload_size = info.payload_size;
+    Status res = toc && archive->entries ? e_success : e_failure;
+    if (res == e_success)                                   // Only the TOC is decoded
+        res = steg_decode_range(stego, stego_size, key, 0, toc_size, (char *)toc, toc_size, &got);
+
+    size_t pos = ARCHIVE_HEADER, data_size = info.payload_size - toc_size;
+    for (size_t i = 0; res == e_success && i < count; i++)
+    {
+        ArchiveEntry *entry = &archive->entries[i];
+        size_t len = pos + 2 <= toc_size ? get_be(toc + pos, 2) : 0;
+        if (pos + 2 + len + 8 > toc_size || !valid_name((const char *)toc + pos + 2, len))
+        {
+            res = e_failure;
+            break;
+        }
+        memcpy(entry->name, toc + pos + 2, len);
+        entry->name[len] = '\0';
+        pos += 2 + len;
+        size_t offset = get_be(toc + pos, 4);
+        entry->size = get_be(toc + pos + 4, 4);
+        if (offset > data_size || entry->size > data_size - offset)
+            res = e_failure;                                // Points past the payload
+        entry->offset = toc_size + offset;
+        pos += 8;
+    }
+    free(toc);
+    if (res == e_success && pos != toc_size)
+        res = e_failure;
+    if (res == e_failure)
+        archive_free(archive);
+    return res;
+}
+
+Status archive_extract_entry(const char *stego, size_t stego_size, const unsigned char *key,
+                             const Archive *archive, size_t index, const char *out_path)
+{
+    const ArchiveEntry *entry = &archive->entries[index];
+    MappedFile map = {0};
+    size_t written;
+    FILE *out = fopen(out_path, "w+b");
+
+    if (out == NULL)
+    {
+        perror(out_path);
+        return e_failure;
+    }
+    Status res = map_file_write(out, entry->size, &map);   // Decoded straight into the mapped file
+    if (res == e_success)
+        res = steg_decode_range(stego, stego_size, key, entry->offset, entry->size, map.data, entry->size, &written);
+    unmap_file(&map);
+    fclose(out);
+    return res;
+}
+
+void archive_free(Archive *archive)
+{
+    free(archive->entries);
+    archive->entries = NULL;
+    archive->count = 0;
+}
+
+/* Map a stego image, read the key and the archive TOC */
+static Status open_archive(const char *stego_fname, const StegOptions *opts, MappedFile *map,
+                           unsigned char key[CHACHA_KEY_BYTES], const unsigned char **key_used, Archive *archive)
+{
+    FILE *fptr = fopen(stego_fname, "rb");
+    StegPayloadInfo info;
+
+    *key_used = NULL;
+    if (fptr == NULL || map_file_read(fptr, map) == e_failure)
+    {
+        printf("Error: Cannot read %s\n", stego_fname);
+        if (fptr) fclose(fptr);
+        return e_failure;
+    }
+    fclose(fptr);                                           // The mapping stays valid
+    if (opts->key_fname)
+    {
+        if (chacha_read_key(opts->key_fname, key) == e_failure)
+        {
+            printf("Error: Unreadable key file %s\n", opts->key_fname);
+            return e_failure;
+        }
+        *key_used = key;
+    }
+    if (archive_read(map->data, map->size, *key_used, archive) == e_success)
+        return e_success;
+    if (steg_decode_info(map->data, map->size, &info) == e_success && strcmp(info.extn, ARCHIVE_EXTN) == 0 && info.encrypted)
+        printf("Error: %s\n", *key_used ? "Wrong key for the archive" : "Archive is encrypted, pass the key file with -K");
+    else
+        printf("Error: %s holds no archive\n", stego_fname);
+    return e_failure;
+}
+
+Status run_archive_list(const char *stego_fname, const StegOptions *opts)
+{
+    MappedFile map = {0};
+    unsigned char key[CHACHA_KEY_BYTES];
+    const unsigned char *key_used;
+    Archive archive;
+    size_t total = 0;
+
+    if (open_archive(stego_fname, opts, &map, key, &key_used, &archive) == e_failure)
+    {
+        unmap_file(&map);
+        return e_failure;
+    }
+    for (size_t i = 0; i < archive.count; i++)
+    {
+        printf("%12zu  %s\n", archive.entries[i].size, archive.entries[i].name);
+        total += archive.entries[i].size;
+    }
+    printf("%zu entries, %zu bytes\n", archive.count, total);
+    archive_free(&archive);
+    unmap_file(&map);
+    return e_success;
+}
+
+Status run_archive_extract(const char *stego_fname, const char *out_dir, char *names[], int count, const StegOptions *opts)
+{
+    MappedFile map = {0};
+    unsigned char key[CHACHA_KEY_BYTES];
+    const unsigned char *key_used;
+    char path[PATH_MAX];
+    Archive archive;
+    Status res = e_success;
+
+    if (open_archive(stego_fname, opts, &map, key, &key_used, &archive) == e_failure)
+    {
+        unmap_file(&map);
+        return e_failure;
+    }
+    for (int n = 0; n < count; n++)                         // Every name asked for must exist
+    {
+        size_t i = 0;
+        while (i < archive.count && strcmp(archive.entries[i].name, names[n]) != 0)
+            i++;
+        if (i == archive.count)
+        {
+            printf("Error: %s is not in the archive\n", names[n]);
+            res = e_failure;
+        }
+    }
+    for (size_t i = 0; res == e_success && i < archive.count; i++)
+    {
+        int wanted = count == 0;
+        for (int n = 0; !wanted && n < count; n++)
+            wanted = strcmp(archive.entries[i].name, names[n]) == 0;
+        if (!wanted)
+            continue;                                       // Its bytes are never decoded
+        if (snprintf(path, sizeof(path), "%s/%s", out_dir, archive.entries[i].name) >= (int)sizeof(path) ||
+            archive_extract_entry(map.data, map.size, key_used, &archive, i, path) == e_failure)
+        {
+            printf("Error: Cannot extract %s\n", archive.entries[i].name);
+            res = e_failure;
+        }
+        else if (!opts->quiet)
+        {
+            printf("Extracted %s (%zu bytes)\n", path, archive.entries[i].size);
+        }
+    }
+    archive_free(&archive);
+    unmap_file(&map);
+    return res;
+}
@@ -0,0 +1,64 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdio.h>          // FILE
+#include <stddef.h>         // size_t
+#include "types.h"          // Status, StegOptions
+
+/*
+ * Archive payloads (-c / -t / -x)
+ * Many secret files embedded in one cover with a single encode. The
+ * payload is stored with the extension ARCHIVE_EXTN and starts with a
+ * table of contents, then the file contents back to back:
+ *
+ *     "SAR1"  count (4)  toc_size (4)                          12 bytes
+ *     per entry: name_len (2)  name  offset (4)  size (4)
+ *     file data (entry offsets count from the end of the TOC)
+ *
+ * Every number is big endian like the size fields of the stego header.
+ * Listing decodes only the TOC; extracting an entry decodes only its bytes
+ * with steg_decode_range(), which seeks straight to their slots (and skips
+ * the -z blocks before them), so one file out of a large archive costs
+ * about as much as that file alone
+ */
+
+#define ARCHIVE_EXTN ".sar"         // Stored extension of archive payloads
+#define ARCHIVE_MAGIC "SAR1"
+#define ARCHIVE_HEADER 12           // Magic, count and TOC size
+#define ARCHIVE_NAME_MAX 255        // Longest entry name (file name without directories)
+
+typedef struct _ArchiveEntry
+{
+    char name[ARCHIVE_NAME_MAX + 1];
+    size_t offset;                  // Payload offset of the first byte (TOC included)
+    size_t size;
+} ArchiveEntry;
+
+typedef struct _Archive
+{
+    ArchiveEntry *entries;
+    size_t count;
+    size_t payload_size;            // TOC and data
+} Archive;
+
+/* Write the archive of count files (stored under their base names) to a temporary file, rewound; NULL on failure.
+   Every file is copied once more: the temporary file needs their total size free in /tmp */
+FILE *archive_create(char *files[], int count);
+
+/* Read the TOC of the archive payload of a stego image (key: -K payloads), e_failure if it holds no archive */
+Status archive_read(const char *stego, size_t stego_size, const unsigned char *key, Archive *archive);
+
+/* Extract entry index into the file out_path */
+Status archive_extract_entry(const char *stego, size_t stego_size, const unsigned char *key,
+                             const Archive *archive, size_t index, const char *out_path);
+
+/* Release the entries of an archive */
+void archive_free(Archive *archive);
+
+/* -t: print the entries of the archive in a stego image */
+Status run_archive_list(const char *stego_fname, const StegOptions *opts);
+
+/* -x: extract the entries named in names (all of them when count is 0) into out_dir */
+Status run_archive_extract(const char *stego_fname, const char *out_dir, char *names[], int count, const StegOptions *opts);
+
+#endif
@@ -0,0 +1,285 @@
+#include <stdio.h>              // Manifest reading, status report
+#include <stdlib.h>             // Job allocation
+#include <string.h>             // Manifest parsing
+#include <time.h>               // Per-job latency
+#include <unistd.h>             // sysconf
+#include <limits.h>             // PATH_MAX
+#include "batch.h"              // Batch mode declarations
+#include "encode.h"             // Encoding phases
+#include "decode.h"             // Decoding phases
+#include "parallel.h"           // Work-stealing pool
+#include "iobackend.h"          // Asynchronous tile I/O
+#include "common.h"             // TILE_BYTES, TILE_IMAGE_BYTES
+#include "png.h"                // png_file
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+/* One manifest line */
+typedef struct _BatchJob
+{
+    int line;                           // Manifest line number (for the report)
+    OperationType op;                   // e_encode or e_decode
+    char *argv[6];                      // Fake argv for the existing validators
+    char output_fname[PATH_MAX];        // Output name of a decode job
+    EncodeInfo encInfo;
+    DecodeInfo decInfo;
+    size_t tiles_left;                  // Payload tiles still running (atomic)
+    int failed;                         // Set by any failed stage or tile
+    struct timespec start, end;         // Latency of the job
+} BatchJob;
+
+/* Reusable per-worker tile buffers */
+typedef struct _BatchWorkers
+{
+    char **image_buf;                   // TILE_IMAGE_BYTES image bytes per worker
+    char **data_buf;                    // TILE_BYTES payload bytes per worker
+    IoQueue **io;                       // I/O queue per worker (NULL: pread/pwrite)
+    const StegOptions *opts;            // --io and --qd of the queues
+} BatchWorkers;
+
+static BatchWorkers batch_workers;
+
+/* Buffers and I/O queue of the calling worker, allocated on first use and kept for every later job */
+static Status worker_buffers(int worker, char **image_buf, char **data_buf)
+{
+    if (batch_workers.image_buf[worker] == NULL)
+    {
+        batch_workers.image_buf[worker] = malloc(TILE_IMAGE_BYTES);
+        batch_workers.data_buf[worker] = malloc(TILE_BYTES);
+        if (!batch_workers.opts->use_mmap)
+            batch_workers.io[worker] = io_queue_create((IoBackend)batch_workers.opts->io_backend, batch_workers.opts->io_depth);
+    }
+    *image_buf = batch_workers.image_buf[worker];
+    *data_buf = batch_workers.data_buf[worker];
+    return (*image_buf && *data_buf) ? e_success : e_failure;
+}
+
+/* Close the job's files and record its end time (the image tail is copied through the worker's queue) */
+static void job_done(BatchJob *job, int worker)
+{
+    if (job->failed)                    // Successful jobs were closed by the finish phase
+    {
+        if (job->op == e_encode) close_files(&job->encInfo);
+        else abort_decoding(&job->decInfo);           // Partial output is removed
+    }
+    else if (job->op == e_encode)
+    {
+        job->encInfo.io = batch_workers.io[worker];
+        job->failed = end_secret_tiles(&job->encInfo) == e_failure || finish_encoding(&job->encInfo) == e_failure;
+        job->encInfo.io = NULL;
+    }
+    else
+    {
+        job->failed = end_secret_tiles_decode(&job->decInfo) == d_failure || finish_decoding(&job->decInfo) == d_failure;
+        if (job->failed)
+            abort_decoding(&job->decInfo);            // Checksum mismatch: the damaged output is removed
+    }
+    clock_gettime(CLOCK_MONOTONIC, &job->end);
+}
+
+/* Task: one payload tile of a job, the last tile to finish closes the job */
+static void job_tile(TaskPool *pool, void *arg, size_t tile, int worker)
+{
+    BatchJob *job = arg;
+    char *image_buf, *data_buf;
+    (void)pool;
+
+    if (worker_buffers(worker, &image_buf, &data_buf) == e_failure)
+        job->failed = 1;
+    else if (job->op == e_encode)
+    {
+        if (encode_secret_tile(&job->encInfo, tile, image_buf, data_buf, batch_workers.io[worker]) == e_failure) job->failed = 1;
+    }
+    else if (decode_secret_tile(&job->decInfo, tile, image_buf, data_buf, batch_workers.io[worker]) == d_failure)
+        job->failed = 1;
+
+    if (__atomic_sub_fetch(&job->tiles_left, 1, __ATOMIC_ACQ_REL) == 0)
+        job_done(job, worker);
+}
+
+/* Task: validate, open and write/read the header fields of a job, then queue its tiles */
+static void job_begin(TaskPool *pool, void *arg, size_t index, int worker)
+{
+    BatchJob *job = arg;
+    size_t tiles;
+    (void)index;
+
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    if (png_file(job->argv[2]))         // PNG jobs are one zlib stream each: run whole on this worker
+    {
+        if (job->op == e_encode)
+            job->failed = read_and_validate_encode_args(job->argv, &job->encInfo) == e_failure ||
+                          do_encoding(&job->encInfo) == e_failure;
+        else
+            job->failed = read_and_validate_decode_file(job->argv, &job->decInfo) == d_failure ||
+                          do_decoding(&job->decInfo) == d_failure;
+        clock_gettime(CLOCK_MONOTONIC, &job->end);     // Files are closed either way
+        return;
+    }
+    if (job->op == e_encode)
+    {
+        job->failed = read_and_validate_encode_args(job->argv, &job->encInfo) == e_failure ||
+                      begin_encoding(&job->encInfo) == e_failure ||
+                      start_secret_tiles(&job->encInfo) == e_failure;
+        tiles = tile_count(embedded_size(&job->encInfo), TILE_BYTES);
+    }
+    else
+    {
+        job->failed = read_and_validate_decode_file(job->argv, &job->decInfo) == d_failure ||
+                      begin_decoding(&job->decInfo) == d_failure ||
+                      start_secret_tiles_decode(&job->decInfo) == d_failure;
+        tiles = tile_count(embedded_size_decode(&job->decInfo), TILE_BYTES);
+    }
+
+    if (job->failed || tiles == 0)
+    {
+        job_done(job, worker);
+        return;
+    }
+
+    job->tiles_left = tiles;
+    for (size_t t = 1; t < tiles; t++)  // Other workers may steal these
+    {
+        if (pool_push(pool, worker, job_tile, job, t) == e_failure)
+        {
+            job->failed = 1;            // Tiles that were not queued count as done
+            if (__atomic_sub_fetch(&job->tiles_left, 1, __ATOMIC_ACQ_REL) == 0)
+                job_done(job, worker);
+        }
+    }
+    job_tile(pool, job, 0, worker);     // First tile right away, buffers are warm
+}
+
+/* Parse one manifest line into a job, returns 0 for lines to skip, -1 for bad lines */
+static int parse_job(char *line, BatchJob *job, const StegOptions *opts)
+{
+    char *fields[4] = { NULL, NULL, NULL, NULL };
+    int n = 0;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0' || line[0] == '#')
+        return 0;
+    for (char *tok = strtok(line, ","); tok && n < 4; tok = strtok(NULL, ","))
+        fields[n++] = tok;
+
+    if (n >= 3 && strcmp(fields[0], "e") == 0)
+        job->op = e_encode;
+    else if (n == 3 && strcmp(fields[0], "d") == 0)
+        job->op = e_decode;
+    else
+        return -1;
+
+    job->argv[0] = "batch";
+    job->argv[1] = job->op == e_encode ? "-e" : "-d";
+    job->argv[2] = strdup(fields[1]);
+    if (job->op == e_encode)
+    {
+        job->argv[3] = strdup(fields[2]);
+        job->argv[4] = fields[3] ? strdup(fields[3]) : NULL;
+    }
+    else
+    {
+        snprintf(job->output_fname, PATH_MAX, "%s", fields[2]);
+        job->argv[3] = job->output_fname;
+    }
+
+    job->encInfo.use_mmap = job->decInfo.use_mmap = opts->use_mmap;
+    job->decInfo.preallocate = opts->preallocate;
+    job->encInfo.bit_depth = opts->bit_depth;
+    job->encInfo.use_alpha = opts->use_alpha;
+    job->encInfo.compress = opts->compress;
+    job->encInfo.use_crc = opts->checksum;
+    job->encInfo.scatter = opts->scatter;
+    job->encInfo.patch = opts->clone;                 // Write only the payload span of every stego image
+    job->encInfo.in_place = opts->in_place;
+    job->encInfo.key_fname = job->decInfo.key_fname = opts->key_fname;
+    job->encInfo.quiet = job->decInfo.quiet = 1;      // One status line per job instead
+    return 1;
+}
+
+Status run_batch(const char *manifest_fname, const StegOptions *opts)
+{
+    FILE *manifest = fopen(manifest_fname, "r");
+    if (manifest == NULL) { perror("fopen"); return e_failure; }
+
+    BatchJob *jobs = NULL;
+    size_t count = 0, capacity = 0;
+    int bad_lines = 0, line_no = 0;
+    char line[3 * PATH_MAX];
+
+    while (fgets(line, sizeof(line), manifest))
+    {
+        line_no++;
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            BatchJob *grown = realloc(jobs, capacity * sizeof(BatchJob));
+            if (grown == NULL) { fclose(manifest); free(jobs); return e_failure; }
+            jobs = grown;
+        }
+        memset(&jobs[count], 0, sizeof(BatchJob));
+        jobs[count].line = line_no;
+        int res = parse_job(line, &jobs[count], opts);
+        if (res < 0)
+        {
+            printf("Error: manifest line %d is not a valid job\n", line_no);
+            bad_lines++;
+        }
+        else if (res > 0)
+            count++;
+    }
+    fclose(manifest);
+
+    int workers = opts->threads > 0 ? opts->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    TaskPool *pool = pool_create(workers);
+    if (pool == NULL) { free(jobs); return e_failure; }
+    workers = pool_workers(pool);
+    batch_workers.image_buf = calloc(workers, sizeof(char *));
+    batch_workers.data_buf = calloc(workers, sizeof(char *));
+    batch_workers.io = calloc(workers, sizeof(IoQueue *));
+    batch_workers.opts = opts;
+
+    for (size_t i = 0; i < count; i++)
+        pool_push(pool, -1, job_begin, &jobs[i], 0);
+    pool_run(pool);
+
+    size_t failed = 0;
+    for (size_t i = 0; i < count; i++)  // Status report in manifest order
+    {
+        BatchJob *job = &jobs[i];
+        double ms = (job->end.tv_sec - job->start.tv_sec) * 1e3 + (job->end.tv_nsec - job->start.tv_nsec) / 1e6;
+        const char *out = job->op == e_encode ? (job->encInfo.stego_image_fname ? job->encInfo.stego_image_fname : "-")
+                                              : job->decInfo.output_path[0] ? job->decInfo.output_path : job->output_fname;
+        failed += job->failed != 0;
+        if (opts->quiet && !job->failed)
+            continue;                     // -q: only failures and the summary
+        printf("%-6s line %d: %s %s -> %s (%.3f ms)\n", job->failed ? "FAILED" : "OK", job->line,
+               job->op == e_encode ? "encode" : "decode", job->argv[2], out, ms);
+    }
+    printf("Batch: %zu jobs, %zu failed, %d invalid lines\n", count, failed, bad_lines);
+
+    for (int i = 0; i < workers; i++)
+    {
+        free(batch_workers.image_buf[i]);
+        free(batch_workers.data_buf[i]);
+        io_queue_destroy(batch_workers.io[i]);
+    }
+    free(batch_workers.image_buf);
+    free(batch_workers.data_buf);
+    free(batch_workers.io);
+    for (size_t i = 0; i < count; i++)
+    {
+        free(jobs[i].argv[2]);
+        if (jobs[i].op == e_encode)
+        {
+            free(jobs[i].argv[3]);
+            free(jobs[i].argv[4]);
+        }
+    }
+    free(jobs);
+    pool_destroy(pool);
+
+    return (failed == 0 && bad_lines == 0) ? e_success : e_failure;
+}
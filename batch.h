@@ -0,0 +1,19 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "types.h"          // Status, StegOptions
+
+/*
+ * Manifest driven batch mode (-b manifest.csv)
+ * One job per line:
+ *     e,<source_image.bmp>,<secret_file>[,<stego_image.bmp>]
+ *     d,<stego_image.bmp>,<output_file>
+ * Empty lines and lines starting with '#' are ignored.
+ * All jobs run in one process on a work-stealing pool; large payloads are
+ * split into TILE_BYTES sub-tasks so they cannot hold up small jobs
+ */
+
+/* Run every job of a manifest, prints a status line per job; fails if any job failed */
+Status run_batch(const char *manifest_fname, const StegOptions *opts);
+
+#endif
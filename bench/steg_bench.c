@@ -0,0 +1,466 @@
+#include <stdio.h>                // printf, FILE
+#include <stdlib.h>               // malloc, qsort, atoi
+#include <string.h>               // strcmp, strstr, memcmp
+#include <limits.h>               // PATH_MAX
+#include <time.h>                 // clock_gettime
+#include <unistd.h>               // rmdir, unlink
+#include "encode.h"               // Encoder stages
+#include "decode.h"               // Decoder stages
+#include "lsb.h"                  // Bulk LSB kernels
+#include "lz.h"                   // Payload compression
+#include "chacha.h"               // Payload cipher
+#include "corpus.h"               // Deterministic covers and payloads
+
+/*
+ * Microbenchmarks for every LSB kernel and I/O stage plus end-to-end
+ * encode/decode throughput. Every result is one JSON object per line:
+ *   {"revision":..., "bench":..., "variant":..., "depth":..., "bytes":...,
+ *    "iters":..., "mb_s":..., "min_us":..., "p50_us":..., "p90_us":..., "p99_us":...}
+ * mb_s is payload bytes over the median time, so lines from two commits
+ * can be compared directly (e.g. with jq or a spreadsheet)
+ */
+
+#ifndef STEG_REVISION
+#define STEG_REVISION "unknown"
+#endif
+
+#define MAX_ITERS 10000
+
+typedef void (*BenchFn)(void *ctx);
+
+typedef struct _BenchConfig
+{
+    int iters;                    // Timed iterations per benchmark (plus one warm-up)
+    size_t bytes;                 // Payload bytes for kernel and stage benchmarks
+    double cover_mp;              // Cover size of the end-to-end benchmarks
+    size_t payload;               // Secret size of the end-to-end benchmarks
+    int threads;                  // -j of the end-to-end benchmarks
+    const char *filter;           // Only run benchmarks whose name contains this
+    char dir[PATH_MAX];           // Scratch directory for corpus and output files
+} BenchConfig;
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, double p)
+{
+    int index = (int)(p * (n - 1) + 0.5);
+    return sorted[index];
+}
+
+/* Check a benchmark against --filter (matched against "bench/variant/depth") */
+static int bench_selected(const BenchConfig *cfg, const char *name, const char *variant, int depth)
+{
+    char full_name[128];
+
+    snprintf(full_name, sizeof(full_name), "%s/%s/%d", name, variant, depth);
+    return !cfg->filter || strstr(full_name, cfg->filter) != NULL;
+}
+
+/* Time fn iters times and print one JSON result line */
+static void run_bench(const BenchConfig *cfg, const char *name, const char *variant, int depth,
+                      size_t bytes, BenchFn fn, void *ctx)
+{
+    static double times[MAX_ITERS];
+
+    if (!bench_selected(cfg, name, variant, depth))
+        return;
+
+    fn(ctx);                                          // Warm-up: page faults, caches, lazy init
+    for (int i = 0; i < cfg->iters; i++)
+    {
+        double start = now_us();
+        fn(ctx);
+        times[i] = now_us() - start;
+    }
+    qsort(times, cfg->iters, sizeof(double), compare_double);
+
+    double p50 = percentile(times, cfg->iters, 0.50);
+    printf("{\"revision\":\"%s\",\"bench\":\"%s\",\"variant\":\"%s\",\"depth\":%d,\"bytes\":%zu,"
+           "\"iters\":%d,\"mb_s\":%.1f,\"min_us\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,\"p99_us\":%.1f}\n",
+           STEG_REVISION, name, variant, depth, bytes, cfg->iters,
+           p50 > 0 ? bytes / p50 : 0.0, times[0], p50,
+           percentile(times, cfg->iters, 0.90), percentile(times, cfg->iters, 0.99));
+    fflush(stdout);
+}
+
+/* -------------------- Kernels -------------------- */
+
+typedef struct _KernelCtx
+{
+    char *data;                   // Payload bytes
+    char *image;                  // 8 cover bytes per payload byte (enough for any depth)
+    size_t n;
+    int depth;
+} KernelCtx;
+
+static void bench_embed(void *arg)
+{
+    KernelCtx *k = arg;
+    lsb_embed_bytes_k(k->data, k->n, k->image, k->depth);
+}
+
+static void bench_extract(void *arg)
+{
+    KernelCtx *k = arg;
+    lsb_extract_bytes_k(k->image, k->n, k->data, k->depth);
+}
+
+static void bench_encode_byte(void *arg)           // Original one byte at a time encoder
+{
+    KernelCtx *k = arg;
+    for (size_t i = 0; i < k->n; i++)
+        encode_byte_to_lsb(k->data[i], k->image + 8 * i);
+}
+
+static void bench_decode_byte(void *arg)           // Original one byte at a time decoder
+{
+    KernelCtx *k = arg;
+    for (size_t i = 0; i < k->n; i++)
+        k->data[i] = decode_byte_from_lsb(k->image + 8 * i);
+}
+
+static void bench_chacha(void *arg)
+{
+    KernelCtx *k = arg;
+    static const ChaCha cipher = {{1, 2, 3, 4, 5, 6, 7, 8}, {9, 10, 11}};
+    chacha_xor(&cipher, 0, k->data, k->data, k->n);
+}
+
+static void kernel_benches(const BenchConfig *cfg)
+{
+    KernelCtx k = {malloc(cfg->bytes), malloc(cfg->bytes * 8), cfg->bytes, 1};
+    if (!k.data || !k.image) { printf("Error: Out of memory\n"); exit(1); }
+    corpus_fill(k.data, k.n, 1);
+    corpus_fill(k.image, k.n * 8, 2);
+
+    for (int isa = lsb_isa_scalar; isa < lsb_isa_count; isa++)
+    {
+        if (!lsb_select((LsbIsa)isa))
+            continue;                                 // Not available on this CPU
+        for (k.depth = 1; k.depth <= LSB_MAX_DEPTH; k.depth++)
+        {
+            if (k.depth > 1 && isa != lsb_isa_scalar && isa != lsb_isa_bmi2)
+                continue;                             // Multi-bit kernels only exist as scalar and BMI2
+            run_bench(cfg, "lsb_embed", lsb_isa_name((LsbIsa)isa), k.depth, k.n, bench_embed, &k);
+            run_bench(cfg, "lsb_extract", lsb_isa_name((LsbIsa)isa), k.depth, k.n, bench_extract, &k);
+        }
+    }
+    lsb_init();                                       // Back to the default variant
+
+    for (int isa = lsb_isa_scalar; isa < lsb_isa_count; isa++)
+    {
+        if (chacha_select((LsbIsa)isa))               // Only variants with a cipher kernel
+            run_bench(cfg, "chacha20_xor", lsb_isa_name((LsbIsa)isa), 1, k.n, bench_chacha, &k);
+    }
+    chacha_init();
+
+    run_bench(cfg, "encode_byte_to_lsb", "legacy", 1, k.n, bench_encode_byte, &k);
+    run_bench(cfg, "decode_byte_from_lsb", "legacy", 1, k.n, bench_decode_byte, &k);
+
+    free(k.data);
+    free(k.image);
+}
+
+/* -------------------- Stages -------------------- */
+
+typedef struct _CopyCtx
+{
+    FILE *src;
+    FILE *dest;
+} CopyCtx;
+
+static void bench_copy_remaining(void *arg)
+{
+    CopyCtx *c = arg;
+    rewind(c->src);
+    rewind(c->dest);
+    copy_remaining_img_data(c->src, c->dest);
+    fflush(c->dest);
+}
+
+static void stage_benches(const BenchConfig *cfg)
+{
+    char src_name[PATH_MAX + 32], dest_name[PATH_MAX + 32];
+    if (!bench_selected(cfg, "copy_remaining_img_data", "stdio", 1))
+        return;
+    snprintf(src_name, sizeof(src_name), "%s/copy_src.bin", cfg->dir);
+    snprintf(dest_name, sizeof(dest_name), "%s/copy_dest.bin", cfg->dir);
+    if (corpus_write_payload(src_name, cfg->bytes * 8, 3) == e_failure) exit(1);
+
+    CopyCtx c = {fopen(src_name, "rb"), fopen(dest_name, "wb")};
+    if (!c.src || !c.dest) { perror("fopen"); exit(1); }
+    run_bench(cfg, "copy_remaining_img_data", "stdio", 1, cfg->bytes * 8, bench_copy_remaining, &c);
+
+    fclose(c.src);
+    fclose(c.dest);
+    unlink(src_name);
+    unlink(dest_name);
+}
+
+/* -------------------- Compression -------------------- */
+
+typedef struct _CodecCtx
+{
+    char *raw;                    // CSV corpus text
+    char *packed;                 // Sequence of blocks with headers
+    char *out;
+    size_t n;
+    size_t packed_size;
+    int failed;
+} CodecCtx;
+
+static void bench_lz_compress(void *arg)
+{
+    CodecCtx *c = arg;
+    size_t pos = 0;
+    for (size_t start = 0; start < c->n; start += LZ_BLOCK)
+        pos += lz_compress_block(c->raw + start, c->n - start < LZ_BLOCK ? c->n - start : LZ_BLOCK, c->packed + pos);
+    c->packed_size = pos;
+}
+
+static void bench_lz_decompress(void *arg)
+{
+    CodecCtx *c = arg;
+    size_t pos = 0;
+    for (size_t start = 0; start < c->n; start += LZ_BLOCK)
+    {
+        int raw;
+        size_t stored = lz_block_size(c->packed + pos, &raw);
+        size_t out_len = c->n - start < LZ_BLOCK ? c->n - start : LZ_BLOCK;
+        if (lz_decompress_block(c->packed + pos + LZ_HEADER, stored, raw, c->out + start, out_len) == e_failure)
+            c->failed = 1;
+        pos += LZ_HEADER + stored;
+    }
+}
+
+static void codec_benches(const BenchConfig *cfg)
+{
+    char name[PATH_MAX + 32];
+    if (!bench_selected(cfg, "lz_compress", "block", 1) && !bench_selected(cfg, "lz_decompress", "block", 1))
+        return;
+    snprintf(name, sizeof(name), "%s/codec.csv", cfg->dir);
+    if (corpus_write_payload(name, cfg->bytes, 4) == e_failure) exit(1);
+
+    size_t blocks = (cfg->bytes + LZ_BLOCK - 1) / LZ_BLOCK;
+    CodecCtx c = {malloc(cfg->bytes), malloc(blocks * LZ_BLOCK_BOUND), malloc(cfg->bytes), cfg->bytes, 0, 0};
+    FILE *fptr = fopen(name, "rb");
+    if (!c.raw || !c.packed || !c.out) { printf("Error: Out of memory\n"); exit(1); }
+    if (!fptr || fread(c.raw, 1, c.n, fptr) != c.n) { perror("fread"); exit(1); }
+    fclose(fptr);
+    unlink(name);
+
+    bench_lz_compress(&c);                            // Decompression needs the packed blocks
+    run_bench(cfg, "lz_compress", "block", 1, c.n, bench_lz_compress, &c);
+    run_bench(cfg, "lz_decompress", "block", 1, c.n, bench_lz_decompress, &c);
+    if (c.failed || memcmp(c.raw, c.out, c.n) != 0) { printf("Error: LZ round trip failed\n"); exit(1); }
+
+    free(c.raw);
+    free(c.packed);
+    free(c.out);
+}
+
+/* -------------------- End to end -------------------- */
+
+typedef struct _EndToEndCtx
+{
+    char cover[PATH_MAX + 32];
+    char secret[PATH_MAX + 32];
+    char stego[PATH_MAX + 32];
+    char output[PATH_MAX + 32];
+    char key[PATH_MAX + 32];
+    int use_mmap;
+    int threads;
+    int depth;
+    int compress;
+    int encrypt;
+    int serial;                                       // stdio path without the read/write threads
+    int scatter;                                      // Keyed run order (--scatter)
+    int io_backend;                                   // IoBackend of the tile transfers
+    int failed;
+} EndToEndCtx;
+
+static void bench_encode(void *arg)
+{
+    EndToEndCtx *e = arg;
+    EncodeInfo encInfo = {0};
+    encInfo.src_image_fname = e->cover;
+    encInfo.secret_fname = e->secret;
+    encInfo.stego_image_fname = e->stego;
+    encInfo.use_mmap = e->use_mmap;
+    encInfo.threads = e->threads;
+    encInfo.bit_depth = e->depth;
+    encInfo.compress = e->compress;
+    encInfo.key_fname = e->encrypt ? e->key : NULL;
+    encInfo.no_pipeline = e->serial;
+    encInfo.scatter = e->scatter;
+    encInfo.io_backend = e->io_backend;
+    encInfo.quiet = 1;
+    if (do_encoding(&encInfo) == e_failure)
+    {
+        close_files(&encInfo);
+        e->failed = 1;
+    }
+}
+
+static void bench_decode(void *arg)
+{
+    EndToEndCtx *e = arg;
+    DecodeInfo decInfo = {0};
+    decInfo.stego_image_fname = e->stego;
+    decInfo.output_fname = e->output;                 // Written with the stored extension
+    decInfo.use_mmap = e->use_mmap;
+    decInfo.threads = e->threads;
+    decInfo.io_backend = e->io_backend;
+    decInfo.key_fname = e->key;
+    decInfo.quiet = 1;
+    if (do_decoding(&decInfo) == d_failure)
+    {
+        close_files_decode(&decInfo);
+        e->failed = 1;
+    }
+}
+
+static const struct
+{
+    const char *name;
+    int use_mmap;
+    int parallel;
+    int compress;
+    int encrypt;
+    int serial;
+    IoBackend io_backend;
+    int scatter;
+} end_to_end_modes[] = {{"stdio", 0, 0, 0, 0, 0, io_backend_auto, 0}, {"mmap", 1, 0, 0, 0, 0, io_backend_auto, 0},
+                        {"stdio_j", 0, 1, 0, 0, 0, io_backend_auto, 0}, {"mmap_j", 1, 1, 0, 0, 0, io_backend_auto, 0},
+                        {"stdio_z", 0, 0, 1, 0, 0, io_backend_auto, 0}, {"mmap_j_z", 1, 1, 1, 0, 0, io_backend_auto, 0},
+                        {"stdio_K", 0, 0, 0, 1, 0, io_backend_auto, 0}, {"mmap_K", 1, 0, 0, 1, 0, io_backend_auto, 0},
+                        {"mmap_j_K", 1, 1, 0, 1, 0, io_backend_auto, 0}, {"stdio_serial", 0, 0, 0, 0, 1, io_backend_auto, 0},
+                        {"stdio_j_threads", 0, 1, 0, 0, 0, io_backend_threads, 0}, {"stdio_j_sync", 0, 1, 0, 0, 0, io_backend_sync, 0},
+                        {"mmap_K_scatter", 1, 0, 0, 1, 0, io_backend_auto, 1}, {"mmap_j_K_scatter", 1, 1, 0, 1, 0, io_backend_auto, 1}};
+
+#define END_TO_END_MODES (sizeof(end_to_end_modes) / sizeof(end_to_end_modes[0]))
+
+static void end_to_end_benches(const BenchConfig *cfg)
+{
+    EndToEndCtx e = {0};
+    int selected = 0;
+
+    for (size_t m = 0; m < END_TO_END_MODES; m++)      // Skip the corpus when nothing would run
+        for (int depth = 1; depth <= LSB_MAX_DEPTH; depth++)
+            selected |= bench_selected(cfg, "do_encoding", end_to_end_modes[m].name, depth) ||
+                        bench_selected(cfg, "do_decoding", end_to_end_modes[m].name, depth);
+    if (!selected)
+        return;
+
+    snprintf(e.cover, sizeof(e.cover), "%s/cover.bmp", cfg->dir);
+    snprintf(e.secret, sizeof(e.secret), "%s/secret.csv", cfg->dir);
+    snprintf(e.stego, sizeof(e.stego), "%s/stego.bmp", cfg->dir);
+    snprintf(e.output, sizeof(e.output), "%s/output", cfg->dir);
+    snprintf(e.key, sizeof(e.key), "%s/bench.key", cfg->dir);
+    if (corpus_write_cover(e.cover, cfg->cover_mp, 1) == e_failure ||
+        corpus_write_payload(e.secret, cfg->payload, 2) == e_failure ||
+        corpus_write_payload(e.key, CHACHA_KEY_BYTES, 5) == e_failure)   // Any 32 bytes make a raw key
+    {
+        printf("Error: Cannot create the benchmark corpus in %s\n", cfg->dir);
+        exit(1);
+    }
+
+    for (size_t m = 0; m < END_TO_END_MODES; m++)
+    {
+        const char *mode = end_to_end_modes[m].name;
+        if (end_to_end_modes[m].parallel && cfg->threads <= 1)
+            continue;
+        for (e.depth = 1; e.depth <= LSB_MAX_DEPTH; e.depth++)
+        {
+            e.use_mmap = end_to_end_modes[m].use_mmap;
+            e.threads = end_to_end_modes[m].parallel ? cfg->threads : 0;
+            e.compress = end_to_end_modes[m].compress;
+            e.encrypt = end_to_end_modes[m].encrypt;
+            e.serial = end_to_end_modes[m].serial;
+            e.scatter = end_to_end_modes[m].scatter;
+            e.io_backend = end_to_end_modes[m].io_backend;
+            if (bench_selected(cfg, "do_decoding", mode, e.depth))
+                bench_encode(&e);                     // Decoding needs this depth's stego image
+            run_bench(cfg, "do_encoding", mode, e.depth, cfg->payload, bench_encode, &e);
+            if (e.failed) { printf("Error: Encoding failed (cover too small for the payload?)\n"); exit(1); }
+            run_bench(cfg, "do_decoding", mode, e.depth, cfg->payload, bench_decode, &e);
+            if (e.failed) { printf("Error: Decoding failed\n"); exit(1); }
+        }
+    }
+
+    char output[PATH_MAX + 48];
+    snprintf(output, sizeof(output), "%s.csv", e.output);
+    unlink(output);
+    unlink(e.stego);
+    unlink(e.secret);
+    unlink(e.cover);
+    unlink(e.key);
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [--iters N] [--bytes SIZE] [--cover MP] [--payload SIZE] [-j N] [--filter TEXT] [--dir DIR]\n", prog);
+    printf("  --iters N       timed iterations per benchmark (default 20)\n");
+    printf("  --bytes SIZE    payload of the kernel/stage benchmarks (default 1M)\n");
+    printf("  --cover MP      cover size of the end-to-end benchmarks (default 16)\n");
+    printf("  --payload SIZE  secret size of the end-to-end benchmarks (default 1M)\n");
+    printf("  -j N            also run the end-to-end benchmarks with N threads\n");
+    printf("  --filter TEXT   only run benchmarks whose bench/variant/depth contains TEXT\n");
+    printf("  --dir DIR       scratch directory (default: a new directory in /tmp)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    BenchConfig cfg = {20, 1 << 20, 16, 1 << 20, 0, NULL, ""};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--iters") == 0 && i + 1 < argc)
+            cfg.iters = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bytes") == 0 && i + 1 < argc)
+            cfg.bytes = corpus_parse_size(argv[++i]);
+        else if (strcmp(argv[i], "--cover") == 0 && i + 1 < argc)
+            cfg.cover_mp = atof(argv[++i]);
+        else if (strcmp(argv[i], "--payload") == 0 && i + 1 < argc)
+            cfg.payload = corpus_parse_size(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            cfg.threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            cfg.filter = argv[++i];
+        else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc)
+            snprintf(cfg.dir, sizeof(cfg.dir), "%s", argv[++i]);
+        else { usage(argv[0]); return 1; }
+    }
+    if (cfg.iters < 1 || cfg.iters > MAX_ITERS || cfg.bytes == 0 || cfg.payload == 0 || cfg.cover_mp <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int own_dir = cfg.dir[0] == '\0';
+    if (own_dir)
+    {
+        snprintf(cfg.dir, sizeof(cfg.dir), "/tmp/steg_bench_XXXXXX");
+        if (!mkdtemp(cfg.dir)) { perror("mkdtemp"); return 1; }
+    }
+
+    lsb_init();
+    kernel_benches(&cfg);
+    stage_benches(&cfg);
+    codec_benches(&cfg);
+    end_to_end_benches(&cfg);
+
+    if (own_dir) rmdir(cfg.dir);
+    return 0;
+}
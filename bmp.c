@@ -0,0 +1,504 @@
+#include <string.h>             // memcpy, strcmp
+#include <limits.h>             // INT_MIN (height that cannot be negated)
+#include "bmp.h"                // BMP declarations
+#include "lsb.h"                // Bulk LSB kernels
+#include "common.h"             // LSB_CHUNK, MAGIC_STRING, FORMAT_FLAG_*
+
+static uint le16(const unsigned char *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static uint le32(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint)p[3] << 24;
+}
+
+/* Byte lane of a 32-bit pixel not covered by the colour masks, -1 if the masks are not byte aligned */
+static int unused_lane(uint red, uint green, uint blue)
+{
+    uint used = red | green | blue;
+    int lane = -1;
+    for (int i = 0; i < 4; i++)
+    {
+        uint bits = used & (0xFFu << (8 * i));
+        if (bits == 0 && lane < 0)
+            lane = i;                                // First lane without colour bits
+        else if (bits != 0 && bits != (0xFFu << (8 * i)))
+            return -1;                               // Lane shared by channels (e.g. 10-10-10-2)
+    }
+    return lane;
+}
+
+Status bmp_parse(const unsigned char *head, size_t len, size_t file_size, BmpInfo *bmp)
+{
+    memset(bmp, 0, sizeof(*bmp));
+    if (len < 26 || head[0] != 'B' || head[1] != 'M')
+        return e_failure;                            // Not a bitmap
+
+    bmp->file_size = file_size;
+    bmp->data_offset = le32(head + 10);
+    bmp->dib_size = le32(head + 14);
+    uint compression = 0;
+    int height;
+
+    if (bmp->dib_size == 12)                         // BITMAPCOREHEADER: 16-bit fields
+    {
+        bmp->width = le16(head + 18);
+        height = (short)le16(head + 20);
+        bmp->bits_per_pixel = le16(head + 24);
+    }
+    else if (bmp->dib_size >= 40 && len >= 54)       // BITMAPINFOHEADER and its V2-V5 extensions
+    {
+        bmp->width = le32(head + 18);
+        height = (int)le32(head + 22);
+        bmp->bits_per_pixel = le16(head + 28);
+        compression = le32(head + 30);
+    }
+    else
+        return e_failure;
+    if (height == INT_MIN)
+        return e_failure;                            // -height does not fit
+
+    bmp->top_down = height < 0;
+    bmp->height = height < 0 ? (uint)-height : (uint)height;
+    bmp->alpha_lane = -1;
+
+    if (bmp->bits_per_pixel == 32)
+    {
+        if (compression == 0)                        // BI_RGB: B, G, R, unused
+            bmp->alpha_lane = 3;
+        else if (compression == 3 || compression == 6)  // BI_BITFIELDS / BI_ALPHABITFIELDS
+        {
+            if (len < 66) return e_failure;          // Masks follow the 40-byte header or are part of V2+
+            bmp->alpha_lane = unused_lane(le32(head + 54), le32(head + 58), le32(head + 62));
+            if (bmp->alpha_lane < 0) return e_failure;
+        }
+        else
+            return e_failure;
+    }
+    else if (bmp->bits_per_pixel != 24 || compression != 0)
+        return e_failure;                            // Palettes, 16-bit and compressed images are not supported
+
+    bmp->stride = (((size_t)bmp->width * bmp->bits_per_pixel + 31) / 32) * 4;
+    size_t pixels, end;                              // Crafted sizes must not wrap past the checks
+    if (bmp->width == 0 || bmp->height == 0 || bmp->data_offset < 14 + bmp->dib_size ||
+        __builtin_mul_overflow(bmp->stride, (size_t)bmp->height, &pixels) ||
+        __builtin_add_overflow(bmp->data_offset, pixels, &end) || end > file_size)
+        return e_failure;                            // Pixel array outside the file
+    return e_success;
+}
+
+void bmp_layout_rows(const BmpInfo *bmp, int use_alpha, BmpLayout *layout)
+{
+    int pixel_bytes = bmp->bits_per_pixel / 8;
+
+    layout->data_offset = bmp->data_offset;
+    layout->stride = bmp->stride;
+    layout->rows = bmp->height;
+    layout->skip_lane = (pixel_bytes == 4 && !use_alpha) ? bmp->alpha_lane : -1;
+    layout->row_slots = (size_t)bmp->width * (layout->skip_lane >= 0 ? 3 : pixel_bytes);
+    layout->linear = layout->skip_lane < 0 && layout->row_slots == layout->stride;
+    layout->scatter_base = layout->scatter_runs = 0;
+    layout->scatter_run = BMP_SCATTER_RUN;
+    if (layout->linear)                              // One span over all rows
+    {
+        layout->row_slots *= layout->rows;
+        layout->stride = layout->row_slots;
+        layout->rows = 1;
+    }
+}
+
+void bmp_layout_linear(size_t data_offset, size_t size, BmpLayout *layout)
+{
+    layout->data_offset = data_offset;
+    layout->row_slots = size;
+    layout->stride = size;
+    layout->rows = 1;
+    layout->skip_lane = -1;
+    layout->linear = 1;
+    layout->scatter_base = layout->scatter_runs = 0;
+    layout->scatter_run = BMP_SCATTER_RUN;
+}
+
+/* Keystream bytes of the run order: 128 GB into the stream, past any payload (its sizes are 32-bit) */
+#define SCATTER_KEY_POS ((uint64_t)1 << 37)
+
+Status bmp_layout_scatter(BmpLayout *layout, size_t base, const ChaCha *cipher)
+{
+    static const char zero[16];
+    unsigned char bytes[16];
+    size_t slots = bmp_slots(layout), area = base < slots ? slots - base : 0, run = BMP_SCATTER_RUN;
+
+    while (run > BMP_SCATTER_RUN_MIN && area / run < BMP_SCATTER_MIN_RUNS)
+        run /= 2;                                    // 3 * 4096 halves to 24 exactly
+    if (area / run < 2)
+        return e_failure;
+    layout->scatter_base = base;
+    layout->scatter_run = run;
+    layout->scatter_runs = area / run;
+    chacha_xor(cipher, SCATTER_KEY_POS, zero, (char *)bytes, sizeof(bytes));
+    for (int r = 0; r < 4; r++)                      // Little endian: same order on every host
+        layout->scatter_key[r] = (uint32_t)bytes[4 * r] | (uint32_t)bytes[4 * r + 1] << 8 |
+                                 (uint32_t)bytes[4 * r + 2] << 16 | (uint32_t)bytes[4 * r + 3] << 24;
+    return e_success;
+}
+
+/* Round function of the run permutation: every output bit depends on every input bit (splitmix64 finalizer),
+   so the few low bits a small cover keeps are as well mixed as the rest */
+static uint64_t scatter_round(uint64_t x, uint32_t key)
+{
+    x = (x ^ key) * 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+/* Stored position of logical run: 4-round Feistel network over the smallest even bit width, walked back into range */
+static size_t scatter_run(const BmpLayout *layout, size_t run)
+{
+    int half = 0;
+    while (((uint64_t)1 << (2 * half)) < layout->scatter_runs)
+        half++;
+    uint64_t mask = ((uint64_t)1 << half) - 1, x = run;
+
+    do
+    {
+        uint64_t left = x >> half, right = x & mask;
+        for (int r = 0; r < 4; r++)
+        {
+            uint64_t next = left ^ (scatter_round(right, layout->scatter_key[r]) & mask);
+            left = right;
+            right = next;
+        }
+        x = left << half | right;
+    } while (x >= layout->scatter_runs);             // At most 4x the runs: a few steps on average
+    return (size_t)x;
+}
+
+/* Stored slot of a logical slot */
+static size_t scatter_slot(const BmpLayout *layout, size_t slot)
+{
+    size_t rel = slot - layout->scatter_base;
+
+    if (slot < layout->scatter_base || rel / layout->scatter_run >= layout->scatter_runs)
+        return slot;
+    return layout->scatter_base + scatter_run(layout, rel / layout->scatter_run) * layout->scatter_run +
+           rel % layout->scatter_run;
+}
+
+/* Payload bytes from slot on that stay inside one run (all n when nothing is scattered there) */
+static size_t run_bytes(const BmpLayout *layout, size_t slot, size_t n, size_t cover)
+{
+    size_t end;
+
+    if (layout->scatter_runs == 0)
+        return n;
+    if (slot < layout->scatter_base)
+        end = layout->scatter_base;
+    else if ((slot - layout->scatter_base) / layout->scatter_run >= layout->scatter_runs)
+        return n;
+    else
+        end = slot - (slot - layout->scatter_base) % layout->scatter_run + layout->scatter_run;
+    size_t fit = (end - slot) / cover;
+    return fit == 0 || fit > n ? n : fit;
+}
+
+size_t bmp_slots(const BmpLayout *layout)
+{
+    return layout->row_slots * layout->rows;
+}
+
+/* File offset of a stored slot */
+static size_t slot_offset(const BmpLayout *layout, size_t slot)
+{
+    if (layout->linear)
+        return layout->data_offset + slot;
+
+    size_t row = slot / layout->row_slots, col = slot % layout->row_slots;
+    if (layout->skip_lane >= 0)                      // 3 slots per 4-byte pixel
+    {
+        size_t lane = col % 3;
+        col = (col / 3) * 4 + lane + (lane >= (size_t)layout->skip_lane);
+    }
+    return layout->data_offset + row * layout->stride + col;
+}
+
+size_t bmp_slot_offset(const BmpLayout *layout, size_t slot)
+{
+    return slot_offset(layout, scatter_slot(layout, slot));
+}
+
+size_t bmp_span_end(const BmpLayout *layout, size_t slot, size_t count)
+{
+    if (layout->scatter_runs && slot + count > layout->scatter_base)
+        return slot_offset(layout, bmp_slots(layout) - 1) + 1;     // Scattered runs may lie anywhere up to the end
+    return slot_offset(layout, slot + count - 1) + 1;
+}
+
+/* Copy count slots between the image bytes and a packed buffer, one row span at a time */
+static void move_slots(const BmpLayout *layout, char *image, size_t image_offset, size_t slot,
+                       size_t count, char *packed, int to_image)
+{
+    while (count > 0)
+    {
+        size_t row = slot / layout->row_slots, col = slot % layout->row_slots;
+        size_t run = layout->row_slots - col < count ? layout->row_slots - col : count;
+        size_t row_pos = layout->data_offset + row * layout->stride - image_offset;  // May wrap, col brings it back
+
+        if (layout->skip_lane < 0)                   // Contiguous span of the row
+        {
+            char *span = image + (row_pos + col);
+            if (to_image) memcpy(span, packed, run);
+            else memcpy(packed, span, run);
+        }
+        else                                         // Pixel by pixel around the skipped byte
+        {
+            char *pixel = image + (row_pos + (col / 3) * 4);
+            size_t lane = col % 3;
+            for (size_t i = 0; i < run; i++)
+            {
+                char *byte = pixel + lane + (lane >= (size_t)layout->skip_lane);
+                if (to_image) *byte = packed[i];
+                else packed[i] = *byte;
+                if (++lane == 3) { lane = 0; pixel += 4; }
+            }
+        }
+        packed += run;
+        slot += run;
+        count -= run;
+    }
+}
+
+/* Embed n bytes into stored slots from slot on */
+static void embed_slots(const BmpLayout *layout, char *image, size_t image_offset, size_t slot,
+                        const char *data, size_t n, int depth)
+{
+    char packed[LSB_CHUNK * 8];                      // Gathered slots of one chunk
+    size_t cover = lsb_cover_bytes(depth);
+
+    if (layout->linear)                              // Slots are the image bytes themselves
+    {
+        lsb_embed_bytes_k(data, n, image + (layout->data_offset + slot - image_offset), depth);
+        return;
+    }
+    while (n > 0)                                    // Gather, embed, scatter back
+    {
+        size_t count = n < LSB_CHUNK ? n : LSB_CHUNK;
+        move_slots(layout, image, image_offset, slot, cover * count, packed, 0);
+        lsb_embed_bytes_k(data, count, packed, depth);
+        move_slots(layout, image, image_offset, slot, cover * count, packed, 1);
+        slot += cover * count;
+        data += count;
+        n -= count;
+    }
+}
+
+/* Extract n bytes from stored slots from slot on */
+static void extract_slots(const BmpLayout *layout, const char *image, size_t image_offset, size_t slot,
+                          char *data, size_t n, int depth)
+{
+    char packed[LSB_CHUNK * 8];
+    size_t cover = lsb_cover_bytes(depth);
+
+    if (layout->linear)
+    {
+        lsb_extract_bytes_k(image + (layout->data_offset + slot - image_offset), n, data, depth);
+        return;
+    }
+    while (n > 0)
+    {
+        size_t count = n < LSB_CHUNK ? n : LSB_CHUNK;
+        move_slots(layout, (char *)image, image_offset, slot, cover * count, packed, 0);
+        lsb_extract_bytes_k(packed, count, data, depth);
+        slot += cover * count;
+        data += count;
+        n -= count;
+    }
+}
+
+void bmp_embed(const BmpLayout *layout, char *image, size_t image_offset, size_t slot,
+               const char *data, size_t n, int depth)
+{
+    size_t cover = lsb_cover_bytes(depth);
+
+    while (n > 0)                                    // One run at a time (everything at once unless scattered)
+    {
+        size_t count = run_bytes(layout, slot, n, cover);
+        embed_slots(layout, image, image_offset, scatter_slot(layout, slot), data, count, depth);
+        slot += cover * count;
+        data += count;
+        n -= count;
+    }
+}
+
+void bmp_extract(const BmpLayout *layout, const char *image, size_t image_offset, size_t slot,
+                 char *data, size_t n, int depth)
+{
+    size_t cover = lsb_cover_bytes(depth);
+
+    while (n > 0)
+    {
+        size_t count = run_bytes(layout, slot, n, cover);
+        extract_slots(layout, image, image_offset, scatter_slot(layout, slot), data, count, depth);
+        slot += cover * count;
+        data += count;
+        n -= count;
+    }
+}
+
+void bmp_embed_keyed(const BmpLayout *layout, char *image, size_t image_offset, size_t slot,
+                     const char *data, size_t n, int depth, const ChaCha *cipher, uint64_t pos)
+{
+    char keyed[LSB_CHUNK];                           // Encrypted chunk, still in L1 when it is embedded
+    size_t cover = lsb_cover_bytes(depth);
+
+    if (cipher == NULL)
+    {
+        bmp_embed(layout, image, image_offset, slot, data, n, depth);
+        return;
+    }
+    while (n > 0)
+    {
+        size_t count = n < LSB_CHUNK ? n : LSB_CHUNK;
+        chacha_xor(cipher, pos, data, keyed, count);
+        bmp_embed(layout, image, image_offset, slot, keyed, count, depth);
+        slot += cover * count;
+        data += count;
+        pos += count;
+        n -= count;
+    }
+}
+
+void bmp_extract_keyed(const BmpLayout *layout, const char *image, size_t image_offset, size_t slot,
+                       char *data, size_t n, int depth, const ChaCha *cipher, uint64_t pos)
+{
+    size_t cover = lsb_cover_bytes(depth);
+
+    if (cipher == NULL)
+    {
+        bmp_extract(layout, image, image_offset, slot, data, n, depth);
+        return;
+    }
+    while (n > 0)
+    {
+        size_t count = n < LSB_CHUNK ? n : LSB_CHUNK;
+        bmp_extract(layout, image, image_offset, slot, data, count, depth);
+        chacha_xor(cipher, pos, data, data, count);  // Decrypt while the chunk is still in L1
+        slot += cover * count;
+        data += count;
+        pos += count;
+        n -= count;
+    }
+}
+
+/* Big endian 32-bit field at 1 bit per slot */
+static uint field_be32(const BmpLayout *layout, const char *image, size_t image_offset, size_t slot)
+{
+    unsigned char bytes[4];
+    bmp_extract(layout, image, image_offset, slot, (char *)bytes, 4, 1);
+    return (uint)bytes[0] << 24 | (uint)bytes[1] << 16 | (uint)bytes[2] << 8 | bytes[3];
+}
+
+BmpPayload bmp_find_payload(const BmpInfo *bmp, size_t file_size, const char *image, size_t image_offset,
+                            size_t len, BmpLayout *layout, uint *format_word)
+{
+    BmpLayout tries[4];
+    uint flags[4];                                   // Layout flags a format word must carry for each try
+    int count = 0, bad_word = 0;
+    size_t magic_slots = 8 * strlen(MAGIC_STRING);
+
+    if (bmp)
+    {
+        for (int alpha = 0; alpha <= (bmp->bits_per_pixel == 32); alpha++)
+        {
+            bmp_layout_rows(bmp, alpha, &tries[count]);
+            flags[count] = (tries[count].linear ? 0 : FORMAT_FLAG_ROWS) | (alpha ? FORMAT_FLAG_ALPHA : 0);
+            count++;
+        }
+        bmp_layout_linear(bmp->data_offset, file_size - bmp->data_offset, &tries[count]);
+        flags[count++] = 0;
+    }
+    if ((!bmp || (bmp->format == cover_bmp && bmp->data_offset != 54)) && file_size > 54)
+    {
+        bmp_layout_linear(54, file_size - 54, &tries[count]);
+        flags[count++] = 0;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        BmpLayout *try = &tries[i];
+        char magic[3] = {0};
+
+        if (try->data_offset < image_offset || bmp_slots(try) < magic_slots + 32 ||
+            bmp_span_end(try, 0, magic_slots + 32) > image_offset + len)
+            continue;                                // Not enough bytes for the magic and a format word
+        bmp_extract(try, image, image_offset, 0, magic, 2, 1);
+
+        if (strcmp(magic, MAGIC_STRING) == 0 && try->linear)  // Original format is always linear
+        {
+            bmp_layout_linear(try->data_offset, file_size - try->data_offset, layout);
+            *format_word = 1;
+            return bmp_payload_legacy;
+        }
+        if (strcmp(magic, MAGIC_STRING_EXT) == 0)
+        {
+            uint word = field_be32(try, image, image_offset, magic_slots);
+            int depth = word & FORMAT_DEPTH_MASK;
+            if (depth >= 1 && depth <= LSB_MAX_DEPTH && (word & (FORMAT_FLAG_ROWS | FORMAT_FLAG_ALPHA)) == flags[i])
+            {
+                *layout = *try;
+                *format_word = word;
+                return bmp_payload_extended;
+            }
+            bad_word = 1;                            // Maybe a coincidence, keep looking
+        }
+    }
+    return bad_word ? bmp_payload_bad_word : bmp_payload_none;
+}
+
+/* Big endian 32-bit field through a field reader */
+static Status read_be32(bmp_field_fn read, void *ctx, uint *value)
+{
+    unsigned char bytes[4];
+    if (read(ctx, (char *)bytes, 4) == e_failure)
+        return e_failure;
+    *value = (uint)bytes[0] << 24 | (uint)bytes[1] << 16 | (uint)bytes[2] << 8 | bytes[3];
+    return e_success;
+}
+
+const char *bmp_read_fields(bmp_field_fn read, void *ctx, uint word, int cipher_fields, BmpFields *fields)
+{
+    const char *truncated = "truncated header fields";
+    uint extn_size;
+
+    memset(fields, 0, sizeof(*fields));
+    if ((word & FORMAT_FLAG_SCATTER) && !(word & FORMAT_FLAG_CHACHA))
+        return "scattered payload without a key";
+    if (read_be32(read, ctx, &extn_size) == e_failure)
+        return truncated;
+    if (extn_size > STEG_EXTN_MAX)
+        return "bad extension length";
+    if (read(ctx, fields->extn, extn_size) == e_failure)
+        return truncated;
+    if (strlen(fields->extn) != extn_size || strchr(fields->extn, '/'))
+        return "bad extension";                      // It becomes part of the output file name
+    if (read_be32(read, ctx, &fields->size) == e_failure)
+        return truncated;
+    fields->embedded = fields->size;
+    if ((word & FORMAT_FLAG_LZ) && read_be32(read, ctx, &fields->embedded) == e_failure)
+        return truncated;
+    if ((word & FORMAT_FLAG_CHACHA) && !cipher_fields)
+        return read(ctx, NULL, CHACHA_NONCE_BYTES + 4) == e_failure ? truncated : NULL;
+    if ((word & FORMAT_FLAG_CHACHA) &&
+        (read(ctx, (char *)fields->nonce, CHACHA_NONCE_BYTES) == e_failure || read_be32(read, ctx, &fields->check) == e_failure))
+        return truncated;
+    return NULL;
+}
+
+int bmp_fields_fit(const BmpLayout *layout, size_t slot, uint word, const BmpFields *fields)
+{
+    size_t slots = bmp_slots(layout);
+    size_t bytes = (size_t)fields->embedded + ((word & FORMAT_FLAG_CRC) ? CHECKSUM_BYTES : 0);
+    return slot <= slots && bytes <= (slots - slot) / lsb_cover_bytes(word & FORMAT_DEPTH_MASK);
+}
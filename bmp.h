@@ -0,0 +1,168 @@
+#ifndef BMP_H
+#define BMP_H
+
+#include <stddef.h>         // size_t
+#include <stdint.h>         // uint32_t
+#include "types.h"          // Status
+#include "chacha.h"         // Payload cipher
+#include "steg.h"           // STEG_EXTN_MAX
+
+/*
+ * BMP parsing and pixel layout
+ * bmp_parse() reads the file header and any DIB header (CORE, INFO, V2-V5)
+ * of an uncompressed 24-bit or 32-bit bitmap. A BmpLayout then numbers the
+ * cover bytes ("slots") that may carry payload bits: the pixel bytes of
+ * every row in file order, skipping row padding and, for 32-bit pixels,
+ * optionally the alpha/unused byte. Slot s lives at file offset
+ * bmp_slot_offset(layout, s); the embed/extract helpers walk whole rows
+ * at a time so the LSB kernels still see long contiguous spans.
+ * A scattered layout (--scatter) additionally stores the runs of
+ * BMP_SCATTER_RUN slots after the header fields in a keyed order.
+ * The other cover formats (cover.h) describe their pixels with the same
+ * BmpInfo, so everything below works on them unchanged
+ */
+
+/* Container a BmpInfo was parsed from */
+typedef enum
+{
+    cover_bmp,              // Windows bitmap (bmp_parse)
+    cover_pnm,              // Binary PGM / PPM (P5 / P6)
+    cover_tga,              // Uncompressed true-colour or grey Targa
+    cover_png               // Raw rows of an inflated PNG (png.h, never parsed from a header)
+} CoverFormat;
+
+typedef struct _BmpInfo
+{
+    CoverFormat format;     // Which parser filled it in
+    size_t file_size;       // Size of the whole file
+    size_t data_offset;     // bfOffBits: first pixel byte (the header span is everything before it)
+    size_t dib_size;        // DIB header size (12, 40, 52, 56, 108 or 124), 0 for other formats
+    uint width;             // Pixels per row
+    uint height;            // Number of rows
+    int top_down;           // Rows stored top first (negative BMP height)
+    int bits_per_pixel;     // 24 or 32 (8 for grey PGM / TGA)
+    size_t stride;          // File bytes per row, padded to 4 bytes for BMP
+    int alpha_lane;         // Byte of a 32-bit pixel that holds alpha/unused bits, -1 for 24-bit
+} BmpInfo;
+
+typedef struct _BmpLayout
+{
+    size_t data_offset;     // File offset of slot 0
+    size_t row_slots;       // Usable bytes per row
+    size_t stride;          // File bytes per row
+    size_t rows;
+    int skip_lane;          // Byte of each 4-byte pixel that is skipped, -1 for none
+    int linear;             // Slot s is simply at data_offset + s (no gaps)
+    size_t scatter_base;    // First scattered slot (the first payload slot)
+    size_t scatter_runs;    // Whole runs after scatter_base stored in keyed order, 0 when not scattered
+    size_t scatter_run;     // Slots per run, BMP_SCATTER_RUN unless the cover is small
+    uint32_t scatter_key[4];    // Round keys of the run permutation
+} BmpLayout;
+
+/* Slots per scattered run: 3 pages of a linear layout and a multiple of every lsb_cover_bytes() */
+#define BMP_SCATTER_RUN (3 * 4096)
+
+/* Small covers halve the run (down to BMP_SCATTER_RUN_MIN, still a multiple of every lsb_cover_bytes()) until there are this many */
+#define BMP_SCATTER_MIN_RUNS 16
+#define BMP_SCATTER_RUN_MIN 24
+
+/* Largest header bmp_parse() looks at (file header + V5 header + bit masks) */
+#define BMP_HEADER_MAX 138
+
+/* Parse the first len bytes of a file of file_size bytes */
+Status bmp_parse(const unsigned char *head, size_t len, size_t file_size, BmpInfo *bmp);
+
+/* Layout over the pixel rows of bmp, with or without the alpha byte of 32-bit pixels */
+void bmp_layout_rows(const BmpInfo *bmp, int use_alpha, BmpLayout *layout);
+
+/* Layout of size bytes without any gaps starting at data_offset (original stego format) */
+void bmp_layout_linear(size_t data_offset, size_t size, BmpLayout *layout);
+
+/*
+ * Scatter the slots from base on: logical run i of BMP_SCATTER_RUN slots is
+ * stored at run perm(i), a permutation over all whole runs up to the end of
+ * the image keyed by the payload cipher. Runs stay contiguous, so encoder
+ * and decoder still move page sized spans; the slots before base and a
+ * trailing partial run keep their places. Covers with fewer than
+ * BMP_SCATTER_MIN_RUNS runs after base use shorter runs, so the trailing
+ * run stays small. e_failure (layout unchanged) when not even two of the
+ * shortest runs fit, as nothing could move. bmp_span_end() of a span that
+ * reaches past base is then the end of the last slot
+ */
+Status bmp_layout_scatter(BmpLayout *layout, size_t base, const ChaCha *cipher);
+
+/* Number of slots */
+size_t bmp_slots(const BmpLayout *layout);
+
+/* File offset of a slot */
+size_t bmp_slot_offset(const BmpLayout *layout, size_t slot);
+
+/* File offset just past the last of count (> 0) slots starting at slot */
+size_t bmp_span_end(const BmpLayout *layout, size_t slot, size_t count);
+
+/*
+ * Embed / extract n payload bytes at depth starting at slot.
+ * image holds the file bytes from file offset image_offset on and must
+ * contain every slot touched
+ */
+void bmp_embed(const BmpLayout *layout, char *image, size_t image_offset, size_t slot,
+               const char *data, size_t n, int depth);
+void bmp_extract(const BmpLayout *layout, const char *image, size_t image_offset, size_t slot,
+                 char *data, size_t n, int depth);
+
+/*
+ * Same with the payload encrypted on the way in / decrypted on the way out,
+ * one LSB_CHUNK at a time so the cipher adds no pass over memory. pos is
+ * the payload offset of data[0]; cipher NULL is a plain embed / extract
+ */
+void bmp_embed_keyed(const BmpLayout *layout, char *image, size_t image_offset, size_t slot,
+                     const char *data, size_t n, int depth, const ChaCha *cipher, uint64_t pos);
+void bmp_extract_keyed(const BmpLayout *layout, const char *image, size_t image_offset, size_t slot,
+                       char *data, size_t n, int depth, const ChaCha *cipher, uint64_t pos);
+
+/* What bmp_find_payload() found at the start of the payload */
+typedef enum
+{
+    bmp_payload_none,       // No magic string in any candidate layout
+    bmp_payload_legacy,     // MAGIC_STRING: linear layout, everything at 1 bit
+    bmp_payload_extended,   // MAGIC_STRING_EXT with a format word matching the layout
+    bmp_payload_bad_word    // MAGIC_STRING_EXT but no layout with a usable format word
+} BmpPayload;
+
+/*
+ * Locate the magic string of a stego image. Tries the row layout without
+ * and with the alpha byte, then the linear layouts at data_offset and, for
+ * BMP covers, at 54 written by older versions. bmp may be NULL for files
+ * that do not parse, then only the linear layout at 54 is tried. image holds len file bytes
+ * from image_offset on; on success *layout is the payload layout (slot 0 is
+ * the first magic bit) and *format_word the format word (1 for legacy)
+ */
+BmpPayload bmp_find_payload(const BmpInfo *bmp, size_t file_size, const char *image, size_t image_offset,
+                            size_t len, BmpLayout *layout, uint *format_word);
+
+/* Fields between the format word and the payload, in the order every writer stores them */
+typedef struct _BmpFields
+{
+    char extn[STEG_EXTN_MAX + 1];   // Stored extension
+    uint size;                      // Secret size
+    uint embedded;                  // Bytes embedded: the packed size with FORMAT_FLAG_LZ, else size
+    unsigned char nonce[CHACHA_NONCE_BYTES];  // FORMAT_FLAG_CHACHA only
+    uint check;                     // Key check word, FORMAT_FLAG_CHACHA only
+} BmpFields;
+
+/* Next n field bytes at the payload depth; data is NULL to move past them unread. e_failure past the image */
+typedef Status (*bmp_field_fn)(void *ctx, char *data, size_t n);
+
+/*
+ * Read the fields of a payload with format word word through read, the one
+ * parser behind the decoder, -i, libsteg and PNG covers, which each supply
+ * their own way of reaching the slots (stdio or mapped image, scan window,
+ * buffer, inflated rows). cipher_fields 0 moves past the nonce and key check
+ * without reading them. NULL on success, else why the fields are unusable
+ */
+const char *bmp_read_fields(bmp_field_fn read, void *ctx, uint word, int cipher_fields, BmpFields *fields);
+
+/* The payload and checksum trailer of fields fit the slots of layout from slot on */
+int bmp_fields_fit(const BmpLayout *layout, size_t slot, uint word, const BmpFields *fields);
+
+#endif
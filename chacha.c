@@ -0,0 +1,446 @@
+#include <stdio.h>              // fopen (key file, /dev/urandom)
+#include <string.h>             // memcpy, memcmp
+#include <ctype.h>              // isspace, isxdigit
+#include "chacha.h"             // Cipher declarations
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CHACHA_X86 1
+#include <immintrin.h>          // SSE2 / AVX2 / AVX-512 intrinsics
+#else
+#define CHACHA_X86 0
+#endif
+
+/* XOR whole 64-byte blocks with the keystream, state[12] is the counter of the first block */
+typedef void (*chacha_xor_fn)(const uint32_t state[16], const unsigned char *in, unsigned char *out, size_t blocks);
+
+static uint32_t load32_le(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void store32_le(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+/* Initial state: constants, key, counter, nonce */
+static void chacha_state(const ChaCha *cipher, uint32_t counter, uint32_t state[16])
+{
+    state[0] = 0x61707865;                          // "expand 32-byte k"
+    state[1] = 0x3320646e;
+    state[2] = 0x79622d32;
+    state[3] = 0x6b206574;
+    memcpy(state + 4, cipher->key, sizeof(cipher->key));
+    state[12] = counter;
+    memcpy(state + 13, cipher->nonce, sizeof(cipher->nonce));
+}
+
+/* -------------------- Scalar reference -------------------- */
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QUARTER_ROUND(a, b, c, d) \
+    a += b; d ^= a; d = ROTL32(d, 16); \
+    c += d; b ^= c; b = ROTL32(b, 12); \
+    a += b; d ^= a; d = ROTL32(d, 8);  \
+    c += d; b ^= c; b = ROTL32(b, 7)
+
+static void chacha_block(const uint32_t state[16], uint32_t out[16])
+{
+    uint32_t x[16];
+    memcpy(x, state, sizeof(x));
+    for (int i = 0; i < 10; i++)                    // 20 rounds: column round + diagonal round
+    {
+        QUARTER_ROUND(x[0], x[4], x[8], x[12]);
+        QUARTER_ROUND(x[1], x[5], x[9], x[13]);
+        QUARTER_ROUND(x[2], x[6], x[10], x[14]);
+        QUARTER_ROUND(x[3], x[7], x[11], x[15]);
+        QUARTER_ROUND(x[0], x[5], x[10], x[15]);
+        QUARTER_ROUND(x[1], x[6], x[11], x[12]);
+        QUARTER_ROUND(x[2], x[7], x[8], x[13]);
+        QUARTER_ROUND(x[3], x[4], x[9], x[14]);
+    }
+    for (int i = 0; i < 16; i++)
+        out[i] = x[i] + state[i];
+}
+
+static void xor_scalar(const uint32_t state[16], const unsigned char *in, unsigned char *out, size_t blocks)
+{
+    uint32_t s[16], keystream[16];
+    memcpy(s, state, sizeof(s));
+    for (size_t b = 0; b < blocks; b++)
+    {
+        chacha_block(s, keystream);
+        for (int i = 0; i < 16; i++)
+            store32_le(out + 4 * i, load32_le(in + 4 * i) ^ keystream[i]);
+        s[12]++;
+        in += 64;
+        out += 64;
+    }
+}
+
+#if CHACHA_X86
+
+/* -------------------- SSE2 -------------------- */
+
+#define ROTL_SSE2(v, n) _mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+#define QR_SSE2(a, b, c, d) \
+    a = _mm_add_epi32(a, b); d = ROTL_SSE2(_mm_xor_si128(d, a), 16); \
+    c = _mm_add_epi32(c, d); b = ROTL_SSE2(_mm_xor_si128(b, c), 12); \
+    a = _mm_add_epi32(a, b); d = ROTL_SSE2(_mm_xor_si128(d, a), 8);  \
+    c = _mm_add_epi32(c, d); b = ROTL_SSE2(_mm_xor_si128(b, c), 7)
+
+__attribute__((target("sse2")))
+static void xor_sse2(const uint32_t state[16], const unsigned char *in, unsigned char *out, size_t blocks)
+{
+    uint32_t s[16];
+    memcpy(s, state, sizeof(s));
+    for (; blocks >= 4; blocks -= 4)                // 4 blocks side by side, one per 32-bit lane
+    {
+        __m128i x[16], o[16];
+        for (int i = 0; i < 16; i++)
+            o[i] = _mm_set1_epi32((int)s[i]);
+        o[12] = _mm_add_epi32(o[12], _mm_setr_epi32(0, 1, 2, 3));
+        memcpy(x, o, sizeof(x));
+        for (int r = 0; r < 10; r++)
+        {
+            QR_SSE2(x[0], x[4], x[8], x[12]);
+            QR_SSE2(x[1], x[5], x[9], x[13]);
+            QR_SSE2(x[2], x[6], x[10], x[14]);
+            QR_SSE2(x[3], x[7], x[11], x[15]);
+            QR_SSE2(x[0], x[5], x[10], x[15]);
+            QR_SSE2(x[1], x[6], x[11], x[12]);
+            QR_SSE2(x[2], x[7], x[8], x[13]);
+            QR_SSE2(x[3], x[4], x[9], x[14]);
+        }
+        for (int g = 0; g < 16; g += 4)             // Transpose 4 words x 4 blocks, XOR into the output
+        {
+            __m128i a = _mm_add_epi32(x[g], o[g]), b = _mm_add_epi32(x[g + 1], o[g + 1]);
+            __m128i c = _mm_add_epi32(x[g + 2], o[g + 2]), d = _mm_add_epi32(x[g + 3], o[g + 3]);
+            __m128i lo_ab = _mm_unpacklo_epi32(a, b), lo_cd = _mm_unpacklo_epi32(c, d);
+            __m128i hi_ab = _mm_unpackhi_epi32(a, b), hi_cd = _mm_unpackhi_epi32(c, d);
+            __m128i rows[4] = { _mm_unpacklo_epi64(lo_ab, lo_cd), _mm_unpackhi_epi64(lo_ab, lo_cd),
+                                _mm_unpacklo_epi64(hi_ab, hi_cd), _mm_unpackhi_epi64(hi_ab, hi_cd) };
+            for (int blk = 0; blk < 4; blk++)
+            {
+                size_t at = 64 * blk + 4 * g;
+                __m128i data = _mm_loadu_si128((const __m128i *)(in + at));
+                _mm_storeu_si128((__m128i *)(out + at), _mm_xor_si128(data, rows[blk]));
+            }
+        }
+        s[12] += 4;
+        in += 256;
+        out += 256;
+    }
+    xor_scalar(s, in, out, blocks);                 // Tail
+}
+
+/* -------------------- AVX2 -------------------- */
+
+#define ROTL_AVX2(v, n) _mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+#define QR_AVX2(a, b, c, d) \
+    a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot16); \
+    c = _mm256_add_epi32(c, d); b = ROTL_AVX2(_mm256_xor_si256(b, c), 12);             \
+    a = _mm256_add_epi32(a, b); d = _mm256_shuffle_epi8(_mm256_xor_si256(d, a), rot8);  \
+    c = _mm256_add_epi32(c, d); b = ROTL_AVX2(_mm256_xor_si256(b, c), 7)
+
+/* Transpose 8 words (x[0..7]) of 8 blocks and XOR them into the same words of each output block */
+__attribute__((target("avx2")))
+static inline void xor_words_avx2(const __m256i *x, const unsigned char *in, unsigned char *out)
+{
+    __m256i q[8];
+    for (int h = 0; h < 8; h += 4)                  // Within 128-bit lanes: blocks 0-3 low, 4-7 high
+    {
+        __m256i lo01 = _mm256_unpacklo_epi32(x[h], x[h + 1]), hi01 = _mm256_unpackhi_epi32(x[h], x[h + 1]);
+        __m256i lo23 = _mm256_unpacklo_epi32(x[h + 2], x[h + 3]), hi23 = _mm256_unpackhi_epi32(x[h + 2], x[h + 3]);
+        q[h] = _mm256_unpacklo_epi64(lo01, lo23);  // Words h..h+3 of blocks 0 and 4
+        q[h + 1] = _mm256_unpackhi_epi64(lo01, lo23);
+        q[h + 2] = _mm256_unpacklo_epi64(hi01, hi23);
+        q[h + 3] = _mm256_unpackhi_epi64(hi01, hi23);
+    }
+    for (int blk = 0; blk < 4; blk++)
+    {
+        __m256i low = _mm256_permute2x128_si256(q[blk], q[blk + 4], 0x20);   // Block blk
+        __m256i high = _mm256_permute2x128_si256(q[blk], q[blk + 4], 0x31);  // Block blk + 4
+        const __m256i *src_low = (const __m256i *)(in + 64 * blk), *src_high = (const __m256i *)(in + 64 * (blk + 4));
+        _mm256_storeu_si256((__m256i *)(out + 64 * blk), _mm256_xor_si256(_mm256_loadu_si256(src_low), low));
+        _mm256_storeu_si256((__m256i *)(out + 64 * (blk + 4)), _mm256_xor_si256(_mm256_loadu_si256(src_high), high));
+    }
+}
+
+__attribute__((target("avx2")))
+static void xor_avx2(const uint32_t state[16], const unsigned char *in, unsigned char *out, size_t blocks)
+{
+    const __m256i rot16 = _mm256_setr_epi8(2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+                                           2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13);
+    const __m256i rot8 = _mm256_setr_epi8(3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+                                          3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14);
+    uint32_t s[16];
+    memcpy(s, state, sizeof(s));
+    for (; blocks >= 8; blocks -= 8)                // 8 blocks side by side, one per 32-bit lane
+    {
+        __m256i x[16], o[16];
+        for (int i = 0; i < 16; i++)
+            o[i] = _mm256_set1_epi32((int)s[i]);
+        o[12] = _mm256_add_epi32(o[12], _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        memcpy(x, o, sizeof(x));
+        for (int r = 0; r < 10; r++)
+        {
+            QR_AVX2(x[0], x[4], x[8], x[12]);
+            QR_AVX2(x[1], x[5], x[9], x[13]);
+            QR_AVX2(x[2], x[6], x[10], x[14]);
+            QR_AVX2(x[3], x[7], x[11], x[15]);
+            QR_AVX2(x[0], x[5], x[10], x[15]);
+            QR_AVX2(x[1], x[6], x[11], x[12]);
+            QR_AVX2(x[2], x[7], x[8], x[13]);
+            QR_AVX2(x[3], x[4], x[9], x[14]);
+        }
+        for (int i = 0; i < 16; i++)
+            x[i] = _mm256_add_epi32(x[i], o[i]);
+        xor_words_avx2(x, in, out);                 // Bytes 0-31 of each block
+        xor_words_avx2(x + 8, in + 32, out + 32);   // Bytes 32-63
+        s[12] += 8;
+        in += 512;
+        out += 512;
+    }
+    xor_sse2(s, in, out, blocks);                   // Tail: 4 blocks, then scalar
+}
+
+/* -------------------- AVX-512 -------------------- */
+
+#define QR_AVX512(a, b, c, d) \
+    a = _mm512_add_epi32(a, b); d = _mm512_rol_epi32(_mm512_xor_si512(d, a), 16); \
+    c = _mm512_add_epi32(c, d); b = _mm512_rol_epi32(_mm512_xor_si512(b, c), 12); \
+    a = _mm512_add_epi32(a, b); d = _mm512_rol_epi32(_mm512_xor_si512(d, a), 8);  \
+    c = _mm512_add_epi32(c, d); b = _mm512_rol_epi32(_mm512_xor_si512(b, c), 7)
+
+__attribute__((target("avx512f")))
+static void xor_avx512(const uint32_t state[16], const unsigned char *in, unsigned char *out, size_t blocks)
+{
+    uint32_t s[16];
+    memcpy(s, state, sizeof(s));
+    for (; blocks >= 16; blocks -= 16)              // 16 blocks side by side, one per 32-bit lane
+    {
+        __m512i x[16], o[16], q[4][4];
+        for (int i = 0; i < 16; i++)
+            o[i] = _mm512_set1_epi32((int)s[i]);
+        o[12] = _mm512_add_epi32(o[12], _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+        memcpy(x, o, sizeof(x));
+        for (int r = 0; r < 10; r++)
+        {
+            QR_AVX512(x[0], x[4], x[8], x[12]);
+            QR_AVX512(x[1], x[5], x[9], x[13]);
+            QR_AVX512(x[2], x[6], x[10], x[14]);
+            QR_AVX512(x[3], x[7], x[11], x[15]);
+            QR_AVX512(x[0], x[5], x[10], x[15]);
+            QR_AVX512(x[1], x[6], x[11], x[12]);
+            QR_AVX512(x[2], x[7], x[8], x[13]);
+            QR_AVX512(x[3], x[4], x[9], x[14]);
+        }
+        for (int g = 0; g < 4; g++)                 // Within 128-bit lanes: q[g][j] lane L = words 4g..4g+3 of block 4L+j
+        {
+            __m512i a = _mm512_add_epi32(x[4 * g], o[4 * g]), b = _mm512_add_epi32(x[4 * g + 1], o[4 * g + 1]);
+            __m512i c = _mm512_add_epi32(x[4 * g + 2], o[4 * g + 2]), d = _mm512_add_epi32(x[4 * g + 3], o[4 * g + 3]);
+            __m512i lo_ab = _mm512_unpacklo_epi32(a, b), lo_cd = _mm512_unpacklo_epi32(c, d);
+            __m512i hi_ab = _mm512_unpackhi_epi32(a, b), hi_cd = _mm512_unpackhi_epi32(c, d);
+            q[g][0] = _mm512_unpacklo_epi64(lo_ab, lo_cd);
+            q[g][1] = _mm512_unpackhi_epi64(lo_ab, lo_cd);
+            q[g][2] = _mm512_unpacklo_epi64(hi_ab, hi_cd);
+            q[g][3] = _mm512_unpackhi_epi64(hi_ab, hi_cd);
+        }
+        for (int j = 0; j < 4; j++)                 // Transpose the 128-bit lanes: one whole block per vector
+        {
+            __m512i a = _mm512_shuffle_i32x4(q[0][j], q[1][j], _MM_SHUFFLE(1, 0, 1, 0));
+            __m512i b = _mm512_shuffle_i32x4(q[2][j], q[3][j], _MM_SHUFFLE(1, 0, 1, 0));
+            __m512i c = _mm512_shuffle_i32x4(q[0][j], q[1][j], _MM_SHUFFLE(3, 2, 3, 2));
+            __m512i d = _mm512_shuffle_i32x4(q[2][j], q[3][j], _MM_SHUFFLE(3, 2, 3, 2));
+            __m512i rows[4] = { _mm512_shuffle_i32x4(a, b, _MM_SHUFFLE(2, 0, 2, 0)),   // Block j
+                                _mm512_shuffle_i32x4(a, b, _MM_SHUFFLE(3, 1, 3, 1)),   // Block 4 + j
+                                _mm512_shuffle_i32x4(c, d, _MM_SHUFFLE(2, 0, 2, 0)),   // Block 8 + j
+                                _mm512_shuffle_i32x4(c, d, _MM_SHUFFLE(3, 1, 3, 1)) }; // Block 12 + j
+            for (int lane = 0; lane < 4; lane++)
+            {
+                size_t at = 64 * (4 * lane + j);
+                __m512i data = _mm512_loadu_si512((const void *)(in + at));
+                _mm512_storeu_si512((void *)(out + at), _mm512_xor_si512(data, rows[lane]));
+            }
+        }
+        s[12] += 16;
+        in += 1024;
+        out += 1024;
+    }
+    xor_avx2(s, in, out, blocks);                   // Tail: 8 blocks, then 4, then scalar
+}
+
+#endif
+
+/* -------------------- Dispatch -------------------- */
+
+static const chacha_xor_fn chacha_table[lsb_isa_count] = {
+#if CHACHA_X86
+    [lsb_isa_scalar] = xor_scalar,
+    [lsb_isa_sse2] = xor_sse2,
+    [lsb_isa_avx2] = xor_avx2,
+    [lsb_isa_avx512] = xor_avx512,                  // BMI2 has no kernel of its own
+#else
+    [lsb_isa_scalar] = xor_scalar,
+#endif
+};
+
+static void xor_resolve(const uint32_t state[16], const unsigned char *in, unsigned char *out, size_t blocks);
+
+static chacha_xor_fn xor_impl = xor_resolve;
+static LsbIsa current_isa = lsb_isa_scalar;
+
+/* Byte-exact check of a variant against the scalar reference before it is trusted */
+static int chacha_isa_verified(LsbIsa isa)
+{
+    unsigned char in[64 * 29], ref[64 * 29], out[64 * 29];  // 16 + 8 + 4 + 1 blocks: every tail path
+    uint32_t state[16];
+
+    for (size_t i = 0; i < sizeof(in); i++)
+        in[i] = (unsigned char)(i * 197 + 5);
+    for (int i = 0; i < 16; i++)
+        state[i] = 0x9E3779B9u * (i + 1);
+    state[12] = 0xFFFFFFF9u;                        // Counter wraps inside the vector lanes too
+    xor_scalar(state, in, ref, 29);
+    chacha_table[isa](state, in, out, 29);
+    return memcmp(ref, out, sizeof(out)) == 0;
+}
+
+int chacha_select(LsbIsa isa)
+{
+    if (isa >= lsb_isa_count || chacha_table[isa] == NULL || !lsb_isa_supported(isa))
+        return 0;
+    xor_impl = chacha_table[isa];
+    current_isa = isa;
+    return 1;
+}
+
+void chacha_init(void)
+{
+    for (int isa = lsb_isa_count - 1; isa > lsb_isa_scalar; isa--)  // Fastest first
+    {
+        if (chacha_table[isa] && lsb_isa_supported((LsbIsa)isa) && chacha_isa_verified((LsbIsa)isa) &&
+            chacha_select((LsbIsa)isa))
+            return;
+    }
+    chacha_select(lsb_isa_scalar);
+}
+
+LsbIsa chacha_current_isa(void)
+{
+    return current_isa;
+}
+
+static void xor_resolve(const uint32_t state[16], const unsigned char *in, unsigned char *out, size_t blocks)
+{
+    chacha_init();
+    xor_impl(state, in, out, blocks);
+}
+
+/* -------------------- Cipher -------------------- */
+
+void chacha_setup(ChaCha *cipher, const unsigned char key[CHACHA_KEY_BYTES], const unsigned char nonce[CHACHA_NONCE_BYTES])
+{
+    for (int i = 0; i < 8; i++)
+        cipher->key[i] = load32_le(key + 4 * i);
+    for (int i = 0; i < 3; i++)
+        cipher->nonce[i] = load32_le(nonce + 4 * i);
+}
+
+/* XOR part of one block: keystream bytes [skip, skip + n) */
+static void xor_partial(const uint32_t state[16], size_t skip, const unsigned char *in, unsigned char *out, size_t n)
+{
+    uint32_t keystream[16];
+    unsigned char bytes[64];
+    chacha_block(state, keystream);
+    for (int i = 0; i < 16; i++)
+        store32_le(bytes + 4 * i, keystream[i]);
+    for (size_t i = 0; i < n; i++)
+        out[i] = in[i] ^ bytes[skip + i];
+}
+
+void chacha_xor(const ChaCha *cipher, uint64_t pos, const char *in, char *out, size_t n)
+{
+    const unsigned char *src = (const unsigned char *)in;
+    unsigned char *dst = (unsigned char *)out;
+    uint32_t state[16];
+    size_t skip = pos % 64;
+
+    chacha_state(cipher, (uint32_t)(1 + pos / 64), state);  // Block 0 holds the key check
+    if (skip && n > 0)                              // Finish a block started by the previous window
+    {
+        size_t count = 64 - skip < n ? 64 - skip : n;
+        xor_partial(state, skip, src, dst, count);
+        state[12]++;
+        src += count;
+        dst += count;
+        n -= count;
+    }
+    if (n >= 64)
+    {
+        xor_impl(state, src, dst, n / 64);
+        state[12] += (uint32_t)(n / 64);
+        src += n / 64 * 64;
+        dst += n / 64 * 64;
+        n %= 64;
+    }
+    if (n > 0)
+        xor_partial(state, 0, src, dst, n);
+}
+
+uint chacha_key_check(const ChaCha *cipher)
+{
+    uint32_t state[16], keystream[16];
+    chacha_state(cipher, 0, state);
+    chacha_block(state, keystream);
+    return keystream[0];
+}
+
+static int hex_value(int c)
+{
+    return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+Status chacha_read_key(const char *fname, unsigned char key[CHACHA_KEY_BYTES])
+{
+    unsigned char text[2 * CHACHA_KEY_BYTES + 64];  // Hex key plus some whitespace
+    FILE *fptr = fopen(fname, "rb");
+    if (fptr == NULL)
+        return e_failure;
+    size_t len = fread(text, 1, sizeof(text), fptr);
+    fclose(fptr);
+
+    if (len == CHACHA_KEY_BYTES)                    // Raw key
+    {
+        memcpy(key, text, CHACHA_KEY_BYTES);
+        return e_success;
+    }
+
+    size_t start = 0, digits = 0;
+    while (start < len && isspace(text[start]))
+        start++;
+    while (start + digits < len && isxdigit(text[start + digits]))
+        digits++;
+    for (size_t i = start + digits; i < len; i++)
+        if (!isspace(text[i]))
+            return e_failure;                       // Not a hex key
+    if (digits != 2 * CHACHA_KEY_BYTES)
+        return e_failure;
+    for (int i = 0; i < CHACHA_KEY_BYTES; i++)
+        key[i] = (unsigned char)(hex_value(text[start + 2 * i]) << 4 | hex_value(text[start + 2 * i + 1]));
+    return e_success;
+}
+
+Status chacha_random_nonce(unsigned char nonce[CHACHA_NONCE_BYTES])
+{
+    FILE *fptr = fopen("/dev/urandom", "rb");
+    if (fptr == NULL)
+        return e_failure;
+    size_t len = fread(nonce, 1, CHACHA_NONCE_BYTES, fptr);
+    fclose(fptr);
+    return len == CHACHA_NONCE_BYTES ? e_success : e_failure;
+}
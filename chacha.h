@@ -0,0 +1,54 @@
+#ifndef CHACHA_H
+#define CHACHA_H
+
+#include <stddef.h>         // size_t
+#include <stdint.h>         // uint32_t, uint64_t
+#include "types.h"          // Status
+#include "lsb.h"            // LsbIsa (the cipher kernels use the same variant names)
+
+/*
+ * Payload encryption (-K keyfile)
+ * ChaCha20 as in RFC 8439: 256-bit key, 96-bit nonce, 32-bit block
+ * counter. Payload byte i is XORed with keystream byte i of block
+ * 1 + i/64, so any window of the payload can be encrypted or decrypted
+ * on its own (tiles, streaming) and the cipher is applied chunk by chunk
+ * inside the embed/extract loops instead of as a separate pass.
+ * Block 0 is not used for data; its first word is stored as a key check
+ * so a wrong key is reported instead of producing garbage.
+ * This gives confidentiality only, there is no authentication tag
+ */
+
+#define CHACHA_KEY_BYTES 32
+#define CHACHA_NONCE_BYTES 12
+
+typedef struct _ChaCha
+{
+    uint32_t key[8];        // Key words (little endian)
+    uint32_t nonce[3];      // Nonce words (little endian)
+} ChaCha;
+
+/* Select the fastest keystream kernel for this CPU, safe to call more than once */
+void chacha_init(void);
+
+/* Force a kernel variant, returns 0 if there is none for isa or the CPU does not support it */
+int chacha_select(LsbIsa isa);
+
+/* Currently selected kernel variant */
+LsbIsa chacha_current_isa(void);
+
+/* Set up a cipher from raw key and nonce bytes */
+void chacha_setup(ChaCha *cipher, const unsigned char key[CHACHA_KEY_BYTES], const unsigned char nonce[CHACHA_NONCE_BYTES]);
+
+/* XOR n bytes with the keystream starting at payload offset pos (in and out may be the same buffer) */
+void chacha_xor(const ChaCha *cipher, uint64_t pos, const char *in, char *out, size_t n);
+
+/* Key check word stored in the image (first keystream word of block 0) */
+uint chacha_key_check(const ChaCha *cipher);
+
+/* Read a key file: 32 raw bytes or 64 hex digits (surrounding whitespace ignored) */
+Status chacha_read_key(const char *fname, unsigned char key[CHACHA_KEY_BYTES]);
+
+/* Fresh random nonce for every encoded image */
+Status chacha_random_nonce(unsigned char nonce[CHACHA_NONCE_BYTES]);
+
+#endif
@@ -2,5 +2,23 @@
 #define COMMON_H
 
 #define MAGIC_STRING "#*"   // Magic string used to identify if a file is stegged or not
+#define MAGIC_STRING_EXT "#+"   // Magic string of the extended format: a 32-bit format word follows
+
+/* Format word (extended format only, always stored at 1 bit per image byte) */
+#define FORMAT_DEPTH_MASK 0xFF  // Bits 0-7: LSBs per image byte (1..4) used by every later field
+#define FORMAT_FLAG_ROWS 0x100  // Bit 8: payload skips row padding / the alpha byte (see bmp.h)
+#define FORMAT_FLAG_ALPHA 0x200 // Bit 9: 32-bit pixels carry payload in their alpha byte too (-a)
+#define FORMAT_FLAG_LZ 0x400    // Bit 10: payload is LZ compressed (-z), its size follows the secret size
+#define FORMAT_FLAG_CHACHA 0x800 // Bit 11: payload is ChaCha20 encrypted (-K), nonce and key check follow the sizes
+#define FORMAT_FLAG_CRC 0x1000  // Bit 12: CRC32C of the secret follows the payload (4 bytes, encrypted with it under -K)
+#define FORMAT_FLAG_SCATTER 0x2000 // Bit 13: payload runs stored in keyed order (--scatter, needs FORMAT_FLAG_CHACHA)
+
+#define CHECKSUM_BYTES 4    // CRC32C trailer of FORMAT_FLAG_CRC payloads
+
+#define LSB_CHUNK 4096      // Data bytes handled per bulk LSB kernel call (8x that in image bytes)
+#define DECODE_BLOCK (256 * 1024)   // Secret bytes per output write in the block decoder
+#define TILE_BYTES (1024 * 1024)    // Secret bytes per tile in parallel (-j) encode/decode
+#define TILE_IMAGE_BYTES ((size_t)TILE_BYTES * 8 / 3 * 4 + 64)  // Image bytes of one tile at depth 1 with row gaps (<= 4/3 per slot)
+#define COPY_BLOCK (4 * 1024 * 1024)    // Image bytes per transfer of the untouched tail through an I/O queue
 
 #endif   // End of COMMON_H
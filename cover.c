@@ -0,0 +1,166 @@
+#include <string.h>             // memset, strrchr
+#include <strings.h>            // strcasecmp
+#include <unistd.h>             // pread
+#include <sys/stat.h>           // fstat
+#include "cover.h"              // Cover format declarations
+
+#define COVER_MAX_SIDE 0x7FFFFFFFu  // Largest width / height taken from a text header
+
+/* Extensions the command line accepts for images */
+static const struct
+{
+    const char *extn;
+    CoverFormat format;
+    const char *default_name;
+} cover_names[] = {
+    {".bmp", cover_bmp, "default.bmp"},
+    {".pgm", cover_pnm, "default.pgm"},
+    {".ppm", cover_pnm, "default.ppm"},
+    {".pnm", cover_pnm, "default.pnm"},
+    {".tga", cover_tga, "default.tga"},
+    {".png", cover_png, "default.png"},
+};
+
+static uint le16(const unsigned char *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static int pnm_space(unsigned char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+/* Next decimal field of a PNM header, skipping white space and # comments; 0 if there is none */
+static size_t pnm_field(const unsigned char *head, size_t len, size_t *pos)
+{
+    size_t value = 0;
+
+    while (*pos < len && (pnm_space(head[*pos]) || head[*pos] == '#'))
+    {
+        if (head[*pos] == '#')                       // Comment up to the end of the line
+            while (*pos < len && head[*pos] != '\n' && head[*pos] != '\r')
+                (*pos)++;
+        else
+            (*pos)++;
+    }
+    while (*pos < len && head[*pos] >= '0' && head[*pos] <= '9')
+    {
+        value = value * 10 + (head[*pos] - '0');
+        if (value > COVER_MAX_SIDE)
+            return 0;                                // Also keeps stride * height from overflowing
+        (*pos)++;
+    }
+    return value;
+}
+
+/* P5 / P6 followed by width, height and maxval, then one white space character and the samples */
+static Status pnm_parse(const unsigned char *head, size_t len, size_t file_size, BmpInfo *info)
+{
+    size_t pos = 2;
+
+    if (len < 3 || head[0] != 'P' || (head[1] != '5' && head[1] != '6') || !pnm_space(head[2]))
+        return e_failure;                            // Plain (ASCII) and PAM files are not supported
+    size_t width = pnm_field(head, len, &pos);
+    size_t height = pnm_field(head, len, &pos);
+    size_t maxval = pnm_field(head, len, &pos);
+    if (width == 0 || height == 0 || maxval != 255 || pos >= len || !pnm_space(head[pos]))
+        return e_failure;                            // 16-bit samples or maxval < 255 (LSB changes could leave the range)
+
+    info->format = cover_pnm;
+    info->file_size = file_size;
+    info->data_offset = pos + 1;
+    info->width = (uint)width;
+    info->height = (uint)height;
+    info->top_down = 1;
+    info->bits_per_pixel = head[1] == '6' ? 24 : 8;
+    info->stride = width * (info->bits_per_pixel / 8);
+    info->alpha_lane = -1;
+    if (info->data_offset + info->stride * info->height > file_size)
+        return e_failure;                            // Samples outside the file (later frames may follow)
+    return e_success;
+}
+
+/* 18-byte header, id field and colour map (skipped), then the pixels: TGA has no signature, so every field is checked */
+static Status tga_parse(const unsigned char *head, size_t len, size_t file_size, BmpInfo *info)
+{
+    if (len < 18)
+        return e_failure;
+    uint map_type = head[1], image_type = head[2];
+    uint map_length = le16(head + 5), map_bits = head[7];
+    uint bits = head[16], descriptor = head[17];
+    uint attribute_bits = descriptor & 0x0F;         // Alpha bits per pixel: 0, or 8 for 32-bit
+    int supported = image_type == 2 ? bits == 24 || bits == 32 : image_type == 3 && bits == 8;
+
+    if (map_type > 1 || (descriptor & 0xC0) != 0)
+        return e_failure;                            // Unknown colour map type or interleaved rows
+    if (!supported || (attribute_bits != 0 && !(bits == 32 && attribute_bits == 8)))
+        return e_failure;                            // Colour mapped, 16-bit and RLE images are not supported
+
+    info->format = cover_tga;
+    info->file_size = file_size;
+    info->data_offset = 18 + head[0] + (map_type ? (size_t)map_length * ((map_bits + 7) / 8) : 0);
+    info->width = le16(head + 12);
+    info->height = le16(head + 14);
+    info->top_down = (descriptor & 0x20) != 0;       // Origin in the upper left corner
+    info->bits_per_pixel = bits;
+    info->stride = (size_t)info->width * (bits / 8);
+    info->alpha_lane = bits == 32 ? 3 : -1;          // B, G, R, alpha / attribute byte
+    if (info->width == 0 || info->height == 0 || info->data_offset + info->stride * info->height > file_size)
+        return e_failure;                            // Pixels outside the file (a TGA 2.0 footer may follow)
+    return e_success;
+}
+
+Status cover_parse(const unsigned char *head, size_t len, size_t file_size, BmpInfo *info)
+{
+    memset(info, 0, sizeof(*info));
+    if (len >= 2 && head[0] == 'B' && head[1] == 'M')
+        return bmp_parse(head, len, file_size, info);
+    if (len >= 2 && head[0] == 'P')
+        return pnm_parse(head, len, file_size, info);
+    return tga_parse(head, len, file_size, info);
+}
+
+Status cover_read_info(FILE *fptr, BmpInfo *info)
+{
+    unsigned char head[COVER_HEADER_MAX];
+    struct stat st;
+
+    if (fflush(fptr) != 0 || fstat(fileno(fptr), &st) != 0)
+        return e_failure;
+    ssize_t len = pread(fileno(fptr), head, sizeof(head), 0);
+    if (len < 0)
+        return e_failure;
+    return cover_parse(head, (size_t)len, (size_t)st.st_size, info);
+}
+
+int cover_name_format(const char *fname)
+{
+    const char *dot = fname ? strrchr(fname, '.') : NULL;
+
+    for (size_t i = 0; dot != NULL && i < sizeof(cover_names) / sizeof(cover_names[0]); i++)
+        if (strcasecmp(dot, cover_names[i].extn) == 0)
+            return cover_names[i].format;
+    return -1;
+}
+
+const char *cover_default_name(const char *cover_fname)
+{
+    const char *dot = cover_fname ? strrchr(cover_fname, '.') : NULL;
+
+    for (size_t i = 0; dot != NULL && i < sizeof(cover_names) / sizeof(cover_names[0]); i++)
+        if (strcasecmp(dot, cover_names[i].extn) == 0)
+            return cover_names[i].default_name;
+    return cover_names[0].default_name;
+}
+
+const char *cover_format_name(CoverFormat format)
+{
+    switch (format)
+    {
+    case cover_pnm: return "PNM";
+    case cover_tga: return "TGA";
+    case cover_png: return "PNG";
+    default: return "BMP";
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef COVER_H
+#define COVER_H
+
+#include <stdio.h>          // FILE
+#include <stddef.h>         // size_t
+#include "types.h"          // Status
+#include "bmp.h"            // BmpInfo, CoverFormat
+
+/*
+ * Cover formats
+ * Every supported cover is a header span followed by uncompressed pixel
+ * rows, so one BmpInfo (header = the bytes before data_offset, rows of
+ * stride bytes after it) describes each of them and the slot layouts, the
+ * LSB kernels and the mmap paths never see the container. Backends:
+ *   BMP  24-bit and 32-bit uncompressed bitmaps (bmp_parse)
+ *   PNM  binary PGM (P5) and PPM (P6) with maxval 255: rows are packed,
+ *        so the whole image is one linear span
+ *   TGA  uncompressed true-colour (type 2, 24 or 32 bits) and grey
+ *        (type 3, 8 bits) Targa images, bottom-up or top-down
+ * The format is detected from the header bytes, the file name extension
+ * only decides which names the command line accepts
+ */
+
+/* Largest header cover_parse() looks at (a TGA id field, PNM comments) */
+#define COVER_HEADER_MAX 512
+
+/* Parse the first len bytes of a file of file_size bytes with whichever backend they belong to */
+Status cover_parse(const unsigned char *head, size_t len, size_t file_size, BmpInfo *info);
+
+/* Parse the header of an open file without moving its file position */
+Status cover_read_info(FILE *fptr, BmpInfo *info);
+
+/* Format an image file name promises (.bmp, .pgm, .ppm, .pnm or .tga, any case), -1 for other names */
+int cover_name_format(const char *fname);
+
+/* Stego image name used when none is given: default.bmp, default.ppm, ... after the cover's extension */
+const char *cover_default_name(const char *cover_fname);
+
+/* "BMP", "PNM" or "TGA" */
+const char *cover_format_name(CoverFormat format);
+
+#endif
@@ -0,0 +1,150 @@
+#include <string.h>             // memcpy
+#include <pthread.h>            // pthread_once for the tables and the variant choice
+#include "crc32c.h"             // Checksum declarations
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>          // _mm_crc32_u64 / _mm_crc32_u8 (SSE4.2)
+#define CRC_X86 1
+#else
+#define CRC_X86 0
+#endif
+
+#define CRC_POLY 0x82F63B78u    // Castagnoli, bit reflected
+
+static uint32_t crc_table[8][256];      // Slicing-by-8: table k advances a byte k positions further
+static uint32_t x2n_table[32];          // x^(2^n) mod P for crc32c_combine()
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+static int use_hardware = 0;
+
+/* a * b mod P (bit reflected, x^0 in the top bit) */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31, p = 0;
+
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+                break;
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC_POLY : b >> 1;
+    }
+    return p;
+}
+
+/* x^(n * 2^k) mod P */
+static uint32_t x2nmodp(size_t n, unsigned k)
+{
+    uint32_t p = 1u << 31;                              // x^0
+
+    while (n)
+    {
+        if (n & 1)
+            p = multmodp(x2n_table[k & 31], p);
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+static uint32_t update_table(uint32_t crc, const unsigned char *p, size_t n)
+{
+    while (n >= 8)
+    {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);                              // Little endian like the reflected CRC
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^ crc_table[5][(lo >> 16) & 0xFF] ^
+              crc_table[4][lo >> 24] ^ crc_table[3][hi & 0xFF] ^ crc_table[2][(hi >> 8) & 0xFF] ^
+              crc_table[1][(hi >> 16) & 0xFF] ^ crc_table[0][hi >> 24];
+        p += 8;
+        n -= 8;
+    }
+    while (n--)
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xFF];
+    return crc;
+}
+
+#if CRC_X86
+__attribute__((target("sse4.2")))
+static uint32_t update_sse42(uint32_t crc, const unsigned char *p, size_t n)
+{
+    uint64_t c = crc;
+
+    while (n >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        n -= 8;
+    }
+    crc = (uint32_t)c;
+    while (n--)
+        crc = _mm_crc32_u8(crc, *p++);
+    return crc;
+}
+#endif
+
+static void build_tables(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int b = 0; b < 8; b++)
+            c = c & 1 ? (c >> 1) ^ CRC_POLY : c >> 1;
+        crc_table[0][i] = c;
+    }
+    for (int k = 1; k < 8; k++)
+        for (int i = 0; i < 256; i++)
+            crc_table[k][i] = (crc_table[k - 1][i] >> 8) ^ crc_table[0][crc_table[k - 1][i] & 0xFF];
+
+    uint32_t p = 1u << 30;                              // x^1
+    x2n_table[0] = p;
+    for (int n = 1; n < 32; n++)
+        x2n_table[n] = p = multmodp(p, p);
+
+#if CRC_X86
+    __builtin_cpu_init();
+    use_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t n)
+{
+    pthread_once(&crc_once, build_tables);
+#if CRC_X86
+    if (use_hardware)
+        return ~update_sse42(~crc, data, n);
+#endif
+    return ~update_table(~crc, data, n);
+}
+
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b)
+{
+    pthread_once(&crc_once, build_tables);
+    return multmodp(x2nmodp(len_b, 3), crc_a) ^ crc_b;  // crc_a moved past 8 * len_b zero bits
+}
+
+int crc32c_select(int hardware)
+{
+    pthread_once(&crc_once, build_tables);
+#if CRC_X86
+    if (hardware && !__builtin_cpu_supports("sse4.2"))
+        return 0;
+    use_hardware = hardware != 0;
+    return 1;
+#else
+    return !hardware;
+#endif
+}
+
+int crc32c_hardware(void)
+{
+    pthread_once(&crc_once, build_tables);
+    return use_hardware;
+}
@@ -0,0 +1,29 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>         // size_t
+#include <stdint.h>         // uint32_t
+
+/*
+ * Payload checksum
+ * CRC32C (Castagnoli, reflected polynomial 0x82F63B78) of the secret as
+ * the user sees it: before -z compression and -K encryption. Computed with
+ * the SSE4.2 crc32 instruction when the CPU has it, else slicing-by-8
+ * tables. Values are the finished CRC (0 for no data), so pieces checked
+ * by different tiles or blocks are joined with crc32c_combine() instead of
+ * being re-read in order
+ */
+
+/* Continue crc (0 to start) over n more bytes */
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t n);
+
+/* CRC of A followed by B from crc_a, crc_b and the length of B */
+uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b);
+
+/* Force the table (0) or SSE4.2 (1) variant, returns 0 if the CPU does not support it */
+int crc32c_select(int hardware);
+
+/* Non zero if the SSE4.2 variant is in use */
+int crc32c_hardware(void);
+
+#endif
@@ -0,0 +1,600 @@
+#define _GNU_SOURCE                 // accept4, MSG_CMSG_CLOEXEC, struct ucred
+#include <stdio.h>                  // Startup message
+#include <stdlib.h>                 // Jobs, connections, worker buffers
+#include <string.h>                 // memcpy, strlen
+#include <errno.h>                  // EINTR
+#include <pthread.h>                // Workers and connection readers
+#include <unistd.h>                 // pread, pwrite, ftruncate, close
+#include <sys/socket.h>             // SOCK_SEQPACKET, SCM_RIGHTS
+#include <sys/un.h>                 // sockaddr_un
+#include <sys/mman.h>               // Large images are mapped
+#include <sys/stat.h>               // fstat, umask
+#include "daemon.h"                 // Protocol and run_daemon
+#include "steg.h"                   // In-memory encode / decode
+
+typedef struct _Daemon Daemon;
+
+/* One client connection, freed when its reader and every job it queued are done */
+typedef struct _DaemonConn
+{
+    Daemon *daemon;
+    int fd;
+    int refs;                       // Reader + jobs not answered yet (daemon lock)
+    uid_t uid;                      // Peer user (SO_PEERCRED), (uid_t)-1 when unknown
+    pthread_mutex_t send_lock;      // Replies of several workers
+    struct _DaemonConn *next;       // Open connections
+} DaemonConn;
+
+typedef struct _DaemonJob
+{
+    DaemonConn *conn;
+    StegdRequest req;
+    int fds[STEGD_MAX_FDS];
+    int nfds;
+    struct _DaemonJob *next;
+} DaemonJob;
+
+typedef struct _DaemonQueue
+{
+    DaemonJob *head, *tail;
+} DaemonQueue;
+
+/* Worker thread with its buffers for small jobs */
+typedef struct _DaemonWorker
+{
+    Daemon *daemon;
+    pthread_t thread;
+    char *image;                    // STEGD_SMALL_JOB: cover / stego image
+    char *data;                     // STEGD_SMALL_JOB: payload
+} DaemonWorker;
+
+struct _Daemon
+{
+    int listen_fd;
+    int stop;                       // Shutdown requested: no new jobs, workers drain the queues
+    pthread_mutex_t lock;
+    pthread_cond_t work;            // Job queued or stop
+    pthread_cond_t idle;            // A reader finished
+    DaemonQueue small, large;       // Small jobs are always taken first
+    DaemonConn *conns;
+    int readers;                    // Reader threads still running
+    int workers;
+    DaemonWorker *worker;
+};
+
+/* Whole file behind a descriptor: read into buf if it fits, else mapped */
+typedef struct _DaemonView
+{
+    char *data;
+    size_t size;
+    int mapped;
+} DaemonView;
+
+static Status read_full(int fd, char *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = pread(fd, buf + done, len - done, done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return e_failure;
+        done += n;
+    }
+    return e_success;
+}
+
+static Status write_full(int fd, const char *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = pwrite(fd, buf + done, len - done, done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return e_failure;
+        done += n;
+    }
+    return e_success;
+}
+
+/* First size bytes of fd (size 0: the whole file) */
+static Status view_open(int fd, size_t size, char *buf, size_t buf_size, DaemonView *view)
+{
+    struct stat st;
+
+    view->data = buf;                                       // Never NULL, even for an empty file
+    view->mapped = 0;
+    if (fstat(fd, &st) != 0 || (size > 0 && size > (size_t)st.st_size))
+        return e_failure;
+    view->size = size > 0 ? size : (size_t)st.st_size;
+    if (view->size == 0)
+        return e_success;
+    if (view->size <= buf_size)                             // Small: one pread into the worker's buffer
+        return read_full(fd, buf, view->size);
+    void *addr = mmap(NULL, view->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+        return e_failure;
+    view->data = addr;
+    view->mapped = 1;
+    return e_success;
+}
+
+static void view_close(DaemonView *view)
+{
+    if (view->mapped)
+        munmap(view->data, view->size);
+    view->data = NULL;
+    view->mapped = 0;
+}
+
+/* Resize fd to size and map it for writing */
+static char *map_output(int fd, size_t size)
+{
+    if (ftruncate(fd, size) != 0)
+        return NULL;
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return addr == MAP_FAILED ? NULL : addr;
+}
+
+static Status job_encode(DaemonWorker *worker, DaemonJob *job, StegdReply *reply)
+{
+    StegdRequest *req = &job->req;
+    StegParams params = {0};
+    DaemonView cover, payload;
+    Status res;
+
+    params.bit_depth = req->bit_depth;
+    params.use_alpha = req->use_alpha;
+    params.compress = req->compress;
+    params.key = req->has_key ? req->key : NULL;
+    params.extn = req->extn[0] ? req->extn : NULL;
+    if (view_open(job->fds[0], 0, worker->image, STEGD_SMALL_JOB, &cover) == e_failure)
+        return e_failure;
+    if (view_open(job->fds[1], req->payload_size, worker->data, STEGD_SMALL_JOB, &payload) == e_failure)
+    {
+        view_close(&cover);
+        return e_failure;
+    }
+
+    size_t size = steg_encoded_size(cover.size);
+    if (!cover.mapped)                                      // In place in the worker's buffer, then one write
+    {
+        res = steg_encode(cover.data, cover.size, payload.data, payload.size, &params, cover.data, size);
+        if (res == e_success && (ftruncate(job->fds[2], size) != 0 || write_full(job->fds[2], cover.data, size) == e_failure))
+            res = e_failure;
+    }
+    else                                                    // Straight from the mapped cover into the mapped output
+    {
+        char *out = map_output(job->fds[2], size);
+        res = out ? steg_encode(cover.data, cover.size, payload.data, payload.size, &params, out, size) : e_failure;
+        if (out) munmap(out, size);
+    }
+    view_close(&payload);
+    view_close(&cover);
+    reply->size = size;
+    return res;
+}
+
+static Status job_decode(DaemonWorker *worker, DaemonJob *job, StegdReply *reply)
+{
+    DaemonView stego;
+    StegPayloadInfo info;
+    Status res = e_failure;
+    size_t size = 0;
+
+    if (view_open(job->fds[0], 0, worker->image, STEGD_SMALL_JOB, &stego) == e_failure)
+        return e_failure;
+    if (steg_decode_info(stego.data, stego.size, &info) == e_success)
+    {
+        const unsigned char *key = job->req.has_key ? job->req.key : NULL;
+        if (info.payload_size <= STEGD_SMALL_JOB)           // Decode into the worker's buffer, then one write
+        {
+            res = steg_decode(stego.data, stego.size, key, worker->data, STEGD_SMALL_JOB, &size);
+            if (res == e_success && (ftruncate(job->fds[1], size) != 0 || write_full(job->fds[1], worker->data, size) == e_failure))
+                res = e_failure;
+        }
+        else                                                // Straight into the mapped output
+        {
+            char *out = map_output(job->fds[1], info.payload_size);
+            res = out ? steg_decode(stego.data, stego.size, key, out, info.payload_size, &size) : e_failure;
+            if (out) munmap(out, info.payload_size);
+        }
+        reply->bit_depth = info.bit_depth;
+        reply->format_word = info.format_word;
+        reply->encrypted = info.encrypted;
+        memcpy(reply->extn, info.extn, sizeof(reply->extn));
+    }
+    view_close(&stego);
+    reply->size = size;
+    return res;
+}
+
+static Status job_inspect(DaemonJob *job, StegdReply *reply)
+{
+    DaemonView stego;
+    StegPayloadInfo info;
+
+    if (view_open(job->fds[0], 0, NULL, 0, &stego) == e_failure)  // Mapped: only the header pages are touched
+        return e_failure;
+    Status res = steg_decode_info(stego.data, stego.size, &info);
+    view_close(&stego);
+    if (res == e_success)
+    {
+        reply->size = info.payload_size;
+        reply->bit_depth = info.bit_depth;
+        reply->format_word = info.format_word;
+        reply->encrypted = info.encrypted;
+        memcpy(reply->extn, info.extn, sizeof(reply->extn));
+    }
+    return res;
+}
+
+static void send_reply(DaemonConn *conn, const StegdReply *reply)
+{
+    pthread_mutex_lock(&conn->send_lock);
+    send(conn->fd, reply, sizeof(*reply), MSG_NOSIGNAL);   // A client that went away just misses it
+    pthread_mutex_unlock(&conn->send_lock);
+}
+
+/* Drop one reference of a connection (daemon lock held) */
+static void conn_release(DaemonConn *conn)
+{
+    if (--conn->refs > 0)
+        return;
+    close(conn->fd);
+    pthread_mutex_destroy(&conn->send_lock);
+    free(conn);
+}
+
+static void close_fds(int *fds, int nfds)
+{
+    for (int i = 0; i < nfds; i++)
+        close(fds[i]);
+}
+
+static void *daemon_worker(void *arg)
+{
+    DaemonWorker *worker = arg;
+    Daemon *daemon = worker->daemon;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&daemon->lock);
+        while (!daemon->small.head && !daemon->large.head && !daemon->stop)
+            pthread_cond_wait(&daemon->work, &daemon->lock);
+        DaemonQueue *queue = daemon->small.head ? &daemon->small : &daemon->large;
+        DaemonJob *job = queue->head;
+        if (job && (queue->head = job->next) == NULL)
+            queue->tail = NULL;
+        pthread_mutex_unlock(&daemon->lock);
+        if (job == NULL)
+            break;                                          // Stopped and nothing left
+
+        StegdReply reply = {0};
+        Status res = e_failure;
+        reply.id = job->req.id;
+        if (job->req.op == stegd_encode) res = job_encode(worker, job, &reply);
+        else if (job->req.op == stegd_decode) res = job_decode(worker, job, &reply);
+        else if (job->req.op == stegd_inspect) res = job_inspect(job, &reply);
+        reply.status = res;
+        send_reply(job->conn, &reply);
+        close_fds(job->fds, job->nfds);
+
+        pthread_mutex_lock(&daemon->lock);
+        conn_release(job->conn);
+        pthread_mutex_unlock(&daemon->lock);
+        free(job);
+    }
+    return NULL;
+}
+
+/* No new jobs or connections; wake the workers, the readers and accept() */
+static void daemon_stop(Daemon *daemon)
+{
+    pthread_mutex_lock(&daemon->lock);
+    daemon->stop = 1;
+    for (DaemonConn *conn = daemon->conns; conn; conn = conn->next)
+        shutdown(conn->fd, SHUT_RD);                        // Replies can still be sent
+    shutdown(daemon->listen_fd, SHUT_RDWR);
+    pthread_cond_broadcast(&daemon->work);
+    pthread_mutex_unlock(&daemon->lock);
+}
+
+/* Receive one message with its descriptors, returns its size (0 at the end of the connection, -1 on errors) */
+static ssize_t recv_request(int fd, StegdRequest *req, int *fds, int *nfds)
+{
+    char control[CMSG_SPACE(sizeof(int) * STEGD_MAX_FDS)];
+    struct iovec iov = { req, sizeof(*req) };
+    struct msghdr msg = {0};
+    ssize_t n;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    do n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    while (n < 0 && errno == EINTR);
+
+    *nfds = 0;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c))
+    {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+            continue;
+        int count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (int i = 0; i < count; i++)
+        {
+            int received;
+            memcpy(&received, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+            if (*nfds < STEGD_MAX_FDS) fds[(*nfds)++] = received;
+            else close(received);
+        }
+    }
+    if (n > 0 && (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+        n = 1;                                              // Too long, not a StegdRequest
+    return n;
+}
+
+/* Descriptors each operation needs */
+static int op_fds(uint32_t op)
+{
+    return op == stegd_encode ? 3 : op == stegd_decode ? 2 : op == stegd_inspect ? 1 : 0;
+}
+
+/* Connection reader: queue every request until the client hangs up or the daemon stops */
+static void *daemon_reader(void *arg)
+{
+    DaemonConn *conn = arg;
+    Daemon *daemon = conn->daemon;
+    StegdRequest req;
+    int fds[STEGD_MAX_FDS], nfds;
+    ssize_t n;
+
+    while ((n = recv_request(conn->fd, &req, fds, &nfds)) != 0)
+    {
+        StegdReply reply = {0};
+        if (n < 0)
+        {
+            close_fds(fds, nfds);
+            break;                                          // Connection error
+        }
+        reply.id = n == sizeof(req) ? req.id : 0;
+        reply.status = e_failure;
+        if (n != sizeof(req) || req.version != STEGD_VERSION || req.op > stegd_shutdown || nfds != op_fds(req.op))
+        {
+            close_fds(fds, nfds);
+            send_reply(conn, &reply);                       // Malformed request
+            continue;
+        }
+        if (req.op == stegd_shutdown)
+        {
+            if (conn->uid != geteuid() && conn->uid != 0)      // Only the daemon's own user (or root) stops it
+            {
+                send_reply(conn, &reply);
+                continue;
+            }
+            reply.status = e_success;
+            send_reply(conn, &reply);
+            daemon_stop(daemon);
+            continue;
+        }
+
+        DaemonJob *job = calloc(1, sizeof(DaemonJob));
+        struct stat st;
+        pthread_mutex_lock(&daemon->lock);
+        if (job == NULL || daemon->stop || fstat(fds[0], &st) != 0)
+        {
+            pthread_mutex_unlock(&daemon->lock);
+            free(job);
+            close_fds(fds, nfds);
+            send_reply(conn, &reply);
+            continue;
+        }
+        job->conn = conn;
+        job->req = req;
+        job->req.extn[STEG_EXTN_MAX] = '\0';
+        memcpy(job->fds, fds, sizeof(int) * nfds);
+        job->nfds = nfds;
+        DaemonQueue *queue = (size_t)st.st_size <= STEGD_SMALL_JOB ? &daemon->small : &daemon->large;
+        if (queue->tail) queue->tail->next = job;
+        else queue->head = job;
+        queue->tail = job;
+        conn->refs++;
+        pthread_cond_signal(&daemon->work);
+        pthread_mutex_unlock(&daemon->lock);
+    }
+
+    pthread_mutex_lock(&daemon->lock);
+    for (DaemonConn **link = &daemon->conns; *link; link = &(*link)->next)
+    {
+        if (*link == conn)
+        {
+            *link = conn->next;
+            break;
+        }
+    }
+    conn_release(conn);
+    daemon->readers--;
+    pthread_cond_broadcast(&daemon->idle);
+    pthread_mutex_unlock(&daemon->lock);
+    return NULL;
+}
+
+/* Bound and listening socket at path (a stale socket file is replaced, anything else is left alone: EEXIST), -1 on failure.
+   The socket file is created 0600 whatever the umask: only the daemon's user (and root) can connect */
+static int listen_socket(const char *path)
+{
+    struct sockaddr_un addr = {0};
+    struct stat st;
+    int fd, bound;
+    mode_t mask;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    if (lstat(path, &st) == 0 && !S_ISSOCK(st.st_mode))
+    {
+        errno = EEXIST;                                     // -D notes.txt must not delete notes.txt
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path) + 1);
+    if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    unlink(path);                                           // A stale socket of an earlier daemon, if any
+    mask = umask(0177);                                     // bind() creates the file: no window with a wider mode
+    bound = bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+    umask(mask);
+    if (!bound || listen(fd, 64) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+Status run_daemon(const char *socket_path, const StegOptions *opts)
+{
+    Daemon daemon = {0};
+    int started = 0;
+    Status res = e_failure;
+
+    daemon.listen_fd = listen_socket(socket_path);
+    if (daemon.listen_fd < 0)
+    {
+        perror(socket_path);
+        return e_failure;
+    }
+    daemon.workers = opts->threads > 0 ? opts->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (daemon.workers < 1) daemon.workers = 1;
+    pthread_mutex_init(&daemon.lock, NULL);
+    pthread_cond_init(&daemon.work, NULL);
+    pthread_cond_init(&daemon.idle, NULL);
+
+    daemon.worker = calloc(daemon.workers, sizeof(DaemonWorker));
+    for (int i = 0; daemon.worker && i < daemon.workers; i++)  // Buffers for small jobs allocated once
+    {
+        daemon.worker[i].daemon = &daemon;
+        daemon.worker[i].image = malloc(STEGD_SMALL_JOB);
+        daemon.worker[i].data = malloc(STEGD_SMALL_JOB);
+        if (!daemon.worker[i].image || !daemon.worker[i].data ||
+            pthread_create(&daemon.worker[i].thread, NULL, daemon_worker, &daemon.worker[i]) != 0)
+            break;
+        started++;
+    }
+    if (started == daemon.workers)
+    {
+        if (!opts->quiet)
+            printf("stegd: listening on %s with %d workers\n", socket_path, daemon.workers);
+        fflush(stdout);
+        for (;;)
+        {
+            int fd = accept4(daemon.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd < 0 && errno == EINTR)
+                continue;
+            pthread_mutex_lock(&daemon.lock);
+            if (fd < 0 || daemon.stop)
+            {
+                res = daemon.stop ? e_success : e_failure;   // Shutdown request, or the socket failed
+                pthread_mutex_unlock(&daemon.lock);
+                if (fd >= 0) close(fd);
+                break;
+            }
+            DaemonConn *conn = calloc(1, sizeof(DaemonConn));
+            pthread_t reader;
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            struct ucred cred;
+            socklen_t cred_len = sizeof(cred);
+            if (conn)
+            {
+                conn->daemon = &daemon;
+                conn->fd = fd;
+                conn->refs = 1;
+                conn->uid = getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == 0 ? cred.uid : (uid_t)-1;
+                pthread_mutex_init(&conn->send_lock, NULL);
+            }
+            if (conn == NULL || pthread_create(&reader, &attr, daemon_reader, conn) != 0)
+            {
+                if (conn) pthread_mutex_destroy(&conn->send_lock);
+                free(conn);
+                close(fd);                                  // Client sees the connection closed
+            }
+            else
+            {
+                conn->next = daemon.conns;
+                daemon.conns = conn;
+                daemon.readers++;
+            }
+            pthread_attr_destroy(&attr);
+            pthread_mutex_unlock(&daemon.lock);
+        }
+    }
+
+    daemon_stop(&daemon);                                   // Queued jobs still run
+    pthread_mutex_lock(&daemon.lock);
+    while (daemon.readers > 0)
+        pthread_cond_wait(&daemon.idle, &daemon.lock);
+    pthread_mutex_unlock(&daemon.lock);
+    for (int i = 0; i < started; i++)
+        pthread_join(daemon.worker[i].thread, NULL);
+    for (int i = 0; daemon.worker && i < daemon.workers; i++)
+    {
+        free(daemon.worker[i].image);
+        free(daemon.worker[i].data);
+    }
+    free(daemon.worker);
+    close(daemon.listen_fd);
+    unlink(socket_path);
+    pthread_cond_destroy(&daemon.idle);
+    pthread_cond_destroy(&daemon.work);
+    pthread_mutex_destroy(&daemon.lock);
+    return res;
+}
+
+int stegd_connect(const char *socket_path)
+{
+    struct sockaddr_un addr = {0};
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+        return -1;
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, socket_path, strlen(socket_path) + 1);
+    if ((fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+Status stegd_call(int sock, const StegdRequest *req, const int *fds, int nfds, StegdReply *reply)
+{
+    char control[CMSG_SPACE(sizeof(int) * STEGD_MAX_FDS)] = {0};
+    struct iovec iov = { (void *)req, sizeof(*req) };
+    struct msghdr msg = {0};
+    ssize_t n;
+
+    if (nfds < 0 || nfds > STEGD_MAX_FDS)
+        return e_failure;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (nfds > 0)
+    {
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(c), fds, sizeof(int) * nfds);
+    }
+    do n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    while (n < 0 && errno == EINTR);
+    if (n != sizeof(*req))
+        return e_failure;
+    do n = recv(sock, reply, sizeof(*reply), 0);
+    while (n < 0 && errno == EINTR);
+    return n == sizeof(*reply) && reply->status == e_success ? e_success : e_failure;
+}
@@ -0,0 +1,75 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdint.h>         // Fixed width protocol fields
+#include "types.h"          // Status, StegOptions
+#include "steg.h"           // STEG_KEY_BYTES, STEG_EXTN_MAX
+
+/*
+ * stegd: long running daemon (-D socket)
+ * Listens on a Unix domain SOCK_SEQPACKET socket. Every message is one
+ * StegdRequest with the image and payload passed as file descriptors
+ * (SCM_RIGHTS): regular files or memfd/shm shared memory, so no data is
+ * copied through the socket. Jobs run on a persistent pool of workers,
+ * each with STEGD_SMALL_JOB buffers allocated at start; images up to that
+ * size are read into them with pread, larger ones are memory mapped.
+ * Small jobs are always taken before large ones. Every request gets one
+ * StegdReply on the same connection (requests may be pipelined, match
+ * them by id). The socket file is created 0600, and stegd_shutdown is
+ * only honoured from a peer (SO_PEERCRED) running as the daemon's user
+ * or root
+ *
+ * File descriptors per operation:
+ *     stegd_encode    cover, payload, output (resized to the cover size)
+ *     stegd_decode    stego image, output (resized to the payload size)
+ *     stegd_inspect   stego image
+ *     stegd_shutdown  none: finish the queued jobs and exit
+ */
+
+#define STEGD_VERSION 1
+#define STEGD_SMALL_JOB (1024 * 1024)   // Largest image read into the worker buffers (and served first)
+#define STEGD_MAX_FDS 3
+
+typedef enum
+{
+    stegd_encode,
+    stegd_decode,
+    stegd_inspect,
+    stegd_shutdown
+} StegdOp;
+
+typedef struct _StegdRequest
+{
+    uint32_t version;                   // STEGD_VERSION
+    uint32_t op;                        // StegdOp
+    uint64_t id;                        // Returned in the reply
+    uint64_t payload_size;              // Encode: bytes of the payload fd to embed
+    int32_t bit_depth;                  // Encode: StegParams
+    int32_t use_alpha;
+    int32_t compress;
+    int32_t has_key;                    // Non zero: key encrypts (encode) / decrypts (decode) the payload
+    unsigned char key[STEG_KEY_BYTES];
+    char extn[STEG_EXTN_MAX + 1];       // Encode: stored extension, empty for ".txt"
+} StegdRequest;
+
+typedef struct _StegdReply
+{
+    uint64_t id;                        // Id of the request
+    int32_t status;                     // Status of the job
+    int32_t bit_depth;                  // Decode / inspect: StegPayloadInfo
+    uint32_t format_word;
+    int32_t encrypted;
+    uint64_t size;                      // Encode: stego image bytes, decode / inspect: payload bytes
+    char extn[STEG_EXTN_MAX + 1];
+} StegdReply;
+
+/* Serve requests on socket_path with opts->threads workers (0: one per CPU) until a shutdown request */
+Status run_daemon(const char *socket_path, const StegOptions *opts);
+
+/* Client side: connect to a daemon, returns the socket or -1 */
+int stegd_connect(const char *socket_path);
+
+/* Client side: send one request with nfds descriptors and wait for its reply */
+Status stegd_call(int sock, const StegdRequest *req, const int *fds, int nfds, StegdReply *reply);
+
+#endif
@@ -1,15 +1,31 @@
 #include <stdio.h>              // Standard I/O functions
+#include <stdlib.h>             // Block buffer allocation
+#include <errno.h>              // Preallocation error codes
+#include <stdint.h>             // SIZE_MAX (whole payload of a PNG)
 #include "decode.h"             // Include header file for decode function declarations
 #include "types1.h"             // Include custom type definitions (e.g., Status1)
 #include <string.h>             // For string handling functions like strcmp, strrchr
 #include "common.h"             // Include common definitions (e.g., MAGIC_STRING)
+#include "lsb.h"                // Include bulk LSB embed/extract kernels
+#include "lz.h"                 // Include block decompressor for compressed payloads
+#include "chacha.h"             // Include payload cipher for encrypted payloads
+#include "crc32c.h"             // Include payload checksum
+#include "cover.h"              // Include cover format parsers (BMP, PNM, TGA)
+#include "png.h"                // Include streaming PNG covers
+
+#include "parallel.h"           // Include tile runner for -j
+
+#ifndef _WIN32
+#include <fcntl.h>              // posix_fallocate
+#include <unistd.h>             // pread/pwrite for tile workers
+#include <sys/stat.h>           // fstat (image size for the header scan)
+#endif
 
 // Function to validate decoding input and output file extensions
 Status1 read_and_validate_decode_file(char* argv[], DecodeInfo* decInfo)
 {
-    // Check if decoding source file (BMP) has a valid extension
-    char* source = (strrchr(argv[2], '.'));       // Find the last '.' in the source file name
-    if (source == NULL || strcmp(source, ".bmp") != 0)  // If no '.' or not a ".bmp" file
+    // Check if decoding source file (BMP, PNM or TGA) has a valid extension
+    if (cover_name_format(argv[2]) < 0)           // If not a .bmp, .pgm/.ppm/.pnm, .tga or .png file
     {
         return d_failure;                         // Return failure if invalid
     }
@@ -19,7 +35,7 @@ Status1 read_and_validate_decode_file(char* argv[], DecodeInfo* decInfo)
     }
 
     // Check if decoding output file (text or code) has a valid extension
-    char* secret = strrchr(argv[3], '.');  // Find last '.' in output file
+    const char* secret = decode_output_extn(argv[3]);  // Find the extension of the output file name
 
 if (secret != NULL) {
     // If there is an extension, check if it is allowed
@@ -52,30 +68,177 @@ Status1 open_files_decode(DecodeInfo *decInfo)
     return d_success;  // Return success if file opened successfully
 }
 
-// Function to skip the BMP header (first 54 bytes)
-Status1 skip_bmp_header(FILE *fptr_stego_image)
+// Function to map the stego image for the memory mapped decode path
+Status1 map_files_decode(DecodeInfo *decInfo)
+{
+    if (map_file_read(decInfo->fptr_stego_image, &decInfo->stego_map) == e_failure)  // Map the whole stego image
+    {
+        printf("Error: Cannot map stego image file %s\n", decInfo->stego_image_fname);
+        return d_failure;
+    }
+    decInfo->image_offset = 0;                // Nothing consumed yet
+    return d_success;
+}
+
+// Function to allocate a page aligned block buffer
+static char *alloc_block(size_t size)
 {
-    fseek(fptr_stego_image, 54, SEEK_SET);  // Move file pointer to byte 54 (start of image data)
+#ifndef _WIN32
+    void *block = NULL;
+    return posix_memalign(&block, 4096, size) == 0 ? block : NULL;  // Aligned for large direct writes
+#else
+    return malloc(size);
+#endif
+}
 
-    if (ftell(fptr_stego_image) != 54)  // Verify that the pointer moved correctly
+// Function to allocate the reusable image window and output buffer of the block decoder
+static Status1 alloc_decode_buffers(DecodeInfo *decInfo)
+{
+    if (decInfo->image_window == NULL)
+    {
+        decInfo->image_window = alloc_block((size_t)DECODE_BLOCK * 8);  // 8 image bytes per decoded byte
+    }
+    if (decInfo->out_buffer == NULL)
     {
-        return d_failure;  // Return failure if pointer not at expected position
+        decInfo->out_buffer = alloc_block(DECODE_BLOCK);
     }
+    return (decInfo->image_window && decInfo->out_buffer) ? d_success : d_failure;
+}
 
-    return d_success;  // Return success if header skipped successfully
+// Function to reserve disk space for the size bytes of the output file up front
+static Status1 preallocate_output(DecodeInfo *decInfo, size_t size)
+{
+#ifndef _WIN32
+    if (size == 0)
+    {
+        return d_success;
+    }
+    int err = posix_fallocate(fileno(decInfo->fptr_output_file), 0, size);
+    if (err == ENOSPC)                        // Not enough space: fail before decoding anything
+    {
+        printf("Error: No space left for %s\n", decInfo->output_path);
+        return d_failure;
+    }
+#endif
+    return d_success;                         // Unsupported file systems just skip preallocation
 }
 
+// Function to decode n bytes from the next image bytes at the active bit depth
+Status1 decode_bytes_from_lsb(DecodeInfo *decInfo, char *data, size_t n)
+{
+    char chunk_buffer[LSB_CHUNK * 8];         // Image bytes for one chunk of data (header fields)
+    char *image_buffer = decInfo->image_window ? decInfo->image_window : chunk_buffer;
+    size_t block = decInfo->image_window ? DECODE_BLOCK : LSB_CHUNK;  // Bytes decoded per read
+    int depth = decInfo->active_depth ? decInfo->active_depth : 1;    // Header fields use 1 bit
+    size_t cover = lsb_cover_bytes(depth);    // Image bytes per decoded byte
+    const BmpLayout *layout = &decInfo->layout;
 
-// Function to decode one byte of hidden data from the LSBs of 8 image bytes
-char decode_byte_from_lsb(char *image_buffer)
+    if (n == 0)
+    {
+        return d_success;
+    }
+    if (!layout->linear)
+    {
+        block /= 2;                           // Row gaps add up to 1/3 more image bytes
+    }
+
+    if (decInfo->use_mmap)                    // Extract straight from the mapped image
+    {
+        size_t end = bmp_span_end(layout, decInfo->slot, cover * n);
+        if (end > decInfo->stego_map.size)
+        {
+            return d_failure;                 // Return failure if image is too short
+        }
+        bmp_extract_keyed(layout, decInfo->stego_map.data, 0, decInfo->slot, data, n, depth,
+                          decInfo->active_cipher, decInfo->cipher_pos);
+        decInfo->image_offset = end;
+        decInfo->slot += cover * n;
+        decInfo->cipher_pos += n;
+        return d_success;
+    }
+
+    while (n > 0)
+    {
+        size_t count = n < block ? n : block;                                // Bytes in this window
+        size_t len = bmp_span_end(layout, decInfo->slot, cover * count) - decInfo->image_offset;  // Including row gaps
+        if (fread(image_buffer, 1, len, decInfo->fptr_stego_image) != len)
+        {
+            return d_failure;                 // Return failure if image is too short
+        }
+        bmp_extract_keyed(layout, image_buffer, decInfo->image_offset, decInfo->slot, data, count, depth,
+                          decInfo->active_cipher, decInfo->cipher_pos);  // Decode (and decrypt) the chunk
+        decInfo->image_offset += len;
+        decInfo->slot += cover * count;
+        decInfo->cipher_pos += count;
+        data += count;
+        n -= count;
+    }
+    return d_success;
+}
+
+// Function to decode a 32-bit integer (MSB first) from the next 32 image bytes
+static Status1 decode_size(DecodeInfo *decInfo, int *size)
+{
+    unsigned char bytes[4];                   // Size bytes in big endian order
+
+    if (decode_bytes_from_lsb(decInfo, (char *)bytes, 4) == d_failure)
+    {
+        return d_failure;
+    }
+    *size = (int)(((unsigned int)bytes[0] << 24) | ((unsigned int)bytes[1] << 16) |
+                  ((unsigned int)bytes[2] << 8) | bytes[3]);   // Same layout as decode_size_from_lsb()
+    return d_success;
+}
+
+// Function to parse the cover header and find the layout the payload was written in
+Status1 skip_cover_header(DecodeInfo *decInfo)
 {
-    char data = 0;                            // Variable to store the decoded byte
+    unsigned char head[COVER_HEADER_MAX];      // BMP file and DIB header, PNM or TGA header
+    int fd = fileno(decInfo->fptr_stego_image);
+    struct stat st;
+    BmpInfo bmp;
+    uint word;
 
-    for (int i = 0; i < 8; i++)               // Loop through 8 bytes (8 bits of data)
+    if (fstat(fd, &st) != 0)
     {
-        int bit = image_buffer[i] & 1;        // Extract the least significant bit (LSB)
-        data = (data << 1) | bit;             // Shift data left and add the extracted bit
+        return d_failure;
     }
+    ssize_t len = pread(fd, head, sizeof(head), 0);
+    int parsed = len > 0 && cover_parse(head, len, st.st_size, &bmp) == e_success;  // Unsupported images: only the legacy layout
+
+    // Window with the magic string and format word of every candidate layout
+    size_t first = parsed && bmp.data_offset < 54 ? bmp.data_offset : 54;
+    size_t size = (parsed && bmp.data_offset > 54 ? bmp.data_offset : 54) - first + 256;
+    char *window = malloc(size);
+    ssize_t got = window ? pread(fd, window, size, first) : -1;
+    BmpPayload found = got > 0 ? bmp_find_payload(parsed ? &bmp : NULL, st.st_size, window, first, got,
+                                                   &decInfo->layout, &word) : bmp_payload_none;
+    free(window);
+    if (got < 0)
+    {
+        return d_failure;                      // Return failure if the image cannot be read
+    }
+    if (found != bmp_payload_legacy && found != bmp_payload_extended)
+    {
+        bmp_layout_linear(first, st.st_size > (off_t)first ? st.st_size - first : 0, &decInfo->layout);  // Magic check reports it
+    }
+
+    decInfo->slot = 0;                         // Slot 0 is the first bit of the magic string
+    decInfo->image_offset = decInfo->layout.data_offset;
+    if (!decInfo->use_mmap && fseek(decInfo->fptr_stego_image, decInfo->image_offset, SEEK_SET) != 0)
+    {
+        return d_failure;                      // Return failure if pointer not at expected position
+    }
+    return d_success;                          // Return success if header skipped successfully
+}
+
+
+// Function to decode one byte of hidden data from the LSBs of 8 image bytes
+char decode_byte_from_lsb(char *image_buffer)
+{
+    char data;                                // Variable to store the decoded byte
+
+    lsb_extract_bytes(image_buffer, 1, &data); // First image byte holds the MSB
 
     return data;                              // Return the decoded character
 }
@@ -83,140 +246,694 @@ char decode_byte_from_lsb(char *image_buffer)
 // Function to decode and verify the magic string from the stego image
 Status1 decode_magic_string(DecodeInfo *decInfo)
 {
-    char image_buffer[8];                                     // Buffer to hold 8 bytes from image
     char magic[strlen(MAGIC_STRING) + 1];                     // Buffer to store decoded magic string
 
-    for (int i = 0; i < strlen(MAGIC_STRING); i++)            // Loop for each character in MAGIC_STRING
+    decInfo->active_depth = 1;                                // Magic string always uses 1 bit per image byte
+
+    if (decode_bytes_from_lsb(decInfo, magic, strlen(MAGIC_STRING)) == d_failure) // Decode all characters at once
     {
-        fread(image_buffer, 1, 8, decInfo->fptr_stego_image); // Read 8 bytes from stego image
-        magic[i] = decode_byte_from_lsb(image_buffer);        // Decode one character from LSBs
+        return d_failure;                                     // Return failure if image is too short
     }
     
     magic[strlen(MAGIC_STRING)] = '\0';                       // Null-terminate the decoded string
 
     if (strcmp(magic, MAGIC_STRING) == 0)                     // Compare decoded string with original magic string
     {
+        decInfo->extended = 0;                                // Original format: everything at 1 bit
+        decInfo->bit_depth = 1;
+        decInfo->format_word = 1;                             // Depth 1, no flags
         return d_success;                                     // Return success if it matches
     }
 
+    if (strcmp(magic, MAGIC_STRING_EXT) == 0)                 // Extended format: a format word follows
+    {
+        decInfo->extended = 1;
+        return d_success;
+    }
+
     return d_failure;                                         // Return failure if it doesn't match
 }
 
+// Function to decode the format word of the extended format and switch to its bit depth
+Status1 decode_format_word(DecodeInfo *decInfo)
+{
+    int word;
+
+    if (decode_size(decInfo, &word) == d_failure)             // 32 image bytes at 1 bit
+    {
+        return d_failure;
+    }
+
+    decInfo->format_word = (uint)word;
+    decInfo->bit_depth = word & FORMAT_DEPTH_MASK;
+    if (decInfo->bit_depth < 1 || decInfo->bit_depth > LSB_MAX_DEPTH)
+    {
+        return d_failure;                                     // Return failure if the depth is corrupt
+    }
+    if ((word & FORMAT_FLAG_SCATTER) && !(word & FORMAT_FLAG_CHACHA))
+    {
+        return d_failure;                                     // Return failure if the run order has no key
+    }
+    decInfo->active_depth = decInfo->bit_depth;              // Every later field uses this depth
+    return d_success;
+}
+
 // Function to decode a 4-byte (32-bit) integer size from LSBs of 32 image bytes
 int decode_size_from_lsb(char* image_buffer)
 {
-    int data = 0;                            // Variable to store decoded size
+    unsigned char bytes[4];                  // Size bytes in big endian order (MSB first)
+
+    lsb_extract_bytes(image_buffer, 4, (char *)bytes);  // Decode 4 bytes from 32 image bytes
+
+    return (int)(((unsigned int)bytes[0] << 24) | ((unsigned int)bytes[1] << 16) |
+                 ((unsigned int)bytes[2] << 8) | bytes[3]);  // Return the decoded integer size
+}
+
+
+// Field reader of bmp_read_fields(): the next n bytes at the payload depth (stdio or mapped image)
+static Status read_field_decode(void *ctx, char *data, size_t n)
+{
+    return decode_bytes_from_lsb(ctx, data, n) == d_success ? e_success : e_failure;
+}
 
-    for (int i = 0; i < 32; i++)             // Loop through 32 bytes (32 bits)
+// Function to decode the extension, sizes and key check fields (bmp_read_fields(), the parser -i and libsteg use too)
+Status1 decode_header_fields(DecodeInfo *decInfo, BmpFields *fields)
+{
+    const char *error = bmp_read_fields(read_field_decode, decInfo, decInfo->format_word, 1, fields);
+    if (error != NULL)
     {
-        int bit = image_buffer[i] & 1;       // Extract the LSB of each byte
-        data = (data << 1) | bit;            // Shift data left and add the bit
+        printf("Error: Corrupt header fields (%s)!\n", error);
+        return d_failure;
     }
 
-    return data;                             // Return the decoded integer size
+    strcpy(decInfo->extn_secret_file, fields->extn);          // Extension of the secret file (e.g., .txt, .c)
+    decInfo->size_secret_file = fields->size;                  // Field is unsigned, secrets may exceed 2 GB
+    decInfo->packed_size = fields->embedded;                   // Same as the size unless FORMAT_FLAG_LZ
+    return d_success;
 }
 
+// Function to find the extension of an output file name, only in the name after the last '/'
+const char *decode_output_extn(const char *fname)
+{
+    const char* slash = strrchr(fname, '/');                  // Directories may have dots of their own
+    return strrchr(slash != NULL ? slash + 1 : fname, '.');
+}
 
-// Function to decode the size of the secret file extension from the stego image
-Status1 decode_secret_file_extn_size(DecodeInfo *decInfo, int *extn_size)
+// Function to build the output path: the output name without its extension, then the decoded extension
+Status1 decode_output_path(char *path, size_t size, const char *output_fname, const char *extn)
 {
-    char image_buffer[32];                                    // Buffer to hold 32 bytes (for 32 bits of size)
-    size_t bytesRead;
+    const char* dot = decode_output_extn(output_fname);
+    int base = dot != NULL ? (int)(dot - output_fname) : (int)strlen(output_fname);  // Name without its extension
+    return snprintf(path, size, "%.*s%s", base, output_fname, extn) < (int)size ? d_success : d_failure;
+}
 
-    bytesRead = fread(image_buffer, 1, 32, decInfo->fptr_stego_image);  // Read 32 bytes from stego image
+// Function to create the output file, named after output_fname with the decoded extension, once every header field and the key check have passed
+Status1 open_output_decode(DecodeInfo *decInfo)
+{
+    if (decode_output_path(decInfo->output_path, sizeof(decInfo->output_path), decInfo->output_fname,
+                           decInfo->extn_secret_file) == d_failure)  // Add the decoded extension
+    {
+        printf("Error: Output file name too long\n");
+        return d_failure;                                     // Return failure if the name is too long
+    }
 
-    if (bytesRead != 32)                                      // Check if 32 bytes were successfully read
+    decInfo->fptr_output_file = fopen(decInfo->output_path, decInfo->use_mmap ? "w+b" : "wb");  // Create output file (readable too when mapped)
+    if (decInfo->fptr_output_file == NULL)                    // Check if file creation failed
     {
-        return d_failure;                                     // Return failure if read error
+        printf("Error: Cannot create file %s\n", decInfo->output_path);  // Print error message
+        return d_failure;                                     // Return failure
     }
 
-    *extn_size = decode_size_from_lsb(image_buffer);           // Decode 4-byte integer (extension size) from LSBs
-    return d_success;                                          // Return success
+    return d_success;
 }
 
-// Function to decode the actual secret file extension (e.g., ".txt", ".c") from the stego image
-Status1 decode_secret_file_extn(DecodeInfo *decInfo, int extn_size)
+
+// Function to set up the cipher of an encrypted payload from its nonce and check the key against its key check word
+Status1 decode_cipher_fields(DecodeInfo *decInfo, const BmpFields *fields)
 {
-    char image_buffer[8];                                     // Buffer to hold 8 bytes (for one character)
-    int i;
+    unsigned char key[CHACHA_KEY_BYTES];
 
-    for (i = 0; i < extn_size; i++)                           // Loop for each character of extension
+    if (decInfo->key_fname == NULL || chacha_read_key(decInfo->key_fname, key) == e_failure)
     {
-        fread(image_buffer, 1, 8, decInfo->fptr_stego_image); // Read 8 bytes from image for one character
-        decInfo->extn_secret_file[i] = decode_byte_from_lsb(image_buffer);  // Decode character from LSBs
+        return d_failure;                                      // Return failure if there is no usable key
     }
+    chacha_setup(&decInfo->cipher, key, fields->nonce);
+    memset(key, 0, sizeof(key));
+    if (chacha_key_check(&decInfo->cipher) != fields->check)
+    {
+        return d_failure;                                      // Return failure if the key is wrong
+    }
+    return d_success;
+}
+
+// Function to get the cipher of the payload, NULL when it was embedded in the clear
+const ChaCha *payload_cipher_decode(DecodeInfo *decInfo)
+{
+    return (decInfo->format_word & FORMAT_FLAG_CHACHA) ? &decInfo->cipher : NULL;
+}
 
-    decInfo->extn_secret_file[i] = '\0';                      // Null-terminate the decoded extension string
-   
-    char* dot = strrchr(decInfo->output_fname, '.');           // Find the last '.' in output filename
-    if (dot != NULL)                                          // If an extension already exists
+// Function to get the number of bytes embedded after the header fields
+size_t embedded_size_decode(DecodeInfo *decInfo)
+{
+    return (decInfo->format_word & FORMAT_FLAG_LZ) ? decInfo->packed_size : decInfo->size_secret_file;
+}
+
+// Function to read the CRC32C trailer after the payload and compare it with the checksum of the decoded secret
+Status1 decode_checksum(DecodeInfo *decInfo)
+{
+    unsigned char bytes[CHECKSUM_BYTES];                       // Big endian like the size fields
+
+    if (!(decInfo->format_word & FORMAT_FLAG_CRC))
+    {
+        return d_success;                                      // Older images carry no checksum
+    }
+    decInfo->active_cipher = payload_cipher_decode(decInfo);   // Encrypted as the bytes after the payload
+    decInfo->cipher_pos = embedded_size_decode(decInfo);
+    Status1 res = decode_bytes_from_lsb(decInfo, (char *)bytes, CHECKSUM_BYTES);
+    decInfo->active_cipher = NULL;
+    uint32_t stored = ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3];
+    if (res == d_success && stored != decInfo->checksum)
     {
-        *dot = '\0';                                          // Remove the old extension
+        printf("Error: Checksum mismatch, %s is damaged!\n", decInfo->stego_image_fname);
+        return d_failure;
     }
+    return res;
+}
 
-    strcat(decInfo->output_fname, decInfo->extn_secret_file);  // Append the decoded extension to output filename
+// Function to prepare the payload region for tile-wise decoding
+Status1 start_secret_tiles_decode(DecodeInfo *decInfo)
+{
+    size_t total = decInfo->size_secret_file;
+    size_t embedded = embedded_size_decode(decInfo);          // Compressed payloads are extracted to memory first
 
-    decInfo->fptr_output_file = fopen(decInfo->output_fname, "wb");  // Create output file in binary write mode
-    if (decInfo->fptr_output_file == NULL)                    // Check if file creation failed
+    if (decInfo->preallocate && preallocate_output(decInfo, total) == d_failure)  // Reserve the whole file first
     {
-        printf("Error: Cannot create file %s\n", decInfo->output_fname);  // Print error message
-        return d_failure;                                     // Return failure
+        return d_failure;
     }
 
-    if (extn_size == strlen(decInfo->extn_secret_file))        // Verify decoded extension length matches expected
+    decInfo->payload_offset = decInfo->image_offset;           // Stego image is at the first payload byte
+    decInfo->payload_slot = decInfo->slot;
+    if (decInfo->use_mmap)
     {
-        return d_success;                                     // Return success if valid
+        if ((embedded > 0 && bmp_span_end(&decInfo->layout, decInfo->slot, lsb_cover_bytes(decInfo->bit_depth) * embedded) >
+                                 decInfo->stego_map.size) ||
+            map_file_write(decInfo->fptr_output_file, total, &decInfo->output_map) == e_failure)
+        {
+            return d_failure;                 // Return failure if image is too short or output cannot be mapped
+        }
     }
+    else
+    {
+        if (fflush(decInfo->fptr_output_file) != 0)
+        {
+            return d_failure;
+        }
+    }
+    if ((decInfo->format_word & FORMAT_FLAG_LZ) && (decInfo->packed = malloc(embedded ? embedded : 1)) == NULL)
+    {
+        return d_failure;                     // Return failure if the packed payload does not fit in memory
+    }
+    if ((decInfo->format_word & FORMAT_FLAG_CRC) && !decInfo->packed &&   // Compressed: checked block by block
+        (decInfo->tile_crc = calloc(tile_count(embedded, TILE_BYTES) + 1, sizeof(uint32_t))) == NULL)
+    {
+        return d_failure;
+    }
+    return d_success;
+}
+
+// Function to extract one tile: secret bytes [tile*TILE_BYTES, +TILE_BYTES)
+Status1 decode_secret_tile(DecodeInfo *decInfo, size_t tile, char *image_buf, char *data_buf, IoQueue *io)
+{
+    size_t total = embedded_size_decode(decInfo);
+    size_t start = tile * TILE_BYTES;
+    size_t count = total - start < TILE_BYTES ? total - start : TILE_BYTES;
+    size_t cover = lsb_cover_bytes(decInfo->bit_depth);        // Image bytes per secret byte
+    size_t slot = decInfo->payload_slot + cover * start;       // First slot of this tile
+    size_t pos = bmp_slot_offset(&decInfo->layout, slot);      // Image offset of this tile
+    size_t len = bmp_span_end(&decInfo->layout, slot, cover * count) - pos;
 
-    return d_failure;                                         // Return failure if mismatch
+    if (decInfo->packed)                                       // Compressed: extract into memory, unpacked at the end
+    {
+        data_buf = decInfo->packed + start;
+    }
+
+    if (decInfo->use_mmap)                                     // Mapped image straight into the mapped output
+    {
+        bmp_extract_keyed(&decInfo->layout, decInfo->stego_map.data, 0, slot,
+                          decInfo->packed ? data_buf : decInfo->output_map.data + start, count, decInfo->bit_depth,
+                          payload_cipher_decode(decInfo), start);
+        if (decInfo->tile_crc)
+        {
+            decInfo->tile_crc[tile] = crc32c_update(0, decInfo->output_map.data + start, count);
+        }
+        return d_success;
+    }
+
+    IoRequest in = { fileno(decInfo->fptr_stego_image), 0, image_buf, len, pos };
+    if (io_transfer(io, &in, 1) == e_failure)
+    {
+        return d_failure;                                      // Return failure if image is too short
+    }
+    bmp_extract_keyed(&decInfo->layout, image_buf, pos, slot, data_buf, count, decInfo->bit_depth,
+                      payload_cipher_decode(decInfo), start);
+    if (decInfo->packed)
+    {
+        return d_success;
+    }
+    if (decInfo->tile_crc)
+    {
+        decInfo->tile_crc[tile] = crc32c_update(0, data_buf, count);
+    }
+    IoRequest out = { fileno(decInfo->fptr_output_file), 1, data_buf, count, start };
+    if (io_transfer(io, &out, 1) == e_failure)
+    {
+        return d_failure;                                      // Return failure if write fails
+    }
+    return d_success;
 }
 
+// State shared by the workers decompressing an extracted payload
+typedef struct _UnpackTiles
+{
+    DecodeInfo *decInfo;
+    size_t *offsets;                          // Offset of every block header in decInfo->packed
+    uint32_t *crcs;                           // CRC32C of every decompressed block
+    char **out_buf;                           // Per worker: LZ_BLOCK decompressed bytes (stdio mode)
+    int failed;                               // Set by any worker that hits an error
+} UnpackTiles;
+
+// Tile runner callback: decompress one block into the output file
+static void unpack_tile(void *ctx, size_t block, int worker)
+{
+    UnpackTiles *tiles = ctx;
+    DecodeInfo *decInfo = tiles->decInfo;
+    size_t start = (size_t)block * LZ_BLOCK;
+    size_t count = decInfo->size_secret_file - start < LZ_BLOCK ? decInfo->size_secret_file - start : LZ_BLOCK;
+    const char *header = decInfo->packed + tiles->offsets[block];
+    char *out = decInfo->use_mmap ? decInfo->output_map.data + start : tiles->out_buf[worker];
+    int raw;
+
+    if (out == NULL && (out = tiles->out_buf[worker] = malloc(LZ_BLOCK)) == NULL)
+    {
+        tiles->failed = 1;
+        return;
+    }
+    size_t n = lz_block_size(header, &raw);
+    if (lz_decompress_block(header + LZ_HEADER, n, raw, out, count) == e_failure ||
+        (!decInfo->use_mmap && pwrite(fileno(decInfo->fptr_output_file), out, count, start) != (ssize_t)count))
+    {
+        tiles->failed = 1;                    // Corrupt block or write error
+        return;
+    }
+    tiles->crcs[block] = crc32c_update(0, out, count);
+}
 
-// Function to decode the size of the secret file (in bytes) from the stego image
-Status1 decode_secret_file_size(DecodeInfo *decInfo)
+// Function to decompress the extracted payload on decInfo->threads workers
+static Status1 unpack_payload(DecodeInfo *decInfo)
 {
-    char image_buffer[32];                                     // Buffer to store 32 bytes (32 bits for size)
-    size_t bytesRead;
+    size_t blocks = tile_count(decInfo->size_secret_file, LZ_BLOCK);
+    int threads = decInfo->threads > 1 ? decInfo->threads : 1;
+    UnpackTiles tiles = { decInfo, NULL, NULL, NULL, 0 };
+    size_t pos = 0;
 
-    bytesRead = fread(image_buffer, 1, 32, decInfo->fptr_stego_image);  // Read 32 bytes from stego image
-    if (bytesRead != 32)                                       // Verify if 32 bytes were successfully read
+    tiles.offsets = malloc((blocks ? blocks : 1) * sizeof(size_t));
+    tiles.crcs = calloc(blocks ? blocks : 1, sizeof(uint32_t));
+    tiles.out_buf = calloc(threads, sizeof(char *));
+    if (tiles.offsets == NULL || tiles.crcs == NULL || tiles.out_buf == NULL)
     {
-        return d_failure;                                      // Return failure if read error
+        tiles.failed = 1;
+    }
+    for (size_t b = 0; !tiles.failed && b < blocks; b++)     // Index the block headers
+    {
+        int raw;
+        if (decInfo->packed_size - pos < LZ_HEADER)
+        {
+            tiles.failed = 1;
+            break;
+        }
+        tiles.offsets[b] = pos;
+        size_t n = lz_block_size(decInfo->packed + pos, &raw);
+        if (n > decInfo->packed_size - pos - LZ_HEADER)
+        {
+            tiles.failed = 1;                 // Block runs past the payload
+            break;
+        }
+        pos += LZ_HEADER + n;
+    }
+    if (!tiles.failed && pos == decInfo->packed_size)
+    {
+        run_tiles(threads, blocks, unpack_tile, &tiles);
+    }
+    else
+    {
+        tiles.failed = 1;
     }
 
-    decInfo->size_secret_file = decode_size_from_lsb(image_buffer);  // Decode 4-byte integer (file size)
-    return d_success;                                          // Return success
+    for (int i = 0; tiles.out_buf && i < threads; i++)
+    {
+        free(tiles.out_buf[i]);
+    }
+    decInfo->checksum = 0;
+    for (size_t b = 0; !tiles.failed && b < blocks; b++)     // Blocks were checked in any order, joined in secret order
+    {
+        size_t start = b * LZ_BLOCK;
+        decInfo->checksum = crc32c_combine(decInfo->checksum, tiles.crcs[b],
+                                           decInfo->size_secret_file - start < LZ_BLOCK ? decInfo->size_secret_file - start : LZ_BLOCK);
+    }
+    free(tiles.out_buf);
+    free(tiles.offsets);
+    free(tiles.crcs);
+    free(decInfo->packed);
+    decInfo->packed = NULL;
+    return tiles.failed ? d_failure : d_success;
 }
 
-// Function to decode and write the secret file data into the output file
-Status1 decode_secret_file_data(DecodeInfo *decInfo)
+// Function to move past the payload region once all tiles are done
+Status1 end_secret_tiles_decode(DecodeInfo *decInfo)
 {
-    char image_buffer[8];                                      // Buffer to hold 8 bytes for one character
-    size_t bytesRead;
+    size_t slots = lsb_cover_bytes(decInfo->bit_depth) * embedded_size_decode(decInfo);
 
-    for (int i = 0; i < decInfo->size_secret_file; i++)        // Loop for the entire size of the secret file
+    decInfo->slot = decInfo->payload_slot + slots;
+    decInfo->image_offset = slots ? bmp_span_end(&decInfo->layout, decInfo->payload_slot, slots) : decInfo->payload_offset;
+    if (!decInfo->use_mmap && fseek(decInfo->fptr_stego_image, decInfo->image_offset, SEEK_SET) != 0)
+    {
+        return d_failure;
+    }
+    if (decInfo->packed && unpack_payload(decInfo) == d_failure)  // Compressed payload is complete in memory
+    {
+        return d_failure;
+    }
+    if (decInfo->tile_crc)                                     // Tiles were checked in any order, joined in secret order
     {
-        bytesRead = fread(image_buffer, 1, 8, decInfo->fptr_stego_image);  // Read 8 bytes for one character
-        if (bytesRead != 8)                                    // Check if read failed
+        size_t total = embedded_size_decode(decInfo);
+        decInfo->checksum = 0;
+        for (size_t t = 0, start = 0; start < total; t++, start += TILE_BYTES)
         {
-            return d_failure;                                  // Return failure if not 8 bytes read
+            decInfo->checksum = crc32c_combine(decInfo->checksum, decInfo->tile_crc[t],
+                                               total - start < TILE_BYTES ? total - start : TILE_BYTES);
         }
+    }
+    return decode_checksum(decInfo);
+}
+
+// State shared by the tile workers of a parallel decode
+typedef struct _DecodeTiles
+{
+    DecodeInfo *decInfo;
+    char **image_buf;                         // Per worker: TILE_IMAGE_BYTES image bytes (stdio mode)
+    char **data_buf;                          // Per worker: TILE_BYTES decoded bytes (stdio mode)
+    IoQueue **io;                             // Per worker: asynchronous I/O queue (stdio mode)
+    int failed;                               // Set by any worker that hits an error
+} DecodeTiles;
 
-        char ch = decode_byte_from_lsb(image_buffer);          // Decode one character from LSBs
+// Tile runner callback: extract one tile with the calling worker's buffers
+static void decode_tile(void *ctx, size_t tile, int worker)
+{
+    DecodeTiles *tiles = ctx;
 
-        if (fputc(ch, decInfo->fptr_output_file) == EOF)       // Write decoded character to output file
+    if (!tiles->decInfo->use_mmap && tiles->image_buf[worker] == NULL)  // Allocated on a worker's first tile
+    {
+        tiles->image_buf[worker] = malloc(TILE_IMAGE_BYTES);
+        tiles->data_buf[worker] = malloc(TILE_BYTES);
+        tiles->io[worker] = io_queue_create((IoBackend)tiles->decInfo->io_backend, tiles->decInfo->io_depth);  // NULL: pread/pwrite
+        if (tiles->image_buf[worker] == NULL || tiles->data_buf[worker] == NULL)
+        {
+            tiles->failed = 1;
+            return;
+        }
+    }
+    if (decode_secret_tile(tiles->decInfo, tile, tiles->image_buf[worker], tiles->data_buf[worker], tiles->io[worker]) == d_failure)
+    {
+        tiles->failed = 1;
+    }
+}
+
+// Function to decode the secret file data with decInfo->threads workers
+static Status1 decode_secret_file_data_parallel(DecodeInfo *decInfo)
+{
+    DecodeTiles tiles = { decInfo, NULL, NULL, NULL, 0 };
+
+    tiles.image_buf = calloc(decInfo->threads, sizeof(char *));
+    tiles.data_buf = calloc(decInfo->threads, sizeof(char *));
+    tiles.io = calloc(decInfo->threads, sizeof(IoQueue *));
+    if (tiles.image_buf == NULL || tiles.data_buf == NULL || tiles.io == NULL || start_secret_tiles_decode(decInfo) == d_failure)
+    {
+        tiles.failed = 1;
+    }
+    else
+    {
+        run_tiles(decInfo->threads, tile_count(embedded_size_decode(decInfo), TILE_BYTES), decode_tile, &tiles);
+    }
+
+    for (int i = 0; tiles.image_buf && tiles.data_buf && tiles.io && i < decInfo->threads; i++)
+    {
+        free(tiles.image_buf[i]);
+        free(tiles.data_buf[i]);
+        io_queue_destroy(tiles.io[i]);
+    }
+    free(tiles.image_buf);
+    free(tiles.data_buf);
+    free(tiles.io);
+    if (tiles.failed)
+    {
+        return d_failure;
+    }
+    return end_secret_tiles_decode(decInfo);
+}
+
+// Function to decode a compressed payload one block at a time into the output file
+static Status1 decode_packed_data(DecodeInfo *decInfo)
+{
+    char header[LZ_HEADER];                                    // Block header
+    size_t remaining = decInfo->size_secret_file, left = decInfo->packed_size, done = 0;
+    char *body = malloc(LZ_BLOCK_BOUND);                       // Stored block as extracted from the image
+    char *block = decInfo->use_mmap ? NULL : malloc(LZ_BLOCK); // Decompressed block (stdio mode)
+    Status1 res = body && (decInfo->use_mmap || block) ? d_success : d_failure;
+
+    if (res == d_success && decInfo->use_mmap &&
+        map_file_write(decInfo->fptr_output_file, remaining, &decInfo->output_map) == e_failure)
+    {
+        res = d_failure;                                       // Return failure if output cannot be mapped
+    }
+
+    while (res == d_success && remaining > 0)
+    {
+        size_t count = remaining < LZ_BLOCK ? remaining : LZ_BLOCK;
+        char *out = decInfo->use_mmap ? decInfo->output_map.data + done : block;
+        int raw;
+
+        if (left < LZ_HEADER || decode_bytes_from_lsb(decInfo, header, LZ_HEADER) == d_failure)
+        {
+            res = d_failure;
+            break;
+        }
+        size_t n = lz_block_size(header, &raw);
+        left -= LZ_HEADER;
+        if (n > left || n > LZ_BLOCK_BOUND - LZ_HEADER || decode_bytes_from_lsb(decInfo, body, n) == d_failure ||
+            lz_decompress_block(body, n, raw, out, count) == e_failure)
+        {
+            res = d_failure;                                   // Return failure if the block is corrupt
+            break;
+        }
+        decInfo->checksum = crc32c_update(decInfo->checksum, out, count);
+        left -= n;
+        if (!decInfo->use_mmap && fwrite(block, 1, count, decInfo->fptr_output_file) != count)
+        {
+            res = d_failure;                                   // Return failure if write fails
+        }
+        done += count;
+        remaining -= count;
+    }
+
+    free(body);
+    free(block);
+    return res == d_success && left == 0 ? d_success : d_failure;
+}
+
+// Function to move past n secret bytes without decoding them (their slots follow from the layout)
+static Status1 skip_decoded_bytes(DecodeInfo *decInfo, size_t n)
+{
+    int depth = decInfo->active_depth ? decInfo->active_depth : 1;
+
+    decInfo->slot += lsb_cover_bytes(depth) * n;
+    decInfo->cipher_pos += n;
+    decInfo->image_offset = bmp_slot_offset(&decInfo->layout, decInfo->slot);
+    if (!decInfo->use_mmap && fseek(decInfo->fptr_stego_image, decInfo->image_offset, SEEK_SET) != 0)
+    {
+        return d_failure;                                      // Return failure if the image cannot be positioned
+    }
+    return d_success;
+}
+
+// Function to write only secret bytes [start, start + count) of a compressed payload, earlier blocks are skipped
+static Status1 decode_packed_range(DecodeInfo *decInfo, size_t start, size_t count)
+{
+    char header[LZ_HEADER];                                    // Block header
+    size_t left = decInfo->packed_size, block_start = 0, end = start + count;
+    char *body = malloc(LZ_BLOCK_BOUND);                       // Stored block as extracted from the image
+    char *block = malloc(LZ_BLOCK);                            // Decompressed block
+    Status1 res = body && block ? d_success : d_failure;
+
+    while (res == d_success && block_start < end)
+    {
+        size_t total = decInfo->size_secret_file - block_start;
+        size_t raw_len = total < LZ_BLOCK ? total : LZ_BLOCK;  // Secret bytes of this block
+        int raw;
+
+        if (left < LZ_HEADER || decode_bytes_from_lsb(decInfo, header, LZ_HEADER) == d_failure)
+        {
+            res = d_failure;
+            break;
+        }
+        size_t n = lz_block_size(header, &raw);
+        left -= LZ_HEADER;
+        if (n > left || n > LZ_BLOCK_BOUND - LZ_HEADER)
+        {
+            res = d_failure;                                   // Return failure if the block is corrupt
+        }
+        else if (block_start + raw_len <= start)
+        {
+            res = skip_decoded_bytes(decInfo, n);              // Before the range: only the header is decoded
+        }
+        else
+        {
+            size_t from = start > block_start ? start - block_start : 0;
+            size_t to = end < block_start + raw_len ? end - block_start : raw_len;
+            if (decode_bytes_from_lsb(decInfo, body, n) == d_failure ||
+                lz_decompress_block(body, n, raw, block, raw_len) == e_failure ||
+                fwrite(block + from, 1, to - from, decInfo->fptr_output_file) != to - from)
+            {
+                res = d_failure;                               // Return failure if the block is corrupt or write fails
+            }
+        }
+        left -= n;
+        block_start += raw_len;
+    }
+
+    free(body);
+    free(block);
+    return res;
+}
+
+// Function to decode remaining secret bytes from the current position (no tiles, no compression)
+static Status1 decode_plain_data(DecodeInfo *decInfo, size_t remaining)
+{
+    if (decInfo->use_mmap)                                     // Extract straight into the mapped output file
+    {
+        if (map_file_write(decInfo->fptr_output_file, remaining, &decInfo->output_map) == e_failure)
+        {
+            return d_failure;                                  // Return failure if output cannot be mapped
+        }
+        for (size_t done = 0; done < remaining; done += DECODE_BLOCK)   // Checked a block at a time while in cache
+        {
+            size_t count = remaining - done < DECODE_BLOCK ? remaining - done : DECODE_BLOCK;
+            if (decode_bytes_from_lsb(decInfo, decInfo->output_map.data + done, count) == d_failure)
+            {
+                return d_failure;                              // Return failure if image is too short
+            }
+            decInfo->checksum = crc32c_update(decInfo->checksum, decInfo->output_map.data + done, count);
+        }
+        return d_success;
+    }
+
+    if (alloc_decode_buffers(decInfo) == d_failure)            // Reusable image window and output buffer
+    {
+        return d_failure;
+    }
+    setvbuf(decInfo->fptr_output_file, NULL, _IONBF, 0);      // Blocks go straight to write(), no extra copy
+
+    while (remaining > 0)                                      // Loop for the entire size of the secret file
+    {
+        size_t count = remaining < DECODE_BLOCK ? remaining : DECODE_BLOCK;  // Characters in this block
+        if (decode_bytes_from_lsb(decInfo, decInfo->out_buffer, count) == d_failure)  // Read and decode one window
+        {
+            return d_failure;                                  // Return failure if image is too short
+        }
+        decInfo->checksum = crc32c_update(decInfo->checksum, decInfo->out_buffer, count);
+
+        if (fwrite(decInfo->out_buffer, 1, count, decInfo->fptr_output_file) != count)  // Write decoded block to output file
         {
             return d_failure;                                  // Return failure if write fails
         }
+        remaining -= count;
     }
 
     return d_success;                                          // Return success after decoding all bytes
 }
 
-// Main function to coordinate the full decoding process
-Status1 do_decoding(DecodeInfo *decInfo)
+// Function to decode only the --range slice of the secret, the bytes before it are not decoded
+static Status1 decode_range(DecodeInfo *decInfo)
+{
+    size_t total = decInfo->size_secret_file;
+
+    if (decInfo->range_offset > total)
+    {
+        printf("Error: --range starts past the end of the %zu byte secret\n", total);
+        return d_failure;
+    }
+    size_t count = total - decInfo->range_offset < decInfo->range_length ? total - decInfo->range_offset
+                                                                          : decInfo->range_length;
+    if (decInfo->preallocate && preallocate_output(decInfo, count) == d_failure)
+    {
+        return d_failure;
+    }
+    if (decInfo->format_word & FORMAT_FLAG_LZ)                 // Blocks before the range are skipped by their headers
+    {
+        return decode_packed_range(decInfo, decInfo->range_offset, count);
+    }
+    if (skip_decoded_bytes(decInfo, decInfo->range_offset) == d_failure)  // Straight to the slot of the first byte
+    {
+        return d_failure;
+    }
+    return decode_plain_data(decInfo, count);
+}
+
+// Function to decode the secret file data (serial or tiles) and write it to the output file
+static Status1 decode_payload(DecodeInfo *decInfo)
+{
+    if (decInfo->range)                                        // Only a slice, always serial
+    {
+        return decode_range(decInfo);
+    }
+
+    if (decInfo->threads > 1)                                  // Independent tiles on a thread pool
+    {
+        return decode_secret_file_data_parallel(decInfo);
+    }
+
+    if (decInfo->preallocate && preallocate_output(decInfo, decInfo->size_secret_file) == d_failure)  // Reserve the whole file first
+    {
+        return d_failure;
+    }
+
+    if (decInfo->format_word & FORMAT_FLAG_LZ)                 // Streamed block by block through the decompressor
+    {
+        return decode_packed_data(decInfo);
+    }
+
+    return decode_plain_data(decInfo, decInfo->size_secret_file);
+}
+
+// Function to decode and write the secret file data into the output file
+Status1 decode_secret_file_data(DecodeInfo *decInfo)
+{
+    decInfo->active_cipher = payload_cipher_decode(decInfo);  // Serial path: decode_bytes_from_lsb() decrypts every chunk
+    decInfo->cipher_pos = 0;
+    decInfo->checksum = 0;
+    Status1 res = decode_payload(decInfo);
+    decInfo->active_cipher = NULL;
+    if (res == d_success && !decInfo->range && decInfo->threads <= 1)  // A slice cannot be checked; tiles check in end_secret_tiles_decode()
+    {
+        res = decode_checksum(decInfo);
+    }
+    return res;
+}
+
+// Function to open the stego image and decode everything that precedes the secret data
+Status1 begin_decoding(DecodeInfo *decInfo)
 {
     // Step 1: Open stego image file
+    stats_stage(decInfo->stats, stats_open_files);
     Status1 res = open_files_decode(decInfo);
     if (res == d_failure)
     {
@@ -224,82 +941,249 @@ Status1 do_decoding(DecodeInfo *decInfo)
         return d_failure;
     } 
 
-    // Step 2: Skip BMP header (first 54 bytes)
-    res = skip_bmp_header(decInfo->fptr_stego_image);
+    // Step 2: Parse the cover header and skip to the first payload byte
+    stats_stage(decInfo->stats, stats_bmp_header);
+    res = decInfo->use_mmap ? map_files_decode(decInfo) : d_success;
+    if (res == d_success)
+    {
+        res = skip_cover_header(decInfo);                      // Header is skipped by starting at the payload layout
+    }
     if (res == d_failure)
     {
-        printf("Error: skip_bmp_header is failure!\n");
+        printf("Error: skip_cover_header is failure!\n");
         return d_failure;  
     }
-    else
+    else if (!decInfo->quiet)
     {
-        printf("BMP header skipped successfully!\n");
+        printf("Image header skipped successfully!\n");
     }
 
     // Step 3: Decode and verify magic string
+    stats_stage(decInfo->stats, stats_header_fields);
     res = decode_magic_string(decInfo);
     if (res == d_failure)
     {
         printf("Error: Magic string does not match!\n");
         return d_failure;
     }
-    else
+    else if (!decInfo->quiet)
     {
         printf("Success: Magic string matched!\n");
     }
 
-    // Step 4: Decode size of the secret file extension
-    int extn_size = 0;
-    res = decode_secret_file_extn_size(decInfo, &extn_size);
-    if (res == d_failure)
+    // Step 3b: Extended format carries a format word (bit depth, flags)
+    if (decInfo->extended)
     {
-        printf("Error: decode_secret_file_extn_size failure!\n");
-        return d_failure;
+        res = decode_format_word(decInfo);
+        if (res == d_failure)
+        {
+            printf("Error: Invalid format word!\n");
+            return d_failure;
+        }
+        else if (!decInfo->quiet)
+        {
+            printf("Success: Format word decoded (%d bit depth)!\n", decInfo->bit_depth);
+        }
     }
-    else
+
+    // Step 3c: Scattered payload runs are read out of order, from the mapped image
+    if ((decInfo->format_word & FORMAT_FLAG_SCATTER) && !decInfo->use_mmap)
     {
-        printf("Success: decode_secret_file_extn_size!\n");
+        decInfo->use_mmap = 1;
+        size_t offset = decInfo->image_offset;
+        if (map_files_decode(decInfo) == d_failure)
+        {
+            return d_failure;
+        }
+        decInfo->image_offset = offset;                        // Same fields consumed, now through the mapping
     }
 
-    // Step 5: Decode actual secret file extension (e.g., .txt, .c)
-    res = decode_secret_file_extn(decInfo, extn_size);
+    // Steps 4-6: Decode the extension (e.g., .txt, .c), the secret file size, the packed size (-z) and nonce and key check (-K)
+    BmpFields fields;
+    res = decode_header_fields(decInfo, &fields);
     if (res == d_failure)
     {
-        printf("Error: decode_secret_file_extn failure!\n");
-        return d_failure;
+        return d_failure;                                      // The reason is printed by decode_header_fields()
     }
-    else
+    else if (!decInfo->quiet)
     {
-        printf("Success: decode_secret_file_extn!\n");
+        printf("Success: decode_header_fields (%s, %u bytes)!\n", decInfo->extn_secret_file, decInfo->size_secret_file);
     }
 
-    // Step 6: Decode the secret file size
-    res = decode_secret_file_size(decInfo);
-    if (res == d_failure)
+    // Step 6c: Encrypted payloads carry a nonce and a key check word
+    if (decInfo->format_word & FORMAT_FLAG_CHACHA)
+    {
+        res = decode_cipher_fields(decInfo, &fields);
+        if (res == d_failure)
+        {
+            if (decInfo->key_fname)
+            {
+                printf("Error: Wrong key or unreadable key file %s!\n", decInfo->key_fname);
+            }
+            else
+            {
+                printf("Error: Payload is encrypted, pass the key file with -K!\n");
+            }
+            return d_failure;
+        }
+        else if (!decInfo->quiet)
+        {
+            printf("Success: decode_cipher_fields!\n");
+        }
+    }
+    if (decInfo->format_word & FORMAT_FLAG_SCATTER)            // Payload and checksum lie in keyed runs from here on
+    {
+        if (bmp_layout_scatter(&decInfo->layout, decInfo->slot, &decInfo->cipher) == e_failure)
+        {
+            printf("Error: Corrupt header fields (scattered payload in too small an image)!\n");
+            return d_failure;
+        }
+    }
+
+    // Step 6d: The payload (and checksum) must lie inside the image
+    if (!bmp_fields_fit(&decInfo->layout, decInfo->slot, decInfo->format_word, &fields))
+    {
+        printf("Error: Secret size exceeds the image capacity!\n");
+        return d_failure;
+    }
+
+    // Step 6e: Every field checked, create the output file
+    return open_output_decode(decInfo);
+}
+
+// Function to decode a PNG stego image: only the rows holding the payload are inflated (png.h)
+static Status1 decode_png(DecodeInfo *decInfo)
+{
+    unsigned char key[CHACHA_KEY_BYTES];
+    StegPayloadInfo info;
+    BmpPayload found;
+    const char *error = NULL;
+
+    if (decInfo->key_fname && chacha_read_key(decInfo->key_fname, key) == e_failure)
+    {
+        printf("Error: Cannot read key file %s\n", decInfo->key_fname);
+        return d_failure;
+    }
+    stats_stage(decInfo->stats, stats_open_files);
+    if (open_files_decode(decInfo) == d_failure)
+    {
+        return d_failure;
+    }
+    stats_stage(decInfo->stats, stats_header_fields);
+    PngStream *png = png_decode_open(decInfo->fptr_stego_image, decInfo->key_fname ? key : NULL, &info, &found, &error);
+    memset(key, 0, sizeof(key));
+    if (png == NULL)
     {
-        printf("Error: decode_secret_file_size failure!\n");
+        printf("Error: %s: %s\n", decInfo->stego_image_fname, error ? error : "no hidden data");
+        close_files_decode(decInfo);
         return d_failure;
     }
+    decInfo->size_secret_file = (uint)info.payload_size;
+    decInfo->bit_depth = info.bit_depth;
+    decInfo->format_word = info.format_word;
+    strcpy(decInfo->extn_secret_file, info.extn);
+
+    Status res = e_failure;                                     // Output name with the stored extension, as for other covers
+    if (decode_output_path(decInfo->output_path, sizeof(decInfo->output_path), decInfo->output_fname, info.extn) == d_failure ||
+        (decInfo->fptr_output_file = fopen(decInfo->output_path, "wb")) == NULL)
+    {
+        printf("Error: Cannot create file %s\n", decInfo->output_path);
+    }
     else
     {
-        printf("Success: decode_secret_file_size!\n");
+        stats_stage(decInfo->stats, stats_payload);
+        res = png_decode_payload(png, decInfo->fptr_output_file, decInfo->range ? decInfo->range_offset : 0,
+                                 decInfo->range ? decInfo->range_length : SIZE_MAX, &error);
+        if (res == e_failure)
+        {
+            printf("Error: %s: %s\n", decInfo->stego_image_fname, error);
+        }
+        else if (!decInfo->quiet)
+        {
+            printf("Success: secret data decoded from the PNG image data!\n");
+        }
+    }
+    png_close(png);
+    stats_stage(decInfo->stats, stats_close_files);
+    if (res == e_failure)
+    {
+        abort_decoding(decInfo);                               // No damaged or partial output is left behind
+        return d_failure;
+    }
+    close_files_decode(decInfo);
+    return d_success;
+}
+
+// Main function to coordinate the full decoding process
+Status1 do_decoding(DecodeInfo *decInfo)
+{
+    if (png_file(decInfo->stego_image_fname))                  // Streamed through zlib, not the raw image paths
+    {
+        return decode_png(decInfo);
+    }
+
+    // Steps 1-6: Header, magic string, extension and size
+    Status1 res = begin_decoding(decInfo);
+    if (res == d_failure)
+    {
+        abort_decoding(decInfo);
+        return d_failure;
     }
 
     // Step 7: Decode the actual secret file data and write it to output
+    stats_stage(decInfo->stats, stats_payload);
     res = decode_secret_file_data(decInfo);
     if (res == d_failure)
     {
         printf("Error: decode_secret_file_data failure!\n");
+        abort_decoding(decInfo);                               // Damaged payload: the output file is removed
         return d_failure;
     }
-    else
+    else if (!decInfo->quiet)
     {
         printf("Success: decode_secret_file_data!\n");
     }
 
     // Step 8: Close all opened files
-    fclose(decInfo->fptr_stego_image);
-    fclose(decInfo->fptr_output_file);
+    return finish_decoding(decInfo);
+}
+
+// Function to finish a decode once the secret data is written
+Status1 finish_decoding(DecodeInfo *decInfo)
+{
+    stats_stage(decInfo->stats, stats_close_files);
+    close_files_decode(decInfo);
 
     return d_success;                                          // Return overall decoding success
 }
+
+// Function to release buffers and mappings and close all files
+void close_files_decode(DecodeInfo *decInfo)
+{
+    unmap_file(&decInfo->stego_map);
+    unmap_file(&decInfo->output_map);
+    free(decInfo->image_window);                               // Block decoder buffers
+    free(decInfo->out_buffer);
+    free(decInfo->packed);                                     // Extracted compressed payload
+    decInfo->packed = NULL;
+    free(decInfo->tile_crc);
+    decInfo->tile_crc = NULL;
+    decInfo->image_window = NULL;
+    decInfo->out_buffer = NULL;
+    if (decInfo->fptr_stego_image) fclose(decInfo->fptr_stego_image);
+    if (decInfo->fptr_output_file) fclose(decInfo->fptr_output_file);
+    decInfo->fptr_stego_image = NULL;
+    decInfo->fptr_output_file = NULL;
+}
+
+// Function to close all files after a failed decode and remove the output file if it was created
+void abort_decoding(DecodeInfo *decInfo)
+{
+    int created = decInfo->fptr_output_file != NULL;
+
+    close_files_decode(decInfo);
+    if (created)
+    {
+        remove(decInfo->output_path);                          // Never leave a partial or unchecked secret on disk
+    }
+}
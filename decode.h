@@ -2,9 +2,19 @@
 #define DECODE_H
 
 #include <stdio.h>          // Standard I/O functions
+#include <limits.h>         // PATH_MAX
 #include "types1.h"         // Custom type definitions (e.g., Status1)
 #include "types.h"          // Additional type definitions
 #include "common.h"         // Common macros and constants (e.g., MAGIC_STRING)
+#include "mapping.h"        // Memory mapped file views
+#include "stats.h"          // Per-stage timing (--stats)
+#include "bmp.h"            // Cover header and pixel row layout
+#include "chacha.h"         // Payload cipher (-K)
+#include "iobackend.h"      // Asynchronous tile I/O
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
 
 // Structure to hold all information required for decoding
 typedef struct _DecodeInfo
@@ -14,12 +24,58 @@ typedef struct _DecodeInfo
     FILE *fptr_stego_image;    // File pointer for stego image
 
     /* Output file details */
-    char *output_fname;        // Output file name
+    const char *output_fname;  // Output file name as given (never modified)
+    char output_path[PATH_MAX]; // File written: output_fname with the stored extension in place of its own
     FILE *fptr_output_file;    // File pointer for decoded output file
 
     /* Decoded data */
     char extn_secret_file[10]; // Buffer to hold decoded secret file extension (e.g., .txt, .c)
-    int size_secret_file;      // Size of the decoded secret file
+    uint size_secret_file;     // Size of the decoded secret file
+    uint packed_size;          // Size of the compressed payload (FORMAT_FLAG_LZ only)
+    char *packed;              // Extracted compressed payload (tile mode with FORMAT_FLAG_LZ)
+
+    /* Encryption */
+    const char *key_fname;     // Key file (-K), needed for FORMAT_FLAG_CHACHA payloads
+    ChaCha cipher;             // Key and the nonce stored in the image
+    const ChaCha *active_cipher; // Cipher of the bytes being decoded (payload only), NULL for header fields
+    size_t cipher_pos;         // Payload offset of the next byte decoded through active_cipher
+
+    /* Checksum */
+    uint32_t checksum;         // CRC32C of the secret bytes decoded so far
+    uint32_t *tile_crc;        // CRC32C of every tile of a plain payload (tile mode)
+
+    /* Memory mapped mode */
+    int use_mmap;              // Non zero to extract from a mapped image into a mapped output file
+    MappedFile stego_map;      // Mapped stego image
+    MappedFile output_map;     // Mapped output file (sized once the secret size is known)
+    size_t image_offset;       // Next image byte to be decoded
+
+    /* Block decoder */
+    char *image_window;        // Reusable buffer for DECODE_BLOCK * 8 image bytes
+    char *out_buffer;          // Reusable buffer for DECODE_BLOCK decoded bytes
+    int preallocate;           // Non zero to reserve the output file size before writing
+
+    int threads;               // Worker threads for the payload region (-j), 0 or 1 is serial
+    int io_backend;            // IoBackend of the tile transfers (--io)
+    int io_depth;              // Requests in flight per thread (--qd), 0 for the default
+    size_t payload_offset;     // Image offset of the first secret data byte (tile mode)
+    size_t payload_slot;       // Layout slot of the first secret data byte (tile mode)
+    int quiet;                 // Non zero to skip the per-stage success messages
+
+    /* Partial extraction (--range) */
+    int range;                 // Non zero to write only secret bytes [range_offset, range_offset + range_length)
+    size_t range_offset;       // First secret byte written
+    size_t range_length;       // Bytes requested (clipped at the end of the secret)
+
+    /* Stego format (read from the image) */
+    int extended;              // Non zero if MAGIC_STRING_EXT and a format word were found
+    uint format_word;          // Format word (bit depth | FORMAT_FLAG_* bits)
+    int bit_depth;             // LSBs per image byte after the format word
+    int active_depth;          // Depth of the field being decoded (header fields use 1)
+    BmpLayout layout;          // Image bytes that carry payload bits, found by skip_cover_header()
+    size_t slot;               // Next layout slot to be decoded
+
+    StegStats *stats;          // Per-stage timing and I/O counters, NULL when not requested
 } DecodeInfo;
 
 /* Function declarations */
@@ -30,13 +86,20 @@ Status1 read_and_validate_decode_file(char* argv[], DecodeInfo *decInfo);
 // Main driver function to perform full decoding
 Status1 do_decoding(DecodeInfo *decInfo);
 
+// Decoding in phases: everything before the secret data / close
+Status1 begin_decoding(DecodeInfo *decInfo);
+Status1 finish_decoding(DecodeInfo *decInfo);
+
 /* File handling functions */
 
 // Open the stego image file for decoding
 Status1 open_files_decode(DecodeInfo *decInfo);
 
-// Skip the BMP header (first 54 bytes)
-Status1 skip_bmp_header(FILE *fptr_stego_image);
+// Map the stego image for the memory mapped decode path
+Status1 map_files_decode(DecodeInfo *decInfo);
+
+// Parse the cover header and find the layout of the payload (positions the image at its first byte)
+Status1 skip_cover_header(DecodeInfo *decInfo);
 
 /* LSB decoding functions */
 
@@ -46,19 +109,52 @@ char decode_byte_from_lsb(char *image_buffer);
 // Decode a 32-bit integer (file size or extension size) from LSBs of 32 image bytes
 int decode_size_from_lsb(char *image_buffer);
 
+// Decode n bytes from the next n*lsb_cover_bytes(depth) image bytes (bulk, uses the block window when allocated)
+Status1 decode_bytes_from_lsb(DecodeInfo *decInfo, char *data, size_t n);
+
 // Verify magic string in stego image
 Status1 decode_magic_string(DecodeInfo *decInfo);
 
-// Decode the size of the secret file extension
-Status1 decode_secret_file_extn_size(DecodeInfo *decInfo, int *extn_size);
+// Decode the format word of the extended format and switch to its bit depth
+Status1 decode_format_word(DecodeInfo *decInfo);
+
+// Decode the extension, secret size, packed size (FORMAT_FLAG_LZ) and nonce and key check (FORMAT_FLAG_CHACHA)
+Status1 decode_header_fields(DecodeInfo *decInfo, BmpFields *fields);
+
+// Set up the cipher from the key file and the nonce, check the key (FORMAT_FLAG_CHACHA only)
+Status1 decode_cipher_fields(DecodeInfo *decInfo, const BmpFields *fields);
+
+// Create the output file with the decoded extension (after every header field and the key check have passed)
+Status1 open_output_decode(DecodeInfo *decInfo);
 
-// Decode the actual secret file extension and prepare output file
-Status1 decode_secret_file_extn(DecodeInfo *decInfo, int extn_size);
+// Extension of an output file name: from its last '.' after the last '/', NULL without one (dots in directory names do not count)
+const char *decode_output_extn(const char *fname);
 
-// Decode the size of the secret file
-Status1 decode_secret_file_size(DecodeInfo *decInfo);
+// Output path: output_fname with its extension replaced by extn (the decoded one), d_failure if it needs more than size bytes
+Status1 decode_output_path(char *path, size_t size, const char *output_fname, const char *extn);
+
+// Cipher of the payload, NULL when it was embedded in the clear
+const ChaCha *payload_cipher_decode(DecodeInfo *decInfo);
+
+// Bytes embedded after the header fields: the packed size for compressed payloads, else the secret size
+size_t embedded_size_decode(DecodeInfo *decInfo);
+
+// Read the CRC32C trailer after the payload and compare it with the decoded secret (FORMAT_FLAG_CRC only)
+Status1 decode_checksum(DecodeInfo *decInfo);
 
 // Decode secret file data and write to output file
 Status1 decode_secret_file_data(DecodeInfo *decInfo);
 
+// Tile-wise secret data decoding (secret byte i <- layout slots payload_slot + lsb_cover_bytes(depth)*i)
+// Compressed payloads are extracted into decInfo->packed and decompressed by end_secret_tiles_decode()
+Status1 start_secret_tiles_decode(DecodeInfo *decInfo);
+Status1 decode_secret_tile(DecodeInfo *decInfo, size_t tile, char *image_buf, char *data_buf, IoQueue *io);
+Status1 end_secret_tiles_decode(DecodeInfo *decInfo);
+
+// Release buffers and mappings and close all files
+void close_files_decode(DecodeInfo *decInfo);
+
+// Close all files after a failed decode and remove the partly written output file
+void abort_decoding(DecodeInfo *decInfo);
+
 #endif
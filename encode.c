@@ -2,35 +2,48 @@
 #include "encode.h"               // Include encoding function declarations and EncodeInfo
 #include "types.h"                // Include custom type definitions (e.g., Status)
 #include <string.h>               // Include string manipulation functions
+#include <limits.h>               // Include UINT_MAX (largest secret the size field can hold)
 #include "common.h"               // Include common macros (e.g., MAGIC_STRING)
-
-/* Get the image size for BMP */
-uint get_image_size_for_bmp(FILE *fptr_image)
+#include "lsb.h"                  // Include bulk LSB embed/extract kernels
+#include "bmp.h"                  // Include pixel row layout
+#include "cover.h"                // Include cover format parsers (BMP, PNM, TGA)
+#include "lz.h"                   // Include block compressor for -z
+#include "chacha.h"               // Include payload cipher for -K
+#include "parallel.h"             // Include tile runner for -j
+#include "iobackend.h"            // Include asynchronous tile I/O
+#include "reflink.h"              // Include cover clone for --clone
+#include "archive.h"              // Include archive payloads for -c
+#include "crc32c.h"               // Include payload checksum
+#include "png.h"                  // Include streaming PNG covers
+#include <sys/stat.h>             // Include fstat for the tail copy
+#include <stdlib.h>               // Include calloc/free for per-worker buffers
+#include <unistd.h>               // Include pread/pwrite for tile workers
+
+/* Get the image size of a cover (BMP, PNM or TGA) */
+size_t get_image_size_for_cover(FILE *fptr_image)
 {
-    uint width, height;                   // Variables to store width and height
-    fseek(fptr_image, 18, SEEK_SET);     // Move file pointer to byte 18 (width)
-    fread(&width, sizeof(int), 1, fptr_image); // Read width (4 bytes)
-    fread(&height, sizeof(int), 1, fptr_image); // Read height (4 bytes)
-    fseek(fptr_image, 0, SEEK_SET);      // Reset file pointer to beginning
-    return width * height * 3;           // Calculate total capacity (3 bytes per pixel)
+    BmpInfo bmp;                          // Parsed header (position of fptr_image is not moved)
+    BmpLayout layout;                     // Colour bytes of every row, padding skipped
+    if (cover_read_info(fptr_image, &bmp) == e_failure)
+        return 0;                         // Not a supported cover: no capacity
+    bmp_layout_rows(&bmp, 0, &layout);
+    return bmp_slots(&layout);            // Colour bytes per pixel, whatever the row stride
 }
 
 /* Get the size of a file in bytes */
-uint get_file_size(FILE *fptr)
+size_t get_file_size(FILE *fptr)
 {
-    char ch;                              // Variable to read each character
-    int count = 0;                         // Initialize counter
-    while ((ch = fgetc(fptr)) != EOF)     // Read each byte until EOF
-        count++;                           // Increment counter
+    fseek(fptr, 0, SEEK_END);             // Move to the end of the file
+    long count = ftell(fptr);             // Offset of the end is the size
     fseek(fptr, 0, SEEK_SET);             // Reset file pointer to beginning
-    return count;                          // Return total size
+    return count < 0 ? 0 : count;         // Return total size
 }
 
 /* Validate input and output file arguments */
 Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
 {
-    char* source = strrchr(argv[2], '.'); // Find last '.' in source image name
-    if (source == NULL || strcmp(source, ".bmp") != 0) // Check if extension is .bmp
+    int format = cover_name_format(argv[2]); // .bmp, .pgm/.ppm/.pnm, .tga or .png
+    if (format < 0)                        // Check if extension is a cover image
         return e_failure;                  // Return failure if invalid
     encInfo->src_image_fname = argv[2];   // Store source image file name
 
@@ -43,11 +56,10 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo)
     encInfo->secret_fname = argv[3];       // Store secret file name
 
     if (argv[4] == NULL)                   // Check if output file not provided
-        encInfo->stego_image_fname = "default.bmp"; // Use default stego file name
+        encInfo->stego_image_fname = (char *)cover_default_name(argv[2]); // Use default stego file name
     else
     {
-        char* des = strrchr(argv[4], '.'); // Find last '.' in output file name
-        if (des == NULL || strcmp(des, ".bmp") != 0) // Check if extension is .bmp
+        if (cover_name_format(argv[4]) != format) // Stego image keeps the cover's format
             return e_failure;              // Return failure if invalid
         encInfo->stego_image_fname = argv[4]; // Store output stego file name
     }
@@ -61,142 +73,638 @@ Status open_files(EncodeInfo *encInfo)
     encInfo->fptr_src_image = fopen(encInfo->src_image_fname, "rb"); // Open source image in binary read mode
     if (!encInfo->fptr_src_image) { perror("fopen"); return e_failure; } // Error check
 
-    encInfo->fptr_secret = fopen(encInfo->secret_fname, "r");       // Open secret file in read mode
-    if (!encInfo->fptr_secret) { perror("fopen"); return e_failure; } // Error check
+    if (encInfo->archive_count > 0)         // Many files: TOC and contents staged as one secret
+    {
+        encInfo->fptr_secret = archive_create(encInfo->archive_files, encInfo->archive_count);
+        if (!encInfo->fptr_secret) return e_failure;
+    }
+    else
+    {
+        encInfo->fptr_secret = fopen(encInfo->secret_fname, "rb");  // Open secret file in binary read mode
+        if (!encInfo->fptr_secret) { perror("fopen"); return e_failure; } // Error check
+    }
 
-    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname, "wb"); // Open stego file in write binary mode
+    if (encInfo->in_place)                  // The cover itself becomes the stego image
+        encInfo->stego_image_fname = encInfo->src_image_fname;
+    encInfo->fptr_stego_image = fopen(encInfo->stego_image_fname,
+                                      encInfo->in_place ? "r+b" : encInfo->use_mmap || encInfo->patch ? "w+b" : "wb"); // Open stego file
     if (!encInfo->fptr_stego_image) { perror("fopen"); return e_failure; } // Error check
 
+    if (encInfo->patch && !encInfo->in_place)   // Stego image starts as the cover, sharing its blocks where possible
+    {
+        if (clone_file(fileno(encInfo->fptr_src_image), fileno(encInfo->fptr_stego_image), &encInfo->clone_method) == e_failure)
+        { perror("clone"); return e_failure; }
+    }
+
+    if (encInfo->use_mmap)                  // Map all three files, stego image gets the size of the source
+    {
+        if (map_file_read(encInfo->fptr_src_image, &encInfo->src_map) == e_failure) return e_failure;
+        if (map_file_read(encInfo->fptr_secret, &encInfo->secret_map) == e_failure) return e_failure;
+        if (map_file_write(encInfo->fptr_stego_image, encInfo->src_map.size, &encInfo->stego_map) == e_failure) return e_failure;
+        encInfo->image_offset = 0;
+    }
+
     return e_success;                       // Return success if all files opened
 }
 
-/* Check if BMP has enough capacity for secret data */
+/* Format word stored after the magic string of the extended format */
+uint stego_format_word(EncodeInfo *encInfo)
+{
+    return (uint)encInfo->bit_depth | encInfo->format_flags;
+}
+
+/* Extended format (MAGIC_STRING_EXT + format word) is only used when some option needs it */
+int use_extended_format(EncodeInfo *encInfo)
+{
+    return stego_format_word(encInfo) != 1;  // Depth 1 without flags stays in the original format
+}
+
+/* Check if the cover has enough capacity for secret data */
 Status check_capacity(EncodeInfo *encInfo)
 {
-    encInfo->image_capacity = get_image_size_for_bmp(encInfo->fptr_src_image); // Get image capacity
-    encInfo->size_secret_file = get_file_size(encInfo->fptr_secret);           // Get secret file size
-    char *extn = strrchr(encInfo->secret_fname, '.');                           // Get secret file extension
+    bmp_layout_rows(&encInfo->bmp, encInfo->use_alpha, &encInfo->layout);      // Usable bytes of the pixel rows
+    encInfo->format_flags &= ~(FORMAT_FLAG_ROWS | FORMAT_FLAG_ALPHA);
+    if (!encInfo->layout.linear)                                                // Row padding or alpha bytes are skipped
+        encInfo->format_flags |= FORMAT_FLAG_ROWS;
+    if (encInfo->use_alpha && encInfo->bmp.bits_per_pixel == 32)                // Alpha bytes carry payload too
+        encInfo->format_flags |= FORMAT_FLAG_ALPHA;
+    encInfo->image_capacity = bmp_slots(&encInfo->layout);                      // Get image capacity
+    size_t secret_size = get_file_size(encInfo->fptr_secret);                  // Get secret file size from metadata
+    if (secret_size > UINT_MAX)                                                 // Size field is 32 bits wide
+        return e_failure;
+    encInfo->size_secret_file = secret_size;
+    const char *extn = encInfo->archive_count > 0 ? ARCHIVE_EXTN : strrchr(encInfo->secret_fname, '.');  // Get secret file extension
     strcpy(encInfo->extn_secret_file, extn);                                    // Store extension
 
-    uint total_required_bytes = 54 + ((encInfo->size_secret_file 
+    size_t header_bytes = strlen(MAGIC_STRING) + (use_extended_format(encInfo) ? 4 : 0); // Always 1 bit per image byte
+    size_t total_required_bytes = header_bytes * 8 +
+                                  (embedded_size(encInfo)   // Secret data (compressed with -z)
+                                      + ((encInfo->format_flags & FORMAT_FLAG_LZ) ? 4 : 0) // Packed size
+                                      + ((encInfo->format_flags & FORMAT_FLAG_CHACHA) ? CHACHA_NONCE_BYTES + 4 : 0) // Nonce, key check
+                                      + ((encInfo->format_flags & FORMAT_FLAG_CRC) ? CHECKSUM_BYTES : 0) // Checksum trailer
                                       + 4                   // Secret file size
                                       + strlen(encInfo->extn_secret_file) // Extension
-                                      + 4                   // Extension size
-                                      + strlen(MAGIC_STRING)) * 8); // Magic string in bits
+                                      + 4)                  // Extension size
+                                  * lsb_cover_bytes(encInfo->bit_depth); // Image bytes per data byte at this depth
 
     if (encInfo->image_capacity < total_required_bytes) // Check capacity
         return e_failure;                   // Return failure if insufficient
     return e_success;                        // Return success
 }
 
-/* Copy first 54-byte BMP header from source to stego image */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_stego_image)
+/* Bytes embedded after the header fields */
+size_t embedded_size(EncodeInfo *encInfo)
 {
-    unsigned char header[54];                // Buffer to store BMP header
-    size_t bytesRead = fread(header, 54, 1, fptr_src_image);  // Read header
-    size_t bytesWritten = fwrite(header, 54, 1, fptr_stego_image); // Write header
-    return (bytesWritten != bytesRead) ? e_failure : e_success; // Check success
+    return encInfo->packed ? encInfo->packed_size : encInfo->size_secret_file;
 }
 
-/* Encode a byte into LSBs of 8 image bytes */
-Status encode_byte_to_lsb(char data, char *image_buffer)
+/* State shared by the workers compressing the secret */
+typedef struct _CompressTiles
+{
+    EncodeInfo *encInfo;
+    char *blocks;                             // LZ_BLOCK_BOUND bytes reserved per block
+    size_t *sizes;                            // Stored size of every block
+    uint32_t *crcs;                           // CRC32C of every raw block
+    char **raw_buf;                           // Per worker: LZ_BLOCK secret bytes (stdio mode)
+    int failed;                               // Set by any worker that hits an error
+} CompressTiles;
+
+/* Tile runner callback: compress one LZ_BLOCK block of the secret */
+static void compress_tile(void *ctx, size_t block, int worker)
 {
-    for (int i = 0; i < 8; i++)            // Loop over 8 bits
+    CompressTiles *tiles = ctx;
+    EncodeInfo *encInfo = tiles->encInfo;
+    size_t start = block * LZ_BLOCK;
+    size_t count = encInfo->size_secret_file - start < LZ_BLOCK ? encInfo->size_secret_file - start : LZ_BLOCK;
+    const char *raw;
+
+    if (encInfo->use_mmap)
+        raw = encInfo->secret_map.data + start;
+    else
     {
-        int bit = (data >> (7 - i)) & 1;    // Extract i-th bit from data
-        int clear = image_buffer[i] & ~1;   // Clear LSB of image byte
-        clear |= bit;                        // Set LSB to data bit
-        image_buffer[i] = clear;             // Store modified byte back
+        if (tiles->raw_buf[worker] == NULL && (tiles->raw_buf[worker] = malloc(LZ_BLOCK)) == NULL)
+        {
+            tiles->failed = 1;
+            return;
+        }
+        if (pread(fileno(encInfo->fptr_secret), tiles->raw_buf[worker], count, start) != (ssize_t)count)
+        {
+            tiles->failed = 1;                // Secret shrank while encoding
+            return;
+        }
+        raw = tiles->raw_buf[worker];
+    }
+    tiles->crcs[block] = crc32c_update(0, raw, count);  // Checksum of the raw block while it is in cache
+    tiles->sizes[block] = lz_compress_block(raw, count, tiles->blocks + block * LZ_BLOCK_BOUND);
+}
+
+/* Compress the secret block by block on encInfo->threads workers */
+Status compress_secret(EncodeInfo *encInfo)
+{
+    size_t size = get_file_size(encInfo->fptr_secret);
+    size_t blocks = tile_count(size, LZ_BLOCK);
+    int threads = encInfo->threads > 1 ? encInfo->threads : 1;
+    CompressTiles tiles = { encInfo, NULL, NULL, NULL, NULL, 0 };
+    size_t packed = 0;
+
+    encInfo->format_flags &= ~FORMAT_FLAG_LZ;
+    if (size > UINT_MAX)                      // Size field is 32 bits wide
+        return e_failure;
+    encInfo->size_secret_file = size;
+
+    tiles.blocks = malloc(blocks ? blocks * LZ_BLOCK_BOUND : 1);
+    tiles.sizes = calloc(blocks ? blocks : 1, sizeof(size_t));
+    tiles.crcs = calloc(blocks ? blocks : 1, sizeof(uint32_t));
+    tiles.raw_buf = calloc(threads, sizeof(char *));
+    if (tiles.blocks == NULL || tiles.sizes == NULL || tiles.crcs == NULL || tiles.raw_buf == NULL)
+        tiles.failed = 1;
+    else
+        run_tiles(threads, blocks, compress_tile, &tiles);
+
+    encInfo->checksum = 0;
+    for (size_t b = 0; !tiles.failed && b < blocks; b++)   // Close the gaps between the blocks
+    {
+        memmove(tiles.blocks + packed, tiles.blocks + b * LZ_BLOCK_BOUND, tiles.sizes[b]);
+        packed += tiles.sizes[b];
+        encInfo->checksum = crc32c_combine(encInfo->checksum, tiles.crcs[b],
+                                           size - b * LZ_BLOCK < LZ_BLOCK ? size - b * LZ_BLOCK : LZ_BLOCK);
+    }
+    for (int i = 0; tiles.raw_buf && i < threads; i++)
+        free(tiles.raw_buf[i]);
+    free(tiles.raw_buf);
+    free(tiles.sizes);
+    free(tiles.crcs);
+
+    if (tiles.failed || packed >= size)       // Error, or nothing gained: embed the secret as it is
+    {
+        free(tiles.blocks);
+        return tiles.failed ? e_failure : e_success;
+    }
+    char *shrunk = realloc(tiles.blocks, packed);
+    encInfo->packed = shrunk ? shrunk : tiles.blocks;
+    encInfo->packed_size = packed;
+    encInfo->format_flags |= FORMAT_FLAG_LZ;
+    return e_success;
+}
+
+/* Copy the cover header (everything before the pixel array) from source to stego image */
+Status copy_cover_header(FILE *fptr_src_image, FILE *fptr_stego_image, size_t size)
+{
+    unsigned char header[1024];              // Buffer for the headers, palette and gap
+    while (size > 0)
+    {
+        size_t count = size < sizeof(header) ? size : sizeof(header);
+        if (fread(header, 1, count, fptr_src_image) != count) return e_failure;      // Read header
+        if (fwrite(header, 1, count, fptr_stego_image) != count) return e_failure;   // Write header
+        size -= count;
     }
     return e_success;                        // Return success
 }
 
+/* Encode a byte into LSBs of 8 image bytes */
+Status encode_byte_to_lsb(char data, char *image_buffer)
+{
+    lsb_embed_bytes(&data, 1, image_buffer);  // MSB goes to the first image byte
+    return e_success;                        // Return success
+}
+
 /* Encode 32-bit integer into LSBs of 32 bytes */
 Status encode_size_to_lsb(int size, char *image_buffer)
 {
-    for (int i = 0; i < 32; i++)           // Loop over 32 bits
+    char bytes[4];                           // Size in big endian order (MSB first)
+    for (int i = 0; i < 4; i++)
+        bytes[i] = (char)((unsigned int)size >> (24 - 8 * i));
+    lsb_embed_bytes(bytes, 4, image_buffer); // 4 bytes -> 32 image bytes
+    return e_success;
+}
+
+/* Copy len unchanged image bytes from the mapped source to the mapped stego image */
+Status copy_mapped_img_data(EncodeInfo *encInfo, size_t len)
+{
+    if (encInfo->image_offset + len > encInfo->src_map.size) return e_failure; // Image too short
+    if (!encInfo->patch)                                                       // Patch mode: already holds the cover
+        memcpy(encInfo->stego_map.data + encInfo->image_offset,
+               encInfo->src_map.data + encInfo->image_offset, len);           // Copy straight between mappings
+    encInfo->image_offset += len;
+    return e_success;
+}
+
+/* Block of the cover pipeline holding image offset, blocks before it are handed to the writer */
+static PipeBlock *cover_block_at(EncodeInfo *encInfo, size_t offset)
+{
+    PipeBlock *block = encInfo->cover_block;
+
+    while (block == NULL || offset >= block->offset + block->len)
+    {
+        if (block) pipeline_release(encInfo->cover_pipe, block);
+        block = encInfo->cover_block = pipeline_next(encInfo->cover_pipe);
+        if (block == NULL) return NULL;       // Image too short or a read failed
+    }
+    return block;
+}
+
+/* Embed n data bytes straight into the blocks of the cover pipeline */
+static Status encode_bytes_piped(const char *data, size_t n, int depth, EncodeInfo *encInfo)
+{
+    const BmpLayout *layout = &encInfo->layout;
+    size_t cover = lsb_cover_bytes(depth);
+
+    while (n > 0)
     {
-        int bit = (size >> (31 - i)) & 1;   // Extract i-th bit
-        int clear = image_buffer[i] & ~1;   // Clear LSB
-        clear |= bit;                        // Set LSB
-        image_buffer[i] = clear;             // Store back
+        PipeBlock *block = cover_block_at(encInfo, bmp_slot_offset(layout, encInfo->slot));
+        if (block == NULL) return e_failure;
+        size_t block_end = block->offset + block->len;
+
+        size_t lo = 0, hi = n;                // Most data bytes whose image bytes all lie in this block
+        while (lo < hi)
+        {
+            size_t mid = lo + (hi - lo + 1) / 2;
+            if (bmp_span_end(layout, encInfo->slot, cover * mid) <= block_end) lo = mid;
+            else hi = mid - 1;
+        }
+        size_t count = lo;
+
+        if (count > 0)
+            bmp_embed_keyed(layout, block->data, block->offset, encInfo->slot, data, count, depth,
+                            encInfo->active_cipher, encInfo->cipher_pos);
+        else                                  // One data byte straddles two blocks: embed via a copy of its bytes
+        {
+            char straddle[64];                // At most 8 slots plus a row gap
+            size_t first = bmp_slot_offset(layout, encInfo->slot);
+            size_t end = bmp_span_end(layout, encInfo->slot, cover);
+            PipeBlock *next = pipeline_next(encInfo->cover_pipe);   // Held together with block for a moment
+            if (next == NULL || end - block_end > next->len) return e_failure;
+
+            memcpy(straddle, block->data + (first - block->offset), block_end - first);
+            memcpy(straddle + (block_end - first), next->data, end - block_end);
+            bmp_embed_keyed(layout, straddle, first, encInfo->slot, data, 1, depth,
+                            encInfo->active_cipher, encInfo->cipher_pos);
+            memcpy(block->data + (first - block->offset), straddle, block_end - first);
+            memcpy(next->data, straddle + (block_end - first), end - block_end);
+            pipeline_release(encInfo->cover_pipe, block);
+            encInfo->cover_block = next;
+            count = 1;
+        }
+        encInfo->image_offset = bmp_span_end(layout, encInfo->slot, cover * count);
+        encInfo->slot += cover * count;
+        encInfo->cipher_pos += count;
+        data += count;
+        n -= count;
     }
     return e_success;
 }
 
-/* Encode magic string into image */
-Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
+/* Read the image bytes for n data bytes at the active depth, embed them in bulk and write them out */
+static Status encode_bytes(const char *data, size_t n, EncodeInfo *encInfo)
 {
-    char image_buffer[8];                    // Buffer for 8 bytes
-    size_t bytesRead, bytesWritten;
+    char image_buffer[LSB_CHUNK * 8];        // Image bytes for one chunk of data
+    int depth = encInfo->active_depth ? encInfo->active_depth : 1;  // Header fields use 1 bit
+    size_t cover = lsb_cover_bytes(depth);   // Image bytes per data byte
+    const BmpLayout *layout = &encInfo->layout;
+    size_t chunk = layout->linear ? LSB_CHUNK : LSB_CHUNK / 2;      // Row gaps add up to 1/3 more image bytes
 
-    for (int i = 0; magic_string[i] != '\0'; i++)  // Loop through string
+    if (n == 0)
+        return e_success;
+
+    if (encInfo->cover_pipe)                 // Embed in the blocks read ahead, the writer thread stores them
+        return encode_bytes_piped(data, n, depth, encInfo);
+
+    if (encInfo->use_mmap)                   // Embed directly in the mapped stego image
     {
-        bytesRead = fread(image_buffer, 8, 1, encInfo->fptr_src_image);   // Read 8 bytes
-        encode_byte_to_lsb(magic_string[i], image_buffer);                 // Encode char
-        bytesWritten = fwrite(image_buffer, 8, 1, encInfo->fptr_stego_image); // Write modified bytes
-        if (bytesWritten != bytesRead) return e_failure;                    // Check success
+        size_t end = bmp_span_end(layout, encInfo->slot, cover * n);
+        if (copy_mapped_img_data(encInfo, end - encInfo->image_offset) == e_failure) return e_failure; // Cover bytes first
+        bmp_embed_keyed(layout, encInfo->stego_map.data, 0, encInfo->slot, data, n, depth,
+                        encInfo->active_cipher, encInfo->cipher_pos);                   // Then the payload bits
+        encInfo->slot += cover * n;
+        encInfo->cipher_pos += n;
+        return e_success;
+    }
+
+    while (n > 0)
+    {
+        size_t count = n < chunk ? n : chunk;                                           // Bytes in this chunk
+        size_t len = bmp_span_end(layout, encInfo->slot, cover * count) - encInfo->image_offset;  // Including row gaps
+        if (fread(image_buffer, 1, len, encInfo->fptr_src_image) != len) return e_failure; // Read the image bytes
+        bmp_embed_keyed(layout, image_buffer, encInfo->image_offset, encInfo->slot, data, count, depth,
+                        encInfo->active_cipher, encInfo->cipher_pos);                  // Encode (and encrypt) the chunk
+        if (fwrite(image_buffer, 1, len, encInfo->fptr_stego_image) != len) return e_failure; // Write modified bytes
+        encInfo->image_offset += len;
+        encInfo->slot += cover * count;
+        encInfo->cipher_pos += count;
+        data += count;
+        n -= count;
     }
     return e_success;
 }
 
-/* Encode secret file extension size */
-Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
+/* Encode a 32-bit integer (MSB first) into the next 32 image bytes */
+static Status encode_size(int size, EncodeInfo *encInfo)
 {
-    char image_buffer[32];                   // Buffer for 32 bytes
-    size_t bytesRead, bytesWritten;
+    char bytes[4];                           // Size in big endian order
+    for (int i = 0; i < 4; i++)
+        bytes[i] = (char)((unsigned int)size >> (24 - 8 * i));
+    return encode_bytes(bytes, 4, encInfo);  // Same layout as encode_size_to_lsb()
+}
+
+/* Encode magic string into image */
+Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo)
+{
+    return encode_bytes(magic_string, strlen(magic_string), encInfo); // 8 image bytes per character
+}
 
-    bytesRead = fread(image_buffer, 32, 1, encInfo->fptr_src_image); // Read 32 bytes
-    encode_size_to_lsb(size, image_buffer);                           // Encode size
-    bytesWritten = fwrite(image_buffer, 32, 1, encInfo->fptr_stego_image); // Write modified bytes
-    if (bytesWritten != bytesRead) return e_failure;                  // Check success
+/* Encode the format word (1 bit per image byte) and switch to its bit depth */
+Status encode_format_word(uint word, EncodeInfo *encInfo)
+{
+    encInfo->active_depth = 1;
+    if (encode_size((int)word, encInfo) == e_failure) return e_failure;  // 32 image bytes
+    encInfo->active_depth = word & FORMAT_DEPTH_MASK;                    // Every later field uses the chosen depth
     return e_success;
 }
 
+/* Encode secret file extension size */
+Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo)
+{
+    return encode_size(size, encInfo);       // 32 image bytes
+}
+
 /* Encode secret file extension string */
 Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo)
 {
-    char image_buffer[8];                     // Buffer for 8 bytes
-    size_t bytesRead, bytesWritten;
+    return encode_bytes(file_extn, strlen(file_extn), encInfo); // 8 image bytes per character
+}
+
+/* Encode secret file size into 32 bytes of LSBs */
+Status encode_secret_file_size(int file_size, EncodeInfo *encInfo)
+{
+    return encode_size(file_size, encInfo);    // 32 image bytes
+}
+
+/* Encode the size of the compressed payload */
+Status encode_packed_size(int packed_size, EncodeInfo *encInfo)
+{
+    return encode_size(packed_size, encInfo);
+}
+
+/* Read the key file and draw a fresh nonce for this image */
+Status setup_cipher(EncodeInfo *encInfo)
+{
+    unsigned char key[CHACHA_KEY_BYTES];
+
+    if (chacha_read_key(encInfo->key_fname, key) == e_failure || chacha_random_nonce(encInfo->nonce) == e_failure)
+        return e_failure;
+    chacha_setup(&encInfo->cipher, key, encInfo->nonce);
+    memset(key, 0, sizeof(key));
+    encInfo->format_flags |= FORMAT_FLAG_CHACHA;
+    return e_success;
+}
 
-    for (int i = 0; file_extn[i] != '\0'; i++) // Loop through extension characters
+/* Encode the nonce and the key check word */
+Status encode_cipher_fields(EncodeInfo *encInfo)
+{
+    if (encode_bytes((const char *)encInfo->nonce, CHACHA_NONCE_BYTES, encInfo) == e_failure) return e_failure;
+    return encode_size((int)chacha_key_check(&encInfo->cipher), encInfo);
+}
+
+/* Cipher of the payload, NULL when it is embedded in the clear */
+const ChaCha *payload_cipher(EncodeInfo *encInfo)
+{
+    return (encInfo->format_flags & FORMAT_FLAG_CHACHA) ? &encInfo->cipher : NULL;
+}
+
+/* Encode the CRC32C of the secret right after the payload, encrypted as its next bytes */
+Status encode_checksum(EncodeInfo *encInfo)
+{
+    char bytes[CHECKSUM_BYTES];              // Big endian like the size fields
+
+    if (!(encInfo->format_flags & FORMAT_FLAG_CRC))
+        return e_success;
+    for (int i = 0; i < CHECKSUM_BYTES; i++)
+        bytes[i] = (char)(encInfo->checksum >> (24 - 8 * i));
+    encInfo->active_cipher = payload_cipher(encInfo);
+    encInfo->cipher_pos = embedded_size(encInfo);
+    Status res = encode_bytes(bytes, CHECKSUM_BYTES, encInfo);
+    encInfo->active_cipher = NULL;
+    return res;
+}
+
+/* Image offset just past the payload */
+static size_t payload_end(EncodeInfo *encInfo)
+{
+    if (embedded_size(encInfo) == 0)
+        return encInfo->payload_offset;
+    return bmp_span_end(&encInfo->layout, encInfo->payload_slot,
+                        lsb_cover_bytes(encInfo->bit_depth) * embedded_size(encInfo));
+}
+
+/* Prepare the payload region for tile-wise encoding */
+Status start_secret_tiles(EncodeInfo *encInfo)
+{
+    encInfo->payload_offset = encInfo->image_offset;        // Both files are at the first payload byte
+    encInfo->payload_slot = encInfo->slot;
+    if ((encInfo->format_flags & FORMAT_FLAG_CRC) && !encInfo->packed &&  // Compressed secrets were checked block by block
+        (encInfo->tile_crc = calloc(tile_count(embedded_size(encInfo), TILE_BYTES) + 1, sizeof(uint32_t))) == NULL)
+        return e_failure;
+    if (encInfo->use_mmap)
     {
-        bytesRead = fread(image_buffer, 8, 1, encInfo->fptr_src_image); // Read 8 bytes
-        encode_byte_to_lsb(file_extn[i], image_buffer);                  // Encode char
-        bytesWritten = fwrite(image_buffer, 8, 1, encInfo->fptr_stego_image); // Write modified bytes
-        if (bytesWritten != bytesRead) return e_failure;                 // Check success
+        if (payload_end(encInfo) > encInfo->src_map.size)
+            return e_failure;                               // Image too short
+        if (encInfo->layout.scatter_runs && !encInfo->patch)   // Scattered tiles share no window: copy the cover once
+            memcpy(encInfo->stego_map.data + encInfo->payload_offset, encInfo->src_map.data + encInfo->payload_offset,
+                   payload_end(encInfo) - encInfo->payload_offset);
+    }
+    else
+    {
+        if (fflush(encInfo->fptr_stego_image) != 0)         // Header fields must be on disk before pwrite
+            return e_failure;
     }
     return e_success;
 }
-/* Encode secret file size into 32 bytes of LSBs */
-Status encode_secret_file_size(int file_size, EncodeInfo *encInfo)
+
+/* Image bytes of one tile: its slots and the row gaps up to the next tile (the first tile starts at payload_offset) */
+static void tile_range(EncodeInfo *encInfo, size_t start, size_t count, size_t *lo, size_t *hi)
 {
-    char image_buffer[32];                     // Buffer for 32 bytes
-    size_t bytesRead, bytesWritten;
+    size_t cover = lsb_cover_bytes(encInfo->bit_depth);
+    size_t first = encInfo->payload_slot + cover * start;
 
-    bytesRead = fread(image_buffer, 32, 1, encInfo->fptr_src_image); // Read 32 bytes from source
-    encode_size_to_lsb(file_size, image_buffer);                      // Encode file size into LSBs
-    bytesWritten = fwrite(image_buffer, 32, 1, encInfo->fptr_stego_image); // Write modified bytes
-    if (bytesWritten != bytesRead) return e_failure;                  // Return failure if write mismatch
-    return e_success;                                                  // Return success
+    *lo = start == 0 ? encInfo->payload_offset : bmp_slot_offset(&encInfo->layout, first);
+    *hi = start + count == embedded_size(encInfo) ? bmp_span_end(&encInfo->layout, first, cover * count)
+                                                     : bmp_slot_offset(&encInfo->layout, first + cover * count);
 }
 
-/* Encode secret file data into image */
-Status encode_secret_file_data(EncodeInfo *encInfo)
+/* Embed one tile of the secret: payload bytes [tile*TILE_BYTES, +TILE_BYTES) */
+Status encode_secret_tile(EncodeInfo *encInfo, size_t tile, char *cover_buf, char *data_buf, IoQueue *io)
 {
-    char image_buffer[8];                     // Buffer for 8 bytes per secret character
-    size_t bytesRead, bytesWritten;
+    size_t total = embedded_size(encInfo);
+    size_t start = tile * TILE_BYTES;
+    size_t count = total - start < TILE_BYTES ? total - start : TILE_BYTES;
+    size_t slot = encInfo->payload_slot + lsb_cover_bytes(encInfo->bit_depth) * start;  // First slot of this tile
+    size_t lo, hi;                                          // Image offsets of this tile
+    const char *data = encInfo->packed ? encInfo->packed + start : data_buf;  // Compressed secret is in memory
+
+    tile_range(encInfo, start, count, &lo, &hi);
+    if (encInfo->use_mmap)                                  // Copy the cover window and embed in place
+    {
+        if (!encInfo->patch && !encInfo->layout.scatter_runs)
+            memcpy(encInfo->stego_map.data + lo, encInfo->src_map.data + lo, hi - lo);
+        if (!encInfo->packed) data = encInfo->secret_map.data + start;
+        if (encInfo->tile_crc) encInfo->tile_crc[tile] = crc32c_update(0, data, count);
+        bmp_embed_keyed(&encInfo->layout, encInfo->stego_map.data, 0, slot, data, count, encInfo->bit_depth,
+                        payload_cipher(encInfo), start);
+        return e_success;
+    }
+
+    IoRequest in[2] = { { fileno(encInfo->fptr_src_image), 0, cover_buf, hi - lo, lo },
+                        { fileno(encInfo->fptr_secret), 0, data_buf, count, start } };
+    if (io_transfer(io, in, encInfo->packed ? 1 : 2) == e_failure)  // Cover window and secret read together
+        return e_failure;                                   // Short secret or image
+    if (encInfo->tile_crc) encInfo->tile_crc[tile] = crc32c_update(0, data, count);
+    bmp_embed_keyed(&encInfo->layout, cover_buf, lo, slot, data, count, encInfo->bit_depth, payload_cipher(encInfo), start);
+    IoRequest out = { fileno(encInfo->fptr_stego_image), 1, cover_buf, hi - lo, lo };
+    return io_transfer(io, &out, 1);
+}
 
-    for (int i = 0; i < encInfo->size_secret_file; i++) // Loop through all secret bytes
+/* Move past the payload region once all tiles are done and append the checksum of their secret bytes */
+Status end_secret_tiles(EncodeInfo *encInfo)
+{
+    size_t end = payload_end(encInfo), total = embedded_size(encInfo);
+
+    encInfo->image_offset = end;
+    encInfo->slot = encInfo->payload_slot + lsb_cover_bytes(encInfo->bit_depth) * total;
+    if (encInfo->tile_crc)                                  // Tiles were checked in any order, joined in payload order
+    {
+        encInfo->checksum = 0;
+        for (size_t t = 0, start = 0; start < total; t++, start += TILE_BYTES)
+            encInfo->checksum = crc32c_combine(encInfo->checksum, encInfo->tile_crc[t],
+                                               total - start < TILE_BYTES ? total - start : TILE_BYTES);
+    }
+    if (!encInfo->use_mmap &&                               // Single threaded tail continues after the payload
+        (fseek(encInfo->fptr_src_image, end, SEEK_SET) != 0 || fseek(encInfo->fptr_stego_image, end, SEEK_SET) != 0))
+        return e_failure;
+    return encode_checksum(encInfo);
+}
+
+/* State shared by the tile workers of a parallel encode */
+typedef struct _EncodeTiles
+{
+    EncodeInfo *encInfo;
+    char **cover_buf;                         // Per worker: TILE_IMAGE_BYTES image bytes (stdio mode)
+    char **data_buf;                          // Per worker: TILE_BYTES secret bytes (stdio mode)
+    IoQueue **io;                             // Per worker: asynchronous I/O queue (stdio mode)
+    int failed;                               // Set by any worker that hits an error
+} EncodeTiles;
+
+/* Tile runner callback: embed one tile with the calling worker's buffers */
+static void encode_tile(void *ctx, size_t tile, int worker)
+{
+    EncodeTiles *tiles = ctx;
+
+    if (!tiles->encInfo->use_mmap && tiles->cover_buf[worker] == NULL)  // Allocated on a worker's first tile
     {
-        bytesRead = fread(image_buffer, 8, 1, encInfo->fptr_src_image);      // Read 8 bytes from image
-        encode_byte_to_lsb(encInfo->secret_data[i], image_buffer);           // Encode one secret byte
-        bytesWritten = fwrite(image_buffer, 8, 1, encInfo->fptr_stego_image); // Write modified bytes
-        if (bytesWritten != bytesRead) return e_failure;                      // Check for write error
+        tiles->cover_buf[worker] = malloc(TILE_IMAGE_BYTES);
+        tiles->data_buf[worker] = malloc(TILE_BYTES);
+        tiles->io[worker] = worker == 0 && tiles->encInfo->io ? NULL     // Worker 0 borrows the caller's queue
+                            : io_queue_create((IoBackend)tiles->encInfo->io_backend, tiles->encInfo->io_depth);
+        if (tiles->cover_buf[worker] == NULL || tiles->data_buf[worker] == NULL)
+        {
+            tiles->failed = 1;
+            return;
+        }
+    }
+    IoQueue *io = worker == 0 && tiles->encInfo->io ? tiles->encInfo->io : tiles->io[worker];
+    if (encode_secret_tile(tiles->encInfo, tile, tiles->cover_buf[worker], tiles->data_buf[worker], io) == e_failure)
+        tiles->failed = 1;
+}
+
+/* Encode secret file data with encInfo->threads workers, one tile at a time */
+static Status encode_secret_file_data_parallel(EncodeInfo *encInfo)
+{
+    EncodeTiles tiles = { encInfo, NULL, NULL, NULL, 0 };
+
+    tiles.cover_buf = calloc(encInfo->threads, sizeof(char *));
+    tiles.data_buf = calloc(encInfo->threads, sizeof(char *));
+    tiles.io = calloc(encInfo->threads, sizeof(IoQueue *));
+    if (tiles.cover_buf == NULL || tiles.data_buf == NULL || tiles.io == NULL || start_secret_tiles(encInfo) == e_failure)
+        tiles.failed = 1;
+    else
+        run_tiles(encInfo->threads, tile_count(embedded_size(encInfo), TILE_BYTES), encode_tile, &tiles);
+
+    for (int i = 0; tiles.cover_buf && tiles.data_buf && tiles.io && i < encInfo->threads; i++)
+    {
+        free(tiles.cover_buf[i]);
+        free(tiles.data_buf[i]);
+        io_queue_destroy(tiles.io[i]);
+    }
+    free(tiles.cover_buf);
+    free(tiles.data_buf);
+    free(tiles.io);
+    if (tiles.failed) return e_failure;
+    return end_secret_tiles(encInfo);
+}
+
+/* Encode secret file data into image, encrypted on the way if a key was given */
+static Status encode_payload(EncodeInfo *encInfo)
+{
+    char data[LSB_CHUNK];                     // One block of the secret file
+    size_t remaining = encInfo->size_secret_file;
+
+    if (encInfo->threads > 1)                 // Independent tiles on a thread pool
+        return encode_secret_file_data_parallel(encInfo);
+
+    if (encInfo->packed)                      // Compressed secret is already in memory
+        return encode_bytes(encInfo->packed, encInfo->packed_size, encInfo);
+
+    encInfo->checksum = 0;
+    if (encInfo->use_mmap)                    // Mapped secret is already addressable, checked a block at a time while in cache
+    {
+        for (size_t done = 0; done < remaining; done += TILE_BYTES)
+        {
+            size_t count = remaining - done < TILE_BYTES ? remaining - done : TILE_BYTES;
+            encInfo->checksum = crc32c_update(encInfo->checksum, encInfo->secret_map.data + done, count);
+            if (encode_bytes(encInfo->secret_map.data + done, count, encInfo) == e_failure) return e_failure;
+        }
+        return e_success;
+    }
+
+    Pipeline *secret = encInfo->cover_pipe ? pipeline_open(fileno(encInfo->fptr_secret), 0, -1) : NULL;
+    if (secret)                               // Secret read ahead as well, block by block
+    {
+        Status res = e_success;
+        PipeBlock *block;
+        while (res == e_success && remaining > 0 && (block = pipeline_next(secret)) != NULL)
+        {
+            size_t count = block->len < remaining ? block->len : remaining;
+            encInfo->checksum = crc32c_update(encInfo->checksum, block->data, count);
+            res = encode_bytes(block->data, count, encInfo);
+            remaining -= count;
+            pipeline_release(secret, block);
+        }
+        if (pipeline_close(secret, 0) == e_failure || remaining > 0) res = e_failure;  // Secret shrank while encoding
+        return res;
+    }
+
+    while (remaining > 0)                     // Stream the secret block by block
+    {
+        size_t count = remaining < LSB_CHUNK ? remaining : LSB_CHUNK;
+        if (fread(data, 1, count, encInfo->fptr_secret) != count) return e_failure; // Secret shrank while encoding
+        encInfo->checksum = crc32c_update(encInfo->checksum, data, count);
+        if (encode_bytes(data, count, encInfo) == e_failure) return e_failure;      // Embed into the matching image window
+        remaining -= count;
     }
     return e_success;                                                         // Return success
 }
 
+/* Encode secret file data into image */
+Status encode_secret_file_data(EncodeInfo *encInfo)
+{
+    encInfo->active_cipher = payload_cipher(encInfo);    // Serial path: encode_bytes() encrypts every chunk
+    encInfo->cipher_pos = 0;
+    Status res = encode_payload(encInfo);
+    encInfo->active_cipher = NULL;
+    if (res == e_success && encInfo->threads <= 1)      // Tile mode appends it in end_secret_tiles()
+        res = encode_checksum(encInfo);
+    return res;
+}
+
 /* Copy remaining image data after encoding */
 Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
 {
@@ -211,49 +719,252 @@ Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest)
     return e_success;                                                     // Return success
 }
 
-/* Main encoding driver function */
-Status do_encoding(EncodeInfo *encInfo)
+/* Copy the image bytes after the payload through encInfo->io: the next block is read while the last one is written */
+static Status copy_remaining_io(EncodeInfo *encInfo)
+{
+    int in = fileno(encInfo->fptr_src_image), out = fileno(encInfo->fptr_stego_image);
+    struct stat st;
+    char *buf[2] = { malloc(COPY_BLOCK), malloc(COPY_BLOCK) };
+    size_t offset = encInfo->image_offset, prev_offset = 0, prev_len = 0;
+    Status res = buf[0] && buf[1] && fstat(in, &st) == 0 ? e_success : e_failure;
+
+    for (int k = 0; res == e_success && (offset < (size_t)st.st_size || prev_len > 0); k ^= 1)
+    {
+        IoRequest reqs[2];
+        int n = 0;
+        size_t len = (size_t)st.st_size - offset < COPY_BLOCK ? (size_t)st.st_size - offset : COPY_BLOCK;
+        if (prev_len > 0)
+            reqs[n++] = (IoRequest){ out, 1, buf[k ^ 1], prev_len, prev_offset };
+        if (len > 0)
+            reqs[n++] = (IoRequest){ in, 0, buf[k], len, offset };
+        res = io_transfer(encInfo->io, reqs, n);
+        prev_offset = offset;
+        prev_len = len;
+        offset += len;
+    }
+    free(buf[0]);
+    free(buf[1]);
+    return res;
+}
+
+/* Release mappings and close all files */
+void close_files(EncodeInfo *encInfo)
+{
+    if (encInfo->cover_pipe)                                              // Failed encode: stop the threads first
+        pipeline_close(encInfo->cover_pipe, 0);
+    encInfo->cover_pipe = NULL;
+    encInfo->cover_block = NULL;
+    unmap_file(&encInfo->src_map);                                        // Drop the mappings first
+    unmap_file(&encInfo->secret_map);
+    unmap_file(&encInfo->stego_map);
+    free(encInfo->packed);                                                // Compressed secret (-z)
+    encInfo->packed = NULL;
+    free(encInfo->tile_crc);
+    encInfo->tile_crc = NULL;
+
+    if (encInfo->fptr_src_image) fclose(encInfo->fptr_src_image);         // Close source image
+    if (encInfo->fptr_secret) fclose(encInfo->fptr_secret);               // Close secret file
+    if (encInfo->fptr_stego_image) fclose(encInfo->fptr_stego_image);     // Close stego image
+    encInfo->fptr_src_image = encInfo->fptr_secret = encInfo->fptr_stego_image = NULL;
+}
+
+/* Open files, check capacity and write everything that precedes the secret data */
+Status begin_encoding(EncodeInfo *encInfo)
 {
+    if (encInfo->bit_depth < 1) encInfo->bit_depth = 1; // Original format: 1 bit per image byte
+    if (encInfo->in_place) encInfo->patch = 1;          // Only the payload span of the cover is rewritten
+    if (encInfo->scatter) encInfo->use_mmap = 1;        // Scattered runs are written out of order: whole mapped images
+    encInfo->active_depth = 1;                          // Magic string (and format word) use 1 bit
+    if (encInfo->scatter && encInfo->key_fname == NULL) { printf("Error: --scatter needs a key file (-K)!\n"); return e_failure; }
+
+    stats_stage(encInfo->stats, stats_open_files);
     Status res = open_files(encInfo);                // Open all necessary files
     if (res == e_failure) { printf("Error: File does not exist!\n"); return e_failure; }
 
+    stats_stage(encInfo->stats, stats_check_capacity);
+    res = cover_read_info(encInfo->fptr_src_image, &encInfo->bmp); // Headers, row stride and pixel format
+    if (res == e_failure) { printf("Error: Unsupported cover image (uncompressed 24/32-bit BMP or TGA, 8-bit grey TGA, binary PGM/PPM)!\n"); return e_failure; }
+
+    if (encInfo->use_crc)                           // CRC32C trailer only with --crc
+        encInfo->format_flags |= FORMAT_FLAG_CRC;
+    else
+        encInfo->format_flags &= ~FORMAT_FLAG_CRC;
+    if (encInfo->scatter)                           // Keyed run order, set up once the cipher is
+        encInfo->format_flags |= FORMAT_FLAG_SCATTER;
+    else
+        encInfo->format_flags &= ~FORMAT_FLAG_SCATTER;
+    if (encInfo->compress)                          // Capacity is checked against the compressed size
+    {
+        stats_stage(encInfo->stats, stats_compress);
+        res = compress_secret(encInfo);
+        if (res == e_failure) { printf("Error: Failed to compress secret file!\n"); return e_failure; }
+        else if (!encInfo->quiet) printf("Secret file compressed: %zu of %u bytes.\n", embedded_size(encInfo), encInfo->size_secret_file);
+        stats_stage(encInfo->stats, stats_check_capacity);
+    }
+    if (encInfo->key_fname)                         // Nonce and key check are part of the header
+    {
+        res = setup_cipher(encInfo);
+        if (res == e_failure) { printf("Error: Cannot read key file %s (32 bytes or 64 hex digits)!\n", encInfo->key_fname); return e_failure; }
+    }
     res = check_capacity(encInfo);                  // Verify image can hold secret
     if (res == e_failure) { printf("Error: Image file size should be greater than the secret file size!\n"); return e_failure; }
 
-    res = copy_bmp_header(encInfo->fptr_src_image, encInfo->fptr_stego_image); // Copy BMP header
+    stats_stage(encInfo->stats, stats_bmp_header);
+    if (encInfo->patch && !encInfo->use_mmap)                                   // Header is already in the stego image
+        res = fseek(encInfo->fptr_src_image, encInfo->bmp.data_offset, SEEK_SET) == 0 &&
+              fseek(encInfo->fptr_stego_image, encInfo->bmp.data_offset, SEEK_SET) == 0 ? e_success : e_failure;
+    else if (encInfo->use_mmap)
+        res = copy_mapped_img_data(encInfo, encInfo->bmp.data_offset);          // Copy cover header between mappings
+    else if (encInfo->pipelined &&
+             (encInfo->cover_pipe = pipeline_open(fileno(encInfo->fptr_src_image), 0, fileno(encInfo->fptr_stego_image))))
+        res = e_success;                                                        // Header passes through the pipeline unchanged
+    else
+        res = copy_cover_header(encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo->bmp.data_offset); // Copy cover header
+    encInfo->image_offset = encInfo->bmp.data_offset;                           // Pixel array: slot 0 of the layout
+    encInfo->slot = 0;
     if (res == e_failure) { printf("Error: Header file does not store in output image file!\n"); return e_failure; }
-    else printf("Header file stored successfully!\n");
+    else if (!encInfo->quiet && encInfo->in_place) printf("Embedding into %s in place.\n", encInfo->src_image_fname);
+    else if (!encInfo->quiet && encInfo->patch) printf("Cover cloned to the stego image (%s).\n", clone_method_name(encInfo->clone_method));
+    else if (!encInfo->quiet) printf("Header file stored successfully!\n");
 
-    res = encode_magic_string(MAGIC_STRING, encInfo); // Encode magic string
+    stats_stage(encInfo->stats, stats_header_fields);
+    res = encode_magic_string(use_extended_format(encInfo) ? MAGIC_STRING_EXT : MAGIC_STRING, encInfo); // Encode magic string
     if (res == e_failure) { printf("Error: Failed to encode magic string!\n"); return e_failure; }
-    else printf("Magic string encoded successfully.\n");
+    else if (!encInfo->quiet) printf("Magic string encoded successfully.\n");
+
+    if (use_extended_format(encInfo))               // Bit depth and feature flags
+    {
+        res = encode_format_word(stego_format_word(encInfo), encInfo);
+        if (res == e_failure) { printf("Error: Failed to encode format word!\n"); return e_failure; }
+        else if (!encInfo->quiet) printf("Format word encoded successfully.\n");
+    }
 
     res = encode_secret_file_extn_size(strlen(encInfo->extn_secret_file), encInfo); // Encode extension size
     if (res == e_failure) { printf("Error: Failed to encode secret file extn size!\n"); return e_failure; }
-    else printf("Secret file extn size encoded successfully.\n");
+    else if (!encInfo->quiet) printf("Secret file extn size encoded successfully.\n");
 
     res = encode_secret_file_extn(encInfo->extn_secret_file, encInfo); // Encode extension string
     if (res == e_failure) { printf("Error: Failed to encode secret file extn!\n"); return e_failure; }
-    else printf("Secret file extn encoded successfully.\n");
+    else if (!encInfo->quiet) printf("Secret file extn encoded successfully.\n");
 
     res = encode_secret_file_size(encInfo->size_secret_file, encInfo); // Encode secret file size
     if (res == e_failure) { printf("Error: Failed to encode secret file size!\n"); return e_failure; }
-    else printf("Secret file size encoded successfully.\n");
+    else if (!encInfo->quiet) printf("Secret file size encoded successfully.\n");
 
-    fread(encInfo->secret_data, encInfo->size_secret_file, 1, encInfo->fptr_secret); // Read secret data into memory
-    fseek(encInfo->fptr_secret, 0, SEEK_SET);                                         // Reset secret file pointer
+    if (encInfo->format_flags & FORMAT_FLAG_LZ)     // Bytes actually embedded
+    {
+        res = encode_packed_size(encInfo->packed_size, encInfo);
+        if (res == e_failure) { printf("Error: Failed to encode packed size!\n"); return e_failure; }
+        else if (!encInfo->quiet) printf("Packed size encoded successfully.\n");
+    }
 
-    res = encode_secret_file_data(encInfo); // Encode secret file data
-    if (res == e_failure) { printf("Error: Failed to encode secret file data!\n"); return e_failure; }
-    else printf("Secret file data encoded successfully.\n");
+    if (encInfo->format_flags & FORMAT_FLAG_CHACHA) // Everything after this is encrypted
+    {
+        res = encode_cipher_fields(encInfo);
+        if (res == e_failure) { printf("Error: Failed to encode nonce!\n"); return e_failure; }
+        else if (!encInfo->quiet) printf("Nonce and key check encoded successfully.\n");
+    }
+    if ((encInfo->format_flags & FORMAT_FLAG_SCATTER) && // Payload and checksum go to keyed runs from here on
+        bmp_layout_scatter(&encInfo->layout, encInfo->slot, &encInfo->cipher) == e_failure)
+    {
+        printf("Error: Cover too small to scatter the payload (--scatter)!\n");
+        return e_failure;
+    }
 
-    res = copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image); // Copy remaining image bytes
+    return e_success;
+}
+
+/* Copy the image bytes after the secret data and close everything */
+Status finish_encoding(EncodeInfo *encInfo)
+{
+    Status res;
+
+    stats_stage(encInfo->stats, stats_copy_remaining);
+    if (encInfo->patch)
+        res = e_success;                                                  // Bytes after the payload are the cover's already
+    else if (encInfo->use_mmap)
+        res = copy_mapped_img_data(encInfo, encInfo->src_map.size - encInfo->image_offset); // Rest of the mapped image
+    else if (encInfo->cover_pipe)
+    {
+        res = pipeline_close(encInfo->cover_pipe, 1);                    // Rest of the image streams through, then all is written
+        encInfo->cover_pipe = NULL;
+        encInfo->cover_block = NULL;
+    }
+    else if (encInfo->io)
+        res = copy_remaining_io(encInfo);                                 // Tile mode: large overlapped transfers
+    else
+        res = copy_remaining_img_data(encInfo->fptr_src_image, encInfo->fptr_stego_image); // Copy remaining image bytes
     if (res == e_failure) { printf("Error: Failed to encode remaining image data!\n"); return e_failure; }
-    else printf("Remaining image data encoded successfully.\n");
+    else if (!encInfo->quiet && encInfo->patch) printf("Remaining image data left in place.\n");
+    else if (!encInfo->quiet) printf("Remaining image data encoded successfully.\n");
 
-    if (encInfo->fptr_src_image) fclose(encInfo->fptr_src_image);         // Close source image
-    if (encInfo->fptr_secret) fclose(encInfo->fptr_secret);               // Close secret file
-    if (encInfo->fptr_stego_image) fclose(encInfo->fptr_stego_image);     // Close stego image
+    stats_stage(encInfo->stats, stats_close_files);
+    close_files(encInfo);                                                 // Unmap and close everything
 
     return e_success;                                                     // Return success after all steps
 }
+
+/* All encoding stages */
+static Status encode_stages(EncodeInfo *encInfo)
+{
+    Status res = begin_encoding(encInfo);           // Everything up to the secret file size
+    if (res == e_failure) return e_failure;
+
+    stats_stage(encInfo->stats, stats_payload);
+    res = encode_secret_file_data(encInfo); // Encode secret file data
+    if (res == e_failure) { printf("Error: Failed to encode secret file data!\n"); return e_failure; }
+    else if (!encInfo->quiet) printf("Secret file data encoded successfully.\n");
+
+    return finish_encoding(encInfo);                // Remaining image data, close files
+}
+
+/* PNG cover: the secret is embedded while the image data is re-encoded row by row (png.h) */
+static Status encode_png(EncodeInfo *encInfo)
+{
+    unsigned char key[CHACHA_KEY_BYTES];
+    const char *error = NULL;
+
+    if (encInfo->patch || encInfo->in_place || encInfo->scatter)    // The stego image is a new zlib stream
+    { printf("Error: --clone, --inplace and --scatter do not apply to PNG covers!\n"); return e_failure; }
+    if (encInfo->key_fname && chacha_read_key(encInfo->key_fname, key) == e_failure)
+    { printf("Error: Cannot read key file %s!\n", encInfo->key_fname); return e_failure; }
+    encInfo->use_mmap = 0;                                          // Cover and stego image are streamed
+    stats_stage(encInfo->stats, stats_open_files);
+    if (open_files(encInfo) == e_failure || map_file_read(encInfo->fptr_secret, &encInfo->secret_map) == e_failure)
+    { printf("Error: File does not exist!\n"); close_files(encInfo); return e_failure; }
+    if (encInfo->secret_map.size > UINT_MAX)                        // Size field is 32 bits wide
+    { printf("Error: Secret file is 4 GB or larger!\n"); close_files(encInfo); return e_failure; }
+
+    const char *extn = encInfo->archive_count > 0 ? ARCHIVE_EXTN : strrchr(encInfo->secret_fname, '.');
+    StegParams params = {encInfo->bit_depth < 1 ? 1 : encInfo->bit_depth, encInfo->use_alpha, encInfo->compress,
+                         encInfo->key_fname ? key : NULL, extn, encInfo->use_crc, 0};
+    encInfo->size_secret_file = (uint)encInfo->secret_map.size;
+    encInfo->bit_depth = params.bit_depth;
+    strcpy(encInfo->extn_secret_file, extn);
+    stats_stage(encInfo->stats, stats_payload);
+    Status res = png_encode(encInfo->fptr_src_image, encInfo->fptr_stego_image, encInfo->secret_map.data,
+                            encInfo->secret_map.size, &params, &error);
+    memset(key, 0, sizeof(key));
+    if (res == e_failure) printf("Error: PNG cover: %s!\n", error);
+    else if (!encInfo->quiet) printf("Secret file embedded into the PNG image data.\n");
+
+    stats_stage(encInfo->stats, stats_close_files);
+    close_files(encInfo);
+    return res;
+}
+
+/* Main encoding driver function */
+Status do_encoding(EncodeInfo *encInfo)
+{
+    if (png_file(encInfo->src_image_fname))          // Streamed through zlib: none of the raw image paths apply
+        return encode_png(encInfo);
+    encInfo->pipelined = !encInfo->use_mmap && encInfo->threads <= 1 && !encInfo->no_pipeline  // Overlap read, embed and write
+                         && !encInfo->patch && !encInfo->in_place && !encInfo->scatter;           // (patches are small: plain stdio)
+    if (!encInfo->use_mmap && !encInfo->scatter && encInfo->threads > 1)  // Tile mode: the calling thread's queue (also worker 0)
+        encInfo->io = io_queue_create((IoBackend)encInfo->io_backend, encInfo->io_depth);
+
+    Status res = encode_stages(encInfo);
+    io_queue_destroy(encInfo->io);
+    encInfo->io = NULL;
+    return res;
+}
@@ -1,8 +1,16 @@
 #ifndef ENCODE_H
 #define ENCODE_H
 #include <stdio.h>
+#include <stdint.h> // uint32_t
 
 #include "types.h" // Contains user defined types
+#include "mapping.h" // Memory mapped file views
+#include "stats.h" // Per-stage timing (--stats)
+#include "bmp.h" // Cover header and pixel row layout
+#include "chacha.h" // Payload cipher (-K)
+#include "pipeline.h" // Read-ahead / write-behind of the stdio path
+#include "iobackend.h" // Asynchronous tile I/O
+#include "reflink.h" // Cover clone of the patch-only output
 
 /*
  * Structure to store information required for
@@ -16,19 +24,70 @@ typedef struct _EncodeInfo
     /* Source Image info */
     char *src_image_fname; // To store the src image name
     FILE *fptr_src_image;  // To store the address of the src image
-    uint image_capacity;   // To store the size of image
+    size_t image_capacity; // To store the size of image
+    BmpInfo bmp;           // Parsed headers of the src image (BMP, PNM or TGA)
+    BmpLayout layout;      // Image bytes that carry payload bits (row padding / alpha skipped)
+    int use_alpha;         // Non zero to embed in the alpha byte of 32-bit pixels too (-a)
 
     /* Secret File Info */
     char *secret_fname;       // To store the secret file name
     FILE *fptr_secret;        // To store the secret file address
-    char extn_secret_file[5]; // To store the Secret file extension
-    char secret_data[100];    // To store the secret data
-    int size_secret_file;    // To store the size of the secret data
+    char extn_secret_file[10]; // To store the Secret file extension (ARCHIVE_EXTN for archives)
+    char **archive_files;     // Secret files packed into one archive payload (-c), NULL for a single secret
+    int archive_count;        // Number of archive_files
+    uint size_secret_file;    // To store the size of the secret data (streamed, never held in memory)
+    int compress;             // Non zero to LZ compress the secret before embedding (-z)
+    char *packed;             // Compressed secret (-z only, held in memory)
+    uint packed_size;         // Bytes of packed that are embedded
+
+    /* Encryption */
+    const char *key_fname;    // Key file (-K), NULL to embed the payload in the clear
+    ChaCha cipher;            // Key and the random nonce of this image
+    unsigned char nonce[CHACHA_NONCE_BYTES]; // Stored after the sizes
+    int scatter;              // Non zero to store the payload runs in keyed order (--scatter, needs -K, mapped files)
+    const ChaCha *active_cipher; // Cipher of the bytes being written (payload only), NULL for header fields
+    size_t cipher_pos;        // Payload offset of the next byte written through active_cipher
+
+    /* Checksum */
+    int use_crc;              // Non zero to add the CRC32C trailer (--crc, needs the extended format)
+    uint32_t checksum;        // CRC32C of the secret, built while it is embedded (or compressed)
+    uint32_t *tile_crc;       // CRC32C of every tile of a plain payload (tile mode)
 
     /* Stego Image Info */
     char *stego_image_fname; // To store the dest file name
     FILE *fptr_stego_image;  // To store the address of stego image
-
+    int patch;               // Non zero: the stego image starts as a clone of the cover and only the payload span is written (--clone)
+    int in_place;            // Non zero to embed into the source image itself (--inplace, implies patch)
+    CloneMethod clone_method; // How the cover was cloned (patch without in_place)
+
+    /* Memory mapped mode */
+    int use_mmap;            // Non zero to embed directly in mapped files instead of stdio
+    MappedFile src_map;      // Mapped source image
+    MappedFile secret_map;   // Mapped secret file
+    MappedFile stego_map;    // Mapped stego image (same size as the source image)
+    size_t image_offset;     // Next image byte to be written
+    size_t slot;             // Next layout slot (usable image byte) to be written
+
+    /* Pipelined stdio mode (serial do_encoding) */
+    int no_pipeline;         // Non zero to read, embed and write in the calling thread instead
+    int pipelined;           // Set by do_encoding: the cover goes through cover_pipe
+    Pipeline *cover_pipe;    // Source image read ahead, stego image written behind
+    PipeBlock *cover_block;  // Block of cover_pipe being embedded into (NULL before the first)
+
+    int threads;             // Worker threads for the payload region (-j), 0 or 1 is serial
+    int io_backend;          // IoBackend of the tile transfers (--io)
+    int io_depth;            // Requests in flight per thread (--qd), 0 for the default
+    IoQueue *io;             // Queue of the thread running the serial stages in tile mode, NULL for pread/pwrite
+    size_t payload_offset;   // Image offset of the first secret data byte (tile mode)
+    size_t payload_slot;     // Layout slot of the first secret data byte (tile mode)
+    int quiet;               // Non zero to skip the per-stage success messages
+
+    /* Stego format */
+    int bit_depth;           // LSBs per image byte for everything after the format word (1..4, -k)
+    uint format_flags;       // FORMAT_FLAG_* bits stored in the format word
+    int active_depth;        // Depth of the field being written (header fields use 1)
+
+    StegStats *stats;        // Per-stage timing and I/O counters, NULL when not requested
 } EncodeInfo;
 
 /* Encoding function prototype */
@@ -39,24 +98,41 @@ Status read_and_validate_encode_args(char *argv[], EncodeInfo *encInfo);
 /* Perform the encoding */
 Status do_encoding(EncodeInfo *encInfo);
 
+/* Encoding in phases: everything before the secret data / image tail and close */
+Status begin_encoding(EncodeInfo *encInfo);
+Status finish_encoding(EncodeInfo *encInfo);
+
 /* Get File pointers for i/p and o/p files */
 Status open_files(EncodeInfo *encInfo);
 
+/* Format word (bit depth | flags) and whether the extended format is needed */
+uint stego_format_word(EncodeInfo *encInfo);
+int use_extended_format(EncodeInfo *encInfo);
+
 /* check capacity */
 Status check_capacity(EncodeInfo *encInfo);
 
+/* Compress the secret into encInfo->packed (-z), dropped again if it does not shrink */
+Status compress_secret(EncodeInfo *encInfo);
+
+/* Bytes embedded after the header fields: the packed size with -z, else the secret size */
+size_t embedded_size(EncodeInfo *encInfo);
+
 /* Get image size */
-uint get_image_size_for_bmp(FILE *fptr_image);
+size_t get_image_size_for_cover(FILE *fptr_image);
 
 /* Get file size */
-uint get_file_size(FILE *fptr);
+size_t get_file_size(FILE *fptr);
 
-/* Copy bmp image header */
-Status copy_bmp_header(FILE *fptr_src_image, FILE *fptr_dest_image);
+/* Copy the cover image header (size bytes: everything before the pixel array) */
+Status copy_cover_header(FILE *fptr_src_image, FILE *fptr_dest_image, size_t size);
 
 /* Store Magic String */
 Status encode_magic_string(const char *magic_string, EncodeInfo *encInfo);
 
+/* Encode the format word of the extended format and switch to its bit depth */
+Status encode_format_word(uint word, EncodeInfo *encInfo);
+
 /*Encode extension size*/
 Status encode_secret_file_extn_size(int size, EncodeInfo *encInfo);
 
@@ -66,9 +142,29 @@ Status encode_secret_file_extn(const char *file_extn, EncodeInfo *encInfo);
 /* Encode secret file size */
 Status encode_secret_file_size(int file_size, EncodeInfo *encInfo);
 
-/* Encode secret file data*/
+/* Encode the compressed payload size (FORMAT_FLAG_LZ only) */
+Status encode_packed_size(int packed_size, EncodeInfo *encInfo);
+
+/* Read the key file and draw a nonce (-K), sets FORMAT_FLAG_CHACHA */
+Status setup_cipher(EncodeInfo *encInfo);
+
+/* Encode the nonce and key check word (FORMAT_FLAG_CHACHA only) */
+Status encode_cipher_fields(EncodeInfo *encInfo);
+
+/* Cipher of the payload, NULL when it is embedded in the clear */
+const ChaCha *payload_cipher(EncodeInfo *encInfo);
+
+/* Encode the CRC32C trailer right after the payload (FORMAT_FLAG_CRC only) */
+Status encode_checksum(EncodeInfo *encInfo);
+
+/* Encode secret file data, streamed from the secret file in LSB_CHUNK blocks (or the packed secret) */
 Status encode_secret_file_data(EncodeInfo *encInfo);
 
+/* Tile-wise secret data encoding (payload byte i -> layout slots payload_slot + lsb_cover_bytes(depth)*i) */
+Status start_secret_tiles(EncodeInfo *encInfo);
+Status encode_secret_tile(EncodeInfo *encInfo, size_t tile, char *cover_buf, char *data_buf, IoQueue *io);
+Status end_secret_tiles(EncodeInfo *encInfo);
+
 /* Encode a byte into LSB of image data array */
 Status encode_byte_to_lsb(char data, char *image_buffer);
 
@@ -78,4 +174,10 @@ Status encode_size_to_lsb(int size, char *imageBuffer);
 /* Copy remaining image bytes from src to stego image after encoding */
 Status copy_remaining_img_data(FILE *fptr_src, FILE *fptr_dest);
 
+/* Copy len unchanged image bytes from the mapped source to the mapped stego image */
+Status copy_mapped_img_data(EncodeInfo *encInfo, size_t len);
+
+/* Release mappings and close all files */
+void close_files(EncodeInfo *encInfo);
+
 #endif
@@ -0,0 +1,118 @@
+#include <stdlib.h>             // Work matrix
+#include <pthread.h>            // pthread_once for the field tables
+#include "erasure.h"            // Erasure code declarations
+
+static unsigned char gf_exp[512];       // Doubled so gf_exp[log a + log b] needs no modulo
+static unsigned char gf_log[256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void build_tables(void)
+{
+    unsigned x = 1;
+    for (int i = 0; i < 255; i++)
+    {
+        gf_exp[i] = gf_exp[i + 255] = (unsigned char)x;
+        gf_log[x] = (unsigned char)i;
+        x <<= 1;
+        if (x & 0x100)
+            x ^= 0x11d;
+    }
+    gf_exp[510] = gf_exp[511] = gf_exp[0];
+}
+
+static unsigned char gf_mul(unsigned char a, unsigned char b)
+{
+    return a && b ? gf_exp[gf_log[a] + gf_log[b]] : 0;
+}
+
+static unsigned char gf_inv(unsigned char a)
+{
+    return gf_exp[255 - gf_log[a]];                     // a != 0
+}
+
+unsigned char erasure_coef(int k, int s, int d)
+{
+    pthread_once(&tables_once, build_tables);
+    if (s < k)
+        return s == d;
+    return gf_inv((unsigned char)(s ^ d));              // s >= k > d, never 0
+}
+
+void erasure_mul_add(unsigned char *dst, const unsigned char *src, unsigned char c, size_t n)
+{
+    unsigned char row[256];
+
+    if (c == 0)
+        return;
+    if (c == 1)
+    {
+        for (size_t i = 0; i < n; i++)
+            dst[i] ^= src[i];
+        return;
+    }
+    pthread_once(&tables_once, build_tables);
+    for (int v = 0; v < 256; v++)                       // c * v for every byte value, one lookup per byte after
+        row[v] = gf_mul(c, (unsigned char)v);
+    for (size_t i = 0; i < n; i++)
+        dst[i] ^= row[src[i]];
+}
+
+Status erasure_invert(int k, int n, const int *rows, unsigned char *inv)
+{
+    unsigned char *a = malloc((size_t)k * k);
+
+    pthread_once(&tables_once, build_tables);
+    if (a == NULL || k < 1 || n > ERASURE_MAX_SHARDS)
+    {
+        free(a);
+        return e_failure;
+    }
+    for (int r = 0; r < k; r++)                         // a = rows of the encoding matrix, inv = identity
+    {
+        if (rows[r] < 0 || rows[r] >= n)
+        {
+            free(a);
+            return e_failure;
+        }
+        for (int c = 0; c < k; c++)
+        {
+            a[r * k + c] = erasure_coef(k, rows[r], c);
+            inv[r * k + c] = r == c;
+        }
+    }
+    for (int c = 0; c < k; c++)                         // Gauss-Jordan elimination
+    {
+        int p = c;
+        while (p < k && a[p * k + c] == 0)
+            p++;
+        if (p == k)
+        {
+            free(a);
+            return e_failure;                           // Singular: an index was repeated
+        }
+        for (int j = 0; p != c && j < k; j++)
+        {
+            unsigned char t = a[c * k + j]; a[c * k + j] = a[p * k + j]; a[p * k + j] = t;
+            t = inv[c * k + j]; inv[c * k + j] = inv[p * k + j]; inv[p * k + j] = t;
+        }
+        unsigned char scale = gf_inv(a[c * k + c]);
+        for (int j = 0; j < k; j++)
+        {
+            a[c * k + j] = gf_mul(a[c * k + j], scale);
+            inv[c * k + j] = gf_mul(inv[c * k + j], scale);
+        }
+        for (int r = 0; r < k; r++)
+        {
+            unsigned char f = a[r * k + c];
+            if (r == c || f == 0)
+                continue;
+            for (int j = 0; j < k; j++)
+            {
+                a[r * k + j] ^= gf_mul(f, a[c * k + j]);
+                inv[r * k + j] ^= gf_mul(f, inv[c * k + j]);
+            }
+        }
+    }
+    free(a);
+    return e_success;
+}
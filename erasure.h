@@ -0,0 +1,29 @@
+#ifndef ERASURE_H
+#define ERASURE_H
+
+#include <stddef.h>         // size_t
+#include "types.h"          // Status
+
+/*
+ * k-of-n erasure code of sharded payloads
+ * Systematic Reed-Solomon over GF(2^8) (polynomial 0x11d): shards 0..k-1
+ * are the data itself, shards k..n-1 are parity rows of a Cauchy matrix,
+ * so any k of the n shards (all of the same length) rebuild the data.
+ * Parity shard s is the sum over data shards d of erasure_coef(k, s, d)
+ * times shard d; a missing data shard is the sum over k surviving shards
+ * of the decode matrix from erasure_invert() times those shards
+ */
+
+#define ERASURE_MAX_SHARDS 255
+
+/* Coefficient of data shard d (0..k-1) in shard s (0..n-1): identity for s < k, Cauchy 1/(s ^ d) above */
+unsigned char erasure_coef(int k, int s, int d);
+
+/* dst ^= c * src over n bytes in GF(2^8) */
+void erasure_mul_add(unsigned char *dst, const unsigned char *src, unsigned char c, size_t n);
+
+/* Decode matrix of k distinct shard indices rows[]: data shard d = sum_j inv[d * k + j] * shard rows[j].
+   e_failure if an index repeats or is out of range */
+Status erasure_invert(int k, int n, const int *rows, unsigned char *inv);
+
+#endif
@@ -0,0 +1,348 @@
+#include <stdio.h>              // Report
+#include <stdlib.h>             // File list allocation, qsort
+#include <string.h>             // Path handling
+#include <time.h>               // Scan duration
+#include <unistd.h>             // pread, sysconf
+#include <fcntl.h>              // open, posix_fadvise
+#include <dirent.h>             // Directory walk
+#include <limits.h>             // PATH_MAX
+#include <stdint.h>             // SIZE_MAX
+#include <sys/stat.h>           // lstat, fstat
+#include "inspect.h"            // Inspect mode declarations
+#include "common.h"             // MAGIC_STRING, FORMAT_DEPTH_MASK
+#include "lsb.h"                // lsb_cover_bytes
+#include "bmp.h"                // Payload layout
+#include "cover.h"              // Cover format parsers (BMP, PNM, TGA)
+#include "parallel.h"           // Work-stealing pool
+#include "mapping.h"            // --verify reads the whole image
+#include "steg.h"               // steg_verify
+#include "png.h"                // PNG covers are read through zlib
+#include "chacha.h"             // chacha_read_key
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+/* Files found below the paths given on the command line */
+typedef struct _InspectList
+{
+    char **names;
+    StegInspect *info;                  // Filled by the workers, one per name
+    const unsigned char *key;           // -K key for --verify, NULL without
+    int verify;                         // --verify: also check the payload checksums
+    size_t count;
+    size_t capacity;
+} InspectList;
+
+/* Header fields of one file as read from the scan window */
+typedef struct _InspectFields
+{
+    const BmpLayout *layout;
+    const char *raw;                    // Bytes read, from file offset first on
+    size_t first;
+    size_t len;
+    size_t slot;                        // Next field slot
+    int depth;
+} InspectFields;
+
+/* Whether the bytes read hold count more slots */
+static int have_slots(const BmpLayout *layout, size_t slot, size_t count, size_t image_offset, size_t len)
+{
+    return slot + count <= bmp_slots(layout) && bmp_span_end(layout, slot, count) <= image_offset + len;
+}
+
+/* Field reader of bmp_read_fields() over the scan window (the nonce and key check are only skipped) */
+static Status read_window_field(void *ctx, char *data, size_t n)
+{
+    InspectFields *scan = ctx;
+    size_t count = lsb_cover_bytes(scan->depth) * n;
+
+    if (data && !have_slots(scan->layout, scan->slot, count, scan->first, scan->len))
+        return e_failure;
+    if (data)
+        bmp_extract(scan->layout, scan->raw, scan->first, scan->slot, data, n, scan->depth);
+    scan->slot += count;
+    return e_success;
+}
+
+static InspectResult inspect_done(StegInspect *info, InspectResult result, const char *reason)
+{
+    info->result = result;
+    info->reason = reason;
+    return result;
+}
+
+/* PNG: the fields are read from the first rows inflated; verify (-K key or NULL) also reads back the payload */
+static InspectResult inspect_png(const char *fname, const unsigned char *key, int verify, StegInspect *info)
+{
+    StegPayloadInfo payload;
+    BmpPayload found;
+    const char *error;
+
+    FILE *fptr = fopen(fname, "rb");
+    if (fptr == NULL)
+        return inspect_done(info, inspect_unreadable, "cannot open");
+    PngStream *png = png_decode_open(fptr, key, &payload, &found, &error);
+    InspectResult result = png ? inspect_stego : found == bmp_payload_none && error == NULL ? inspect_clean
+                         : found == bmp_payload_none ? inspect_unreadable : inspect_broken;
+    if (png)
+    {
+        info->format_word = payload.format_word != 1 ? payload.format_word : 0;
+        info->bit_depth = payload.bit_depth;
+        strcpy(info->extn, payload.extn);
+        info->size_secret_file = (uint)payload.payload_size;
+        info->packed_size = (payload.format_word & FORMAT_FLAG_LZ) ? (uint)payload.embedded_size : 0;
+        if (verify && png_decode_payload(png, NULL, 0, SIZE_MAX, &error) == e_failure)
+            result = inspect_broken;
+        else
+            info->verified = verify;
+    }
+    png_close(png);
+    fclose(fptr);
+    return inspect_done(info, result, error);
+}
+
+InspectResult inspect_file(const char *fname, StegInspect *info)
+{
+    char raw[INSPECT_BYTES];
+    struct stat st;
+    BmpInfo bmp;
+    BmpLayout layout;
+    size_t first = 0;                                            // File offset of raw[0]
+
+    memset(info, 0, sizeof(*info));
+    if (png_file(fname))
+        return inspect_png(fname, NULL, 0, info);
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+        return inspect_done(info, inspect_unreadable, "cannot open");
+#ifdef POSIX_FADV_RANDOM
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);   // Only the first page is needed: no readahead window
+#endif
+    ssize_t len = fstat(fd, &st) == 0 ? pread(fd, raw, sizeof(raw), 0) : -1;
+    int parsed = len > 0 && cover_parse((const unsigned char *)raw, len, st.st_size, &bmp) == e_success;
+    if (!parsed && (len < 54 || raw[0] != 'B' || raw[1] != 'M'))    // Unsupported BMPs: still the legacy layout
+    {
+        close(fd);
+        return inspect_done(info, inspect_unreadable, "not a supported image");
+    }
+    if (parsed && bmp.data_offset + 320 > (size_t)len)           // Fields span <= 288 pixel bytes: read at the pixels instead
+    {
+        first = bmp.data_offset;                                 // (the pre-parser layout at 54 is not tried then)
+        len = pread(fd, raw, sizeof(raw), first);
+    }
+    close(fd);
+    if (len < 0)
+        return inspect_done(info, inspect_unreadable, "cannot read");
+
+    /* Magic string and format word, 1 bit per image byte, in whichever layout holds them */
+    uint word = 0;
+    BmpPayload found = bmp_find_payload(parsed ? &bmp : NULL, st.st_size, raw, first, len, &layout, &word);
+    if (found == bmp_payload_none)
+        return inspect_done(info, inspect_clean, NULL);
+    if (found == bmp_payload_bad_word)
+        return inspect_done(info, inspect_broken, "bad format word");
+    info->format_word = found == bmp_payload_extended ? word : 0;
+    info->bit_depth = word & FORMAT_DEPTH_MASK;
+    info->image_capacity = bmp_slots(&layout);
+    InspectFields scan = {&layout, raw, first, (size_t)len, found == bmp_payload_extended ? 48 : 16, info->bit_depth};
+
+    /* Extension, sizes (nonce and key check are not needed here) at the payload depth, like the decoder */
+    BmpFields fields;
+    const char *error = bmp_read_fields(read_window_field, &scan, word, 0, &fields);
+    if (error)
+        return inspect_done(info, inspect_broken, error);
+    size_t extn_size = strlen(fields.extn);
+    if (extn_size < 1)
+        return inspect_done(info, inspect_broken, "bad extension length");
+    if (fields.extn[0] != '.')                                   // Stricter than the decoder: scans see many clean files
+        return inspect_done(info, inspect_broken, "bad extension");
+    for (size_t i = 1; i < extn_size; i++)
+        if (fields.extn[i] <= ' ' || fields.extn[i] > '~' || fields.extn[i] == '.')
+            return inspect_done(info, inspect_broken, "bad extension");
+    strcpy(info->extn, fields.extn);
+    info->size_secret_file = fields.size;
+    if (info->format_word & FORMAT_FLAG_LZ)                      // Compressed: the packed size is what is embedded
+        info->packed_size = fields.embedded;
+
+    size_t slot = scan.slot;
+    info->payload_offset = bmp_slot_offset(&layout, slot);
+    size_t end = slot + ((size_t)fields.embedded + ((word & FORMAT_FLAG_CRC) ? CHECKSUM_BYTES : 0)) *
+                        lsb_cover_bytes(info->bit_depth);        // Slot just past the payload and trailer
+    if (!bmp_fields_fit(&layout, slot, word, &fields) ||
+        (end > slot && bmp_span_end(&layout, slot, end - slot) > (size_t)st.st_size))
+        return inspect_done(info, inspect_broken, "size exceeds image capacity");
+
+    return inspect_done(info, inspect_stego, NULL);
+}
+
+InspectResult inspect_verify(const char *fname, const unsigned char *key, StegInspect *info)
+{
+    MappedFile map = {0};
+    StegPayloadInfo payload;
+
+    if (info->result != inspect_stego || !(info->format_word & FORMAT_FLAG_CRC) ||
+        ((info->format_word & FORMAT_FLAG_CHACHA) && key == NULL))
+        return info->result;                                     // Nothing that can be checked
+    if (png_file(fname))
+        return inspect_png(fname, key, 1, info);
+    FILE *fptr = fopen(fname, "rb");
+    Status res = fptr ? map_file_read(fptr, &map) : e_failure;
+    if (fptr) fclose(fptr);                                      // The mapping stays valid
+    if (res == e_failure)
+        return inspect_done(info, inspect_unreadable, "cannot read");
+    res = steg_verify(map.data, map.size, key, &payload);
+    unmap_file(&map);
+    if (res == e_failure)
+        return inspect_done(info, inspect_broken, "checksum mismatch");
+    info->verified = 1;
+    return info->result;
+}
+
+/* -------------------- Directory scan -------------------- */
+
+static Status list_add(InspectList *list, const char *name)
+{
+    if (list->count == list->capacity)
+    {
+        size_t capacity = list->capacity ? list->capacity * 2 : 256;
+        char **names = realloc(list->names, capacity * sizeof(char *));
+        if (names == NULL) return e_failure;
+        list->names = names;
+        list->capacity = capacity;
+    }
+    if ((list->names[list->count] = strdup(name)) == NULL) return e_failure;
+    list->count++;
+    return e_success;
+}
+
+/* Add every image (*.bmp, *.pgm, *.ppm, *.pnm, *.tga) below dir (symbolic links to directories are not followed) */
+static Status walk_directory(const char *dir, InspectList *list)
+{
+    char path[PATH_MAX];
+    struct dirent *entry;
+    DIR *dp = opendir(dir);
+    if (dp == NULL) { printf("ERROR   %s (cannot open directory)\n", dir); return e_success; }
+
+    while ((entry = readdir(dp)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        if (snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int)sizeof(path))
+            continue;                                        // Path too long
+
+        int is_dir = entry->d_type == DT_DIR, is_file = entry->d_type == DT_REG;
+        if (entry->d_type == DT_UNKNOWN)                     // File system without d_type
+        {
+            struct stat st;
+            if (lstat(path, &st) != 0) continue;
+            is_dir = S_ISDIR(st.st_mode);
+            is_file = S_ISREG(st.st_mode);
+        }
+        if (is_dir && walk_directory(path, list) == e_failure) { closedir(dp); return e_failure; }
+        if (is_file && cover_name_format(entry->d_name) >= 0 && list_add(list, path) == e_failure) { closedir(dp); return e_failure; }
+    }
+    closedir(dp);
+    return e_success;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void inspect_task(TaskPool *pool, void *arg, size_t index, int worker)
+{
+    InspectList *list = arg;
+    (void)pool;
+    (void)worker;
+    if (inspect_file(list->names[index], &list->info[index]) == inspect_stego && list->verify)
+        inspect_verify(list->names[index], list->key, &list->info[index]);
+}
+
+Status run_inspect(int count, char *paths[], const StegOptions *opts)
+{
+    InspectList list = {0};
+    Status res = e_success;
+    int missing = 0;                                         // Paths given that do not exist
+    struct timespec start, end;
+    size_t totals[inspect_unreadable + 1] = {0};
+    unsigned char key[CHACHA_KEY_BYTES];
+
+    if (opts->verify && opts->key_fname)
+    {
+        if (chacha_read_key(opts->key_fname, key) == e_failure)
+        {
+            printf("Error: Unreadable key file %s\n", opts->key_fname);
+            return e_failure;
+        }
+        list.key = key;
+    }
+    list.verify = opts->verify;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count && res == e_success; i++)      // Explicit files are always inspected
+    {
+        struct stat st;
+        size_t first = list.count;
+        if (stat(paths[i], &st) != 0) { printf("ERROR   %s (no such file or directory)\n", paths[i]); missing++; continue; }
+        if (S_ISDIR(st.st_mode))
+        {
+            res = walk_directory(paths[i], &list);
+            qsort(list.names + first, list.count - first, sizeof(char *), compare_names);  // Stable report order
+        }
+        else
+            res = list_add(&list, paths[i]);
+    }
+
+    list.info = calloc(list.count ? list.count : 1, sizeof(StegInspect));
+    int workers = opts->threads > 0 ? opts->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    TaskPool *pool = res == e_success && list.info ? pool_create(workers) : NULL;
+    if (pool == NULL) res = e_failure;
+
+    if (res == e_success)
+    {
+        for (size_t i = 0; i < list.count; i++)
+            pool_push(pool, -1, inspect_task, &list, i);
+        pool_run(pool);
+        pool_destroy(pool);
+
+        for (size_t i = 0; i < list.count; i++)             // Report in walk order
+        {
+            StegInspect *info = &list.info[i];
+            totals[info->result]++;
+            if (info->result == inspect_stego)
+            {
+                printf("STEGO   %s depth=%d extn=%s size=%u", list.names[i], info->bit_depth, info->extn, info->size_secret_file);
+                if (info->format_word & FORMAT_FLAG_LZ)
+                    printf(" packed=%u", info->packed_size);
+                if (info->format_word & FORMAT_FLAG_CHACHA)
+                    printf(" encrypted");
+                if (info->format_word & FORMAT_FLAG_SCATTER)
+                    printf(" scattered");
+                if (opts->verify)
+                    printf(info->verified ? " verified" : (info->format_word & FORMAT_FLAG_CRC) ? " unverified (no key)" : " no checksum");
+                printf("\n");
+            }
+            else if (opts->quiet)
+                continue;                                    // -q: only the files carrying a payload
+            else if (info->result == inspect_clean)
+                printf("CLEAN   %s\n", list.names[i]);
+            else
+                printf("%-7s %s (%s)\n", info->result == inspect_broken ? "BROKEN" : "ERROR", list.names[i], info->reason);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("Inspect: %zu files, %zu stego, %zu broken, %zu unreadable, %zu clean (%.3f s)\n",
+               list.count, totals[inspect_stego], totals[inspect_broken], totals[inspect_unreadable],
+               totals[inspect_clean], (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+        if (opts->verify && (totals[inspect_broken] || totals[inspect_unreadable]))
+            res = e_failure;                                 // --verify: non zero exit on any damaged file
+    }
+    else
+        printf("Error: Out of memory while inspecting\n");
+
+    for (size_t i = 0; i < list.count; i++)
+        free(list.names[i]);
+    free(list.names);
+    free(list.info);
+    return missing ? e_failure : res;
+}
@@ -0,0 +1,52 @@
+#ifndef INSPECT_H
+#define INSPECT_H
+
+#include <stddef.h>         // size_t
+#include "types.h"          // Status, StegOptions
+
+/*
+ * Inspect mode (-i)
+ * Reads only the cover header and the first few hundred image bytes of a
+ * file, decodes the magic string, format word, extension and size fields
+ * and checks them against the image capacity. Nothing is written and the
+ * payload itself is never read, so whole directory trees can be triaged
+ * at roughly the speed of opening the files. With --verify the payload of
+ * every stego file is also read back and checked against its CRC32C
+ */
+
+/* Image bytes read per file: cover header + every header field at depth 1 with the longest extension */
+#define INSPECT_BYTES 512
+
+typedef enum
+{
+    inspect_clean,          // Image without a magic string
+    inspect_stego,          // Magic string and consistent header fields
+    inspect_broken,         // Magic string but impossible header fields
+    inspect_unreadable      // Cannot be opened or is not a supported image
+} InspectResult;
+
+typedef struct _StegInspect
+{
+    InspectResult result;
+    const char *reason;     // Why the file is broken or unreadable (static string)
+    int bit_depth;          // LSBs per image byte of the payload
+    uint format_word;       // Format word (extended format only)
+    char extn[10];          // Stored extension of the secret file
+    uint size_secret_file;  // Stored secret size
+    uint packed_size;       // Compressed payload size (FORMAT_FLAG_LZ), 0 otherwise
+    size_t payload_offset;  // Image offset of the first secret byte (0 for PNG: the rows are compressed)
+    size_t image_capacity;  // Usable image bytes of the payload layout (0 for PNG)
+    int verified;           // --verify: 1 checksum matched, 0 not checked (no checksum, or encrypted and no key)
+} StegInspect;
+
+/* Inspect one file */
+InspectResult inspect_file(const char *fname, StegInspect *info);
+
+/* Read back the payload of a file inspect_file() found and check its checksum (key: -K, or NULL) */
+InspectResult inspect_verify(const char *fname, const unsigned char *key, StegInspect *info);
+
+/* Inspect files and directory trees (every *.bmp, *.pgm, *.ppm, *.pnm and *.tga below them) on opts->threads workers;
+   e_failure for a missing path, or with opts->verify for any broken or unreadable file */
+Status run_inspect(int count, char *paths[], const StegOptions *opts);
+
+#endif
@@ -0,0 +1,391 @@
+#include <pthread.h>            // Fallback I/O threads
+#include <stdlib.h>             // Queue allocation
+#include <string.h>             // memset, strcmp
+#include <errno.h>              // EINTR
+#include <stdint.h>             // uintptr_t
+#include <unistd.h>             // pread, pwrite, syscall
+#include "iobackend.h"          // I/O backend declarations
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define IO_HAVE_URING 1
+#include <linux/io_uring.h>     // Ring layout and opcodes (no liburing needed)
+#include <sys/syscall.h>        // __NR_io_uring_setup, __NR_io_uring_enter
+#include <sys/mman.h>           // Ring mappings
+#endif
+#endif
+
+#define IO_MAX_THREADS 32       // Fallback threads per queue
+
+/* Walks the requests of one transfer in IO_CHUNK pieces */
+typedef struct _IoCursor
+{
+    IoRequest *reqs;
+    int n;
+    int r;                      // Current request
+    size_t pos;                 // Bytes of reqs[r] already handed out
+} IoCursor;
+
+struct _IoQueue
+{
+    IoBackend backend;          // uring, threads or sync
+    int depth;                  // Requests in flight
+
+    /* io_uring */
+    int ring_fd;
+    void *sq_ring, *cq_ring;    // Ring mappings
+    size_t sq_size, cq_size, sqes_size;
+    unsigned *sq_head, *sq_tail, *sq_array, sq_mask;
+    unsigned *cq_head, *cq_tail, cq_mask;
+    void *sqes;                 // struct io_uring_sqe[sq_entries]
+    void *cqes;                 // struct io_uring_cqe[cq_entries]
+    IoRequest *slots;           // Chunk of every request in flight, indexed by user_data
+    int *free_slots;            // Stack of unused slot numbers
+    int broken;                 // Ring failed: every later transfer is blocking
+
+    /* Thread pool */
+    pthread_t threads[IO_MAX_THREADS];
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // A transfer started, or quit
+    pthread_cond_t idle;        // A chunk finished
+    IoCursor *cursor;           // Transfer being worked on, NULL between transfers
+    int busy;                   // Chunks being transferred
+    int failed;                 // Any chunk of the current transfer failed
+    int quit;
+};
+
+/* Next chunk of the transfer, 0 when every byte was handed out */
+static int cursor_next(IoCursor *cursor, IoRequest *chunk)
+{
+    while (cursor->r < cursor->n && cursor->pos >= cursor->reqs[cursor->r].len)
+    {
+        cursor->r++;
+        cursor->pos = 0;
+    }
+    if (cursor->r == cursor->n)
+        return 0;
+
+    IoRequest *req = &cursor->reqs[cursor->r];
+    size_t len = req->len - cursor->pos < IO_CHUNK ? req->len - cursor->pos : IO_CHUNK;
+    *chunk = (IoRequest){ req->fd, req->write, req->buf + cursor->pos, len, req->offset + cursor->pos };
+    cursor->pos += len;
+    return 1;
+}
+
+/* Blocking transfer of a whole request (short only on an error or the end of the file) */
+static Status sync_transfer(const IoRequest *req)
+{
+    size_t done = 0;
+    while (done < req->len)
+    {
+        ssize_t n = req->write ? pwrite(req->fd, req->buf + done, req->len - done, req->offset + done)
+                               : pread(req->fd, req->buf + done, req->len - done, req->offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return e_failure;              // Error, or a read past the end of the file
+        done += n;
+    }
+    return e_success;
+}
+
+/* -------------------- io_uring -------------------- */
+
+#ifdef IO_HAVE_URING
+static int uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned submit, unsigned wait, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+static void uring_close(IoQueue *io)
+{
+    if (io->sqes) munmap(io->sqes, io->sqes_size);
+    if (io->cq_ring) munmap(io->cq_ring, io->cq_size);
+    if (io->sq_ring) munmap(io->sq_ring, io->sq_size);
+    if (io->ring_fd >= 0) close(io->ring_fd);
+    io->sqes = io->cq_ring = io->sq_ring = NULL;
+    io->ring_fd = -1;
+}
+
+static void *ring_map(int fd, size_t size, off_t offset)
+{
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+static Status uring_open(IoQueue *io)
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    io->ring_fd = uring_setup(io->depth, &params);         // Disabled by sysctl or seccomp: fall back
+    if (io->ring_fd < 0)
+        return e_failure;
+
+    io->sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    io->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    io->sq_ring = ring_map(io->ring_fd, io->sq_size, IORING_OFF_SQ_RING);
+    io->cq_ring = ring_map(io->ring_fd, io->cq_size, IORING_OFF_CQ_RING);
+    io->sqes = ring_map(io->ring_fd, io->sqes_size, IORING_OFF_SQES);
+    io->slots = calloc(io->depth, sizeof(IoRequest));
+    io->free_slots = calloc(io->depth, sizeof(int));
+    if (!io->sq_ring || !io->cq_ring || !io->sqes || !io->slots || !io->free_slots)
+    {
+        uring_close(io);
+        return e_failure;
+    }
+
+    char *sq = io->sq_ring, *cq = io->cq_ring;
+    io->sq_head = (unsigned *)(sq + params.sq_off.head);
+    io->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    io->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    io->sq_array = (unsigned *)(sq + params.sq_off.array);
+    io->cq_head = (unsigned *)(cq + params.cq_off.head);
+    io->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    io->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    io->cqes = cq + params.cq_off.cqes;
+    for (int i = 0; i < io->depth; i++)
+        io->free_slots[i] = i;
+    return e_success;
+}
+
+/* Queue one chunk on the submission ring (there is always room: at most depth are in use) */
+static void uring_queue(IoQueue *io, int slot)
+{
+    const IoRequest *chunk = &io->slots[slot];
+    unsigned tail = *io->sq_tail;                           // Only this thread moves the tail
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)io->sqes + (tail & io->sq_mask);
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = chunk->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = chunk->fd;
+    sqe->addr = (uintptr_t)chunk->buf;
+    sqe->len = (unsigned)chunk->len;
+    sqe->off = chunk->offset;
+    sqe->user_data = (unsigned)slot;
+    io->sq_array[tail & io->sq_mask] = tail & io->sq_mask;
+    __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+/* Finish one completed chunk, short or unsupported transfers are completed with pread/pwrite */
+static Status uring_complete(IoQueue *io, int slot, int res)
+{
+    IoRequest *chunk = &io->slots[slot];
+
+    if (res == -EINVAL || res == -EOPNOTSUPP || res == -EAGAIN || res == -EINTR)
+        return sync_transfer(chunk);                        // Kernel without IORING_OP_READ/WRITE, or retry
+    if (res < 0 || (res == 0 && chunk->len > 0))
+        return e_failure;                                   // I/O error, or a read past the end of the file
+    if ((size_t)res < chunk->len)
+    {
+        chunk->buf += res;
+        chunk->len -= res;
+        chunk->offset += res;
+        return sync_transfer(chunk);
+    }
+    return e_success;
+}
+
+static Status uring_transfer(IoQueue *io, IoCursor *cursor)
+{
+    int used = 0, failed = 0, exhausted = 0;
+
+    for (;;)
+    {
+        while (!failed && !exhausted && used < io->depth)  // Keep depth chunks in flight
+        {
+            int slot = io->free_slots[io->depth - 1 - used];
+            if (!cursor_next(cursor, &io->slots[slot]))
+            {
+                exhausted = 1;
+                break;
+            }
+            uring_queue(io, slot);
+            used++;
+        }
+        if (used == 0)
+            break;
+
+        unsigned pending = *io->sq_tail - __atomic_load_n(io->sq_head, __ATOMIC_ACQUIRE);
+        if (uring_enter(io->ring_fd, pending, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            io->broken = 1;                                 // Chunks in flight cannot be reaped any more
+            return e_failure;
+        }
+
+        unsigned head = *io->cq_head;
+        while (head != __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            struct io_uring_cqe *cqe = (struct io_uring_cqe *)io->cqes + (head & io->cq_mask);
+            int slot = (int)cqe->user_data;
+            if (uring_complete(io, slot, cqe->res) == e_failure)
+                failed = 1;                                 // Stop submitting, reap what is in flight
+            used--;
+            io->free_slots[io->depth - 1 - used] = slot;
+            head++;
+        }
+        __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return failed ? e_failure : e_success;
+}
+#endif
+
+/* -------------------- Thread pool fallback -------------------- */
+
+/* Transfer chunks of the current cursor until it is exhausted, called with io->lock held */
+static void thread_chunks(IoQueue *io)
+{
+    IoRequest chunk;
+
+    while (io->cursor && cursor_next(io->cursor, &chunk))
+    {
+        io->busy++;
+        int skip = io->failed;                              // Transfer already failed: only drain
+        pthread_mutex_unlock(&io->lock);
+        Status res = skip ? e_success : sync_transfer(&chunk);
+        pthread_mutex_lock(&io->lock);
+        if (res == e_failure)
+            io->failed = 1;
+        io->busy--;
+        pthread_cond_broadcast(&io->idle);
+    }
+}
+
+static void *io_thread(void *arg)
+{
+    IoQueue *io = arg;
+
+    pthread_mutex_lock(&io->lock);
+    while (!io->quit)
+    {
+        thread_chunks(io);
+        if (!io->quit)
+            pthread_cond_wait(&io->work, &io->lock);
+    }
+    pthread_mutex_unlock(&io->lock);
+    return NULL;
+}
+
+static Status threads_transfer(IoQueue *io, IoCursor *cursor)
+{
+    pthread_mutex_lock(&io->lock);
+    io->cursor = cursor;
+    io->failed = 0;
+    pthread_cond_broadcast(&io->work);
+    thread_chunks(io);                                      // The caller is one of the transfer threads
+    while (io->busy > 0)
+        pthread_cond_wait(&io->idle, &io->lock);
+    io->cursor = NULL;
+    Status res = io->failed ? e_failure : e_success;
+    pthread_mutex_unlock(&io->lock);
+    return res;
+}
+
+static Status threads_open(IoQueue *io)
+{
+    int count = io->depth - 1 < IO_MAX_THREADS ? io->depth - 1 : IO_MAX_THREADS;
+
+    for (io->thread_count = 0; io->thread_count < count; io->thread_count++)
+        if (pthread_create(&io->threads[io->thread_count], NULL, io_thread, io) != 0)
+            break;                                          // Fewer threads, same result
+    return e_success;
+}
+
+/* -------------------- Queue -------------------- */
+
+IoQueue *io_queue_create(IoBackend backend, int depth)
+{
+    IoQueue *io = calloc(1, sizeof(IoQueue));
+    if (io == NULL) return NULL;
+
+    io->depth = depth > 0 ? (depth < IO_MAX_DEPTH ? depth : IO_MAX_DEPTH) : IO_DEFAULT_DEPTH;
+    io->ring_fd = -1;
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->work, NULL);
+    pthread_cond_init(&io->idle, NULL);
+
+#ifdef IO_HAVE_URING
+    if ((backend == io_backend_auto || backend == io_backend_uring) && uring_open(io) == e_success)
+    {
+        io->backend = io_backend_uring;
+        return io;
+    }
+#endif
+    if (backend == io_backend_uring)                        // Asked for explicitly but not available
+    {
+        io_queue_destroy(io);
+        return NULL;
+    }
+    io->backend = backend == io_backend_sync ? io_backend_sync : io_backend_threads;
+    if (io->backend == io_backend_threads)
+        threads_open(io);
+    return io;
+}
+
+IoBackend io_queue_backend(const IoQueue *io)
+{
+    return io ? io->backend : io_backend_sync;
+}
+
+Status io_transfer(IoQueue *io, IoRequest *reqs, int n)
+{
+    IoCursor cursor = { reqs, n, 0, 0 };
+
+#ifdef IO_HAVE_URING
+    if (io && io->backend == io_backend_uring && !io->broken)
+        return uring_transfer(io, &cursor);
+#endif
+    if (io && io->backend == io_backend_threads && io->thread_count > 0)
+        return threads_transfer(io, &cursor);
+
+    for (int i = 0; i < n; i++)                             // Blocking, one request after the other
+        if (sync_transfer(&reqs[i]) == e_failure)
+            return e_failure;
+    return e_success;
+}
+
+void io_queue_destroy(IoQueue *io)
+{
+    if (io == NULL) return;
+
+    pthread_mutex_lock(&io->lock);
+    io->quit = 1;
+    pthread_cond_broadcast(&io->work);
+    pthread_mutex_unlock(&io->lock);
+    for (int i = 0; i < io->thread_count; i++)
+        pthread_join(io->threads[i], NULL);
+#ifdef IO_HAVE_URING
+    uring_close(io);
+#endif
+    free(io->slots);
+    free(io->free_slots);
+    pthread_cond_destroy(&io->idle);
+    pthread_cond_destroy(&io->work);
+    pthread_mutex_destroy(&io->lock);
+    free(io);
+}
+
+static const char *const backend_names[] = { "auto", "uring", "threads", "sync" };
+
+const char *io_backend_name(IoBackend backend)
+{
+    return backend_names[backend];
+}
+
+Status io_backend_parse(const char *name, IoBackend *backend)
+{
+    for (int i = 0; i < (int)(sizeof(backend_names) / sizeof(backend_names[0])); i++)
+    {
+        if (strcmp(name, backend_names[i]) == 0)
+        {
+            *backend = (IoBackend)i;
+            return e_success;
+        }
+    }
+    return e_failure;
+}
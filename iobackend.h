@@ -0,0 +1,57 @@
+#ifndef IOBACKEND_H
+#define IOBACKEND_H
+
+#include <stddef.h>         // size_t
+#include "types.h"          // Status
+
+/*
+ * Asynchronous I/O backend of the tile transfers (-j, batch mode)
+ * Every large read or write is cut into IO_CHUNK pieces and up to depth
+ * pieces are kept in flight, either through an io_uring (Linux) or a
+ * small pool of pread/pwrite threads where io_uring is not available, so
+ * a handful of worker threads keep a fast device busy. A queue belongs to
+ * one thread; a NULL queue means plain blocking pread/pwrite
+ */
+
+#define IO_CHUNK (256 * 1024)       // Bytes per request in flight
+#define IO_DEFAULT_DEPTH 16         // Requests in flight per queue when --qd is not given
+#define IO_MAX_DEPTH 256            // Upper bound for --qd
+
+typedef enum
+{
+    io_backend_auto,        // io_uring if the kernel allows it, else threads
+    io_backend_uring,       // io_uring only (queue creation fails without it)
+    io_backend_threads,     // pread/pwrite thread pool
+    io_backend_sync         // Blocking pread/pwrite in the calling thread
+} IoBackend;
+
+/* One transfer: len bytes between buf and fd at offset */
+typedef struct _IoRequest
+{
+    int fd;
+    int write;              // Non zero for a write
+    char *buf;
+    size_t len;
+    size_t offset;
+} IoRequest;
+
+typedef struct _IoQueue IoQueue;
+
+/* Create a queue with up to depth requests in flight (0 for the default), NULL on failure */
+IoQueue *io_queue_create(IoBackend backend, int depth);
+
+/* Backend a queue actually uses (never io_backend_auto) */
+IoBackend io_queue_backend(const IoQueue *io);
+
+/* Transfer every byte of the n requests, overlapped, returns when all are done; io NULL is blocking pread/pwrite.
+   e_failure on an I/O error or a read past the end of the file */
+Status io_transfer(IoQueue *io, IoRequest *reqs, int n);
+
+/* Stop the queue's threads / ring and free it (NULL is ignored) */
+void io_queue_destroy(IoQueue *io);
+
+/* Name of a backend and the reverse (--io=NAME), parse returns e_failure for unknown names */
+const char *io_backend_name(IoBackend backend);
+Status io_backend_parse(const char *name, IoBackend *backend);
+
+#endif
@@ -0,0 +1,510 @@
+#include <stdint.h>             // Fixed width integer types
+#include <string.h>             // memcpy, memcmp
+#include <pthread.h>            // pthread_once
+#include "lsb.h"                // Bulk LSB kernel declarations
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LSB_X86 1
+#include <immintrin.h>          // SSE2 / AVX2 / AVX-512 / BMI2 intrinsics
+#else
+#define LSB_X86 0
+#endif
+
+typedef void (*lsb_embed_fn)(const char *data, size_t n, char *image_buffer);
+typedef void (*lsb_extract_fn)(const char *image_buffer, size_t n, char *data);
+
+/* -------------------- Scalar reference -------------------- */
+
+static void embed_scalar(const char *data, size_t n, char *image_buffer)
+{
+    for (size_t i = 0; i < n; i++)                  // Loop through payload bytes
+    {
+        unsigned char byte = (unsigned char)data[i];
+        char *dst = image_buffer + 8 * i;           // 8 cover bytes per payload byte
+        for (int j = 0; j < 8; j++)                 // MSB goes to the first cover byte
+            dst[j] = (char)((dst[j] & ~1) | ((byte >> (7 - j)) & 1));
+    }
+}
+
+static void extract_scalar(const char *image_buffer, size_t n, char *data)
+{
+    for (size_t i = 0; i < n; i++)                  // Loop through payload bytes
+    {
+        const char *src = image_buffer + 8 * i;
+        unsigned char byte = 0;
+        for (int j = 0; j < 8; j++)                 // First cover byte holds the MSB
+            byte = (unsigned char)((byte << 1) | (src[j] & 1));
+        data[i] = (char)byte;
+    }
+}
+
+/* Scalar multi-bit kernels: payload byte left aligned into cover_bytes*depth bits */
+static void embed_scalar_k(const char *data, size_t n, char *image_buffer, int depth)
+{
+    size_t cover = lsb_cover_bytes(depth);
+    unsigned int mask = (1u << depth) - 1;
+    for (size_t i = 0; i < n; i++)
+    {
+        unsigned int value = (unsigned char)data[i] << (cover * depth - 8);  // Pad bits at the end
+        char *dst = image_buffer + cover * i;
+        for (size_t j = 0; j < cover; j++)
+        {
+            unsigned int bits = (value >> (depth * (cover - 1 - j))) & mask;
+            dst[j] = (char)((dst[j] & ~mask) | bits);
+        }
+    }
+}
+
+static void extract_scalar_k(const char *image_buffer, size_t n, char *data, int depth)
+{
+    size_t cover = lsb_cover_bytes(depth);
+    unsigned int mask = (1u << depth) - 1;
+    for (size_t i = 0; i < n; i++)
+    {
+        const char *src = image_buffer + cover * i;
+        unsigned int value = 0;
+        for (size_t j = 0; j < cover; j++)
+            value = (value << depth) | (src[j] & mask);
+        data[i] = (char)(value >> (cover * depth - 8));  // Drop pad bits
+    }
+}
+
+#if LSB_X86
+
+/* Reverse the bit order of every byte value (used where no byte shuffle is available) */
+static unsigned char bit_reverse[256];
+
+static void init_bit_reverse(void)
+{
+    for (int v = 0; v < 256; v++)
+    {
+        unsigned char r = 0;
+        for (int b = 0; b < 8; b++)
+            r |= (unsigned char)(((v >> b) & 1) << (7 - b));
+        bit_reverse[v] = r;
+    }
+}
+
+/* -------------------- SSE2 -------------------- */
+
+__attribute__((target("sse2")))
+static inline void embed_sse2_16(__m128i spread, char *dst)
+{
+    const __m128i bitsel = _mm_setr_epi8((char)0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1,
+                                         (char)0x80, 0x40, 0x20, 0x10, 8, 4, 2, 1);
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(spread, bitsel), bitsel), one);
+    __m128i cover = _mm_loadu_si128((const __m128i *)dst);
+    cover = _mm_or_si128(_mm_andnot_si128(one, cover), bits);   // Clear LSBs, set payload bits
+    _mm_storeu_si128((__m128i *)dst, cover);
+}
+
+__attribute__((target("sse2")))
+static void embed_sse2(const char *data, size_t n, char *image_buffer)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)                    // 16 payload bytes -> 128 cover bytes
+    {
+        __m128i d = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i half[2] = { _mm_unpacklo_epi8(d, d), _mm_unpackhi_epi8(d, d) };
+        char *dst = image_buffer + 8 * i;
+        for (int h = 0; h < 2; h++)
+        {
+            __m128i q0 = _mm_unpacklo_epi16(half[h], half[h]);  // 4 bytes, each x4
+            __m128i q1 = _mm_unpackhi_epi16(half[h], half[h]);
+            embed_sse2_16(_mm_unpacklo_epi32(q0, q0), dst);      // 2 bytes, each x8
+            embed_sse2_16(_mm_unpackhi_epi32(q0, q0), dst + 16);
+            embed_sse2_16(_mm_unpacklo_epi32(q1, q1), dst + 32);
+            embed_sse2_16(_mm_unpackhi_epi32(q1, q1), dst + 48);
+            dst += 64;
+        }
+    }
+    embed_scalar(data + i, n - i, image_buffer + 8 * i);        // Tail
+}
+
+__attribute__((target("sse2")))
+static void extract_sse2(const char *image_buffer, size_t n, char *data)
+{
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2)                      // 16 cover bytes -> 2 payload bytes
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(image_buffer + 8 * i));
+        int mask = _mm_movemask_epi8(_mm_slli_epi16(v, 7));     // Bit j = LSB of cover byte j
+        data[i] = (char)bit_reverse[mask & 0xFF];
+        data[i + 1] = (char)bit_reverse[(mask >> 8) & 0xFF];
+    }
+    extract_scalar(image_buffer + 8 * i, n - i, data + i);      // Tail
+}
+
+/* -------------------- BMI2 -------------------- */
+
+#define LSB_LANE_MASK 0x0101010101010101ULL
+
+__attribute__((target("bmi2")))
+static void embed_bmi2(const char *data, size_t n, char *image_buffer)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t cover;
+        memcpy(&cover, image_buffer + 8 * i, 8);
+        uint64_t bits = _pdep_u64((unsigned char)data[i], LSB_LANE_MASK);  // Bit j -> byte j
+        cover = (cover & ~LSB_LANE_MASK) | __builtin_bswap64(bits);       // MSB -> first byte
+        memcpy(image_buffer + 8 * i, &cover, 8);
+    }
+}
+
+__attribute__((target("bmi2")))
+static void extract_bmi2(const char *image_buffer, size_t n, char *data)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t cover;
+        memcpy(&cover, image_buffer + 8 * i, 8);
+        data[i] = (char)_pext_u64(__builtin_bswap64(cover), LSB_LANE_MASK);
+    }
+}
+
+/* Depth 2: 4 cover bytes per payload byte, depth 4: 2 cover bytes */
+__attribute__((target("bmi2")))
+static void embed_bmi2_k(const char *data, size_t n, char *image_buffer, int depth)
+{
+    if (depth == 2)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            uint32_t cover;
+            memcpy(&cover, image_buffer + 4 * i, 4);
+            uint32_t bits = _pdep_u32((unsigned char)data[i], 0x03030303u);     // Bit pair j -> byte j
+            cover = (cover & ~0x03030303u) | __builtin_bswap32(bits);           // High pair -> first byte
+            memcpy(image_buffer + 4 * i, &cover, 4);
+        }
+    }
+    else if (depth == 4)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            uint16_t cover;
+            memcpy(&cover, image_buffer + 2 * i, 2);
+            uint16_t bits = (uint16_t)_pdep_u32((unsigned char)data[i], 0x0F0Fu);
+            cover = (uint16_t)((cover & ~0x0F0Fu) | __builtin_bswap16(bits));   // High nibble -> first byte
+            memcpy(image_buffer + 2 * i, &cover, 2);
+        }
+    }
+    else
+        embed_scalar_k(data, n, image_buffer, depth);
+}
+
+__attribute__((target("bmi2")))
+static void extract_bmi2_k(const char *image_buffer, size_t n, char *data, int depth)
+{
+    if (depth == 2)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            uint32_t cover;
+            memcpy(&cover, image_buffer + 4 * i, 4);
+            data[i] = (char)_pext_u32(__builtin_bswap32(cover), 0x03030303u);
+        }
+    }
+    else if (depth == 4)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            uint16_t cover;
+            memcpy(&cover, image_buffer + 2 * i, 2);
+            data[i] = (char)_pext_u32(__builtin_bswap16(cover), 0x0F0Fu);
+        }
+    }
+    else
+        extract_scalar_k(image_buffer, n, data, depth);
+}
+
+/* -------------------- AVX2 -------------------- */
+
+__attribute__((target("avx2")))
+static void embed_avx2(const char *data, size_t n, char *image_buffer)
+{
+    const __m256i spread_idx = _mm256_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                                                2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3);
+    const __m256i bitsel = _mm256_set1_epi64x(0x0102040810204080LL);
+    const __m256i one = _mm256_set1_epi8(1);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)                      // 4 payload bytes -> 32 cover bytes
+    {
+        int32_t word;
+        memcpy(&word, data + i, 4);
+        __m256i spread = _mm256_shuffle_epi8(_mm256_set1_epi32(word), spread_idx);
+        __m256i bits = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_and_si256(spread, bitsel), bitsel), one);
+        __m256i cover = _mm256_loadu_si256((const __m256i *)(image_buffer + 8 * i));
+        cover = _mm256_or_si256(_mm256_andnot_si256(one, cover), bits);
+        _mm256_storeu_si256((__m256i *)(image_buffer + 8 * i), cover);
+    }
+    embed_scalar(data + i, n - i, image_buffer + 8 * i);        // Tail
+}
+
+__attribute__((target("avx2")))
+static void extract_avx2(const char *image_buffer, size_t n, char *data)
+{
+    const __m256i reverse_idx = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                                 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)                      // 32 cover bytes -> 4 payload bytes
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(image_buffer + 8 * i));
+        v = _mm256_shuffle_epi8(v, reverse_idx);    // First cover byte of each group -> bit 7
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_slli_epi16(v, 7));
+        memcpy(data + i, &mask, 4);
+    }
+    extract_scalar(image_buffer + 8 * i, n - i, data + i);      // Tail
+}
+
+/* -------------------- AVX-512BW -------------------- */
+
+__attribute__((target("avx512f,avx512bw")))
+static void embed_avx512(const char *data, size_t n, char *image_buffer)
+{
+    const __m512i reverse_idx = _mm512_set4_epi64(0x08090A0B0C0D0E0FLL, 0x0001020304050607LL,
+                                                  0x08090A0B0C0D0E0FLL, 0x0001020304050607LL);
+    const __m512i one = _mm512_set1_epi8(1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)                      // 8 payload bytes -> 64 cover bytes
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        __m512i bits = _mm512_maskz_mov_epi8((__mmask64)word, one);  // Bit j of byte g -> byte 8g+j
+        bits = _mm512_shuffle_epi8(bits, reverse_idx);              // MSB -> first cover byte
+        __m512i cover = _mm512_loadu_si512((const void *)(image_buffer + 8 * i));
+        cover = _mm512_or_si512(_mm512_andnot_si512(one, cover), bits);
+        _mm512_storeu_si512((void *)(image_buffer + 8 * i), cover);
+    }
+    embed_scalar(data + i, n - i, image_buffer + 8 * i);        // Tail
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void extract_avx512(const char *image_buffer, size_t n, char *data)
+{
+    const __m512i reverse_idx = _mm512_set4_epi64(0x08090A0B0C0D0E0FLL, 0x0001020304050607LL,
+                                                  0x08090A0B0C0D0E0FLL, 0x0001020304050607LL);
+    const __m512i one = _mm512_set1_epi8(1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)                      // 64 cover bytes -> 8 payload bytes
+    {
+        __m512i v = _mm512_loadu_si512((const void *)(image_buffer + 8 * i));
+        v = _mm512_shuffle_epi8(v, reverse_idx);
+        uint64_t mask = (uint64_t)_mm512_test_epi8_mask(v, one);
+        memcpy(data + i, &mask, 8);
+    }
+    extract_scalar(image_buffer + 8 * i, n - i, data + i);      // Tail
+}
+
+#endif /* LSB_X86 */
+
+/* -------------------- Dispatch -------------------- */
+
+static const struct
+{
+    const char *name;
+    lsb_embed_fn embed;
+    lsb_extract_fn extract;
+} lsb_table[lsb_isa_count] =
+{
+#if LSB_X86
+    { "scalar", embed_scalar, extract_scalar },
+    { "sse2",   embed_sse2,   extract_sse2 },
+    { "bmi2",   embed_bmi2,   extract_bmi2 },
+    { "avx2",   embed_avx2,   extract_avx2 },
+    { "avx512", embed_avx512, extract_avx512 },
+#else
+    { "scalar", embed_scalar, extract_scalar },
+    { "sse2",   embed_scalar, extract_scalar },
+    { "bmi2",   embed_scalar, extract_scalar },
+    { "avx2",   embed_scalar, extract_scalar },
+    { "avx512", embed_scalar, extract_scalar },
+#endif
+};
+
+static void embed_resolve(const char *data, size_t n, char *image_buffer);
+static void extract_resolve(const char *image_buffer, size_t n, char *data);
+
+static lsb_embed_fn embed_impl = embed_resolve;       // Resolved on first use if lsb_init() was not called
+static lsb_extract_fn extract_impl = extract_resolve;
+static LsbIsa current_isa = lsb_isa_scalar;
+static int depth_resolved = 0;                        // Multi-bit kernels follow the selected variant
+static int bmi2_k = 0;                                // PDEP/PEXT multi-bit kernels in use
+static pthread_once_t detect_once = PTHREAD_ONCE_INIT;
+static LsbIsa best_isa = lsb_isa_scalar;              // Fastest verified variant, set once
+
+int lsb_isa_supported(LsbIsa isa)
+{
+#if LSB_X86
+    __builtin_cpu_init();
+    switch (isa)
+    {
+        case lsb_isa_scalar: return 1;
+        case lsb_isa_sse2:   return __builtin_cpu_supports("sse2");
+        case lsb_isa_bmi2:   return __builtin_cpu_supports("bmi2");
+        case lsb_isa_avx2:   return __builtin_cpu_supports("avx2");
+        case lsb_isa_avx512: return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+        default:             return 0;
+    }
+#else
+    return isa == lsb_isa_scalar;
+#endif
+}
+
+/* PDEP/PEXT are present and fast: the AVX2 and AVX-512 checks do not imply BMI2, and AMD before
+   Zen 3 (families 15h and 17h) runs them as microcode at tens of cycles each */
+static int lsb_bmi2_fast(void)
+{
+#if LSB_X86
+    return __builtin_cpu_supports("bmi2") && !__builtin_cpu_is("amdfam15h") && !__builtin_cpu_is("amdfam17h");
+#else
+    return 0;
+#endif
+}
+
+/* Byte-exact check of a variant against the scalar reference before it is trusted */
+static int lsb_isa_verified(LsbIsa isa, int use_k)
+{
+    char payload[77], out[77];                      // Odd length exercises every tail path
+    char ref[77 * 8], cover[77 * 8];
+
+    for (size_t i = 0; i < sizeof(cover); i++)
+        ref[i] = cover[i] = (char)(i * 131 + 17);
+    for (size_t i = 0; i < sizeof(payload); i++)
+        payload[i] = (char)(i * 197 + 5);
+
+    embed_scalar(payload, sizeof(payload), ref);
+    lsb_table[isa].embed(payload, sizeof(payload), cover);
+    if (memcmp(ref, cover, sizeof(cover)) != 0)
+        return 0;
+
+    lsb_table[isa].extract(cover, sizeof(out), out);
+    if (memcmp(payload, out, sizeof(out)) != 0)
+        return 0;
+
+#if LSB_X86
+    for (int depth = 2; use_k && depth <= LSB_MAX_DEPTH; depth++)  // Multi-bit kernels too
+    {
+        embed_scalar_k(payload, sizeof(payload), ref, depth);
+        embed_bmi2_k(payload, sizeof(payload), cover, depth);
+        if (memcmp(ref, cover, sizeof(cover)) != 0)
+            return 0;
+        extract_bmi2_k(cover, sizeof(out), out, depth);
+        if (memcmp(payload, out, sizeof(out)) != 0)
+            return 0;
+    }
+#endif
+    return 1;
+}
+
+int lsb_select(LsbIsa isa)
+{
+    if (isa >= lsb_isa_count || !lsb_isa_supported(isa))
+        return 0;
+#if LSB_X86
+    if (bit_reverse[1] == 0)                        // Lookup table for the SSE2 extractor
+        init_bit_reverse();
+#endif
+    embed_impl = lsb_table[isa].embed;
+    extract_impl = lsb_table[isa].extract;
+    current_isa = isa;
+    bmi2_k = isa >= lsb_isa_bmi2 && lsb_bmi2_fast();
+    depth_resolved = 1;
+    return 1;
+}
+
+/* Runs once: candidates are verified before any of them is published to embed_impl/extract_impl,
+   so a thread that races past the resolvers never sees an untested kernel */
+static void lsb_detect(void)
+{
+#if LSB_X86
+    if (bit_reverse[1] == 0)
+        init_bit_reverse();
+#endif
+    for (int isa = lsb_isa_count - 1; isa > lsb_isa_scalar; isa--)  // Fastest first
+    {
+        int use_k = isa >= lsb_isa_bmi2 && lsb_bmi2_fast();
+        if (lsb_isa_supported((LsbIsa)isa) && lsb_isa_verified((LsbIsa)isa, use_k))
+        {
+            best_isa = (LsbIsa)isa;
+            break;
+        }
+    }
+    if (!depth_resolved)                            // Keep a variant forced by lsb_select()
+        lsb_select(best_isa);
+}
+
+void lsb_init(void)
+{
+    pthread_once(&detect_once, lsb_detect);
+    lsb_select(best_isa);                           // Also restores the default after lsb_select()
+}
+
+LsbIsa lsb_current_isa(void)
+{
+    return current_isa;
+}
+
+const char *lsb_isa_name(LsbIsa isa)
+{
+    return isa < lsb_isa_count ? lsb_table[isa].name : "unknown";
+}
+
+static void embed_resolve(const char *data, size_t n, char *image_buffer)
+{
+    pthread_once(&detect_once, lsb_detect);
+    embed_impl(data, n, image_buffer);
+}
+
+static void extract_resolve(const char *image_buffer, size_t n, char *data)
+{
+    pthread_once(&detect_once, lsb_detect);
+    extract_impl(image_buffer, n, data);
+}
+
+void lsb_embed_bytes(const char *data, size_t n, char *image_buffer)
+{
+    embed_impl(data, n, image_buffer);
+}
+
+void lsb_extract_bytes(const char *image_buffer, size_t n, char *data)
+{
+    extract_impl(image_buffer, n, data);
+}
+
+size_t lsb_cover_bytes(int depth)
+{
+    return (8 + depth - 1) / depth;                 // 8, 4, 3, 2 for depth 1..4
+}
+
+/* PDEP/PEXT multi-bit kernels are used with every variant from BMI2 up, where the CPU runs them fast */
+static int use_bmi2_k(void)
+{
+    pthread_once(&detect_once, lsb_detect);
+    return bmi2_k;
+}
+
+void lsb_embed_bytes_k(const char *data, size_t n, char *image_buffer, int depth)
+{
+    if (depth <= 1)
+        embed_impl(data, n, image_buffer);
+#if LSB_X86
+    else if (use_bmi2_k())
+        embed_bmi2_k(data, n, image_buffer, depth);
+#endif
+    else
+        embed_scalar_k(data, n, image_buffer, depth);
+}
+
+void lsb_extract_bytes_k(const char *image_buffer, size_t n, char *data, int depth)
+{
+    if (depth <= 1)
+        extract_impl(image_buffer, n, data);
+#if LSB_X86
+    else if (use_bmi2_k())
+        extract_bmi2_k(image_buffer, n, data, depth);
+#endif
+    else
+        extract_scalar_k(image_buffer, n, data, depth);
+}
@@ -0,0 +1,64 @@
+#ifndef LSB_H
+#define LSB_H
+
+#include <stddef.h>         // size_t
+
+/*
+ * Bulk LSB kernels
+ * Every payload byte is spread MSB first over the least significant
+ * bits of 8 consecutive cover bytes, exactly like encode_byte_to_lsb()
+ * and decode_byte_from_lsb() do for a single byte.
+ * The best implementation for the running CPU is picked once by lsb_init()
+ */
+
+/* Instruction set variants of the kernels, ordered from slowest to fastest */
+typedef enum
+{
+    lsb_isa_scalar,          // Portable C loop
+    lsb_isa_sse2,            // 16 cover bytes per step
+    lsb_isa_bmi2,            // PDEP/PEXT on 8 cover bytes at a time
+    lsb_isa_avx2,            // 32 cover bytes per step
+    lsb_isa_avx512,          // 64 cover bytes per step (AVX-512BW)
+    lsb_isa_count
+} LsbIsa;
+
+/* Select the fastest kernel supported by this CPU (CPUID), detection runs once and is thread safe */
+void lsb_init(void);
+
+/* Force a given kernel variant, returns 0 if the CPU does not support it */
+int lsb_select(LsbIsa isa);
+
+/* Check if the CPU supports a kernel variant */
+int lsb_isa_supported(LsbIsa isa);
+
+/* Currently selected kernel variant */
+LsbIsa lsb_current_isa(void);
+
+/* Printable name of a kernel variant */
+const char *lsb_isa_name(LsbIsa isa);
+
+/* Embed n payload bytes into the LSBs of 8*n cover bytes (in place) */
+void lsb_embed_bytes(const char *data, size_t n, char *image_buffer);
+
+/* Extract n payload bytes from the LSBs of 8*n cover bytes */
+void lsb_extract_bytes(const char *image_buffer, size_t n, char *data);
+
+/*
+ * Multi-bit depth (1..4 LSBs per cover byte)
+ * Every payload byte takes lsb_cover_bytes(depth) cover bytes: 8, 4, 3 or 2.
+ * Bits are still stored MSB first; at depth 3 the last cover byte of each
+ * payload byte carries one padding bit so payload bytes stay aligned to
+ * cover bytes (tiles and offsets remain simple multiples)
+ */
+#define LSB_MAX_DEPTH 4
+
+/* Cover bytes used per payload byte at a given depth */
+size_t lsb_cover_bytes(int depth);
+
+/* Embed n payload bytes into n*lsb_cover_bytes(depth) cover bytes (in place) */
+void lsb_embed_bytes_k(const char *data, size_t n, char *image_buffer, int depth);
+
+/* Extract n payload bytes from n*lsb_cover_bytes(depth) cover bytes */
+void lsb_extract_bytes_k(const char *image_buffer, size_t n, char *data, int depth);
+
+#endif
@@ -0,0 +1,248 @@
+#include <stdlib.h>             // Whole payload buffer
+#include <string.h>             // memcpy, memset
+#include <stdint.h>             // Fixed width loads
+#include "lz.h"                 // Codec declarations
+#include "crc32c.h"             // Checksum of the blocks as they are compressed
+
+#define MIN_MATCH 4             // Shortest match worth a token + offset
+#define LAST_LITERALS 5         // Every block ends with at least this many literals
+#define MATCH_LIMIT 12          // No match starts in the last MATCH_LIMIT bytes
+#define HASH_LOG 12             // 4096 entry match finder (fits in L1)
+#define SKIP_TRIGGER 6          // Step grows by 1 every 2^SKIP_TRIGGER misses on incompressible data
+#define RAW_FLAG 0x80000000u
+
+static uint32_t read32(const unsigned char *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t read64(const unsigned char *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash4(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - HASH_LOG);
+}
+
+/* Length of the common prefix of p and match, p never passes limit */
+static size_t count_match(const unsigned char *p, const unsigned char *match, const unsigned char *limit)
+{
+    const unsigned char *start = p;
+    while (p + 8 <= limit)
+    {
+        uint64_t diff = read64(p) ^ read64(match);
+        if (diff)
+            return p - start + (__builtin_ctzll(diff) >> 3);  // Little endian: first differing byte
+        p += 8;
+        match += 8;
+    }
+    while (p < limit && *p == *match)
+    {
+        p++;
+        match++;
+    }
+    return p - start;
+}
+
+/* Length above a 4-bit token field: runs of 255 and a final byte below 255 */
+static unsigned char *write_length(unsigned char *op, size_t length)
+{
+    while (length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (unsigned char)length;
+    return op;
+}
+
+/* One sequence: literals, then a match (match_len 0 for the closing literals) */
+static unsigned char *write_sequence(unsigned char *op, const unsigned char *literals, size_t literal_len,
+                                     size_t offset, size_t match_len)
+{
+    unsigned char *token = op++;
+    size_t match_code = match_len ? match_len - MIN_MATCH : 0;
+
+    *token = (unsigned char)((literal_len < 15 ? literal_len : 15) << 4);
+    if (literal_len >= 15)
+        op = write_length(op, literal_len - 15);
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+    if (match_len == 0)
+        return op;
+
+    *op++ = (unsigned char)offset;                               // Offset, little endian
+    *op++ = (unsigned char)(offset >> 8);
+    *token |= (unsigned char)(match_code < 15 ? match_code : 15);
+    if (match_code >= 15)
+        op = write_length(op, match_code - 15);
+    return op;
+}
+
+/* Greedy single pass compressor, positions fit 16 bits because blocks are at most 64 KB */
+static size_t compress_body(const unsigned char *src, size_t n, unsigned char *dst)
+{
+    uint16_t table[1 << HASH_LOG];
+    const unsigned char *ip = src, *anchor = src, *iend = src + n;
+    unsigned char *op = dst;
+
+    if (n > MATCH_LIMIT)
+    {
+        const unsigned char *match_start_limit = iend - MATCH_LIMIT;
+        const unsigned char *match_end_limit = iend - LAST_LITERALS;
+        uint32_t misses = 1u << SKIP_TRIGGER;
+
+        memset(table, 0, sizeof(table));                         // Empty slots point at byte 0, verified below
+        ip++;
+        while (ip < match_start_limit)
+        {
+            uint32_t sequence = read32(ip);
+            uint32_t h = hash4(sequence);
+            const unsigned char *match = src + table[h];
+            table[h] = (uint16_t)(ip - src);
+
+            if (match >= ip || read32(match) != sequence)
+            {
+                ip += misses++ >> SKIP_TRIGGER;                  // Skip faster through data that does not compress
+                continue;
+            }
+            while (ip > anchor && match > src && ip[-1] == match[-1])  // Extend backwards over pending literals
+            {
+                ip--;
+                match--;
+            }
+            size_t length = MIN_MATCH + count_match(ip + MIN_MATCH, match + MIN_MATCH, match_end_limit);
+            op = write_sequence(op, anchor, ip - anchor, ip - match, length);
+            ip += length;
+            anchor = ip;
+            misses = 1u << SKIP_TRIGGER;
+            if (ip < match_start_limit)
+                table[hash4(read32(ip - 2))] = (uint16_t)(ip - 2 - src);  // Cheap extra entry inside the match
+        }
+    }
+    return write_sequence(op, anchor, iend - anchor, 0, 0) - dst;  // Closing literals
+}
+
+size_t lz_compress_block(const char *src, size_t n, char *dst)
+{
+    unsigned char *body = (unsigned char *)dst + LZ_HEADER;
+    size_t size = compress_body((const unsigned char *)src, n, body);
+    uint32_t header = (uint32_t)size;
+
+    if (size >= n)                                               // Did not shrink: keep the block raw
+    {
+        memcpy(body, src, n);
+        size = n;
+        header = (uint32_t)n | RAW_FLAG;
+    }
+    dst[0] = (char)(header >> 24);
+    dst[1] = (char)(header >> 16);
+    dst[2] = (char)(header >> 8);
+    dst[3] = (char)header;
+    return LZ_HEADER + size;
+}
+
+char *lz_compress_payload(const char *payload, size_t size, size_t *packed, uint32_t *crc)
+{
+    size_t blocks = (size + LZ_BLOCK - 1) / LZ_BLOCK;
+    char *buf = malloc(blocks * LZ_BLOCK_BOUND);
+
+    *packed = 0;
+    if (crc) *crc = 0;
+    for (size_t b = 0; (buf || crc) && b < blocks; b++)
+    {
+        const char *block = payload + b * LZ_BLOCK;
+        size_t count = size - b * LZ_BLOCK < LZ_BLOCK ? size - b * LZ_BLOCK : LZ_BLOCK;
+        if (buf) *packed += lz_compress_block(block, count, buf + *packed);
+        if (crc) *crc = crc32c_update(*crc, block, count);    // While the block is in cache
+    }
+    if (buf && *packed < size)
+        return buf;
+    free(buf);
+    return NULL;
+}
+
+size_t lz_block_size(const char *header, int *raw)
+{
+    const unsigned char *h = (const unsigned char *)header;
+    uint32_t value = (uint32_t)h[0] << 24 | (uint32_t)h[1] << 16 | (uint32_t)h[2] << 8 | h[3];
+    *raw = (value & RAW_FLAG) != 0;
+    return value & ~RAW_FLAG;
+}
+
+/* Length above a 4-bit token field, 0 if the input ends inside it */
+static int read_length(const unsigned char **ip, const unsigned char *iend, size_t *length)
+{
+    unsigned char b;
+    do
+    {
+        if (*ip >= iend) return 0;
+        b = *(*ip)++;
+        *length += b;
+    } while (b == 255);
+    return 1;
+}
+
+Status lz_decompress_block(const char *body, size_t n, int raw, char *dst, size_t out_len)
+{
+    const unsigned char *ip = (const unsigned char *)body, *iend = ip + n;
+    unsigned char *op = (unsigned char *)dst, *oend = op + out_len;
+
+    if (raw)
+    {
+        if (n != out_len) return e_failure;
+        memcpy(dst, body, n);
+        return e_success;
+    }
+
+    for (;;)
+    {
+        if (ip >= iend) return e_failure;
+        unsigned token = *ip++;
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !read_length(&ip, iend, &literal_len)) return e_failure;
+        if (literal_len > (size_t)(iend - ip) || literal_len > (size_t)(oend - op)) return e_failure;
+        if (literal_len <= 16 && iend - ip >= 16 && oend - op >= 16)
+            memcpy(op, ip, 16);                                  // Short literals: one fixed size copy
+        else
+            memcpy(op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+        if (ip == iend)                                          // Closing literals
+            return op == oend ? e_success : e_failure;
+
+        if (iend - ip < 2) return e_failure;
+        size_t offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15 && !read_length(&ip, iend, &match_len)) return e_failure;
+        match_len += MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - (unsigned char *)dst) || match_len > (size_t)(oend - op))
+            return e_failure;                                    // Corrupt block
+
+        const unsigned char *match = op - offset;
+        unsigned char *end = op + match_len;
+        if (offset >= 16 && oend - end >= 16)                    // Wild copy, 16 bytes at a time
+        {
+            do
+            {
+                memcpy(op, match, 16);
+                op += 16;
+                match += 16;
+            } while (op < end);
+        }
+        else                                                     // Overlapping (run length) or near the end
+        {
+            while (op < end)
+                *op++ = *match++;
+        }
+        op = end;
+    }
+}
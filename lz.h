@@ -0,0 +1,37 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stddef.h>         // size_t
+#include <stdint.h>         // uint32_t
+#include "types.h"          // Status
+
+/*
+ * Payload compression (-z)
+ * A byte oriented LZ77 codec in the LZ4 family: no entropy stage, every
+ * sequence is a token, literals copied as is and a 16-bit match offset,
+ * so decoding is little more than memcpy. The secret is cut into
+ * independent LZ_BLOCK blocks, each stored as a 32-bit big endian header
+ * (bit 31 set for a block kept raw, low bits the stored length) followed
+ * by the block body. Independent blocks can be compressed and
+ * decompressed on several threads and streamed one at a time; the raw
+ * size of every block is implied by the secret size
+ */
+
+#define LZ_BLOCK (64 * 1024)                                // Raw bytes per block (last one may be shorter)
+#define LZ_HEADER 4                                         // Block header bytes
+#define LZ_BLOCK_BOUND (LZ_HEADER + LZ_BLOCK + LZ_BLOCK / 255 + 16)  // Largest stored block
+
+/* Compress n (<= LZ_BLOCK) bytes into dst as one block with header, returns the stored size */
+size_t lz_compress_block(const char *src, size_t n, char *dst);
+
+/* Compress size bytes block by block into a new buffer (free() it), NULL if they do not shrink (or no memory).
+   crc, when not NULL, is set to the CRC32C of the payload, taken block by block in the same pass */
+char *lz_compress_payload(const char *payload, size_t size, size_t *packed, uint32_t *crc);
+
+/* Stored body length of a block from its header, *raw is set for blocks kept uncompressed */
+size_t lz_block_size(const char *header, int *raw);
+
+/* Decompress a block body of n bytes into exactly out_len bytes at dst */
+Status lz_decompress_block(const char *body, size_t n, int raw, char *dst, size_t out_len);
+
+#endif
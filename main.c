@@ -3,32 +3,154 @@
 #include "types.h"               // Custom type definitions (Status, OperationType)
 #include "types1.h"              // Custom type definitions for decoding (Status1)
 #include <string.h>              // String manipulation functions
+#include <stdlib.h>              // atoi, strtoull
+#include <stdint.h>              // SIZE_MAX
 #include "decode.h"              // Decoding function declarations
+#include "lsb.h"                 // Bulk LSB kernels (runtime ISA dispatch)
+#include "chacha.h"              // Payload cipher (runtime ISA dispatch)
+#include "batch.h"               // Manifest driven batch mode
+#include "stats.h"               // --stats=json
+#include "inspect.h"             // -i inspect mode
+#include "iobackend.h"           // --io / --qd
+#include "daemon.h"              // -D stegd mode
+#include "archive.h"             // -c / -t / -x archive payloads
+#include "shard.h"               // -s / -r sharded payloads
+#include "cover.h"               // Cover image names (-c)
 
 void interactive_mode(); // Function prototype
 
 OperationType check_operation_type(char *); // Function prototype to check -e or -d
 
+int parse_options(int argc, char *argv[], StegOptions *opts); // Function prototype to strip option flags
+
+void emit_stats(StegStats *stats, const StegOptions *opts, int succeeded); // Function prototype to write --stats
+
+Status parse_range(const char *arg, size_t *offset, size_t *length); // Function prototype to read --range
+
+void set_encode_options(EncodeInfo *encInfo, const StegOptions *opts, StegStats *run_stats); // Function prototype to apply options
+
+int encode_archive(int argc, char *argv[], const StegOptions *opts, StegStats *run_stats); // Function prototype of -c
+
 int main(int argc, char *argv[])
 {
-    EncodeInfo encInfo;             // Declare encoding information structure
+    EncodeInfo encInfo = {0};       // Declare encoding information structure
+    StegOptions opts = {0};         // Options given after -e/-d
+    StegStats stats;                // Filled only with --stats
+    StegStats *run_stats = NULL;
+
+    lsb_init();                     // Pick the fastest LSB kernels for this CPU once
+    chacha_init();                  // And the fastest cipher kernel
+    argc = parse_options(argc, argv, &opts); // Remove option flags, keep file names in place
+
+    if (opts.bit_depth < 0 || opts.bit_depth > LSB_MAX_DEPTH) // Only 1..4 LSBs per cover byte
+    {
+        printf("Error: -k must be between 1 and %d\n", LSB_MAX_DEPTH);
+        return 1;
+    }
+
+    if (opts.range < 0)             // Malformed --range
+    {
+        printf("Error: --range must be offset:length or offset: (byte counts)\n");
+        return 1;
+    }
+
+    if (opts.scatter && opts.key_fname == NULL) // The run order is derived from the key
+    {
+        printf("Error: --scatter needs a key file (-K)\n");
+        return 1;
+    }
+
+    if (opts.io_backend < 0)        // Unknown --io name
+    {
+        printf("Error: --io must be auto, uring, threads or sync\n");
+        return 1;
+    }
+    if (opts.io_backend == io_backend_uring) // Asked for explicitly: fail now instead of silently blocking
+    {
+        IoQueue *probe = io_queue_create(io_backend_uring, 1);
+        if (probe == NULL)
+        {
+            printf("Error: io_uring is not available on this system (use --io=threads)\n");
+            return 1;
+        }
+        io_queue_destroy(probe);
+    }
+
+    if (opts.stats)
+        run_stats = &stats;
+
+    if (argc == 3 && check_operation_type(argv[1]) == e_batch) // Many jobs from one manifest
+    {
+        stats_start(run_stats, "batch");
+        Status res = run_batch(argv[2], &opts);
+        emit_stats(run_stats, &opts, res == e_success);
+        return res == e_success ? 0 : 1;
+    }
+
+    if (argc >= 3 && check_operation_type(argv[1]) == e_inspect) // Header-only scan, nothing is written
+    {
+        return run_inspect(argc - 2, argv + 2, &opts) == e_success ? 0 : 1;
+    }
+
+    if (argc == 3 && check_operation_type(argv[1]) == e_daemon) // Long running worker pool
+    {
+        return run_daemon(argv[2], &opts) == e_success ? 0 : 1;
+    }
+
+    if (argc >= 4 && check_operation_type(argv[1]) == e_archive) // Many secret files, one encode
+    {
+        return encode_archive(argc, argv, &opts, run_stats);
+    }
+
+    if (argc == 3 && check_operation_type(argv[1]) == e_list) // Archive TOC only
+    {
+        return run_archive_list(argv[2], &opts) == e_success ? 0 : 1;
+    }
+
+    if (argc >= 4 && check_operation_type(argv[1]) == e_extract) // Only the entries asked for are decoded
+    {
+        return run_archive_extract(argv[2], argv[3], argv + 4, argc - 4, &opts) == e_success ? 0 : 1;
+    }
+
+    if (argc >= 5 && check_operation_type(argv[1]) == e_shard) // One secret over many covers
+    {
+        return run_shard_encode(argv[2], argv[3], argv + 4, argc - 4, &opts) == e_success ? 0 : 1;
+    }
+
+    if (argc >= 4 && check_operation_type(argv[1]) == e_rebuild) // Any k of the n shard images
+    {
+        return run_shard_decode(argv[2], argv + 3, argc - 3, &opts) == e_success ? 0 : 1;
+    }
 
     if (argc == 4 || argc == 5)     // Check correct number of command-line arguments
     {
         OperationType res = check_operation_type(argv[1]); // Determine operation type
         if (res == e_encode)        // If encoding mode selected
         {
+            if (opts.in_place && argc == 5)    // The cover is the output
+            {
+                printf("Error: --inplace embeds into the source image, no output file may be given\n");
+                return e_failure;
+            }
+            set_encode_options(&encInfo, &opts, run_stats);
             Status res = read_and_validate_encode_args(argv, &encInfo); // Validate input/output files
             if (res == e_success)   // If validation successful
             {
+                stats_start(run_stats, "encode");
                 res = do_encoding(&encInfo); // Perform encoding
-                if (res == e_success)       // If encoding succeeds
-                    printf("Encoding the secret data successfully!\n");
-                else                        // If encoding fails
+                if (run_stats)
+                {
+                    stats.payload_bytes = encInfo.size_secret_file;
+                    stats.bit_depth = encInfo.bit_depth;
+                }
+                emit_stats(run_stats, &opts, res == e_success);
+                if (res == e_failure)          // If encoding fails
                 {
                     printf("Error: Encoding stop!\n");
                     return e_failure;
                 }
+                if (!opts.quiet)            // If encoding succeeds
+                    printf("Encoding the secret data successfully!\n");
             }
             else                         // Validation failed
             {
@@ -38,18 +160,36 @@ int main(int argc, char *argv[])
         }
         else if (res == e_decode)       // If decoding mode selected
         {
-            DecodeInfo decInfo;          // Declare decoding information structure
+            DecodeInfo decInfo = {0};    // Declare decoding information structure
+            decInfo.use_mmap = opts.use_mmap;  // Extract from mapped files if requested
+            decInfo.preallocate = opts.preallocate; // Reserve output space up front if requested
+            decInfo.threads = opts.threads;    // Split the payload region into tiles if requested
+            decInfo.io_backend = opts.io_backend; // Asynchronous tile I/O
+            decInfo.io_depth = opts.io_depth;
+            decInfo.key_fname = opts.key_fname; // Key of encrypted payloads
+            decInfo.quiet = opts.quiet;        // No per-stage messages with -q
+            decInfo.range = opts.range;        // Only a slice of the secret with --range
+            decInfo.range_offset = opts.range_offset;
+            decInfo.range_length = opts.range_length;
+            decInfo.stats = run_stats;         // Per-stage timing with --stats
             Status1 res = read_and_validate_decode_file(argv, &decInfo); // Validate files for decoding
             if (res == d_success)       // If validation successful
             {
+                stats_start(run_stats, "decode");
                 res = do_decoding(&decInfo); // Perform decoding
-                if (res == d_success)       // If decoding succeeds
-                    printf("Decoding successful!\n");
-                else                        // If decoding fails
+                if (run_stats)
+                {
+                    stats.payload_bytes = decInfo.size_secret_file;
+                    stats.bit_depth = decInfo.bit_depth;
+                }
+                emit_stats(run_stats, &opts, res == d_success);
+                if (res == d_failure)          // If decoding fails (the failing step printed why)
                 {
-                    printf("Error: decode_secret_file_data failure!\n");
+                    printf("Error: Decoding stop!\n");
                     return e_failure;
                 }
+                if (!opts.quiet)            // If decoding succeeds
+                    printf("Decoding successful!\n");
             }
             else                          // Validation failed
             {
@@ -66,7 +206,32 @@ int main(int argc, char *argv[])
     else                                 // Incorrect number of arguments
     {
          printf(" Error: Incorrect number of arguments.\n");
-        printf("Usage: %s <-e/-d> <source_image> <secret_file/output_file>\n", argv[0]);
+        printf("Usage: %s <-e/-d> [-m] [-p] [-j N] [-k N] [-a] [-z] [-K keyfile [--scatter]] [-q] [--crc] [--clone | --inplace] [--io=NAME] [--qd N] [--range offset:length] [--stats=json[:file]] <source_image> <secret_file/output_file>\n", argv[0]);
+        printf("  images: uncompressed 24/32-bit .bmp or .tga, 8-bit grey .tga, binary .pgm/.ppm/.pnm (maxval 255), 8-bit grey/RGB/RGBA .png; the stego image keeps the cover's format\n");
+        printf("  -m  use memory mapped files instead of stdio\n");
+        printf("  -p  preallocate the decoded output file\n");
+        printf("  -j N  embed/extract the payload with N threads\n");
+        printf("  -k N  embed N (1-4) bits per cover byte, decoding detects it\n");
+        printf("  -a  also embed in the alpha byte of 32-bit covers, decoding detects it\n");
+        printf("  -z  LZ compress the secret before embedding, decoding detects it\n");
+        printf("  -K keyfile  encrypt / decrypt the payload with ChaCha20 (key: 32 bytes or 64 hex digits)\n");
+        printf("  -q  no per-stage messages (errors are still printed)\n");
+        printf("  --scatter  with -K: spread the payload over the whole image in 12 KB runs in a keyed order, decoding detects it\n");
+        printf("  --crc  store a CRC32C of the secret after the payload, checked by decoding and -i --verify (\"#+\" format, not read by older versions)\n");
+        printf("  --clone  stego image starts as a reflink / kernel copy of the cover, only the payload span is written\n");
+        printf("  --inplace  embed into the source image itself (no output file), only the payload span is written\n");
+        printf("  --io=auto|uring|threads|sync  I/O backend of the -j tiles and batch jobs (auto: io_uring, else threads)\n");
+        printf("  --range offset:length  decode only these secret bytes (offset: for the rest), earlier bytes are skipped\n");
+        printf("  --qd N  I/O requests of %d KB in flight per thread (default %d)\n", IO_CHUNK / 1024, IO_DEFAULT_DEPTH);
+        printf("  --stats=json[:file]  per-stage time, I/O counters and peak RSS as JSON to stderr or file\n");
+        printf("       %s -i [-j N] [-q] [--verify [-K keyfile]] <stego_image/directory>...   report payload metadata (--verify: check every payload checksum), writes nothing\n", argv[0]);
+        printf("       %s -b <manifest.csv> [-m] [-p] [-j N] [-k N] [-a] [-z] [-K keyfile [--scatter]] [-q] [--clone | --inplace] [--io=NAME] [--qd N] [--stats=json[:file]]   run many jobs in one process\n", argv[0]);
+        printf("       %s -c [encode options] <cover.bmp> <stego.bmp> <file>...   embed many files as one archive payload\n", argv[0]);
+        printf("       %s -t [-K keyfile] <stego.bmp>   list the archive (only its table of contents is decoded)\n", argv[0]);
+        printf("       %s -x [-K keyfile] [-q] <stego.bmp> <dir> [name...]   extract all or the named archive entries into dir\n", argv[0]);
+        printf("       %s -s [-j N] [-k N] [-a] [-z] [-K keyfile [--scatter]] [--parity M] <secret_file> <dir> <cover.bmp>...   split the secret over the covers into dir, any all-but-M rebuild it\n", argv[0]);
+        printf("       %s -r [-j N] [-K keyfile] [-q] <output_file> <stego.bmp>...   rebuild a split secret from its shard images\n", argv[0]);
+        printf("       %s -D <socket> [-j N] [-q]   stegd: serve encode / decode / inspect requests on a Unix socket with N warm workers\n", argv[0]);
         interactive_mode(); // calling func
     }
 }
@@ -78,9 +243,170 @@ OperationType check_operation_type(char *symbol)
         return e_encode;               // Return encoding operation
     else if (strcmp("-d", symbol) == 0) // If "-d" entered
         return e_decode;               // Return decoding operation
+    else if (strcmp("-b", symbol) == 0) // If "-b" entered
+        return e_batch;                // Return batch operation
+    else if (strcmp("-i", symbol) == 0) // If "-i" entered
+        return e_inspect;              // Return inspect operation
+    else if (strcmp("-D", symbol) == 0) // If "-D" entered
+        return e_daemon;               // Return daemon operation
+    else if (strcmp("-c", symbol) == 0) // If "-c" entered
+        return e_archive;              // Return archive encode operation
+    else if (strcmp("-t", symbol) == 0) // If "-t" entered
+        return e_list;                 // Return archive list operation
+    else if (strcmp("-x", symbol) == 0) // If "-x" entered
+        return e_extract;              // Return archive extract operation
+    else if (strcmp("-s", symbol) == 0) // If "-s" entered
+        return e_shard;                // Return shard encode operation
+    else if (strcmp("-r", symbol) == 0) // If "-r" entered
+        return e_rebuild;              // Return shard rebuild operation
     else                               // If neither
         return e_unsupported;          // Return unsupported operation
 }
+/* Function to copy the command line options into an encode */
+void set_encode_options(EncodeInfo *encInfo, const StegOptions *opts, StegStats *run_stats)
+{
+    encInfo->use_mmap = opts->use_mmap;  // Embed directly in mapped files if requested
+    encInfo->patch = opts->clone;        // Clone the cover, write only the payload span
+    encInfo->in_place = opts->in_place;  // Embed into the cover itself
+    encInfo->threads = opts->threads;    // Split the payload region into tiles if requested
+    encInfo->io_backend = opts->io_backend; // Asynchronous tile I/O
+    encInfo->io_depth = opts->io_depth;
+    encInfo->bit_depth = opts->bit_depth; // LSBs per cover byte (0 = original 1 bit format)
+    encInfo->use_alpha = opts->use_alpha; // Alpha bytes of 32-bit covers carry payload too
+    encInfo->compress = opts->compress;   // LZ compress the secret first
+    encInfo->key_fname = opts->key_fname; // Encrypt the payload with this key
+    encInfo->use_crc = opts->checksum;   // CRC32C trailer with --crc
+    encInfo->scatter = opts->scatter;    // Keyed run order with --scatter
+    encInfo->quiet = opts->quiet;        // No per-stage messages with -q
+    encInfo->stats = run_stats;          // Per-stage timing with --stats
+}
+
+/* Function to encode -c cover.bmp stego.bmp file... (no stego.bmp with --inplace) as one archive payload */
+int encode_archive(int argc, char *argv[], const StegOptions *opts, StegStats *run_stats)
+{
+    EncodeInfo encInfo = {0};
+    int first = opts->in_place ? 3 : 4;  // First secret file
+    int format = argc > first ? cover_name_format(argv[2]) : -1;
+
+    if (format < 0 || (!opts->in_place && cover_name_format(argv[3]) != format))  // Stego image keeps the cover's format
+    {
+        printf("Error: -c needs <cover.bmp> <stego.bmp> <file>... (no stego image with --inplace)\n");
+        return 1;
+    }
+    set_encode_options(&encInfo, opts, run_stats);
+    encInfo.src_image_fname = argv[2];
+    encInfo.stego_image_fname = opts->in_place ? argv[2] : argv[3];
+    encInfo.archive_files = argv + first;
+    encInfo.archive_count = argc - first;
+
+    stats_start(run_stats, "encode");
+    Status res = do_encoding(&encInfo);
+    if (run_stats)
+    {
+        run_stats->payload_bytes = encInfo.size_secret_file;
+        run_stats->bit_depth = encInfo.bit_depth;
+    }
+    emit_stats(run_stats, opts, res == e_success);
+    if (res == e_failure)
+    {
+        printf("Error: Encoding stop!\n");
+        return 1;
+    }
+    if (!opts->quiet)
+        printf("Encoded %d files into %s\n", encInfo.archive_count, encInfo.stego_image_fname);
+    return 0;
+}
+
+/* Function to stop the --stats clock and write the JSON object (does nothing without --stats) */
+void emit_stats(StegStats *stats, const StegOptions *opts, int succeeded)
+{
+    if (stats == NULL)
+        return;
+    stats_stop(stats);
+    stats->threads = opts->threads;
+    stats->use_mmap = opts->use_mmap;
+    if (stats_write_json(stats, opts->stats_file, succeeded) == e_failure)
+        printf("Error: Cannot write stats to %s\n", opts->stats_file);
+}
+
+/* Function to read "offset:length" (or "offset:" for the rest of the secret) of --range */
+Status parse_range(const char *arg, size_t *offset, size_t *length)
+{
+    char *end;
+
+    if (*arg < '0' || *arg > '9')
+        return e_failure;
+    *offset = strtoull(arg, &end, 10);
+    if (*end++ != ':')
+        return e_failure;
+    if (*end == '\0')
+    {
+        *length = SIZE_MAX;            // To the end of the secret
+        return e_success;
+    }
+    if (*end < '0' || *end > '9')
+        return e_failure;
+    *length = strtoull(end, &end, 10);
+    return *end == '\0' ? e_success : e_failure;
+}
+
+/* Function to remove option flags from argv, returns the new argument count */
+int parse_options(int argc, char *argv[], StegOptions *opts)
+{
+    int kept = argc > 2 ? 2 : argc;    // Program name and -e/-d always stay
+    for (int i = kept; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-m") == 0)    // Memory mapped mode
+            opts->use_mmap = 1;
+        else if (strcmp(argv[i], "-p") == 0)    // Preallocate decoded output
+            opts->preallocate = 1;
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)  // Worker threads
+            opts->threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc)  // Bit depth
+            opts->bit_depth = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-a") == 0)    // Embed in alpha bytes
+            opts->use_alpha = 1;
+        else if (strcmp(argv[i], "-z") == 0)    // Compress the payload
+            opts->compress = 1;
+        else if (strcmp(argv[i], "-K") == 0 && i + 1 < argc)  // Key file
+            opts->key_fname = argv[++i];
+        else if (strcmp(argv[i], "--clone") == 0)    // Patch-only stego output
+            opts->clone = 1;
+        else if (strcmp(argv[i], "--inplace") == 0)  // Embed into the cover
+            opts->in_place = 1;
+        else if (strcmp(argv[i], "--crc") == 0)      // Checksum trailer (extended format)
+            opts->checksum = 1;
+        else if (strcmp(argv[i], "--verify") == 0)   // -i reads the payloads back
+            opts->verify = 1;
+        else if (strcmp(argv[i], "--scatter") == 0)  // Keyed payload order
+            opts->scatter = 1;
+        else if (strncmp(argv[i], "--io=", 5) == 0)  // I/O backend of the tiles
+        {
+            IoBackend backend;
+            opts->io_backend = io_backend_parse(argv[i] + 5, &backend) == e_success ? (int)backend : -1;
+        }
+        else if (strcmp(argv[i], "--range") == 0 && i + 1 < argc)  // Partial extraction
+            opts->range = parse_range(argv[++i], &opts->range_offset, &opts->range_length) == e_success ? 1 : -1;
+        else if (strcmp(argv[i], "--parity") == 0 && i + 1 < argc)  // Parity shards of -s
+            opts->parity = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--qd") == 0 && i + 1 < argc)  // I/O queue depth
+            opts->io_depth = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-q") == 0)    // Quiet
+            opts->quiet = 1;
+        else if (strcmp(argv[i], "--stats=json") == 0)        // Stats to stderr
+            opts->stats = 1;
+        else if (strncmp(argv[i], "--stats=json:", 13) == 0 && argv[i][13]) // Stats to a file
+        {
+            opts->stats = 1;
+            opts->stats_file = argv[i] + 13;
+        }
+        else
+            argv[kept++] = argv[i];        // Positional argument, keep it
+    }
+    argv[kept] = NULL;                 // Validators check for a missing optional name
+    return kept;
+}
+
 // -------------------- Interactive function --------------------
 void interactive_mode()
 {
@@ -0,0 +1,67 @@
+#include <stdio.h>              // FILE, fileno
+#include "mapping.h"            // MappedFile declarations
+
+#ifndef _WIN32
+#include <sys/mman.h>           // mmap, munmap, madvise
+#include <sys/stat.h>           // fstat
+#include <unistd.h>             // ftruncate
+#endif
+
+/* Map an already opened file read only */
+Status map_file_read(FILE *fptr, MappedFile *map)
+{
+#ifndef _WIN32
+    struct stat st;
+    map->data = NULL;
+    map->size = 0;
+    if (fstat(fileno(fptr), &st) != 0)      // Get the file size from metadata
+        return e_failure;
+    if (st.st_size == 0)                    // Nothing to map, an empty view is valid
+        return e_success;
+
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fptr), 0);
+    if (addr == MAP_FAILED) { perror("mmap"); return e_failure; }
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);  // Encoder and decoder walk the file front to back
+
+    map->data = addr;
+    map->size = st.st_size;
+    return e_success;
+#else
+    (void)fptr; (void)map;
+    return e_failure;                       // Not available on this platform
+#endif
+}
+
+/* Resize an already opened (writable) file to size bytes and map it read/write */
+Status map_file_write(FILE *fptr, size_t size, MappedFile *map)
+{
+#ifndef _WIN32
+    map->data = NULL;
+    map->size = 0;
+    fflush(fptr);                           // Nothing buffered may land after the mapping
+    if (ftruncate(fileno(fptr), size) != 0) { perror("ftruncate"); return e_failure; }
+    if (size == 0)
+        return e_success;
+
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(fptr), 0);
+    if (addr == MAP_FAILED) { perror("mmap"); return e_failure; }
+
+    map->data = addr;
+    map->size = size;
+    return e_success;
+#else
+    (void)fptr; (void)size; (void)map;
+    return e_failure;                       // Not available on this platform
+#endif
+}
+
+/* Release a mapping (does nothing if nothing is mapped) */
+void unmap_file(MappedFile *map)
+{
+#ifndef _WIN32
+    if (map->data != NULL)
+        munmap(map->data, map->size);
+#endif
+    map->data = NULL;
+    map->size = 0;
+}
@@ -0,0 +1,28 @@
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include <stdio.h>          // FILE
+#include <stddef.h>         // size_t
+#include "types.h"          // Status
+
+/*
+ * Memory mapped view of a whole file
+ * Used by the mmap encode/decode paths so image and secret bytes are
+ * accessed in place instead of through fread/fwrite chunks
+ */
+typedef struct _MappedFile
+{
+    char *data;             // Start of the mapping (NULL when nothing is mapped)
+    size_t size;            // Number of mapped bytes
+} MappedFile;
+
+/* Map an already opened file read only */
+Status map_file_read(FILE *fptr, MappedFile *map);
+
+/* Resize an already opened (writable) file to size bytes and map it read/write */
+Status map_file_write(FILE *fptr, size_t size, MappedFile *map);
+
+/* Release a mapping (does nothing if nothing is mapped) */
+void unmap_file(MappedFile *map);
+
+#endif
@@ -0,0 +1,221 @@
+#include <pthread.h>            // Worker threads
+#include <sched.h>              // sched_yield
+#include <stdlib.h>             // Deque allocation
+#include "parallel.h"           // Tile runner declarations
+
+#define MAX_THREADS 256         // Upper bound for -j
+
+typedef struct _TilePool
+{
+    TileFn fn;                  // Work for one tile
+    void *ctx;                  // Caller context passed through to fn
+    size_t tiles;               // Number of tiles
+    size_t next;                // Next tile to hand out (atomic)
+} TilePool;
+
+typedef struct _TileWorker
+{
+    TilePool *pool;             // Shared pool
+    int index;                  // Worker number passed to fn
+} TileWorker;
+
+/* Worker loop: claim tiles until none are left */
+static void *tile_worker(void *arg)
+{
+    TileWorker *worker = arg;
+    TilePool *pool = worker->pool;
+    size_t tile;
+
+    while ((tile = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->tiles)
+        pool->fn(pool->ctx, tile, worker->index);
+    return NULL;
+}
+
+size_t tile_count(size_t total, size_t tile_bytes)
+{
+    return (total + tile_bytes - 1) / tile_bytes;
+}
+
+Status run_tiles(int threads, size_t tiles, TileFn fn, void *ctx)
+{
+    TilePool pool = { fn, ctx, tiles, 0 };
+    TileWorker workers[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    int started = 0;
+
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if ((size_t)threads > tiles) threads = (int)tiles;    // No idle threads for small payloads
+
+    for (int i = 1; i < threads; i++)                      // Calling thread is worker 0
+    {
+        workers[i].pool = &pool;
+        workers[i].index = i;
+        if (pthread_create(&tids[i], NULL, tile_worker, &workers[i]) != 0)
+            break;                                         // Fewer threads, same result
+        started = i;
+    }
+
+    workers[0].pool = &pool;
+    workers[0].index = 0;
+    tile_worker(&workers[0]);
+
+    for (int i = 1; i <= started; i++)
+        pthread_join(tids[i], NULL);
+    return e_success;
+}
+
+/* -------------------- Work-stealing task pool -------------------- */
+
+typedef struct _Task
+{
+    TaskFn fn;                  // Work to do
+    void *arg;                  // Caller argument (e.g. a batch job)
+    size_t index;               // Caller index (e.g. a tile number)
+} Task;
+
+typedef struct _TaskDeque
+{
+    Task *items;                // Ring buffer of tasks
+    size_t head;                // Oldest task (steal end)
+    size_t count;               // Number of queued tasks
+    size_t capacity;            // Size of items
+    pthread_mutex_t lock;       // Owner and thieves both take it, tasks are coarse
+} TaskDeque;
+
+struct _TaskPool
+{
+    int workers;                // Number of workers (and deques)
+    TaskDeque *deques;          // One deque per worker
+    size_t pending;             // Queued or running tasks (atomic)
+    size_t next;                // Round robin cursor for pool_push(-1)
+};
+
+TaskPool *pool_create(int workers)
+{
+    if (workers < 1) workers = 1;
+    if (workers > MAX_THREADS) workers = MAX_THREADS;
+
+    TaskPool *pool = calloc(1, sizeof(TaskPool));
+    if (pool == NULL) return NULL;
+    pool->deques = calloc(workers, sizeof(TaskDeque));
+    if (pool->deques == NULL) { free(pool); return NULL; }
+    pool->workers = workers;
+    for (int i = 0; i < workers; i++)
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+    return pool;
+}
+
+int pool_workers(TaskPool *pool)
+{
+    return pool->workers;
+}
+
+Status pool_push(TaskPool *pool, int worker, TaskFn fn, void *arg, size_t index)
+{
+    if (worker < 0)                                        // Spread initial tasks
+        worker = (int)(__atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) % pool->workers);
+
+    TaskDeque *dq = &pool->deques[worker];
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->capacity)                         // Grow, keeping the ring order
+    {
+        size_t capacity = dq->capacity ? dq->capacity * 2 : 64;
+        Task *items = malloc(capacity * sizeof(Task));
+        if (items == NULL) { pthread_mutex_unlock(&dq->lock); return e_failure; }
+        for (size_t i = 0; i < dq->count; i++)
+            items[i] = dq->items[(dq->head + i) % dq->capacity];
+        free(dq->items);
+        dq->items = items;
+        dq->head = 0;
+        dq->capacity = capacity;
+    }
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_RELAXED);  // Counted before it can be run
+    dq->items[(dq->head + dq->count) % dq->capacity] = (Task){ fn, arg, index };
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+    return e_success;
+}
+
+/* Take a task from the bottom (own deque) or the top (stealing) */
+static int deque_take(TaskDeque *dq, int steal, Task *task)
+{
+    int found = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0)
+    {
+        if (steal)
+        {
+            *task = dq->items[dq->head];
+            dq->head = (dq->head + 1) % dq->capacity;
+        }
+        else
+            *task = dq->items[(dq->head + dq->count - 1) % dq->capacity];
+        dq->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+typedef struct _PoolWorker
+{
+    TaskPool *pool;
+    int index;
+} PoolWorker;
+
+static void *pool_worker(void *arg)
+{
+    PoolWorker *worker = arg;
+    TaskPool *pool = worker->pool;
+    Task task;
+
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0)
+    {
+        int found = deque_take(&pool->deques[worker->index], 0, &task);
+        for (int i = 1; !found && i < pool->workers; i++)   // Steal, starting at the next worker
+            found = deque_take(&pool->deques[(worker->index + i) % pool->workers], 1, &task);
+
+        if (!found)
+        {
+            sched_yield();                                 // Others are still running tasks
+            continue;
+        }
+        task.fn(pool, task.arg, task.index, worker->index);
+        __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+void pool_run(TaskPool *pool)
+{
+    PoolWorker workers[MAX_THREADS];
+    pthread_t tids[MAX_THREADS];
+    int started = 0;
+
+    for (int i = 0; i < pool->workers; i++)
+    {
+        workers[i].pool = pool;
+        workers[i].index = i;
+    }
+    for (int i = 1; i < pool->workers; i++)                // Calling thread is worker 0
+    {
+        if (pthread_create(&tids[i], NULL, pool_worker, &workers[i]) != 0)
+            break;                                         // Remaining deques are drained by stealing
+        started = i;
+    }
+    pool_worker(&workers[0]);
+    for (int i = 1; i <= started; i++)
+        pthread_join(tids[i], NULL);
+}
+
+void pool_destroy(TaskPool *pool)
+{
+    if (pool == NULL) return;
+    for (int i = 0; i < pool->workers; i++)
+    {
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].items);
+    }
+    free(pool->deques);
+    free(pool);
+}
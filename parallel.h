@@ -0,0 +1,50 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>         // size_t
+#include "types.h"          // Status
+
+/*
+ * Tile runner for intra-image parallelism
+ * The payload region is cut into independent tiles (payload byte i always
+ * lives in image bytes base + 8*i ... base + 8*i + 7) and a pool of worker
+ * threads pulls tile numbers from a shared counter until all are done
+ */
+
+/* Work done for one tile, worker is the index (0..threads-1) of the calling thread */
+typedef void (*TileFn)(void *ctx, size_t tile, int worker);
+
+/* Run fn for tiles 0..tiles-1 on up to threads workers, returns after every tile is done */
+Status run_tiles(int threads, size_t tiles, TileFn fn, void *ctx);
+
+/* Number of tiles needed to cover total bytes with tiles of tile_bytes */
+size_t tile_count(size_t total, size_t tile_bytes);
+
+/*
+ * Work-stealing task pool (batch mode)
+ * Every worker owns a deque: it pushes and pops at the bottom (newest first)
+ * while idle workers steal from the top (oldest first) of the others, so
+ * the sub-tasks of a huge job stay local while small jobs queued behind it
+ * are picked up by whoever is free
+ */
+typedef struct _TaskPool TaskPool;
+
+/* Work for one task, may push more tasks from the same worker */
+typedef void (*TaskFn)(TaskPool *pool, void *arg, size_t index, int worker);
+
+/* Create a pool with the given number of workers, NULL on allocation failure */
+TaskPool *pool_create(int workers);
+
+/* Queue a task on a worker's deque (worker -1 spreads tasks round robin) */
+Status pool_push(TaskPool *pool, int worker, TaskFn fn, void *arg, size_t index);
+
+/* Run workers until every queued task (and every task they push) is done */
+void pool_run(TaskPool *pool);
+
+/* Number of workers of a pool */
+int pool_workers(TaskPool *pool);
+
+/* Free a pool */
+void pool_destroy(TaskPool *pool);
+
+#endif
@@ -0,0 +1,210 @@
+#include <pthread.h>            // Reader and writer threads
+#include <stdlib.h>             // Block allocation
+#include <errno.h>              // EINTR
+#include <unistd.h>             // pread, pwrite
+#include "pipeline.h"           // Pipeline declarations
+
+struct _Pipeline
+{
+    int in_fd;                  // File read ahead
+    int out_fd;                 // File written behind, -1 for none
+    size_t offset;              // Input offset of the next block to read
+    PipeBlock blocks[PIPE_DEPTH]; // Ring, block i lives in blocks[i % PIPE_DEPTH]
+    size_t read;                // Blocks filled by the reader
+    size_t taken;               // Blocks handed to the caller
+    size_t released;            // Blocks the caller is done with
+    size_t written;             // Blocks written (free for reading again)
+    int eof;                    // Reader is done: end of input or error
+    int stop;                   // Close without draining, or a write failed
+    int failed;                 // Any read or write error
+    int reader_started;         // Non zero when the reader thread runs
+    int writer_started;         // Non zero when the writer thread runs
+    pthread_mutex_t lock;
+    pthread_cond_t changed;     // Broadcast on every counter change
+    pthread_t reader, writer;
+};
+
+/* Read up to len bytes at offset, short only at the end of the file */
+static ssize_t read_full(int fd, char *buf, size_t len, size_t offset)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = pread(fd, buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        if (n == 0) break;
+        done += n;
+    }
+    return done;
+}
+
+static Status write_full(int fd, const char *buf, size_t len, size_t offset)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = pwrite(fd, buf + done, len - done, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return e_failure;
+        done += n;
+    }
+    return e_success;
+}
+
+/* Reader thread: fill free blocks in order until the end of the input */
+static void *pipe_reader(void *arg)
+{
+    Pipeline *pipeline = arg;
+
+    pthread_mutex_lock(&pipeline->lock);
+    while (!pipeline->eof)
+    {
+        while (!pipeline->stop && pipeline->read - pipeline->written == PIPE_DEPTH)
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        if (pipeline->stop)
+            break;
+
+        PipeBlock *block = &pipeline->blocks[pipeline->read % PIPE_DEPTH];
+        pthread_mutex_unlock(&pipeline->lock);              // Block is not visible to anyone else yet
+        ssize_t len = read_full(pipeline->in_fd, block->data, PIPE_BLOCK, pipeline->offset);
+        pthread_mutex_lock(&pipeline->lock);
+
+        if (len < 0)
+            pipeline->failed = 1;
+        if (len > 0)
+        {
+            block->offset = pipeline->offset;
+            block->len = len;
+            pipeline->offset += len;
+            pipeline->read++;
+        }
+        if (len < PIPE_BLOCK)                               // Short block: end of the input (or an error)
+            pipeline->eof = 1;
+        pthread_cond_broadcast(&pipeline->changed);
+    }
+    pipeline->eof = 1;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+/* Writer thread: write released blocks in order until every block read is written */
+static void *pipe_writer(void *arg)
+{
+    Pipeline *pipeline = arg;
+
+    pthread_mutex_lock(&pipeline->lock);
+    for (;;)
+    {
+        while (!pipeline->stop && pipeline->released == pipeline->written && !(pipeline->eof && pipeline->written == pipeline->read))
+            pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+        if (pipeline->stop || pipeline->released == pipeline->written)
+            break;
+
+        PipeBlock *block = &pipeline->blocks[pipeline->written % PIPE_DEPTH];
+        pthread_mutex_unlock(&pipeline->lock);              // Caller and reader do not touch released blocks
+        Status res = write_full(pipeline->out_fd, block->data, block->len, block->offset);
+        pthread_mutex_lock(&pipeline->lock);
+
+        if (res == e_failure)
+            pipeline->failed = pipeline->stop = 1;          // Nothing later may be written out of order
+        else
+            pipeline->written++;
+        pthread_cond_broadcast(&pipeline->changed);
+    }
+    pthread_mutex_unlock(&pipeline->lock);
+    return NULL;
+}
+
+Pipeline *pipeline_open(int in_fd, size_t offset, int out_fd)
+{
+    Pipeline *pipeline = calloc(1, sizeof(Pipeline));
+    if (pipeline == NULL) return NULL;
+
+    pipeline->in_fd = in_fd;
+    pipeline->out_fd = out_fd;
+    pipeline->offset = offset;
+    for (int i = 0; i < PIPE_DEPTH; i++)
+    {
+        if ((pipeline->blocks[i].data = malloc(PIPE_BLOCK)) == NULL)
+        {
+            while (i-- > 0) free(pipeline->blocks[i].data);
+            free(pipeline);
+            return NULL;
+        }
+    }
+    pthread_mutex_init(&pipeline->lock, NULL);
+    pthread_cond_init(&pipeline->changed, NULL);
+
+    if (pthread_create(&pipeline->reader, NULL, pipe_reader, pipeline) != 0)
+    {
+        pipeline_close(pipeline, 0);
+        return NULL;
+    }
+    pipeline->reader_started = 1;
+    if (out_fd >= 0)
+    {
+        if (pthread_create(&pipeline->writer, NULL, pipe_writer, pipeline) != 0)
+        {
+            pipeline_close(pipeline, 0);
+            return NULL;
+        }
+        pipeline->writer_started = 1;
+    }
+    return pipeline;
+}
+
+PipeBlock *pipeline_next(Pipeline *pipeline)
+{
+    PipeBlock *block = NULL;
+
+    pthread_mutex_lock(&pipeline->lock);
+    while (!pipeline->stop && !pipeline->eof && pipeline->taken == pipeline->read)
+        pthread_cond_wait(&pipeline->changed, &pipeline->lock);
+    if (!pipeline->stop && pipeline->taken < pipeline->read)
+        block = &pipeline->blocks[pipeline->taken++ % PIPE_DEPTH];
+    pthread_mutex_unlock(&pipeline->lock);
+    return block;
+}
+
+void pipeline_release(Pipeline *pipeline, PipeBlock *block)
+{
+    (void)block;                                            // Always the oldest block taken
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->released++;
+    if (pipeline->out_fd < 0)                               // Nothing to write: free for reading at once
+        pipeline->written = pipeline->released;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+}
+
+Status pipeline_close(Pipeline *pipeline, int drain)
+{
+    PipeBlock *block;
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->released = pipeline->taken;                   // Blocks still held go out as they are
+    if (pipeline->out_fd < 0)
+        pipeline->written = pipeline->released;
+    if (!drain)
+        pipeline->stop = 1;
+    pthread_cond_broadcast(&pipeline->changed);
+    pthread_mutex_unlock(&pipeline->lock);
+
+    while (drain && (block = pipeline_next(pipeline)) != NULL)  // Rest of the input passes through unchanged
+        pipeline_release(pipeline, block);
+
+    if (pipeline->reader_started)
+        pthread_join(pipeline->reader, NULL);
+    if (pipeline->writer_started)
+        pthread_join(pipeline->writer, NULL);
+
+    Status res = pipeline->failed ? e_failure : e_success;
+    pthread_cond_destroy(&pipeline->changed);
+    pthread_mutex_destroy(&pipeline->lock);
+    for (int i = 0; i < PIPE_DEPTH; i++)
+        free(pipeline->blocks[i].data);
+    free(pipeline);
+    return res;
+}
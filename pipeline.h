@@ -0,0 +1,41 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>         // size_t
+#include "types.h"          // Status
+
+/*
+ * Read-ahead / write-behind pipeline (serial stdio encode)
+ * A reader thread fills a ring of blocks from the input file while the
+ * caller embeds into earlier blocks and a writer thread writes the blocks
+ * the caller is done with to the output file, in order and at the same
+ * offsets. Reading, embedding and writing overlap, and every byte of the
+ * input is read once and every byte of the output written once
+ */
+
+#define PIPE_BLOCK (1024 * 1024)    // Bytes per block (the last block of a file may be shorter)
+#define PIPE_DEPTH 4                // Blocks in the ring: read ahead + held by the caller + write behind
+
+typedef struct _PipeBlock
+{
+    char *data;             // PIPE_BLOCK bytes
+    size_t offset;          // File offset of data[0]
+    size_t len;             // Bytes read into data
+} PipeBlock;
+
+typedef struct _Pipeline Pipeline;
+
+/* Start reading in_fd at offset, blocks go to out_fd (-1 to only read), NULL if threads or buffers are not available */
+Pipeline *pipeline_open(int in_fd, size_t offset, int out_fd);
+
+/* Next block in file order (waits for the reader), NULL at the end of the input or after an I/O error */
+PipeBlock *pipeline_next(Pipeline *pipeline);
+
+/* Hand the oldest block taken back: it is written to out_fd, then reused for reading */
+void pipeline_release(Pipeline *pipeline, PipeBlock *block);
+
+/* Release every block still held, then either pass the rest of the input through unchanged (drain)
+   or stop reading; joins the threads and frees the pipeline. e_failure after any read or write error */
+Status pipeline_close(Pipeline *pipeline, int drain);
+
+#endif
@@ -0,0 +1,826 @@
+#include <stdlib.h>             // Row window, stream state
+#include <string.h>             // memcpy, memmove, memcmp, strlen
+#include <limits.h>             // UINT_MAX (size fields are 32 bits wide)
+#include <pthread.h>            // pthread_once for the kernel selection
+#include <zlib.h>               // IDAT inflate / deflate, chunk CRC
+#include "png.h"                // PNG cover declarations
+#include "common.h"             // Magic strings, FORMAT_FLAG_*
+#include "lsb.h"                // lsb_cover_bytes, kernel selection
+#include "lz.h"                 // -z payload blocks
+#include "chacha.h"             // -K payload cipher
+#include "crc32c.h"             // Payload checksum
+
+#define PNG_MAX_SIDE 0x7FFFFFFFu    // Largest width / height the format allows
+
+static const unsigned char png_signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+/* Pick the LSB and cipher kernels once for every thread */
+static void init_kernels(void)
+{
+    lsb_init();
+    chacha_init();
+}
+
+struct _PngStream
+{
+    FILE *in;                   // PNG being read
+    FILE *out;                  // Stego PNG being written, NULL when decoding
+    z_stream inflater;          // Image data of in
+    z_stream deflater;          // Image data of out
+    int inflating;              // inflater / deflater need an End call
+    int deflating;
+    int stream_end;             // Inflate reached the end of the zlib stream
+    uint32_t idat_left;         // Bytes of the current IDAT chunk not read yet
+    uLong idat_crc;             // CRC of the current IDAT chunk over the bytes read so far
+    int bad_crc;                // A chunk did not match its CRC
+    int idat_done;              // Past the last IDAT chunk: next_chunk holds the header of the chunk after them
+    unsigned char next_chunk[8];
+    unsigned char zin[PNG_IO_BYTES];    // Compressed bytes read (also the copy buffer of other chunks)
+    unsigned char zout[PNG_IO_BYTES];   // Compressed bytes of the next IDAT chunk written
+
+    uint width;
+    uint height;
+    size_t channels;            // Bytes per pixel: 1 grey, 3 RGB, 4 RGBA (the filter distance)
+    size_t row_bytes;           // Raw bytes per row, without the filter type byte
+
+    BmpLayout layout;           // Payload slots over the raw rows (row r starts at offset r * row_bytes)
+    size_t row_slots;           // Slots per row
+    size_t slot;                // Next payload slot
+    int depth;                  // Depth of the next bytes (header fields before the format word use 1)
+
+    unsigned char *window;      // Raw rows first_row .. rows_loaded - 1
+    unsigned char *filters;     // Original filter type of every window row
+    size_t window_rows;         // Capacity of window
+    size_t first_row;
+    size_t rows_loaded;         // Rows inflated so far
+    unsigned char *prev_in;     // Raw cover row rows_loaded - 1 (what the next row was filtered against)
+    unsigned char *prev_out;    // Last row written (what the next row is filtered against now)
+    unsigned char *line;        // One filtered row: type byte + row_bytes
+
+    StegPayloadInfo info;       // Fields of the payload being decoded
+    ChaCha cipher;
+    int keyed;                  // cipher holds the key the payload was encrypted with
+};
+
+static uint32_t be32(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put_be32(unsigned char *p, uint32_t value)
+{
+    for (int i = 0; i < 4; i++)
+        p[i] = (unsigned char)(value >> (24 - 8 * i));
+}
+
+static Status read_exact(FILE *fptr, void *buf, size_t n)
+{
+    return fread(buf, 1, n, fptr) == n ? e_success : e_failure;
+}
+
+/* Data and CRC of the chunk whose header was just read, copied to out (only read when decoding) and checked */
+static const char *pass_chunk(PngStream *png, const unsigned char *chunk)
+{
+    uLong crc = crc32(crc32(0, NULL, 0), chunk + 4, 4);         // Over type and data
+    unsigned char stored[4];
+
+    for (size_t n = be32(chunk); n > 0; )
+    {
+        size_t count = n < PNG_IO_BYTES ? n : PNG_IO_BYTES;
+        if (read_exact(png->in, png->zin, count) == e_failure)
+            return "truncated PNG chunk";
+        crc = crc32(crc, png->zin, (uInt)count);
+        if (png->out && fwrite(png->zin, 1, count, png->out) != count)
+            return "cannot write the stego image";
+        n -= count;
+    }
+    if (read_exact(png->in, stored, sizeof(stored)) == e_failure)
+        return "truncated PNG chunk";
+    if (be32(stored) != crc)
+    {
+        png->bad_crc = 1;
+        return "bad PNG chunk CRC";
+    }
+    if (png->out && fwrite(stored, 1, sizeof(stored), png->out) != sizeof(stored))
+        return "cannot write the stego image";
+    return NULL;
+}
+
+/* Error of a failed pass over the image data: a chunk CRC mismatch, else corrupt zlib data or filters */
+static const char *data_error(const PngStream *png)
+{
+    return png->bad_crc ? "bad PNG chunk CRC" : "corrupt PNG image data";
+}
+
+/* -------------------- Chunks and zlib streams -------------------- */
+
+/* Signature and IHDR, then every chunk up to the first IDAT (copied to out); sets up the row buffers */
+static const char *png_open(PngStream *png)
+{
+    unsigned char head[8 + 8 + 13 + 4];                          // Signature, IHDR chunk with its CRC
+    unsigned char chunk[8];
+    const char *error;
+
+    if (read_exact(png->in, head, sizeof(head)) == e_failure || memcmp(head, png_signature, 8) != 0 ||
+        be32(head + 8) != 13 || memcmp(head + 12, "IHDR", 4) != 0)
+        return "not a PNG image";
+    if (be32(head + 29) != crc32(crc32(0, NULL, 0), head + 12, 4 + 13))
+    {
+        png->bad_crc = 1;
+        return "bad PNG chunk CRC";
+    }
+    const unsigned char *ihdr = head + 16;
+    png->width = be32(ihdr);
+    png->height = be32(ihdr + 4);
+    if (png->width == 0 || png->height == 0 || png->width > PNG_MAX_SIDE || png->height > PNG_MAX_SIDE ||
+        ihdr[10] != 0 || ihdr[11] != 0)
+        return "bad PNG header";
+    if (ihdr[8] != 8 || (ihdr[9] != 0 && ihdr[9] != 2 && ihdr[9] != 6))
+        return "unsupported PNG pixel format (8-bit grey, RGB or RGBA only)";
+    if (ihdr[12] != 0)
+        return "interlaced PNG images are not supported";
+    png->channels = ihdr[9] == 0 ? 1 : ihdr[9] == 2 ? 3 : 4;
+    png->row_bytes = (size_t)png->width * png->channels;
+    if (png->out && fwrite(head, 1, sizeof(head), png->out) != sizeof(head))
+        return "cannot write the stego image";
+
+    for (;;)                                                     // Ancillary chunks, PLTE
+    {
+        if (read_exact(png->in, chunk, sizeof(chunk)) == e_failure || memcmp(chunk + 4, "IEND", 4) == 0)
+            return "no image data";
+        if (memcmp(chunk + 4, "IDAT", 4) == 0)
+            break;
+        if (be32(chunk) > PNG_MAX_SIDE)
+            return "bad PNG chunk";
+        if (png->out && fwrite(chunk, 1, sizeof(chunk), png->out) != sizeof(chunk))
+            return "cannot write the stego image";
+        if ((error = pass_chunk(png, chunk)) != NULL)
+            return error;
+    }
+    png->idat_left = be32(chunk);
+    png->idat_crc = crc32(crc32(0, NULL, 0), chunk + 4, 4);
+
+    if (inflateInit(&png->inflater) != Z_OK)
+        return "out of memory";
+    png->inflating = 1;
+    if (png->out)
+    {
+        if (deflateInit(&png->deflater, Z_DEFAULT_COMPRESSION) != Z_OK)
+            return "out of memory";
+        png->deflating = 1;
+        png->deflater.next_out = png->zout;
+        png->deflater.avail_out = PNG_IO_BYTES;
+    }
+
+    /* A few rows are enough for 8 slots (one payload byte) at any width; more only to move in larger spans */
+    png->window_rows = PNG_IO_BYTES / png->row_bytes;
+    if (png->window_rows < 8 / png->width + 2)
+        png->window_rows = 8 / png->width + 2;
+    if (png->window_rows > png->height)
+        png->window_rows = png->height;
+    png->window = malloc(png->window_rows * png->row_bytes);
+    png->filters = malloc(png->window_rows);
+    png->prev_in = calloc(1, png->row_bytes);                    // The row above the first one is all zero
+    png->prev_out = calloc(1, png->row_bytes);
+    png->line = malloc(png->row_bytes + 1);
+    if (!png->window || !png->filters || !png->prev_in || !png->prev_out || !png->line)
+        return "out of memory";
+    return NULL;
+}
+
+/* Past the CRC of the current IDAT chunk (read in full) to the next chunk; e_failure once it is not an IDAT,
+   on a read error or a CRC mismatch */
+static Status next_idat(PngStream *png)
+{
+    unsigned char chunk[4 + 8];
+
+    if (png->idat_done || read_exact(png->in, chunk, sizeof(chunk)) == e_failure)
+        return e_failure;
+    if (be32(chunk) != png->idat_crc)
+    {
+        png->bad_crc = 1;
+        return e_failure;
+    }
+    png->idat_crc = crc32(crc32(0, NULL, 0), chunk + 8, 4);
+    if (memcmp(chunk + 8, "IDAT", 4) != 0)
+    {
+        memcpy(png->next_chunk, chunk + 4, 8);
+        png->idat_done = 1;
+        return e_failure;
+    }
+    png->idat_left = be32(chunk + 4);
+    return e_success;
+}
+
+/* Inflate exactly n bytes of image data into dst */
+static Status inflate_bytes(PngStream *png, unsigned char *dst, size_t n)
+{
+    png->inflater.next_out = dst;
+    png->inflater.avail_out = (uInt)n;
+    while (png->inflater.avail_out > 0)
+    {
+        if (png->stream_end)
+            return e_failure;                                    // Image data ends early
+        if (png->inflater.avail_in == 0)                         // Next bytes of this IDAT chunk, or of the next one
+        {
+            while (png->idat_left == 0)
+                if (next_idat(png) == e_failure)
+                    return e_failure;
+            size_t count = png->idat_left < PNG_IO_BYTES ? png->idat_left : PNG_IO_BYTES;
+            if (read_exact(png->in, png->zin, count) == e_failure)
+                return e_failure;
+            png->idat_crc = crc32(png->idat_crc, png->zin, (uInt)count);
+            png->inflater.next_in = png->zin;
+            png->inflater.avail_in = (uInt)count;
+            png->idat_left -= (uint32_t)count;
+        }
+        int ret = inflate(&png->inflater, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END)
+            png->stream_end = 1;
+        else if (ret != Z_OK)
+            return e_failure;
+    }
+    return e_success;
+}
+
+/* Write the first n bytes of zout as one IDAT chunk */
+static Status write_idat(PngStream *png, size_t n)
+{
+    unsigned char head[8], crc[4];
+
+    put_be32(head, (uint32_t)n);
+    memcpy(head + 4, "IDAT", 4);
+    put_be32(crc, (uint32_t)crc32(crc32(0, head + 4, 4), png->zout, (uInt)n));
+    if (fwrite(head, 1, sizeof(head), png->out) != sizeof(head) || fwrite(png->zout, 1, n, png->out) != n ||
+        fwrite(crc, 1, sizeof(crc), png->out) != sizeof(crc))
+        return e_failure;
+    png->deflater.next_out = png->zout;
+    png->deflater.avail_out = PNG_IO_BYTES;
+    return e_success;
+}
+
+/* Deflate n bytes of image data, a full IDAT chunk written whenever zout fills up; Z_FINISH ends the stream */
+static Status deflate_bytes(PngStream *png, const unsigned char *data, size_t n, int flush)
+{
+    png->deflater.next_in = (unsigned char *)data;
+    png->deflater.avail_in = (uInt)n;
+    for (;;)
+    {
+        int ret = deflate(&png->deflater, flush);
+        if (ret == Z_STREAM_ERROR)
+            return e_failure;
+        if (png->deflater.avail_out == 0)
+        {
+            if (write_idat(png, PNG_IO_BYTES) == e_failure) return e_failure;
+        }
+        else if (flush == Z_FINISH ? ret == Z_STREAM_END : png->deflater.avail_in == 0)
+            break;
+    }
+    if (flush == Z_FINISH && png->deflater.avail_out < PNG_IO_BYTES)
+        return write_idat(png, PNG_IO_BYTES - png->deflater.avail_out);
+    return e_success;
+}
+
+/* -------------------- Scanline filters -------------------- */
+
+static unsigned char paeth(int a, int b, int c)
+{
+    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return (unsigned char)(pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+}
+
+/* Undo filter type on row in place, prev is the raw row above it */
+static Status unfilter_row(int type, unsigned char *row, const unsigned char *prev, size_t n, size_t bpp)
+{
+    size_t i;
+
+    switch (type)
+    {
+    case 0:
+        break;
+    case 1:
+        for (i = bpp; i < n; i++) row[i] += row[i - bpp];
+        break;
+    case 2:
+        for (i = 0; i < n; i++) row[i] += prev[i];
+        break;
+    case 3:
+        for (i = 0; i < bpp; i++) row[i] += prev[i] >> 1;
+        for (; i < n; i++) row[i] += (row[i - bpp] + prev[i]) >> 1;
+        break;
+    case 4:
+        for (i = 0; i < bpp; i++) row[i] += prev[i];
+        for (; i < n; i++) row[i] += paeth(row[i - bpp], prev[i], prev[i - bpp]);
+        break;
+    default:
+        return e_failure;                                        // Unknown filter type
+    }
+    return e_success;
+}
+
+/* Filter raw row with type into out, prev is the raw row above it */
+static void filter_row(int type, const unsigned char *raw, const unsigned char *prev, unsigned char *out, size_t n, size_t bpp)
+{
+    size_t i;
+
+    switch (type)
+    {
+    case 1:
+        for (i = 0; i < bpp; i++) out[i] = raw[i];
+        for (; i < n; i++) out[i] = raw[i] - raw[i - bpp];
+        break;
+    case 2:
+        for (i = 0; i < n; i++) out[i] = raw[i] - prev[i];
+        break;
+    case 3:
+        for (i = 0; i < bpp; i++) out[i] = raw[i] - (prev[i] >> 1);
+        for (; i < n; i++) out[i] = raw[i] - ((raw[i - bpp] + prev[i]) >> 1);
+        break;
+    case 4:
+        for (i = 0; i < bpp; i++) out[i] = raw[i] - prev[i];
+        for (; i < n; i++) out[i] = raw[i] - paeth(raw[i - bpp], prev[i], prev[i - bpp]);
+        break;
+    default:
+        memcpy(out, raw, n);
+        break;
+    }
+}
+
+/* -------------------- Row window -------------------- */
+
+/* Inflate and unfilter the next row to the end of the window */
+static Status load_row(PngStream *png)
+{
+    size_t index = png->rows_loaded - png->first_row;
+    unsigned char *row = png->window + index * png->row_bytes;
+
+    if (inflate_bytes(png, &png->filters[index], 1) == e_failure || inflate_bytes(png, row, png->row_bytes) == e_failure ||
+        unfilter_row(png->filters[index], row, png->prev_in, png->row_bytes, png->channels) == e_failure)
+        return e_failure;
+    memcpy(png->prev_in, row, png->row_bytes);
+    png->rows_loaded++;
+    return e_success;
+}
+
+/* Drop the window rows before row upto, filtered again with their original type and deflated when encoding */
+static Status release_rows(PngStream *png, size_t upto)
+{
+    size_t count = upto - png->first_row;
+
+    for (size_t i = 0; png->out && i < count; i++)
+    {
+        const unsigned char *row = png->window + i * png->row_bytes;
+        png->line[0] = png->filters[i];
+        filter_row(png->filters[i], row, png->prev_out, png->line + 1, png->row_bytes, png->channels);
+        memcpy(png->prev_out, row, png->row_bytes);
+        if (deflate_bytes(png, png->line, png->row_bytes + 1, Z_NO_FLUSH) == e_failure)
+            return e_failure;
+    }
+    size_t keep = png->rows_loaded - upto;
+    memmove(png->window, png->window + count * png->row_bytes, keep * png->row_bytes);
+    memmove(png->filters, png->filters + count, keep);
+    png->first_row = upto;
+    return e_success;
+}
+
+/* Move the window on to the row of the cursor and fill it up */
+static Status advance(PngStream *png)
+{
+    for (;;)
+    {
+        size_t row = png->slot / png->row_slots;
+        size_t drop = row < png->rows_loaded ? row : png->rows_loaded;
+        if (drop > png->first_row && release_rows(png, drop) == e_failure)
+            return e_failure;
+        if (png->rows_loaded == png->height || png->rows_loaded - png->first_row == png->window_rows)
+            return e_success;
+        if (load_row(png) == e_failure)
+            return e_failure;
+    }
+}
+
+/* How many of n bytes at the cursor fit into the window, after moving it on; 0 past the end of the image */
+static size_t window_fit(PngStream *png, size_t n)
+{
+    size_t cover = lsb_cover_bytes(png->depth);
+
+    if (advance(png) == e_failure)
+        return 0;
+    size_t slots = png->rows_loaded * png->row_slots;
+    size_t count = slots > png->slot ? (slots - png->slot) / cover : 0;
+    return count < n ? count : n;
+}
+
+/* Embed n bytes, encrypted as payload bytes pos.. when cipher is set */
+static Status put_bytes(PngStream *png, const char *data, size_t n, const ChaCha *cipher, uint64_t pos)
+{
+    while (n > 0)
+    {
+        size_t count = window_fit(png, n);
+        if (count == 0) return e_failure;
+        bmp_embed_keyed(&png->layout, (char *)png->window, png->first_row * png->row_bytes, png->slot,
+                        data, count, png->depth, cipher, pos);
+        png->slot += lsb_cover_bytes(png->depth) * count;
+        data += count;
+        pos += count;
+        n -= count;
+    }
+    return e_success;
+}
+
+/* Embed the payload a block at a time; *crc (when set) takes in each plain block right after it is embedded */
+static Status put_payload(PngStream *png, const char *data, size_t n, const ChaCha *cipher, uint32_t *crc)
+{
+    for (size_t pos = 0; pos < n; pos += LZ_BLOCK)
+    {
+        size_t count = n - pos < LZ_BLOCK ? n - pos : LZ_BLOCK;
+        if (put_bytes(png, data + pos, count, cipher, pos) == e_failure) return e_failure;
+        if (crc) *crc = crc32c_update(*crc, data + pos, count);
+    }
+    return e_success;
+}
+
+static Status put_size(PngStream *png, uint size)
+{
+    unsigned char bytes[4];                                      // Big endian, like encode_size_to_lsb()
+    put_be32(bytes, size);
+    return put_bytes(png, (const char *)bytes, 4, NULL, 0);
+}
+
+/* Extract n bytes, decrypted as payload bytes pos.. when cipher is set */
+static Status get_bytes(PngStream *png, char *data, size_t n, const ChaCha *cipher, uint64_t pos)
+{
+    while (n > 0)
+    {
+        size_t count = window_fit(png, n);
+        if (count == 0) return e_failure;
+        bmp_extract_keyed(&png->layout, (const char *)png->window, png->first_row * png->row_bytes, png->slot,
+                          data, count, png->depth, cipher, pos);
+        png->slot += lsb_cover_bytes(png->depth) * count;
+        data += count;
+        pos += count;
+        n -= count;
+    }
+    return e_success;
+}
+
+/* Field reader of bmp_read_fields() over the inflated rows */
+static Status read_field(void *ctx, char *data, size_t n)
+{
+    return get_bytes(ctx, data, n, NULL, 0);
+}
+
+/* The raw rows as the pixel array of a headerless BMP of the same pixel format */
+static void png_pixels(const PngStream *png, BmpInfo *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->format = cover_png;
+    info->file_size = png->row_bytes * png->height;
+    info->width = png->width;
+    info->height = png->height;
+    info->top_down = 1;
+    info->bits_per_pixel = (int)(8 * png->channels);
+    info->stride = png->row_bytes;
+    info->alpha_lane = png->channels == 4 ? 3 : -1;
+}
+
+/* Write the window, the row after it and the rest of the image, then every chunk after the image data */
+static Status finish_image(PngStream *png)
+{
+    Status res = release_rows(png, png->rows_loaded);
+    if (res == e_success && png->rows_loaded < png->height)     // Its filter refers to the last changed row
+    {
+        res = load_row(png);
+        if (res == e_success) res = release_rows(png, png->rows_loaded);
+    }
+
+    /* Every later row is filtered against an unchanged row: its filtered bytes go from inflate to deflate as they are */
+    size_t left = (png->height - png->rows_loaded) * (png->row_bytes + 1);
+    unsigned char *block = left > 0 ? malloc(PNG_IO_BYTES) : NULL;
+    if (left > 0 && block == NULL) res = e_failure;
+    while (res == e_success && left > 0)
+    {
+        size_t count = left < PNG_IO_BYTES ? left : PNG_IO_BYTES;
+        res = inflate_bytes(png, block, count);
+        if (res == e_success) res = deflate_bytes(png, block, count, Z_NO_FLUSH);
+        left -= count;
+    }
+    free(block);
+    if (res == e_success) res = deflate_bytes(png, NULL, 0, Z_FINISH);
+
+    while (res == e_success && !png->idat_done)                 // Rest of the old IDAT chunks (zlib trailer, padding)
+    {
+        while (res == e_success && png->idat_left > 0)           // Read, not skipped: next_idat() checks their CRC
+        {
+            size_t count = png->idat_left < PNG_IO_BYTES ? png->idat_left : PNG_IO_BYTES;
+            res = read_exact(png->in, png->zin, count);
+            png->idat_crc = crc32(png->idat_crc, png->zin, (uInt)count);
+            png->idat_left -= (uint32_t)count;
+        }
+        if (res == e_success && next_idat(png) == e_failure && !png->idat_done)
+            res = e_failure;
+    }
+    if (res == e_success && fwrite(png->next_chunk, 1, sizeof(png->next_chunk), png->out) != sizeof(png->next_chunk))
+        res = e_failure;
+    size_t got;
+    while (res == e_success && (got = fread(png->zin, 1, PNG_IO_BYTES, png->in)) > 0)
+        if (fwrite(png->zin, 1, got, png->out) != got)
+            res = e_failure;
+    return res;
+}
+
+/* -------------------- Encode / decode -------------------- */
+
+int png_file(const char *fname)
+{
+    unsigned char head[sizeof(png_signature)];
+    FILE *fptr = fname ? fopen(fname, "rb") : NULL;
+
+    if (fptr == NULL)
+        return 0;
+    int found = read_exact(fptr, head, sizeof(head)) == e_success && memcmp(head, png_signature, sizeof(head)) == 0;
+    fclose(fptr);
+    return found;
+}
+
+Status png_encode(FILE *cover, FILE *stego, const char *payload, size_t payload_size,
+                  const StegParams *params, const char **error)
+{
+    StegParams none = {0};
+    BmpInfo pixels;
+    unsigned char nonce[CHACHA_NONCE_BYTES];
+    size_t packed_size = 0;
+    char *packed = NULL;
+    uint flags = 0;
+    uint32_t crc = 0, *plain_crc;
+
+    pthread_once(&kernels_once, init_kernels);
+    if (params == NULL) params = &none;
+    plain_crc = params->checksum ? &crc : NULL;                  // CRC32C taken by the first pass over the payload
+    const char *extn = params->extn ? params->extn : ".txt";
+    int depth = params->bit_depth ? params->bit_depth : 1;
+    *error = NULL;
+    if (depth < 1 || depth > LSB_MAX_DEPTH || strlen(extn) > STEG_EXTN_MAX || payload_size > UINT_MAX)
+    {
+        *error = "bad parameters";
+        return e_failure;
+    }
+    if (params->scatter)
+    {
+        *error = "--scatter is not supported for PNG covers (rows are written in order)";
+        return e_failure;
+    }
+    PngStream *png = calloc(1, sizeof(PngStream));
+    if (png == NULL)
+    {
+        *error = "out of memory";
+        return e_failure;
+    }
+    png->in = cover;
+    png->out = stego;
+    *error = png_open(png);
+    Status res = *error ? e_failure : e_success;
+
+    if (res == e_success)
+    {
+        png_pixels(png, &pixels);
+        bmp_layout_rows(&pixels, params->use_alpha, &png->layout);
+        png->row_slots = bmp_slots(&png->layout) / png->height;
+        flags = (png->layout.linear ? 0 : FORMAT_FLAG_ROWS) | (params->use_alpha && png->channels == 4 ? FORMAT_FLAG_ALPHA : 0);
+        if (params->compress && payload_size > 0)
+        {
+            if ((packed = lz_compress_payload(payload, payload_size, &packed_size, plain_crc)) != NULL)
+                flags |= FORMAT_FLAG_LZ;
+            plain_crc = NULL;                                    // Done while compressing, kept raw or not
+        }
+        if (params->checksum)
+            flags |= FORMAT_FLAG_CRC;
+        if (params->key)                                         // Fresh nonce per image
+        {
+            if (chacha_random_nonce(nonce) == e_failure)
+            {
+                *error = "cannot get a random nonce";
+                res = e_failure;
+            }
+            chacha_setup(&png->cipher, params->key, nonce);
+            flags |= FORMAT_FLAG_CHACHA;
+        }
+    }
+    uint word = (uint)depth | flags;
+    size_t embedded = packed ? packed_size : payload_size;
+    size_t header = (strlen(MAGIC_STRING) + (word != 1 ? 4 : 0)) * 8;
+    size_t fields = 4 + strlen(extn) + 4 + (packed ? 4 : 0) + (params->key ? CHACHA_NONCE_BYTES + 4 : 0) +
+                    ((flags & FORMAT_FLAG_CRC) ? CHECKSUM_BYTES : 0);
+    if (res == e_success && header + lsb_cover_bytes(depth) * (fields + embedded) > bmp_slots(&png->layout))
+    {
+        *error = "image too small for the secret";               // Checked before anything is embedded
+        res = e_failure;
+    }
+
+    const ChaCha *cipher = params->key ? &png->cipher : NULL;
+    png->depth = 1;
+    if (res == e_success) res = put_bytes(png, word != 1 ? MAGIC_STRING_EXT : MAGIC_STRING, strlen(MAGIC_STRING), NULL, 0);
+    if (res == e_success && word != 1) res = put_size(png, word);
+    png->depth = depth;
+    if (res == e_success) res = put_size(png, (uint)strlen(extn));
+    if (res == e_success) res = put_bytes(png, extn, strlen(extn), NULL, 0);
+    if (res == e_success) res = put_size(png, (uint)payload_size);
+    if (res == e_success && packed) res = put_size(png, (uint)packed_size);
+    if (res == e_success && params->key)
+    {
+        res = put_bytes(png, (const char *)nonce, CHACHA_NONCE_BYTES, NULL, 0);
+        if (res == e_success) res = put_size(png, chacha_key_check(&png->cipher));
+    }
+    if (res == e_success) res = put_payload(png, packed ? packed : payload, embedded, cipher, plain_crc);
+    if (res == e_success && (flags & FORMAT_FLAG_CRC))           // Trailer: encrypted as the bytes after the payload
+    {
+        unsigned char bytes[CHECKSUM_BYTES];
+        put_be32(bytes, crc);
+        res = put_bytes(png, (const char *)bytes, CHECKSUM_BYTES, cipher, embedded);
+    }
+    if (res == e_success) res = finish_image(png);
+    if (res == e_failure && *error == NULL)
+        *error = ferror(stego) ? "cannot write the stego image" : data_error(png);
+
+    free(packed);
+    png_close(png);
+    return res;
+}
+
+PngStream *png_decode_open(FILE *stego, const unsigned char *key, StegPayloadInfo *info,
+                           BmpPayload *found, const char **error)
+{
+    BmpInfo pixels;
+    BmpFields fields;
+    uint word = 0;
+
+    pthread_once(&kernels_once, init_kernels);
+    memset(info, 0, sizeof(*info));
+    *found = bmp_payload_none;
+    PngStream *png = calloc(1, sizeof(PngStream));
+    if (png == NULL)
+    {
+        *error = "out of memory";
+        return NULL;
+    }
+    png->in = stego;
+    if ((*error = png_open(png)) != NULL)
+    {
+        png_close(png);
+        return NULL;
+    }
+
+    /* Enough rows for the magic string and format word in every layout (48 slots within 64 bytes) */
+    while (png->rows_loaded < png->window_rows && png->rows_loaded * png->row_bytes < 64)
+        if (load_row(png) == e_failure)
+        {
+            *error = data_error(png);
+            png_close(png);
+            return NULL;
+        }
+    png_pixels(png, &pixels);
+    *found = bmp_find_payload(&pixels, pixels.file_size, (const char *)png->window, 0,
+                              png->rows_loaded * png->row_bytes, &png->layout, &word);
+    if (*found != bmp_payload_legacy && *found != bmp_payload_extended)
+    {
+        *error = *found == bmp_payload_bad_word ? "bad format word" : NULL;   // NULL: a clean image
+        png_close(png);
+        return NULL;
+    }
+    png->row_slots = bmp_slots(&png->layout) / png->height;
+    png->slot = (strlen(MAGIC_STRING) + (*found == bmp_payload_extended ? 4 : 0)) * 8;
+    png->depth = word & FORMAT_DEPTH_MASK;
+
+    if ((*error = bmp_read_fields(read_field, png, word, 1, &fields)) == NULL &&
+        ((word & FORMAT_FLAG_SCATTER) || !bmp_fields_fit(&png->layout, png->slot, word, &fields)))
+        *error = (word & FORMAT_FLAG_SCATTER) ? "scattered payload in a PNG image" : "size exceeds image capacity";
+    if (*error)
+    {
+        png_close(png);
+        return NULL;
+    }
+
+    strcpy(info->extn, fields.extn);
+    info->payload_size = fields.size;
+    info->embedded_size = fields.embedded;
+    info->bit_depth = png->depth;
+    info->format_word = word;
+    info->encrypted = (word & FORMAT_FLAG_CHACHA) != 0;
+    info->checksum = (word & FORMAT_FLAG_CRC) != 0;
+    *error = NULL;
+    if (info->encrypted && key)
+    {
+        chacha_setup(&png->cipher, key, fields.nonce);
+        if (chacha_key_check(&png->cipher) != fields.check)
+        {
+            *error = "wrong key";
+            png_close(png);
+            return NULL;
+        }
+        png->keyed = 1;
+    }
+    png->info = *info;
+    return png;
+}
+
+Status png_decode_payload(PngStream *png, FILE *out, size_t offset, size_t length, const char **error)
+{
+    const StegPayloadInfo *info = &png->info;
+    const ChaCha *cipher = info->encrypted ? &png->cipher : NULL;
+    int packed = (info->format_word & FORMAT_FLAG_LZ) != 0;
+    size_t cover = lsb_cover_bytes(png->depth);
+    char header[LZ_HEADER];
+    uint32_t crc = 0;
+
+    *error = NULL;
+    if (info->encrypted && !png->keyed)
+    {
+        *error = "the payload is encrypted, a key file (-K) is needed";
+        return e_failure;
+    }
+    if (offset > info->payload_size)
+    {
+        *error = "range starts past the end of the payload";
+        return e_failure;
+    }
+    size_t end = length < info->payload_size - offset ? offset + length : info->payload_size;
+    int whole = offset == 0 && end == info->payload_size;
+    char *block = malloc(LZ_BLOCK), *body = packed ? malloc(LZ_BLOCK_BOUND) : NULL;
+    Status res = block && (body || !packed) ? e_success : e_failure;
+    size_t start = 0, pos = 0;                                   // Payload byte of block, embedded byte at the cursor
+
+    while (res == e_success && start < end)
+    {
+        size_t count = info->payload_size - start < LZ_BLOCK ? info->payload_size - start : LZ_BLOCK;
+        if (packed)                                              // One -z block per step
+        {
+            int raw;
+            if (info->embedded_size - pos < LZ_HEADER || get_bytes(png, header, LZ_HEADER, cipher, pos) == e_failure)
+            {
+                res = e_failure;
+                break;
+            }
+            size_t n = lz_block_size(header, &raw);
+            pos += LZ_HEADER;
+            if (n > info->embedded_size - pos || n > LZ_BLOCK_BOUND - LZ_HEADER)
+                res = e_failure;                                 // Corrupt block
+            else if (!whole && start + count <= offset)
+                png->slot += cover * n;                          // Before the range: rows are only inflated
+            else if (get_bytes(png, body, n, cipher, pos) == e_failure || lz_decompress_block(body, n, raw, block, count) == e_failure)
+                res = e_failure;
+            pos += n;
+        }
+        else if (!whole && start + count <= offset)
+            png->slot += cover * count;
+        else
+            res = get_bytes(png, block, count, cipher, pos);
+        if (!packed)
+            pos += count;
+        if (res == e_success && (whole || start + count > offset))
+        {
+            size_t from = offset > start ? offset - start : 0, to = end - start < count ? end - start : count;
+            if (whole) crc = crc32c_update(crc, block, count);
+            if (out && fwrite(block + from, 1, to - from, out) != to - from)
+            {
+                *error = "cannot write the output file";
+                res = e_failure;
+            }
+        }
+        start += count;
+    }
+    free(block);
+    free(body);
+
+    if (res == e_success && whole && packed && pos != info->embedded_size)
+        res = e_failure;                                         // Blocks do not add up
+    if (res == e_success && whole && info->checksum)
+    {
+        unsigned char bytes[CHECKSUM_BYTES];
+        if (get_bytes(png, (char *)bytes, CHECKSUM_BYTES, cipher, info->embedded_size) == e_failure)
+            res = e_failure;
+        else if (be32(bytes) != crc)
+        {
+            *error = "checksum mismatch";
+            res = e_failure;
+        }
+    }
+    if (res == e_failure && *error == NULL)
+        *error = png->bad_crc ? "bad PNG chunk CRC" : "corrupt payload";
+    return res;
+}
+
+void png_close(PngStream *png)
+{
+    if (png == NULL)
+        return;
+    if (png->inflating) inflateEnd(&png->inflater);
+    if (png->deflating) deflateEnd(&png->deflater);
+    free(png->window);
+    free(png->filters);
+    free(png->prev_in);
+    free(png->prev_out);
+    free(png->line);
+    free(png);
+}
@@ -0,0 +1,68 @@
+#ifndef PNG_H
+#define PNG_H
+
+#include <stdio.h>          // FILE
+#include <stddef.h>         // size_t
+#include "types.h"          // Status
+#include "steg.h"           // StegParams, StegPayloadInfo
+#include "bmp.h"            // BmpPayload
+
+/*
+ * PNG covers
+ * 8-bit grey, RGB and RGBA images (not interlaced) are embedded into
+ * without ever holding the whole image: the IDAT stream is inflated one
+ * scanline at a time, unfiltered into a window of a few rows, the payload
+ * goes into those rows with the same slot layout, kernels and stego
+ * format as a BMP of that pixel format (the raw rows play the part of the
+ * pixel array), and each row is filtered again with its original filter
+ * type and deflated as soon as the payload has moved past it. Once the
+ * payload is in, the rest of the image only has to be recompressed: its
+ * filtered bytes are passed from inflate to deflate in large blocks
+ * without being unfiltered. Chunks other than IDAT are copied unchanged;
+ * every chunk read up to the end of the image data is CRC checked.
+ * Decoding inflates just the rows the payload occupies.
+ * Memory is the row window, the zlib states and PNG_IO_BYTES buffers,
+ * whatever the image size (plus the compressed payload with -z). Not
+ * supported: palette, grey + alpha and 16-bit images (an LSB change
+ * would not be a small colour change, or the layout has no such lane),
+ * Adam7 interlacing and --scatter (rows are only visited in order)
+ */
+
+/* Compressed bytes read and IDAT bytes written at a time, and the least row window */
+#define PNG_IO_BYTES (64 * 1024)
+
+/* One PNG being decoded (opaque) */
+typedef struct _PngStream PngStream;
+
+/* Non zero if the file starts with the PNG signature */
+int png_file(const char *fname);
+
+/*
+ * Embed payload into the PNG read from cover and write the stego PNG to
+ * stego (both positioned at the start). On e_failure *error says why
+ */
+Status png_encode(FILE *cover, FILE *stego, const char *payload, size_t payload_size,
+                  const StegParams *params, const char **error);
+
+/*
+ * Find the payload of a stego PNG and read every field before it. key is
+ * checked against encrypted payloads; NULL still reads the fields (info
+ * says the payload is encrypted) but png_decode_payload() will fail.
+ * Returns NULL when there is no readable payload: *found says whether a
+ * magic string was seen and *error why (NULL for an image without one)
+ */
+PngStream *png_decode_open(FILE *stego, const unsigned char *key, StegPayloadInfo *info,
+                           BmpPayload *found, const char **error);
+
+/*
+ * Write payload bytes [offset, offset + length) (clipped at its end) to
+ * out, NULL to only read them; e_failure if offset is past the end. The whole payload (offset 0, length at
+ * least its size) is checked against its CRC32C; a slice stops reading
+ * rows at its last byte and is not checked
+ */
+Status png_decode_payload(PngStream *png, FILE *out, size_t offset, size_t length, const char **error);
+
+/* Release a stream of png_decode_open() (does not close its file) */
+void png_close(PngStream *png);
+
+#endif
@@ -0,0 +1,84 @@
+#define _GNU_SOURCE                 // copy_file_range
+#include <stdlib.h>                 // Copy buffer
+#include <errno.h>                  // EINTR
+#include <unistd.h>                 // pread, pwrite, copy_file_range
+#include <sys/stat.h>               // fstat
+#include "reflink.h"                // CloneMethod declarations
+#include "common.h"                 // COPY_BLOCK
+
+#ifdef __linux__
+#include <sys/ioctl.h>              // ioctl
+#include <linux/fs.h>               // FICLONE
+#endif
+
+/* Copy the bytes of src_fd from offset on with pread/pwrite */
+static Status copy_plain(int src_fd, int dest_fd, size_t offset)
+{
+    char *buf = malloc(COPY_BLOCK);
+    Status res = buf ? e_success : e_failure;
+
+    while (res == e_success)
+    {
+        ssize_t n = pread(src_fd, buf, COPY_BLOCK, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0)
+        {
+            if (n < 0) res = e_failure;
+            break;                                          // End of the cover
+        }
+        for (ssize_t done = 0; res == e_success && done < n; )
+        {
+            ssize_t w = pwrite(dest_fd, buf + done, n - done, offset + done);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) res = e_failure;
+            else done += w;
+        }
+        offset += n;
+    }
+    free(buf);
+    return res;
+}
+
+Status clone_file(int src_fd, int dest_fd, CloneMethod *method)
+{
+    struct stat st;
+    size_t done = 0;
+
+    if (fstat(src_fd, &st) != 0)
+        return e_failure;
+
+#ifdef __linux__
+#ifdef FICLONE
+    if (ioctl(dest_fd, FICLONE, src_fd) == 0)               // Same filesystem with shared extents
+    {
+        *method = clone_reflink;
+        return e_success;
+    }
+#endif
+    while (done < (size_t)st.st_size)                       // In-kernel copy (other filesystems, or no reflink)
+    {
+        loff_t in = done, out = done;
+        ssize_t n = copy_file_range(src_fd, &in, dest_fd, &out, (size_t)st.st_size - done, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;                                  // Not supported here: copy the rest by hand
+        done += n;
+    }
+    if (done == (size_t)st.st_size)
+    {
+        *method = clone_copy_range;
+        return e_success;
+    }
+#endif
+    *method = clone_copy;
+    return copy_plain(src_fd, dest_fd, done);
+}
+
+const char *clone_method_name(CloneMethod method)
+{
+    switch (method)
+    {
+        case clone_reflink: return "reflink";
+        case clone_copy_range: return "copy_file_range";
+        default: return "copy";
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef REFLINK_H
+#define REFLINK_H
+
+#include "types.h"          // Status
+
+/*
+ * Whole-file copy of the cover for patch-only stego output (--clone)
+ * The stego image starts as a copy of the cover that shares its blocks
+ * where the filesystem can (FICLONE reflink), is copied inside the kernel
+ * where it cannot (copy_file_range), and falls back to a plain read/write
+ * copy; the encoder then rewrites only the bytes that carry the payload
+ */
+
+typedef enum
+{
+    clone_reflink,          // Blocks shared with the cover (btrfs, XFS, ...): no data written
+    clone_copy_range,       // Copied by the kernel without passing through user space
+    clone_copy              // pread/pwrite copy
+} CloneMethod;
+
+/* Make dest_fd (opened for writing) a copy of every byte of src_fd, method tells how */
+Status clone_file(int src_fd, int dest_fd, CloneMethod *method);
+
+/* Name of a method for messages */
+const char *clone_method_name(CloneMethod method);
+
+#endif
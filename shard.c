@@ -0,0 +1,474 @@
+#include <stdio.h>                  // Report, mapped files
+#include <stdlib.h>                 // Shard buffers
+#include <string.h>                 // Names, headers
+#include <limits.h>                 // UINT_MAX (the payload size field is 32 bits wide)
+#include <unistd.h>                 // sysconf
+#include <sys/stat.h>               // Output is never the cover itself
+#include "shard.h"                  // Shard declarations
+#include "erasure.h"                // Parity shards
+#include "steg.h"                   // In-memory encode / decode
+#include "chacha.h"                 // Key file, random set id
+#include "mapping.h"                // Mapped covers, images and output
+#include "parallel.h"               // run_tiles
+#include "decode.h"                 // decode_output_path
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+static void put_be(unsigned char *p, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        p[i] = (unsigned char)(value >> (8 * (bytes - 1 - i)));
+}
+
+static uint64_t get_be(const unsigned char *p, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value = value << 8 | p[i];
+    return value;
+}
+
+void shard_header_write(const ShardHeader *header, unsigned char out[SHARD_HEADER])
+{
+    memcpy(out, SHARD_MAGIC, 4);
+    put_be(out + 4, header->set_id, 8);
+    put_be(out + 12, header->index, 2);
+    put_be(out + 14, header->n, 2);
+    put_be(out + 16, header->k, 2);
+    memset(out + 18, 0, 10);
+    memcpy(out + 18, header->extn, strlen(header->extn));
+    put_be(out + 28, header->secret_size, 8);
+    put_be(out + 36, header->shard_size, 4);
+}
+
+Status shard_header_read(const unsigned char in[SHARD_HEADER], ShardHeader *header)
+{
+    if (memcmp(in, SHARD_MAGIC, 4) != 0)
+        return e_failure;
+    header->set_id = get_be(in + 4, 8);
+    header->index = (int)get_be(in + 12, 2);
+    header->n = (int)get_be(in + 14, 2);
+    header->k = (int)get_be(in + 16, 2);
+    memcpy(header->extn, in + 18, 10);
+    header->secret_size = get_be(in + 28, 8);
+    header->shard_size = get_be(in + 36, 4);
+    if (header->n < 1 || header->n > ERASURE_MAX_SHARDS || header->k < 1 || header->k > header->n ||
+        header->index >= header->n)
+        return e_failure;
+    if (header->extn[9] != '\0' || header->extn[0] != '.' || strchr(header->extn, '/'))
+        return e_failure;                                   // It becomes part of the output file name
+    return header->shard_size == (header->secret_size + header->k - 1) / header->k ? e_success : e_failure;
+}
+
+/* Workers of opts->threads, default one per CPU, at most one per image */
+static int shard_workers(const StegOptions *opts)
+{
+    int workers = opts->threads > 0 ? opts->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return workers > 0 ? workers : 1;
+}
+
+/* Read the -K key file, *key_used is NULL without one */
+static Status shard_key(const StegOptions *opts, unsigned char key[CHACHA_KEY_BYTES], const unsigned char **key_used)
+{
+    *key_used = NULL;
+    if (opts->key_fname == NULL)
+        return e_success;
+    if (chacha_read_key(opts->key_fname, key) == e_failure)
+    {
+        printf("Error: Unreadable key file %s\n", opts->key_fname);
+        return e_failure;
+    }
+    *key_used = key;
+    return e_success;
+}
+
+/* Map a whole file read only */
+static Status map_path(const char *fname, MappedFile *map)
+{
+    FILE *fptr = fopen(fname, "rb");
+    Status res = fptr ? map_file_read(fptr, map) : e_failure;
+    if (fptr) fclose(fptr);                                 // The mapping stays valid
+    return res;
+}
+
+/* -------------------- Encode -------------------- */
+
+typedef struct _ShardEncode
+{
+    char **covers;
+    char **outputs;                 // Stego image of every cover
+    const StegParams *params;
+    const char *secret;             // Mapped secret
+    ShardHeader header;             // Common fields (index set per shard)
+    Status *results;
+} ShardEncode;
+
+/* Payload of shard index: header, then its slice of the secret or its parity */
+static unsigned char *shard_payload(const ShardEncode *enc, int index)
+{
+    const ShardHeader *h = &enc->header;
+    unsigned char *payload = calloc(1, SHARD_HEADER + h->shard_size);
+    ShardHeader header = *h;
+
+    if (payload == NULL)
+        return NULL;
+    header.index = index;
+    shard_header_write(&header, payload);
+    for (int d = 0; d < h->k; d++)                          // Data shards: one slice; parity: every slice once
+    {
+        size_t start = (size_t)d * h->shard_size;
+        size_t len = start < h->secret_size ? h->secret_size - start : 0;
+        len = len < h->shard_size ? len : h->shard_size;   // The zero padding of the last shard adds nothing
+        erasure_mul_add(payload + SHARD_HEADER, (const unsigned char *)enc->secret + start,
+                        erasure_coef(h->k, index, d), len);
+    }
+    return payload;
+}
+
+static void encode_shard(void *ctx, size_t index, int worker)
+{
+    ShardEncode *enc = ctx;
+    MappedFile cover = {0}, out = {0};
+    FILE *fptr = NULL;
+    unsigned char *payload = shard_payload(enc, (int)index);
+    Status res = payload ? map_path(enc->covers[index], &cover) : e_failure;
+
+    (void)worker;
+    if (res == e_success && (fptr = fopen(enc->outputs[index], "w+b")) == NULL)
+        res = e_failure;
+    if (res == e_success)
+        res = map_file_write(fptr, steg_encoded_size(cover.size), &out);
+    if (res == e_success)
+        res = steg_encode(cover.data, cover.size, (const char *)payload, SHARD_HEADER + enc->header.shard_size,
+                          enc->params, out.data, out.size);
+    unmap_file(&out);
+    unmap_file(&cover);
+    if (fptr) fclose(fptr);
+    free(payload);
+    enc->results[index] = res;
+}
+
+/* Output names out_dir/<cover name>, distinct and never one of the covers */
+static Status shard_outputs(const char *out_dir, char *covers[], int count, char **outputs)
+{
+    for (int i = 0; i < count; i++)
+    {
+        const char *slash = strrchr(covers[i], '/');
+        struct stat cover_st, out_st;
+        outputs[i] = malloc(PATH_MAX);
+        if (outputs[i] == NULL ||
+            snprintf(outputs[i], PATH_MAX, "%s/%s", out_dir, slash ? slash + 1 : covers[i]) >= PATH_MAX)
+            return e_failure;
+        for (int j = 0; j < i; j++)
+        {
+            if (strcmp(outputs[j], outputs[i]) == 0)
+            {
+                printf("Error: %s and %s would both be written to %s\n", covers[j], covers[i], outputs[i]);
+                return e_failure;
+            }
+        }
+        if (stat(covers[i], &cover_st) == 0 && stat(outputs[i], &out_st) == 0 &&
+            cover_st.st_dev == out_st.st_dev && cover_st.st_ino == out_st.st_ino)
+        {
+            printf("Error: %s would overwrite its cover, choose another directory\n", outputs[i]);
+            return e_failure;
+        }
+    }
+    return e_success;
+}
+
+Status run_shard_encode(const char *secret_fname, const char *out_dir, char *covers[], int count, const StegOptions *opts)
+{
+    ShardEncode enc = {0};
+    StegParams params = {0};
+    MappedFile secret = {0};
+    unsigned char key[CHACHA_KEY_BYTES], id[CHACHA_NONCE_BYTES];
+    const char *extn = strrchr(secret_fname, '.');
+    Status res = e_success;
+
+    if (count < 1 || count > ERASURE_MAX_SHARDS || opts->parity < 0 || opts->parity >= count)
+    {
+        printf("Error: 1 to %d covers and fewer --parity shards than covers\n", ERASURE_MAX_SHARDS);
+        return e_failure;
+    }
+    if (extn == NULL || strchr(extn, '/') || strlen(extn) > STEG_EXTN_MAX)
+        extn = ".txt";                                      // Rebuilt as .txt like an unnamed secret
+    params.bit_depth = opts->bit_depth;
+    params.use_alpha = opts->use_alpha;
+    params.compress = opts->compress;
+    params.checksum = opts->checksum;
+    params.scatter = opts->scatter;
+    params.extn = SHARD_EXTN;
+    if (shard_key(opts, key, &params.key) == e_failure || chacha_random_nonce(id) == e_failure ||
+        map_path(secret_fname, &secret) == e_failure)
+    {
+        printf("Error: Cannot read %s\n", secret_fname);
+        return e_failure;
+    }
+
+    enc.covers = covers;
+    enc.params = &params;
+    enc.secret = secret.data;
+    enc.header.set_id = get_be(id, 8);
+    enc.header.n = count;
+    enc.header.k = count - opts->parity;
+    strcpy(enc.header.extn, extn);
+    enc.header.secret_size = secret.size;
+    enc.header.shard_size = (secret.size + enc.header.k - 1) / enc.header.k;
+    enc.outputs = calloc(count, sizeof(char *));
+    enc.results = calloc(count, sizeof(Status));
+    if (!enc.outputs || !enc.results || enc.header.shard_size > UINT_MAX - SHARD_HEADER ||
+        shard_outputs(out_dir, covers, count, enc.outputs) == e_failure)
+        res = e_failure;
+
+    for (int i = 0; res == e_success && !opts->compress && i < count; i++)   // Every cover must hold a shard
+    {
+        MappedFile cover = {0};
+        if (map_path(covers[i], &cover) == e_failure ||
+            steg_capacity(cover.data, cover.size, &params) < SHARD_HEADER + enc.header.shard_size)
+        {
+            printf("Error: %s cannot hold a shard of %zu bytes\n", covers[i], SHARD_HEADER + enc.header.shard_size);
+            res = e_failure;
+        }
+        unmap_file(&cover);
+    }
+    if (res == e_success)
+        res = run_tiles(shard_workers(opts), count, encode_shard, &enc);    // One task per cover
+    for (int i = 0; enc.results && res == e_success && i < count; i++)
+    {
+        if (enc.results[i] == e_failure)
+        {
+            printf("Error: Cannot write shard %d to %s\n", i, enc.outputs[i]);
+            res = e_failure;
+        }
+    }
+    if (res == e_success && !opts->quiet)
+        printf("Split %zu bytes over %d covers (%d data + %d parity shards of %zu bytes)\n",
+               secret.size, count, enc.header.k, opts->parity, enc.header.shard_size);
+
+    for (int i = 0; enc.outputs && i < count; i++)
+        free(enc.outputs[i]);
+    free(enc.outputs);
+    free(enc.results);
+    unmap_file(&secret);
+    return res;
+}
+
+/* -------------------- Decode -------------------- */
+
+typedef struct _ShardImage
+{
+    MappedFile map;
+    ShardHeader header;
+    int valid;                      // Header read (with the key for encrypted shards)
+    unsigned char *parity;          // Decoded parity shard (rebuilds only)
+} ShardImage;
+
+typedef struct _ShardDecode
+{
+    char **names;
+    ShardImage *images;
+    const unsigned char *key;
+    ShardHeader header;             // Header of the chosen set
+    ShardImage **chosen;            // k images, chosen[j] carries shard rows[j]
+    int *rows;
+    int *missing;                   // Data shards that are rebuilt
+    unsigned char *inv;             // Decode matrix (k * k)
+    char *out;                      // Mapped output file
+    Status *results;
+} ShardDecode;
+
+/* Secret bytes of data shard d */
+static size_t data_length(const ShardHeader *h, int d)
+{
+    size_t start = (size_t)d * h->shard_size;
+    size_t len = start < h->secret_size ? h->secret_size - start : 0;
+    return len < h->shard_size ? len : h->shard_size;
+}
+
+/* Data shard row in the output file, NULL when it holds no bytes (an empty secret maps nothing) */
+static char *out_shard(const ShardDecode *dec, int row)
+{
+    return data_length(&dec->header, row) ? dec->out + (size_t)row * dec->header.shard_size : NULL;
+}
+
+static void read_shard_header(void *ctx, size_t index, int worker)
+{
+    ShardDecode *dec = ctx;
+    ShardImage *image = &dec->images[index];
+    StegPayloadInfo info;
+    unsigned char head[SHARD_HEADER];
+    size_t got;
+
+    (void)worker;
+    image->valid = map_path(dec->names[index], &image->map) == e_success &&
+                   steg_decode_info(image->map.data, image->map.size, &info) == e_success &&
+                   strcmp(info.extn, SHARD_EXTN) == 0 &&
+                   steg_decode_range(image->map.data, image->map.size, dec->key, 0, SHARD_HEADER, (char *)head,
+                                     sizeof(head), &got) == e_success &&
+                   shard_header_read(head, &image->header) == e_success &&
+                   info.payload_size == SHARD_HEADER + image->header.shard_size;
+}
+
+/* Data shards straight into the output file, parity shards into memory */
+static void decode_shard(void *ctx, size_t j, int worker)
+{
+    ShardDecode *dec = ctx;
+    ShardImage *image = dec->chosen[j];
+    const ShardHeader *h = &dec->header;
+    int row = dec->rows[j];
+    size_t got;
+
+    (void)worker;
+    if (row < h->k)
+    {
+        dec->results[j] = steg_decode_range(image->map.data, image->map.size, dec->key, SHARD_HEADER, data_length(h, row),
+                                            out_shard(dec, row), data_length(h, row), &got);
+        return;
+    }
+    image->parity = malloc(h->shard_size ? h->shard_size : 1);
+    dec->results[j] = image->parity ? steg_decode_range(image->map.data, image->map.size, dec->key, SHARD_HEADER,
+                                                        h->shard_size, (char *)image->parity, h->shard_size, &got)
+                                    : e_failure;
+}
+
+/* Missing data shard dec->missing[m] from the k chosen shards */
+static void rebuild_shard(void *ctx, size_t m, int worker)
+{
+    ShardDecode *dec = ctx;
+    const ShardHeader *h = &dec->header;
+    int d = dec->missing[m];
+    unsigned char *buf = calloc(1, h->shard_size ? h->shard_size : 1);
+
+    (void)worker;
+    for (int j = 0; buf && j < h->k; j++)
+    {
+        int row = dec->rows[j];
+        const unsigned char *src = row < h->k ? (const unsigned char *)out_shard(dec, row) : dec->chosen[j]->parity;
+        erasure_mul_add(buf, src, dec->inv[d * h->k + j], row < h->k ? data_length(h, row) : h->shard_size);
+    }
+    if (buf && data_length(h, d) > 0)                       // Shards past the end of the secret are all padding
+        memcpy(out_shard(dec, d), buf, data_length(h, d));
+    dec->results[m] = buf ? e_success : e_failure;
+    free(buf);
+}
+
+/* Pick k distinct shards of the set of the first valid image, data shards first */
+static int choose_shards(ShardDecode *dec, int count)
+{
+    ShardImage *first = NULL;
+    int found = 0;
+
+    for (int i = 0; i < count && !first; i++)
+        if (dec->images[i].valid) first = &dec->images[i];
+    if (first == NULL)
+        return 0;
+    dec->header = first->header;
+    int *taken = calloc(dec->header.n, sizeof(int));
+    for (int pass = 0; taken && pass < 2; pass++)           // Data shards need no rebuilding, take them first
+    {
+        for (int i = 0; i < count && found < dec->header.k; i++)
+        {
+            const ShardHeader *h = &dec->images[i].header;
+            if (!dec->images[i].valid || h->set_id != dec->header.set_id || h->n != dec->header.n ||
+                h->k != dec->header.k || h->secret_size != dec->header.secret_size || taken[h->index] ||
+                (pass == 0) != (h->index < h->k))
+                continue;
+            taken[h->index] = 1;
+            dec->chosen[found] = &dec->images[i];
+            dec->rows[found++] = h->index;
+        }
+    }
+    free(taken);
+    return found;
+}
+
+Status run_shard_decode(const char *output_fname, char *images[], int count, const StegOptions *opts)
+{
+    ShardDecode dec = {0};
+    unsigned char key[CHACHA_KEY_BYTES];
+    char path[PATH_MAX];
+    MappedFile out = {0};
+    FILE *fptr = NULL;
+    int workers = shard_workers(opts), missing = 0;
+    Status res = shard_key(opts, key, &dec.key);
+
+    dec.names = images;
+    dec.images = calloc(count, sizeof(ShardImage));
+    dec.chosen = calloc(count, sizeof(ShardImage *));
+    dec.rows = calloc(count, sizeof(int));
+    dec.results = calloc(count, sizeof(Status));
+    if (res == e_success && (!dec.images || !dec.chosen || !dec.rows || !dec.results))
+        res = e_failure;
+    if (res == e_success)
+        res = run_tiles(workers, count, read_shard_header, &dec);         // Headers only
+
+    int found = res == e_success ? choose_shards(&dec, count) : 0;
+    if (res == e_success && (found == 0 || found < dec.header.k))
+    {
+        if (found == 0)
+            printf("Error: No shard found%s\n", dec.key ? " (or wrong key)" : " (encrypted shards need -K)");
+        else
+            printf("Error: Only %d of the %d shards needed were found\n", found, dec.header.k);
+        res = e_failure;
+    }
+    if (res == e_success)                                   // Output name as the decoder builds it
+    {
+        if (decode_output_path(path, sizeof(path), output_fname, dec.header.extn) == d_failure ||
+            (fptr = fopen(path, "w+b")) == NULL ||
+            map_file_write(fptr, dec.header.secret_size, &out) == e_failure)
+        {
+            printf("Error: Cannot create file %s\n", path);
+            res = e_failure;
+        }
+        dec.out = out.data;
+    }
+    if (res == e_success)
+        res = run_tiles(workers, found, decode_shard, &dec);              // One task per chosen image
+    for (int j = 0; res == e_success && j < found; j++)
+        res = dec.results[j];
+
+    if (res == e_success)
+    {
+        dec.missing = calloc(dec.header.k, sizeof(int));
+        int *present = calloc(dec.header.k, sizeof(int));
+        for (int j = 0; present && j < found; j++)
+            if (dec.rows[j] < dec.header.k) present[dec.rows[j]] = 1;
+        for (int d = 0; present && dec.missing && d < dec.header.k; d++)
+            if (!present[d]) dec.missing[missing++] = d;
+        if (!present || !dec.missing)
+            res = e_failure;
+        free(present);
+    }
+    if (res == e_success && missing > 0)                    // Rebuild from parity
+    {
+        dec.inv = malloc((size_t)dec.header.k * dec.header.k);
+        res = dec.inv ? erasure_invert(dec.header.k, dec.header.n, dec.rows, dec.inv) : e_failure;
+        if (res == e_success)
+            res = run_tiles(workers, missing, rebuild_shard, &dec);
+        for (int m = 0; res == e_success && m < missing; m++)
+            res = dec.results[m];
+    }
+    if (res == e_failure && found >= dec.header.k && found > 0)
+        printf("Error: Shards are damaged%s\n", dec.key ? " or the key is wrong" : "");
+    if (res == e_success && !opts->quiet)
+        printf("Rebuilt %s (%llu bytes) from %d of %d shards%s\n", path, (unsigned long long)dec.header.secret_size,
+               found, dec.header.n, missing ? ", missing data shards rebuilt from parity" : "");
+
+    unmap_file(&out);
+    if (fptr) fclose(fptr);
+    for (int i = 0; dec.images && i < count; i++)
+    {
+        unmap_file(&dec.images[i].map);
+        free(dec.images[i].parity);
+    }
+    free(dec.images);
+    free(dec.chosen);
+    free(dec.rows);
+    free(dec.results);
+    free(dec.missing);
+    free(dec.inv);
+    return res;
+}
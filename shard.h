@@ -0,0 +1,52 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h>         // size_t
+#include <stdint.h>         // uint64_t
+#include "types.h"          // Status, StegOptions
+
+/*
+ * Sharded payloads (-s / -r)
+ * One secret spread over n covers. It is cut into k equal data shards
+ * and, with --parity m, m = n - k Reed-Solomon parity shards are added
+ * (erasure.c), so any k of the n stego images rebuild it. Every shard is
+ * an ordinary payload with the extension SHARD_EXTN that starts with a
+ * SHARD_HEADER byte header (big endian):
+ *
+ *     "SHD1"  set id (8)  index (2)  n (2)  k (2)  extension (10)  secret size (8)  shard size (4)
+ *
+ * The set id is random per secret so shards of different secrets are not
+ * mixed up. Covers are encoded and shard images decoded as one task per
+ * image on -j workers through the in-memory library on mapped files;
+ * decoded data shards land straight in the mapped output file and only
+ * missing ones are rebuilt from parity
+ */
+
+#define SHARD_EXTN ".shd"
+#define SHARD_MAGIC "SHD1"
+#define SHARD_HEADER 40
+
+typedef struct _ShardHeader
+{
+    uint64_t set_id;
+    int index;                      // 0..n-1, data shards first
+    int n;                          // Shards written
+    int k;                          // Shards needed (n without parity)
+    char extn[10];                  // Extension of the secret file
+    uint64_t secret_size;
+    size_t shard_size;              // Bytes per shard (the last data shard is zero padded)
+} ShardHeader;
+
+/* Header bytes of a shard */
+void shard_header_write(const ShardHeader *header, unsigned char out[SHARD_HEADER]);
+
+/* Parse and check header bytes, e_failure if they are not a consistent shard header (or the extension is not a '.' and up to 8 more bytes without '/') */
+Status shard_header_read(const unsigned char in[SHARD_HEADER], ShardHeader *header);
+
+/* -s: split secret_fname over count covers (opts->parity of them parity), stego images written as out_dir/<cover name> */
+Status run_shard_encode(const char *secret_fname, const char *out_dir, char *covers[], int count, const StegOptions *opts);
+
+/* -r: rebuild the secret from shard images into output_fname with the stored extension in place of its own */
+Status run_shard_decode(const char *output_fname, char *images[], int count, const StegOptions *opts);
+
+#endif
@@ -0,0 +1,148 @@
+#include <stdio.h>                // fprintf
+#include <string.h>               // memset, strstr
+#include <stdlib.h>               // strtoull
+#include <time.h>                 // clock_gettime
+#include <fcntl.h>                // open
+#include <unistd.h>               // pread, close
+#include <sys/resource.h>         // getrusage
+#include "stats.h"                // Stats declarations
+
+static const char *stage_names[stats_stage_count] = {
+    "open_files", "check_capacity", "compress", "bmp_header", "header_fields",
+    "payload", "copy_remaining", "close_files"};
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Value of one "name: value" line of /proc/self/io */
+static unsigned long long io_field(const char *buf, const char *key)
+{
+    const char *line = strstr(buf, key);
+    return line ? strtoull(line + strlen(key), NULL, 10) : 0;
+}
+
+/* Current process wide I/O counters, minus the reads of /proc/self/io made so far */
+static IoCounters read_io(StegStats *stats)
+{
+    IoCounters io = {0};
+    char buf[512];
+
+    if (stats->io_fd < 0)
+        return io;
+    ssize_t len = pread(stats->io_fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0)
+        return io;
+    buf[len] = '\0';
+
+    io.read_bytes = io_field(buf, "rchar:");
+    io.write_bytes = io_field(buf, "wchar:");
+    io.read_calls = io_field(buf, "syscr:");
+    io.write_calls = io_field(buf, "syscw:");
+
+    io.read_bytes -= stats->self.read_bytes;  // This read is counted after it returns,
+    io.read_calls -= stats->self.read_calls;  // so only the earlier ones are subtracted
+    stats->self.read_bytes += len;
+    stats->self.read_calls++;
+    return io;
+}
+
+static IoCounters io_delta(IoCounters end, IoCounters start)
+{
+    IoCounters d = {end.read_bytes - start.read_bytes, end.write_bytes - start.write_bytes,
+                    end.read_calls - start.read_calls, end.write_calls - start.write_calls};
+    return d;
+}
+
+static void io_add(IoCounters *sum, IoCounters d)
+{
+    sum->read_bytes += d.read_bytes;
+    sum->write_bytes += d.write_bytes;
+    sum->read_calls += d.read_calls;
+    sum->write_calls += d.write_calls;
+}
+
+void stats_start(StegStats *stats, const char *operation)
+{
+    if (!stats) return;
+    int fd = open("/proc/self/io", O_RDONLY);  // Kept open for the run, -1 outside Linux
+    memset(stats, 0, sizeof(*stats));
+    stats->operation = operation;
+    stats->current = -1;
+    stats->io_fd = fd;
+    stats->io_start = read_io(stats);
+    stats->start_us = now_us();
+}
+
+/* Add the time and I/O since the current stage started to it */
+static void stats_end_stage(StegStats *stats)
+{
+    if (stats->current < 0) return;
+    double end = now_us();
+    IoCounters io = read_io(stats);
+    stats->stage_us[stats->current] += end - stats->stage_start_us;
+    io_add(&stats->stage_io[stats->current], io_delta(io, stats->stage_io_start));
+    stats->current = -1;
+}
+
+void stats_stage(StegStats *stats, StatsStage stage)
+{
+    if (!stats) return;
+    stats_end_stage(stats);
+    stats->current = stage;
+    stats->stage_used[stage] = 1;
+    stats->stage_io_start = read_io(stats);
+    stats->stage_start_us = now_us();
+}
+
+void stats_stop(StegStats *stats)
+{
+    if (!stats) return;
+    stats_end_stage(stats);
+    stats->total_us = now_us() - stats->start_us;
+    stats->io_total = io_delta(read_io(stats), stats->io_start);
+    if (stats->io_fd >= 0) close(stats->io_fd);
+    stats->io_fd = -1;
+}
+
+static void write_io(FILE *out, IoCounters io)
+{
+    fprintf(out, "\"read_bytes\":%llu,\"write_bytes\":%llu,\"read_calls\":%llu,\"write_calls\":%llu",
+            io.read_bytes, io.write_bytes, io.read_calls, io.write_calls);
+}
+
+Status stats_write_json(StegStats *stats, const char *fname, int succeeded)
+{
+    struct rusage usage = {0};
+    FILE *out = fname ? fopen(fname, "w") : stderr;
+    if (!out) { perror("fopen"); return e_failure; }
+    getrusage(RUSAGE_SELF, &usage);
+
+    fprintf(out, "{\"operation\":\"%s\",\"status\":\"%s\",\"total_us\":%.1f,",
+            stats->operation, succeeded ? "ok" : "failed", stats->total_us);
+    fprintf(out, "\"payload_bytes\":%llu,\"bit_depth\":%d,\"threads\":%d,\"mmap\":%d,",
+            stats->payload_bytes, stats->bit_depth, stats->threads, stats->use_mmap);
+    if (stats->stage_used[stats_payload] && stats->stage_us[stats_payload] > 0)
+        fprintf(out, "\"payload_mb_s\":%.1f,", stats->payload_bytes / stats->stage_us[stats_payload]);
+
+    fprintf(out, "\"stages\":{");
+    for (int s = 0, first = 1; s < stats_stage_count; s++)
+    {
+        if (!stats->stage_used[s]) continue;
+        fprintf(out, "%s\"%s\":{\"us\":%.1f,", first ? "" : ",", stage_names[s], stats->stage_us[s]);
+        write_io(out, stats->stage_io[s]);
+        fprintf(out, "}");
+        first = 0;
+    }
+    fprintf(out, "},\"io\":{");
+    write_io(out, stats->io_total);
+    fprintf(out, "},\"peak_rss_kb\":%ld,\"minor_faults\":%ld,\"major_faults\":%ld,"
+                 "\"voluntary_switches\":%ld,\"involuntary_switches\":%ld}\n",
+            usage.ru_maxrss, usage.ru_minflt, usage.ru_majflt, usage.ru_nvcsw, usage.ru_nivcsw);
+
+    if (fname && fclose(out) != 0) return e_failure;
+    return e_success;
+}
@@ -0,0 +1,72 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "types.h"          // Status
+
+/*
+ * Run statistics (--stats=json)
+ * Wall time and I/O counters per stage of an encode/decode plus peak RSS
+ * and page faults for the whole run, written as one JSON object.
+ * Every function accepts a NULL StegStats, so the encoder and decoder
+ * call them unconditionally and pay nothing when stats are off
+ */
+
+/* Stages in the order they run (decoding skips capacity and copy_remaining) */
+typedef enum
+{
+    stats_open_files,
+    stats_check_capacity,
+    stats_compress,         // -z: secret compressed before the capacity check
+    stats_bmp_header,
+    stats_header_fields,    // Magic string, format word, extension and size
+    stats_payload,          // Secret data
+    stats_copy_remaining,   // Image bytes after the secret data
+    stats_close_files,
+    stats_stage_count
+} StatsStage;
+
+/* Counters from /proc/self/io (all threads), zero where not available */
+typedef struct _IoCounters
+{
+    unsigned long long read_bytes;    // rchar
+    unsigned long long write_bytes;   // wchar
+    unsigned long long read_calls;    // syscr
+    unsigned long long write_calls;   // syscw
+} IoCounters;
+
+typedef struct _StegStats
+{
+    const char *operation;            // "encode", "decode" or "batch"
+    int current;                      // Stage being timed, -1 if none
+    int io_fd;                        // Open /proc/self/io, -1 if not available
+    IoCounters self;                  // Reads made by the stats code itself (subtracted)
+    double start_us;                  // Start of the run
+    double stage_start_us;            // Start of the current stage
+    IoCounters stage_io_start;        // Counters at the start of the current stage
+    IoCounters io_start;              // Counters at the start of the run
+    double total_us;                  // Set by stats_stop
+    IoCounters io_total;
+    int stage_used[stats_stage_count];
+    double stage_us[stats_stage_count];
+    IoCounters stage_io[stats_stage_count];
+
+    /* Filled in by the caller, reported as is */
+    unsigned long long payload_bytes; // Secret bytes embedded or extracted
+    int bit_depth;
+    int threads;
+    int use_mmap;
+} StegStats;
+
+/* Start a run (clears stats) */
+void stats_start(StegStats *stats, const char *operation);
+
+/* End the current stage (if any) and start timing stage */
+void stats_stage(StegStats *stats, StatsStage stage);
+
+/* End the current stage and the run */
+void stats_stop(StegStats *stats);
+
+/* Write the JSON object to fname, or stderr if fname is NULL; succeeded is the outcome of the run */
+Status stats_write_json(StegStats *stats, const char *fname, int succeeded);
+
+#endif
@@ -0,0 +1,464 @@
+#include <stdlib.h>             // Compressed payload buffer
+#include <string.h>             // memcpy, strlen
+#include <limits.h>             // UINT_MAX (size fields are 32 bits wide)
+#include <pthread.h>            // pthread_once for the kernel selection
+#include "steg.h"               // libsteg declarations
+#include "common.h"             // Magic strings, FORMAT_FLAG_*
+#include "bmp.h"                // Pixel row layout
+#include "cover.h"              // Cover format parsers (BMP, PNM, TGA)
+#include "lsb.h"                // lsb_cover_bytes, kernel selection
+#include "lz.h"                 // -z payload blocks
+#include "chacha.h"             // -K payload cipher
+#include "crc32c.h"             // Payload checksum
+
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+/* Pick the LSB and cipher kernels once for every thread */
+static void init_kernels(void)
+{
+    lsb_init();
+    chacha_init();
+}
+
+/* Next field position in the payload layout of an image buffer */
+typedef struct _StegCursor
+{
+    BmpLayout layout;
+    char *image;                // Whole image (only read when decoding)
+    size_t size;                // Bytes of image
+    size_t slot;                // Next layout slot
+    int depth;                  // Depth of the next field (header fields before the format word use 1)
+} StegCursor;
+
+/* Slots of n data bytes at the cursor lie inside the image */
+static int fits(const StegCursor *cur, size_t n)
+{
+    size_t cover = lsb_cover_bytes(cur->depth), slots = bmp_slots(&cur->layout);
+    return cur->slot <= slots && n <= (slots - cur->slot) / cover &&
+           (n == 0 || bmp_span_end(&cur->layout, cur->slot, cover * n) <= cur->size);
+}
+
+/* Embed n bytes, encrypted as payload bytes pos.. when cipher is set (data may be NULL when n is 0) */
+static Status put_bytes(StegCursor *cur, const char *data, size_t n, const ChaCha *cipher, size_t pos)
+{
+    if (!fits(cur, n)) return e_failure;
+    if (n == 0) return e_success;
+    bmp_embed_keyed(&cur->layout, cur->image, 0, cur->slot, data, n, cur->depth, cipher, pos);
+    cur->slot += lsb_cover_bytes(cur->depth) * n;
+    return e_success;
+}
+
+/* Embed the payload a block at a time; *crc (when set) takes in each plain block right after it is embedded */
+static Status put_payload(StegCursor *cur, const char *data, size_t n, const ChaCha *cipher, uint32_t *crc)
+{
+    for (size_t pos = 0; pos < n; pos += LZ_BLOCK)
+    {
+        size_t count = n - pos < LZ_BLOCK ? n - pos : LZ_BLOCK;
+        if (put_bytes(cur, data + pos, count, cipher, pos) == e_failure) return e_failure;
+        if (crc) *crc = crc32c_update(*crc, data + pos, count);
+    }
+    return e_success;
+}
+
+static Status put_size(StegCursor *cur, uint size)
+{
+    char bytes[4];                                      // Big endian, like encode_size_to_lsb()
+    for (int i = 0; i < 4; i++)
+        bytes[i] = (char)(size >> (24 - 8 * i));
+    return put_bytes(cur, bytes, 4, NULL, 0);
+}
+
+/* Extract n bytes, decrypted as payload bytes pos.. when cipher is set (data may be NULL when n is 0) */
+static Status get_bytes(StegCursor *cur, char *data, size_t n, const ChaCha *cipher, size_t pos)
+{
+    if (!fits(cur, n)) return e_failure;
+    if (n == 0) return e_success;
+    bmp_extract_keyed(&cur->layout, cur->image, 0, cur->slot, data, n, cur->depth, cipher, pos);
+    cur->slot += lsb_cover_bytes(cur->depth) * n;
+    return e_success;
+}
+
+/* Layout and ROWS / ALPHA flags of a cover, like check_capacity() */
+static Status cover_layout(const char *cover, size_t cover_size, const StegParams *params, BmpLayout *layout, uint *flags)
+{
+    BmpInfo bmp;
+
+    if (cover_parse((const unsigned char *)cover, cover_size < COVER_HEADER_MAX ? cover_size : COVER_HEADER_MAX,
+                    cover_size, &bmp) == e_failure)
+        return e_failure;
+    bmp_layout_rows(&bmp, params->use_alpha, layout);
+    *flags = 0;
+    if (!layout->linear)
+        *flags |= FORMAT_FLAG_ROWS;
+    if (params->use_alpha && bmp.bits_per_pixel == 32)
+        *flags |= FORMAT_FLAG_ALPHA;
+    return e_success;
+}
+
+/* Data bytes at the payload depth left after the magic string, format word and the fields before the payload */
+static size_t room(const BmpLayout *layout, uint word, size_t extn_len)
+{
+    size_t header = (strlen(MAGIC_STRING) + (word != 1 ? 4 : 0)) * 8;    // 1 bit per slot
+    size_t fields = 4 + extn_len + 4 + ((word & FORMAT_FLAG_LZ) ? 4 : 0) +
+                    ((word & FORMAT_FLAG_CHACHA) ? CHACHA_NONCE_BYTES + 4 : 0) + ((word & FORMAT_FLAG_CRC) ? CHECKSUM_BYTES : 0);
+    size_t slots = bmp_slots(layout);
+    size_t bytes = slots > header ? (slots - header) / lsb_cover_bytes(word & FORMAT_DEPTH_MASK) : 0;
+
+    bytes = bytes > fields ? bytes - fields : 0;
+    return bytes > UINT_MAX ? UINT_MAX : bytes;
+}
+
+size_t steg_capacity(const char *cover, size_t cover_size, const StegParams *params)
+{
+    StegParams none = {0};
+    BmpLayout layout;
+    uint flags;
+
+    if (params == NULL) params = &none;
+    int depth = params->bit_depth ? params->bit_depth : 1;
+    if (depth < 1 || depth > LSB_MAX_DEPTH || cover_layout(cover, cover_size, params, &layout, &flags) == e_failure)
+        return 0;
+    flags |= (params->compress ? FORMAT_FLAG_LZ : 0) | (params->key ? FORMAT_FLAG_CHACHA : 0) |
+             (params->checksum ? FORMAT_FLAG_CRC : 0);
+    return room(&layout, (uint)depth | flags, strlen(params->extn ? params->extn : ".txt"));
+}
+
+size_t steg_encoded_size(size_t cover_size)
+{
+    return cover_size;
+}
+
+Status steg_encode(const char *cover, size_t cover_size, const char *payload, size_t payload_size,
+                   const StegParams *params, char *out, size_t out_size)
+{
+    StegParams none = {0};
+    StegCursor cur = {0};
+    ChaCha cipher;
+    unsigned char nonce[CHACHA_NONCE_BYTES];
+    uint flags;
+    size_t packed_size = 0;
+    char *packed = NULL;
+    uint32_t crc = 0, *plain_crc;
+
+    pthread_once(&kernels_once, init_kernels);
+    if (params == NULL) params = &none;
+    const char *extn = params->extn ? params->extn : ".txt";
+    int depth = params->bit_depth ? params->bit_depth : 1;
+    if (depth < 1 || depth > LSB_MAX_DEPTH || strlen(extn) > STEG_EXTN_MAX || payload_size > UINT_MAX ||
+        (payload == NULL && payload_size > 0) ||
+        (params->scatter && params->key == NULL) ||
+        out_size < steg_encoded_size(cover_size) || cover_layout(cover, cover_size, params, &cur.layout, &flags) == e_failure)
+        return e_failure;
+
+    plain_crc = params->checksum ? &crc : NULL;         // CRC32C taken by the first pass over the payload
+    if (params->compress && payload_size > 0)
+    {
+        if ((packed = lz_compress_payload(payload, payload_size, &packed_size, plain_crc)) != NULL)
+            flags |= FORMAT_FLAG_LZ;
+        plain_crc = NULL;                               // Done while compressing, kept raw or not
+    }
+    if (params->checksum)
+        flags |= FORMAT_FLAG_CRC;
+    if (params->key)                                    // Fresh nonce per image
+    {
+        if (chacha_random_nonce(nonce) == e_failure)
+        {
+            free(packed);
+            return e_failure;
+        }
+        chacha_setup(&cipher, params->key, nonce);
+        flags |= FORMAT_FLAG_CHACHA | (params->scatter ? FORMAT_FLAG_SCATTER : 0);
+    }
+    uint word = (uint)depth | flags;
+    size_t embedded = packed ? packed_size : payload_size;
+    if (embedded > room(&cur.layout, word, strlen(extn)))
+    {
+        free(packed);
+        return e_failure;                               // Cover too small
+    }
+
+    if (out != cover)
+        memcpy(out, cover, cover_size);
+    cur.image = out;
+    cur.size = cover_size;
+    cur.depth = 1;
+    Status res = put_bytes(&cur, word != 1 ? MAGIC_STRING_EXT : MAGIC_STRING, strlen(MAGIC_STRING), NULL, 0);
+    if (res == e_success && word != 1)
+        res = put_size(&cur, word);
+    cur.depth = depth;
+    if (res == e_success) res = put_size(&cur, strlen(extn));
+    if (res == e_success) res = put_bytes(&cur, extn, strlen(extn), NULL, 0);
+    if (res == e_success) res = put_size(&cur, (uint)payload_size);
+    if (res == e_success && packed) res = put_size(&cur, (uint)packed_size);
+    if (res == e_success && params->key)
+    {
+        res = put_bytes(&cur, (const char *)nonce, CHACHA_NONCE_BYTES, NULL, 0);
+        if (res == e_success) res = put_size(&cur, chacha_key_check(&cipher));
+    }
+    if (res == e_success && (flags & FORMAT_FLAG_SCATTER))     // Payload and checksum in keyed runs
+        res = bmp_layout_scatter(&cur.layout, cur.slot, &cipher);
+    if (res == e_success)
+        res = put_payload(&cur, packed ? packed : payload, embedded, params->key ? &cipher : NULL, plain_crc);
+    if (res == e_success && (flags & FORMAT_FLAG_CRC))     // Trailer: encrypted as the bytes after the payload
+    {
+        char bytes[CHECKSUM_BYTES];
+        for (int i = 0; i < CHECKSUM_BYTES; i++)
+            bytes[i] = (char)(crc >> (24 - 8 * i));
+        res = put_bytes(&cur, bytes, CHECKSUM_BYTES, params->key ? &cipher : NULL, embedded);
+    }
+
+    free(packed);
+    return res;
+}
+
+/* Field reader of bmp_read_fields() over the image buffer */
+static Status read_field(void *ctx, char *data, size_t n)
+{
+    return get_bytes(ctx, data, n, NULL, 0);
+}
+
+/* Find the payload and read every field before it; cur is left at the first payload byte */
+static Status read_fields(const char *stego, size_t stego_size, StegCursor *cur, StegPayloadInfo *info, BmpFields *fields)
+{
+    BmpInfo bmp;
+    uint word;
+
+    memset(info, 0, sizeof(*info));
+    int parsed = cover_parse((const unsigned char *)stego, stego_size < COVER_HEADER_MAX ? stego_size : COVER_HEADER_MAX,
+                             stego_size, &bmp) == e_success;
+    BmpPayload found = bmp_find_payload(parsed ? &bmp : NULL, stego_size, stego, 0, stego_size, &cur->layout, &word);
+    if (found != bmp_payload_legacy && found != bmp_payload_extended)
+        return e_failure;
+    if (found == bmp_payload_legacy)
+        word = 1;
+    cur->image = (char *)stego;
+    cur->size = stego_size;
+    cur->slot = (strlen(MAGIC_STRING) + (found == bmp_payload_extended ? 4 : 0)) * 8;  // Past magic and format word
+    cur->depth = word & FORMAT_DEPTH_MASK;
+    if (cur->depth < 1 || cur->depth > LSB_MAX_DEPTH)
+        return e_failure;
+
+    if (bmp_read_fields(read_field, cur, word, 1, fields) != NULL ||
+        !fits(cur, (size_t)fields->embedded + ((word & FORMAT_FLAG_CRC) ? CHECKSUM_BYTES : 0)))
+        return e_failure;                               // Corrupt fields, or sizes point past the image
+
+    strcpy(info->extn, fields->extn);
+    info->payload_size = fields->size;
+    info->embedded_size = fields->embedded;
+    info->bit_depth = cur->depth;
+    info->format_word = word;
+    info->encrypted = (word & FORMAT_FLAG_CHACHA) != 0;
+    info->checksum = (word & FORMAT_FLAG_CRC) != 0;
+    return e_success;
+}
+
+Status steg_decode_info(const char *stego, size_t stego_size, StegPayloadInfo *info)
+{
+    StegCursor cur = {0};
+    BmpFields fields;
+
+    pthread_once(&kernels_once, init_kernels);
+    return read_fields(stego, stego_size, &cur, info, &fields);
+}
+
+/* Decompress the LZ blocks of a -z payload straight into out (into one scratch block when out is NULL), *crc of the result */
+static Status unpack_payload(StegCursor *cur, const StegPayloadInfo *info, const ChaCha *cipher, char *out, uint32_t *crc)
+{
+    char header[LZ_HEADER];
+    char *body = malloc(LZ_BLOCK_BOUND);                // One stored block
+    char *scratch = out ? NULL : malloc(LZ_BLOCK);
+    size_t remaining = info->payload_size, left = info->embedded_size, pos = 0;
+    Status res = body && (out || scratch) ? e_success : e_failure;
+
+    *crc = 0;
+
+    while (res == e_success && remaining > 0)
+    {
+        size_t count = remaining < LZ_BLOCK ? remaining : LZ_BLOCK;
+        int raw;
+        if (left < LZ_HEADER || get_bytes(cur, header, LZ_HEADER, cipher, pos) == e_failure)
+        {
+            res = e_failure;
+            break;
+        }
+        size_t n = lz_block_size(header, &raw);
+        left -= LZ_HEADER;
+        pos += LZ_HEADER;
+        char *dst = out ? out : scratch;
+        if (n > left || n > LZ_BLOCK_BOUND - LZ_HEADER || get_bytes(cur, body, n, cipher, pos) == e_failure ||
+            lz_decompress_block(body, n, raw, dst, count) == e_failure)
+            res = e_failure;                            // Corrupt block
+        else
+            *crc = crc32c_update(*crc, dst, count);     // Checked while the block is in cache
+        left -= n;
+        pos += n;
+        if (out) out += count;
+        remaining -= count;
+    }
+    free(body);
+    free(scratch);
+    return res == e_success && left == 0 ? e_success : e_failure;
+}
+
+/* Decompress only raw bytes [offset, offset + count) of a -z payload into out, blocks before them are skipped */
+static Status unpack_range(StegCursor *cur, const StegPayloadInfo *info, const ChaCha *cipher,
+                           size_t offset, size_t count, char *out)
+{
+    char header[LZ_HEADER];
+    char *body = malloc(LZ_BLOCK_BOUND), *block = malloc(LZ_BLOCK);
+    size_t left = info->embedded_size, pos = 0, start = 0, end = offset + count;
+    Status res = body && block ? e_success : e_failure;
+
+    while (res == e_success && start < end)
+    {
+        size_t raw_len = info->payload_size - start < LZ_BLOCK ? info->payload_size - start : LZ_BLOCK;
+        int raw;
+        if (left < LZ_HEADER || get_bytes(cur, header, LZ_HEADER, cipher, pos) == e_failure)
+        {
+            res = e_failure;
+            break;
+        }
+        size_t n = lz_block_size(header, &raw);
+        left -= LZ_HEADER;
+        pos += LZ_HEADER;
+        if (n > left || n > LZ_BLOCK_BOUND - LZ_HEADER)
+            res = e_failure;                            // Corrupt block
+        else if (start + raw_len <= offset)
+            cur->slot += lsb_cover_bytes(cur->depth) * n;   // Before the range: only the header is read
+        else
+        {
+            size_t from = offset > start ? offset - start : 0, to = end < start + raw_len ? end - start : raw_len;
+            char *dst = from == 0 && to == raw_len ? out : block;  // Whole blocks go straight to out
+            if (get_bytes(cur, body, n, cipher, pos) == e_failure || lz_decompress_block(body, n, raw, dst, raw_len) == e_failure)
+                res = e_failure;
+            else if (dst == block)
+                memcpy(out, block + from, to - from);
+            out += to - from;
+        }
+        left -= n;
+        pos += n;
+        start += raw_len;
+    }
+    free(body);
+    free(block);
+    return res;
+}
+
+/* Read the fields of a stego image and set up the cipher of an encrypted payload; cur is left at its first byte */
+static Status open_payload(const char *stego, size_t stego_size, const unsigned char *key, StegCursor *cur,
+                           StegPayloadInfo *info, ChaCha *cipher)
+{
+    BmpFields fields;
+
+    pthread_once(&kernels_once, init_kernels);
+    if (read_fields(stego, stego_size, cur, info, &fields) == e_failure)
+        return e_failure;
+    if (info->encrypted)
+    {
+        if (key == NULL)
+            return e_failure;
+        chacha_setup(cipher, key, fields.nonce);
+        if (chacha_key_check(cipher) != fields.check)
+            return e_failure;                           // Wrong key
+        if ((info->format_word & FORMAT_FLAG_SCATTER) && bmp_layout_scatter(&cur->layout, cur->slot, cipher) == e_failure)
+            return e_failure;                           // No encoder scatters so small a cover
+    }
+    return e_success;
+}
+
+/* Compare crc with the trailer after the payload (cur is just past the payload), e_success without a trailer */
+static Status check_trailer(StegCursor *cur, const StegPayloadInfo *info, const ChaCha *cipher, uint32_t crc)
+{
+    unsigned char bytes[CHECKSUM_BYTES];
+
+    if (!info->checksum)
+        return e_success;
+    if (get_bytes(cur, (char *)bytes, CHECKSUM_BYTES, cipher, info->embedded_size) == e_failure)
+        return e_failure;
+    return (((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) | ((uint32_t)bytes[2] << 8) | bytes[3]) == crc
+           ? e_success : e_failure;
+}
+
+Status steg_decode(const char *stego, size_t stego_size, const unsigned char *key,
+                   char *out, size_t out_size, size_t *payload_size)
+{
+    StegCursor cur = {0};
+    StegPayloadInfo info;
+    ChaCha cipher;
+    uint32_t crc = 0;
+
+    if (open_payload(stego, stego_size, key, &cur, &info, &cipher) == e_failure || out_size < info.payload_size)
+        return e_failure;
+
+    const ChaCha *active = info.encrypted ? &cipher : NULL;
+    Status res = (info.format_word & FORMAT_FLAG_LZ)
+                 ? unpack_payload(&cur, &info, active, out, &crc)
+                 : get_bytes(&cur, out, info.payload_size, active, 0);
+    if (res == e_success && info.checksum && !(info.format_word & FORMAT_FLAG_LZ))
+        crc = crc32c_update(0, out, info.payload_size);
+    if (res == e_success)
+        res = check_trailer(&cur, &info, active, crc);
+    if (res == e_success && payload_size)
+        *payload_size = info.payload_size;
+    return res;
+}
+
+Status steg_verify(const char *stego, size_t stego_size, const unsigned char *key, StegPayloadInfo *info)
+{
+    StegCursor cur = {0};
+    StegPayloadInfo found;
+    ChaCha cipher;
+    uint32_t crc = 0;
+    Status res;
+
+    if (info == NULL) info = &found;
+    if (open_payload(stego, stego_size, key, &cur, info, &cipher) == e_failure)
+        return e_failure;
+    const ChaCha *active = info->encrypted ? &cipher : NULL;
+    if (info->format_word & FORMAT_FLAG_LZ)
+        res = unpack_payload(&cur, info, active, NULL, &crc);
+    else if (!info->checksum)
+        res = e_success;                                // Nothing to check the plain bytes against
+    else
+    {
+        char *block = malloc(LZ_BLOCK);                 // Extracted, decrypted and checked a block at a time
+        res = block ? e_success : e_failure;
+        for (size_t pos = 0; res == e_success && pos < info->payload_size; pos += LZ_BLOCK)
+        {
+            size_t count = info->payload_size - pos < LZ_BLOCK ? info->payload_size - pos : LZ_BLOCK;
+            res = get_bytes(&cur, block, count, active, pos);
+            crc = crc32c_update(crc, block, count);
+        }
+        free(block);
+    }
+    return res == e_success ? check_trailer(&cur, info, active, crc) : e_failure;
+}
+
+Status steg_decode_range(const char *stego, size_t stego_size, const unsigned char *key, size_t offset, size_t length,
+                         char *out, size_t out_size, size_t *written)
+{
+    StegCursor cur = {0};
+    StegPayloadInfo info;
+    ChaCha cipher;
+    Status res;
+
+    if (open_payload(stego, stego_size, key, &cur, &info, &cipher) == e_failure || offset > info.payload_size)
+        return e_failure;
+    size_t count = info.payload_size - offset < length ? info.payload_size - offset : length;
+    if (out_size < count)
+        return e_failure;
+
+    const ChaCha *active = info.encrypted ? &cipher : NULL;
+    if (count == 0)
+        res = e_success;                                // Empty slice: out may be NULL, nothing is read
+    else if (info.format_word & FORMAT_FLAG_LZ)
+        res = unpack_range(&cur, &info, active, offset, count, out);
+    else
+    {
+        cur.slot += lsb_cover_bytes(cur.depth) * offset;   // Byte i is computed from the layout, nothing before it is read
+        res = get_bytes(&cur, out, count, active, offset);
+    }
+    if (res == e_success && written)
+        *written = count;
+    return res;
+}
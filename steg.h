@@ -0,0 +1,75 @@
+#ifndef STEG_H
+#define STEG_H
+
+#include <stddef.h>         // size_t
+#include "types.h"          // Status, uint
+
+/*
+ * libsteg: in-memory encode / decode
+ * The same stego format as the command line tool (depths, row layouts,
+ * -a, -z and -K payloads), but from caller buffers to caller buffers: no
+ * FILE*, no file names and no temporary files. Every function only
+ * touches its arguments, so any number of threads may encode and decode
+ * at the same time; the CPU kernels are selected on the first call.
+ * Images written by the tool decode here and the other way round. Covers
+ * are any format of cover.h (BMP, binary PGM / PPM, TGA)
+ */
+
+#define STEG_EXTN_MAX 9     // Longest extension stored with a payload (e.g. ".txt")
+#define STEG_KEY_BYTES 32   // ChaCha20 key
+
+/* How a payload is embedded (all zero: the original format, 1 bit per cover byte and no checksum) */
+typedef struct _StegParams
+{
+    int bit_depth;                  // LSBs per cover byte (1..4), 0 for 1
+    int use_alpha;                  // Embed in the alpha byte of 32-bit covers too
+    int compress;                   // LZ compress the payload first (kept raw if it does not shrink)
+    const unsigned char *key;       // STEG_KEY_BYTES to encrypt the payload with, NULL for none
+    const char *extn;               // Extension stored with the payload, NULL for ".txt"
+    int checksum;                   // Add a CRC32C trailer of the payload (extended format, as --crc)
+    int scatter;                    // Store the payload runs in keyed order (needs key, as --scatter)
+} StegParams;
+
+/* Header fields of a stego image */
+typedef struct _StegPayloadInfo
+{
+    size_t payload_size;            // Bytes steg_decode() writes
+    size_t embedded_size;           // Bytes stored in the image (compressed size with -z)
+    int bit_depth;                  // LSBs per cover byte of the payload
+    uint format_word;               // Depth | FORMAT_FLAG_* bits (1 for the original format)
+    int encrypted;                  // A key is needed to decode
+    int checksum;                   // A CRC32C of the payload follows it (checked by steg_decode / steg_verify)
+    char extn[STEG_EXTN_MAX + 1];   // Stored extension
+} StegPayloadInfo;
+
+/* Largest payload a cover can carry with params (compressed size with compress), 0 if the cover is not supported */
+size_t steg_capacity(const char *cover, size_t cover_size, const StegParams *params);
+
+/* Size of the output buffer steg_encode() needs: the stego image is as large as the cover */
+size_t steg_encoded_size(size_t cover_size);
+
+/* Embed payload into cover, writing the stego image to out (out may be cover itself for an in-place encode).
+   e_failure if the cover is not supported, too small, or out_size < steg_encoded_size(cover_size) */
+Status steg_encode(const char *cover, size_t cover_size, const char *payload, size_t payload_size,
+                   const StegParams *params, char *out, size_t out_size);
+
+/* Read the header fields of a stego image (no key needed), e_failure if it holds no payload */
+Status steg_decode_info(const char *stego, size_t stego_size, StegPayloadInfo *info);
+
+/* Extract the payload straight from stego into out (out_size >= info.payload_size), key is needed
+   for encrypted payloads; *payload_size is set to the bytes written. e_failure on a wrong key, damage or a checksum mismatch */
+Status steg_decode(const char *stego, size_t stego_size, const unsigned char *key,
+                   char *out, size_t out_size, size_t *payload_size);
+
+/* Decode the whole payload without writing it anywhere: e_success if it decodes (key check, -z blocks) and its
+   CRC32C matches. Images without a checksum (info->checksum == 0) can only be checked that far. info may be NULL */
+Status steg_verify(const char *stego, size_t stego_size, const unsigned char *key, StegPayloadInfo *info);
+
+/* Extract only payload bytes [offset, offset + length) (clipped at the end of the payload) into out. Plain
+   payloads are read straight from the slots of byte offset on; -z payloads skip the blocks before it by their
+   headers. *written is set to the bytes written; e_failure if offset is past the payload or out_size too small.
+   A slice is not covered by the payload checksum */
+Status steg_decode_range(const char *stego, size_t stego_size, const unsigned char *key, size_t offset, size_t length,
+                         char *out, size_t out_size, size_t *written);
+
+#endif
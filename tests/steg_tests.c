@@ -0,0 +1,2508 @@
+#include <stdio.h>                // printf, FILE
+#include <stdlib.h>               // malloc, free
+#include <string.h>               // memcmp, strcmp
+#include <limits.h>               // PATH_MAX
+#include <unistd.h>               // unlink, rmdir
+#include <fcntl.h>                // open
+#include "encode.h"               // Encoder
+#include "decode.h"               // Decoder
+#include "lsb.h"                  // Bulk LSB kernels
+#include "corpus.h"               // Deterministic covers and payloads
+#include "inspect.h"              // Header-only inspection
+#include "bmp.h"                  // BMP parser
+#include "lz.h"                   // Payload compression
+#include "chacha.h"               // Payload cipher
+#include "pipeline.h"             // Read-ahead / write-behind blocks
+#include "iobackend.h"            // Asynchronous tile I/O
+#include "reflink.h"              // Cover clone
+#include "steg.h"                 // In-memory library API
+#include <pthread.h>              // Concurrent library calls
+#include "daemon.h"               // stegd requests
+#include "archive.h"              // Archive payloads
+#include <sys/stat.h>             // mkdir
+#include <sys/wait.h>             // waitpid of the stegd client of another user
+#include "erasure.h"              // Reed-Solomon shards
+#include "shard.h"                // Sharded payloads
+#include "crc32c.h"               // Payload checksum
+#include "png.h"                  // PNG covers
+#include <zlib.h>                 // PNG rows read back independently
+#include "cover.h"                // Cover formats
+
+/*
+ * Test groups (one ctest test each):
+ *   kernels    every CPU variant and depth of the LSB kernels against a bit-by-bit reference
+ *   legacy     the original one byte helpers agree with the bulk kernels
+ *   roundtrip  encode/decode in every mode and depth gives back the secret file
+ *   format     on-image layout: magic strings, format word, untouched cover bytes
+ *   stats      --stats stage timing and I/O counters
+ *   inspect    -i header checks on clean, stego and damaged images
+ *   bmp        header variants, padded rows and the alpha byte of 32-bit images
+ *   lz         block codec round trips and -z payloads in every mode
+ *   cipher     ChaCha20 test vector, every kernel variant, -K payloads and key handling
+ *   pipeline   block pass-through and pipelined stdio encodes equal to the single thread path
+ *   io         every I/O backend and queue depth, -j encodes/decodes through each of them
+ *   patch      --clone / --inplace output equal to a full copy in every mode
+ *   library    in-memory API equal to the file encoder, sizing, keys, concurrent callers
+ *   range      --range / steg_decode_range() slices equal to the full payload in every layout, -z and -K
+ *   daemon     stegd requests over the socket equal to the library, keys, bad requests, shutdown
+ *   archive    -c archives: TOC, single entry and -x extraction with -z and -K, hostile TOCs
+ *   shard      Reed-Solomon any k of n, -s / -r round trips with lost covers, -z and -K, mixed sets
+ *   checksum   CRC32C vectors and variants, a flipped payload bit caught by decode and --verify in every mode
+ *   scatter    keyed run permutation, --scatter round trips in every layout and mode, --range, library
+ *   cover      PGM / PPM and TGA backends in every mode and layout, library, names, refused headers
+ *   png        streamed PNG covers: round trips, untouched filters and chunks, inspect, --range, refused images
+ */
+
+static int failures;
+
+#define CHECK(cond) do { if (!(cond)) { printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+static char scratch[PATH_MAX];    // Temporary directory of the file based groups
+
+/* -------------------- Helpers -------------------- */
+
+/* Reference embed written straight from the format description: MSB first, depth bits per cover byte */
+static void reference_embed(const char *data, size_t n, char *image, int depth)
+{
+    size_t cover = lsb_cover_bytes(depth);
+    for (size_t i = 0; i < n; i++)
+    {
+        for (size_t j = 0; j < cover; j++)
+        {
+            unsigned char value = 0;
+            for (int b = 0; b < depth; b++)
+            {
+                size_t bit = j * depth + b;              // Bit index from the MSB, >= 8 is padding
+                int set = bit < 8 ? ((unsigned char)data[i] >> (7 - bit)) & 1 : 0;
+                value = (unsigned char)(value << 1 | set);
+            }
+            unsigned char mask = (unsigned char)((1 << depth) - 1);
+            image[i * cover + j] = (char)((image[i * cover + j] & ~mask) | value);
+        }
+    }
+}
+
+/* Encode with every option taken from a template (NULL: the defaults), the file names filled in here */
+static Status encode_file(const char *cover, const char *secret, const char *stego, const EncodeInfo *opts)
+{
+    EncodeInfo encInfo = {0};
+    if (opts)
+        encInfo = *opts;
+    encInfo.src_image_fname = (char *)cover;
+    encInfo.secret_fname = (char *)secret;
+    encInfo.stego_image_fname = (char *)stego;
+    encInfo.quiet = 1;
+    stats_start(encInfo.stats, "encode");
+    Status res = do_encoding(&encInfo);
+    stats_stop(encInfo.stats);
+    close_files(&encInfo);                           // No-op after a successful encode
+    return res;
+}
+
+static Status1 decode_file_key(const char *stego, char *output, int use_mmap, int threads, int preallocate, const char *key)
+{
+    DecodeInfo decInfo = {0};
+    decInfo.key_fname = key;
+    decInfo.stego_image_fname = (char *)stego;
+    decInfo.output_fname = output;
+    decInfo.use_mmap = use_mmap;
+    decInfo.threads = threads;
+    decInfo.preallocate = preallocate;
+    decInfo.quiet = 1;
+    Status1 res = do_decoding(&decInfo);
+    if (res == d_failure)
+        close_files_decode(&decInfo);
+    else
+        strcpy(output, decInfo.output_path);         // Decoder swaps in the stored extension
+    return res;
+}
+
+static Status1 decode_file(const char *stego, char *output, int use_mmap, int threads, int preallocate)
+{
+    return decode_file_key(stego, output, use_mmap, threads, preallocate, NULL);
+}
+
+static char *read_whole_file(const char *fname, size_t *size)
+{
+    FILE *fptr = fopen(fname, "rb");
+    if (!fptr) return NULL;
+    *size = get_file_size(fptr);
+    char *data = malloc(*size ? *size : 1);
+    if (data && fread(data, 1, *size, fptr) != *size)
+    {
+        free(data);
+        data = NULL;
+    }
+    fclose(fptr);
+    return data;
+}
+
+static void scratch_path(char *buf, size_t size, const char *name)
+{
+    snprintf(buf, size, "%s/%s", scratch, name);
+}
+
+/* -------------------- Groups -------------------- */
+
+static void test_kernels(void)
+{
+    static const size_t sizes[] = {0, 1, 3, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 77, 200, 1001};
+    char data[1001], out[1001];
+    char *image = malloc(1001 * 8 + 1), *expect = malloc(1001 * 8 + 1);
+
+    corpus_fill(data, sizeof(data), 7);
+    for (int isa = lsb_isa_scalar; isa < lsb_isa_count; isa++)
+    {
+        if (!lsb_select((LsbIsa)isa))
+            continue;                                // Variant not available on this CPU
+        for (int depth = 1; depth <= LSB_MAX_DEPTH; depth++)
+        {
+            for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+            {
+                size_t n = sizes[s];
+                corpus_fill(image, 1001 * 8 + 1, (uint)(isa * 100 + depth));
+                memcpy(expect, image, 1001 * 8 + 1);
+
+                reference_embed(data, n, expect + 1, depth);        // Odd offset: unaligned buffers
+                lsb_embed_bytes_k(data, n, image + 1, depth);
+                CHECK(memcmp(image, expect, 1001 * 8 + 1) == 0);   // Bytes past the end untouched
+
+                memset(out, 0, sizeof(out));
+                lsb_extract_bytes_k(image + 1, n, out, depth);
+                CHECK(memcmp(out, data, n) == 0);
+                if (depth == 1)
+                {
+                    lsb_extract_bytes(image + 1, n, out);
+                    CHECK(memcmp(out, data, n) == 0);
+                }
+            }
+        }
+    }
+    lsb_init();
+    free(image);
+    free(expect);
+}
+
+static void test_legacy(void)
+{
+    char data[64], image[64 * 8], bulk[64 * 8];
+
+    corpus_fill(data, sizeof(data), 11);
+    corpus_fill(image, sizeof(image), 12);
+    memcpy(bulk, image, sizeof(image));
+
+    for (size_t i = 0; i < sizeof(data); i++)
+        encode_byte_to_lsb(data[i], image + 8 * i);
+    lsb_embed_bytes(data, sizeof(data), bulk);
+    CHECK(memcmp(image, bulk, sizeof(image)) == 0);
+
+    for (size_t i = 0; i < sizeof(data); i++)
+        CHECK(decode_byte_from_lsb(image + 8 * i) == data[i]);
+
+    encode_size_to_lsb(0x12345678, image);
+    CHECK(decode_size_from_lsb(image) == 0x12345678);
+}
+
+static void test_roundtrip(void)
+{
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], stego[PATH_MAX + 32];
+    char first[PATH_MAX + 32], output[PATH_MAX + 48];
+    size_t secret_size, stego_size, first_size, out_size;
+
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(secret, sizeof(secret), "secret.csv");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    scratch_path(first, sizeof(first), "first.bmp");
+    CHECK(corpus_write_cover(cover, 5, 3) == e_success);
+    CHECK(corpus_write_payload(secret, 3 * TILE_BYTES / 2 + 123, 4) == e_success);  // Two tiles, odd tail
+    char *secret_data = read_whole_file(secret, &secret_size);
+    CHECK(secret_data != NULL);
+    if (!secret_data) return;
+
+    static const struct { int use_mmap, threads, preallocate; } modes[] = {
+        {0, 0, 0}, {1, 0, 0}, {0, 0, 1}, {0, 3, 0}, {1, 3, 0}};
+    for (int depth = 1; depth <= LSB_MAX_DEPTH; depth++)
+    {
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+        {
+            CHECK(encode_file(cover, secret, m == 0 ? first : stego, &(EncodeInfo){.use_mmap = modes[m].use_mmap,
+                                                                                   .threads = modes[m].threads,
+                                                                                   .bit_depth = depth}) == e_success);
+            if (m > 0)                               // Every mode writes the same image
+            {
+                char *a = read_whole_file(first, &first_size), *b = read_whole_file(stego, &stego_size);
+                CHECK(a && b && first_size == stego_size && memcmp(a, b, first_size) == 0);
+                free(a);
+                free(b);
+            }
+
+            scratch_path(output, sizeof(output), "output.txt");
+            CHECK(decode_file(m == 0 ? first : stego, output, modes[m].use_mmap, modes[m].threads, modes[m].preallocate) == d_success);
+            CHECK(strcmp(strrchr(output, '.'), ".csv") == 0);           // Stored extension restored
+            char *out = read_whole_file(output, &out_size);
+            CHECK(out && out_size == secret_size && memcmp(out, secret_data, secret_size) == 0);
+            free(out);
+            unlink(output);
+        }
+    }
+
+    /* A dot in a directory name is not the extension of the output file */
+    char dir[PATH_MAX + 32], expect[PATH_MAX + 48];
+    DecodeInfo decInfo = {0};
+    char *args[] = {"steg", "-d", "stego.bmp", "my.dir/out", NULL};
+    CHECK(read_and_validate_decode_file(args, &decInfo) == d_success);
+    scratch_path(dir, sizeof(dir), "out.dir");
+    CHECK(mkdir(dir, 0700) == 0);
+    snprintf(output, sizeof(output), "%s/output", dir);
+    snprintf(expect, sizeof(expect), "%s/output.csv", dir);
+    CHECK(decode_file(first, output, 0, 0, 0) == d_success && strcmp(output, expect) == 0);
+    char *out = read_whole_file(expect, &out_size);
+    CHECK(out && out_size == secret_size && memcmp(out, secret_data, secret_size) == 0);
+    free(out);
+    unlink(expect);
+    rmdir(dir);
+
+    free(secret_data);
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+    unlink(first);
+}
+
+/* Read count bytes stored at 1 bit per image byte starting at image offset pos */
+static void read_lsb_bytes(const char *image, size_t pos, char *out, size_t count)
+{
+    lsb_extract_bytes(image + pos, count, out);
+}
+
+static void test_format(void)
+{
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], stego[PATH_MAX + 32], output[PATH_MAX + 48];
+    size_t cover_size = 0, stego_size = 0;
+    char field[4];
+
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(secret, sizeof(secret), "secret.txt");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    CHECK(corpus_write_bmp(cover, 64, 48, 5) == e_success);
+    CHECK(corpus_write_payload(secret, 100, 6) == e_success);
+    char *cover_data = read_whole_file(cover, &cover_size);
+
+    /* Original format (the default): "#*" right after the BMP header, everything else at 1 bit */
+    CHECK(encode_file(cover, secret, stego, NULL) == e_success);
+    char *image = read_whole_file(stego, &stego_size);
+    CHECK(image && stego_size == cover_size);
+    if (image && cover_data)
+    {
+        CHECK(memcmp(image, cover_data, 54) == 0);                    // Header copied as is
+        read_lsb_bytes(image, 54, field, 2);
+        CHECK(memcmp(field, MAGIC_STRING, 2) == 0);
+        read_lsb_bytes(image, 54 + 16, field, 4);
+        CHECK(field[0] == 0 && field[1] == 0 && field[2] == 0 && field[3] == 4);  // ".txt" length, big endian
+        size_t end = 54 + 8 * (2 + 4 + 4 + 4 + 100);
+        CHECK(memcmp(image + end, cover_data + end, cover_size - end) == 0);  // Rest of the cover untouched
+    }
+    free(image);
+
+    /* Extended format: "#+" and a format word carrying the depth and the checksum flag */
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 3, .use_crc = 1}) == e_success);
+    image = read_whole_file(stego, &stego_size);
+    if (image)
+    {
+        read_lsb_bytes(image, 54, field, 2);
+        CHECK(memcmp(field, MAGIC_STRING_EXT, 2) == 0);
+        read_lsb_bytes(image, 54 + 16, field, 4);
+        CHECK(field[0] == 0 && field[1] == 0 && field[2] == (FORMAT_FLAG_CRC >> 8) && field[3] == 3);
+
+        image[54] ^= 1;                                               // Break the magic string
+        FILE *fptr = fopen(stego, "wb");
+        CHECK(fptr && fwrite(image, 1, stego_size, fptr) == stego_size);
+        if (fptr) fclose(fptr);
+        scratch_path(output, sizeof(output), "output");
+        CHECK(decode_file(stego, output, 0, 0, 0) == d_failure);
+    }
+    free(image);
+
+    /* Secret larger than the cover can hold */
+    CHECK(corpus_write_payload(secret, 64 * 48 * 3 / 8, 6) == e_success);
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 1}) == e_failure);
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 4}) == e_success);    // Fits at 4 bits per byte
+
+    free(cover_data);
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+}
+
+static void test_stats(void)
+{
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], stego[PATH_MAX + 32], json[PATH_MAX + 32];
+    size_t json_size = 0;
+    StegStats stats;
+
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(secret, sizeof(secret), "secret.txt");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    scratch_path(json, sizeof(json), "stats.json");
+    CHECK(corpus_write_cover(cover, 1, 8) == e_success);
+    CHECK(corpus_write_payload(secret, 50000, 9) == e_success);
+
+    EncodeInfo encInfo = {0};
+    encInfo.src_image_fname = cover;
+    encInfo.secret_fname = secret;
+    encInfo.stego_image_fname = stego;
+    encInfo.quiet = 1;
+    encInfo.stats = &stats;
+    stats_start(&stats, "encode");
+    CHECK(do_encoding(&encInfo) == e_success);
+    stats_stop(&stats);
+
+    for (int stage = 0; stage < stats_stage_count; stage++)
+        CHECK(stats.stage_used[stage] || stage == stats_compress);   // Every encode stage ran (compress needs -z)
+    CHECK(stats.total_us >= stats.stage_us[stats_payload]);
+    if (access("/proc/self/io", R_OK) == 0)                          // Linux: payload image bytes were written
+    {
+        CHECK(stats.io_total.write_bytes >= 50000 * 8);               // Written behind: not always in the payload stage
+        CHECK(stats.io_total.read_bytes >= stats.stage_io[stats_payload].read_bytes);
+    }
+
+    CHECK(stats_write_json(&stats, json, 1) == e_success);
+    char *text = read_whole_file(json, &json_size);
+    CHECK(text && json_size > 0 && text[0] == '{' && text[json_size - 2] == '}');
+    if (text)
+    {
+        text[json_size - 1] = '\0';
+        CHECK(strstr(text, "\"operation\":\"encode\"") && strstr(text, "\"payload\":{") && strstr(text, "\"peak_rss_kb\":"));
+    }
+    free(text);
+
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+    unlink(json);
+}
+
+static void test_inspect(void)
+{
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], stego[PATH_MAX + 32];
+    size_t stego_size = 0;
+    StegInspect info;
+
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(secret, sizeof(secret), "secret.csv");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    CHECK(corpus_write_bmp(cover, 200, 100, 10) == e_success);
+    CHECK(corpus_write_payload(secret, 1234, 11) == e_success);
+
+    CHECK(inspect_file(cover, &info) == inspect_clean);
+    CHECK(inspect_file(secret, &info) == inspect_unreadable);          // Not a BMP
+
+    for (int depth = 1; depth <= LSB_MAX_DEPTH; depth++)
+    {
+        CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = depth}) == e_success);
+        CHECK(inspect_file(stego, &info) == inspect_stego);
+        CHECK(info.bit_depth == depth && info.size_secret_file == 1234 && strcmp(info.extn, ".csv") == 0);
+    }
+
+    /* Size field claiming more than the image holds (depth 1: size field LSBs start at 54 + 16 + 32 + 32) */
+    CHECK(encode_file(cover, secret, stego, NULL) == e_success);
+    char *image = read_whole_file(stego, &stego_size);
+    if (image)
+    {
+        image[54 + 16 + 32 + 32] |= 1;                                 // Top bit of the size
+        FILE *fptr = fopen(stego, "wb");
+        CHECK(fptr && fwrite(image, 1, stego_size, fptr) == stego_size);
+        if (fptr) fclose(fptr);
+        CHECK(inspect_file(stego, &info) == inspect_broken);
+    }
+    free(image);
+
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+}
+
+/* Every byte of stego that is not a slot of the layout must equal the cover */
+static int only_slots_changed(const char *cover, const char *stego, size_t size, const BmpInfo *bmp, int use_alpha)
+{
+    size_t pixel_bytes = bmp->bits_per_pixel / 8;
+    if (memcmp(cover, stego, bmp->data_offset) != 0)
+        return 0;                                    // Headers
+    for (size_t y = 0; y < bmp->height; y++)
+    {
+        size_t row = bmp->data_offset + y * bmp->stride;
+        for (size_t x = bmp->width * pixel_bytes; x < bmp->stride; x++)
+            if (cover[row + x] != stego[row + x]) return 0;  // Row padding
+        for (size_t x = 0; pixel_bytes == 4 && !use_alpha && x < bmp->width; x++)
+            if (cover[row + 4 * x + bmp->alpha_lane] != stego[row + 4 * x + bmp->alpha_lane]) return 0;  // Alpha
+    }
+    size_t end = bmp->data_offset + bmp->stride * bmp->height;
+    return memcmp(cover + end, stego + end, size - end) == 0;  // Anything after the pixel array
+}
+
+static void test_bmp(void)
+{
+    static const struct { uint width, height; int bpp; uint dib; int top_down, use_alpha, depth; size_t payload; uint flags; } cases[] = {
+        {333, 77, 24, 40, 0, 0, 1, 2000, FORMAT_FLAG_ROWS},                 // Padded rows (3 bytes per row)
+        {101, 61, 24, 40, 1, 0, 2, 3000, FORMAT_FLAG_ROWS},                 // Padded and top-down
+        {300, 50, 24, 124, 0, 0, 3, 5000, 0},                               // V5 header, pixels at 138
+        {150, 90, 32, 40, 0, 0, 4, 6000, FORMAT_FLAG_ROWS},                 // BGRX, alpha skipped
+        {150, 90, 32, 124, 1, 1, 4, 8000, FORMAT_FLAG_ALPHA},               // BGRA bit fields, alpha used (-a)
+        {7, 500, 32, 108, 0, 0, 1, 50, FORMAT_FLAG_ROWS},                   // V4 header, narrow rows
+        {1001, 1100, 24, 40, 0, 0, 4, 3 * TILE_BYTES / 2 + 77, FORMAT_FLAG_ROWS},  // Several tiles over padded rows
+    };
+    static const struct { int use_mmap, threads; } modes[] = {{0, 0}, {1, 0}, {0, 3}, {1, 3}};
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], stego[PATH_MAX + 32], first[PATH_MAX + 32];
+    char output[PATH_MAX + 32], decoded[PATH_MAX + 32];
+
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(secret, sizeof(secret), "secret.csv");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    scratch_path(first, sizeof(first), "first.bmp");
+    scratch_path(decoded, sizeof(decoded), "decoded.csv");
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        size_t cover_size = 0, first_size = 0, stego_size = 0, secret_size = 0, decoded_size = 0;
+        BmpInfo bmp;
+        StegInspect info;
+
+        CHECK(corpus_write_bmp_format(cover, cases[c].width, cases[c].height, cases[c].bpp, cases[c].dib,
+                                      cases[c].top_down, (uint)c) == e_success);
+        CHECK(corpus_write_payload(secret, cases[c].payload, (uint)c + 20) == e_success);
+        char *cover_data = read_whole_file(cover, &cover_size);
+        char *secret_data = read_whole_file(secret, &secret_size);
+        CHECK(cover_data && bmp_parse((unsigned char *)cover_data, cover_size, cover_size, &bmp) == e_success);
+        CHECK(bmp.data_offset == 14 + cases[c].dib && bmp.top_down == cases[c].top_down &&
+              bmp.bits_per_pixel == cases[c].bpp && bmp.stride % 4 == 0);
+
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+        {
+            CHECK(encode_file(cover, secret, m == 0 ? first : stego, &(EncodeInfo){.use_mmap = modes[m].use_mmap,
+                                                                                   .threads = modes[m].threads,
+                                                                                   .bit_depth = cases[c].depth,
+                                                                                   .use_alpha = cases[c].use_alpha}) == e_success);
+            if (m > 0)                                               // Every mode writes the same image
+            {
+                char *a = read_whole_file(first, &first_size), *b = read_whole_file(stego, &stego_size);
+                CHECK(a && b && first_size == stego_size && memcmp(a, b, first_size) == 0);
+                free(a);
+                free(b);
+            }
+            snprintf(output, sizeof(output), "%s/decoded.txt", scratch);
+            CHECK(decode_file(m == 0 ? first : stego, output, modes[m].use_mmap, modes[m].threads, 0) == d_success);
+            char *out = read_whole_file(decoded, &decoded_size);
+            CHECK(out && decoded_size == secret_size && memcmp(out, secret_data, secret_size) == 0);
+            free(out);
+        }
+
+        char *stego_data = read_whole_file(first, &stego_size);
+        CHECK(stego_data && stego_size == cover_size && cover_data &&
+              only_slots_changed(cover_data, stego_data, cover_size, &bmp, cases[c].use_alpha));
+        CHECK(inspect_file(first, &info) == inspect_stego);
+        CHECK(info.bit_depth == cases[c].depth && info.size_secret_file == cases[c].payload &&
+              (info.format_word & (FORMAT_FLAG_ROWS | FORMAT_FLAG_ALPHA)) == cases[c].flags);
+        free(stego_data);
+        free(cover_data);
+        free(secret_data);
+    }
+
+    /* Palette images are refused instead of being overwritten from byte 54 on */
+    CHECK(corpus_write_bmp(cover, 64, 48, 1) == e_success);
+    CHECK(corpus_write_payload(secret, 10, 2) == e_success);
+    FILE *fptr = fopen(cover, "r+b");
+    CHECK(fptr && fseek(fptr, 28, SEEK_SET) == 0 && fputc(8, fptr) == 8);  // 8 bits per pixel
+    if (fptr) fclose(fptr);
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 1}) == e_failure);
+
+    /* Crafted 24-bit headers: a height of INT_MIN, and a pixel array end that wraps around to 50 */
+    static const struct { uint width, height; size_t file_size; Status expect; } crafted[] = {
+        {64, 48, 54 + 64 * 3 * 48, e_success}, {64, 0x80000000u, 1u << 20, e_failure},
+        {0xAAAAAAACu, 0x7FFFFFFFu, 4096, e_failure}};             // stride 2^33 + 4: 54 + stride * height == 50 mod 2^64
+    for (size_t i = 0; i < sizeof(crafted) / sizeof(crafted[0]); i++)
+    {
+        unsigned char head[54] = {'B', 'M'};
+        uint fields[][2] = {{10, 54}, {14, 40}, {18, crafted[i].width}, {22, crafted[i].height}};
+        for (size_t f = 0; f < 4; f++)
+            for (int b = 0; b < 4; b++)
+                head[fields[f][0] + b] = (unsigned char)(fields[f][1] >> (8 * b));
+        head[26] = 1;                                                 // Planes
+        head[28] = 24;                                                // Bits per pixel, BI_RGB
+        BmpInfo bmp;
+        CHECK(bmp_parse(head, sizeof(head), crafted[i].file_size, &bmp) == crafted[i].expect);
+    }
+
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+    unlink(first);
+    unlink(decoded);
+}
+
+/* Compress n bytes block by block and decompress them again */
+static int lz_roundtrip(const char *data, size_t n)
+{
+    size_t blocks = (n + LZ_BLOCK - 1) / LZ_BLOCK;
+    char *packed = malloc(blocks * LZ_BLOCK_BOUND + 1), *out = malloc(n + 1);
+    size_t pos = 0;
+    int ok = packed && out;
+
+    for (size_t start = 0; ok && start < n; start += LZ_BLOCK)
+        pos += lz_compress_block(data + start, n - start < LZ_BLOCK ? n - start : LZ_BLOCK, packed + pos);
+    for (size_t start = 0, read = 0; ok && start < n; start += LZ_BLOCK)
+    {
+        int raw;
+        size_t stored = lz_block_size(packed + read, &raw);
+        size_t out_len = n - start < LZ_BLOCK ? n - start : LZ_BLOCK;
+        ok = stored <= LZ_BLOCK_BOUND - LZ_HEADER &&
+             lz_decompress_block(packed + read + LZ_HEADER, stored, raw, out + start, out_len) == e_success;
+        read += LZ_HEADER + stored;
+    }
+    ok = ok && memcmp(out, data, n) == 0;
+    free(packed);
+    free(out);
+    return ok;
+}
+
+static void test_lz(void)
+{
+    size_t n = 3 * LZ_BLOCK + 777;
+    char *data = malloc(n), *block = malloc(LZ_BLOCK_BOUND), *out = malloc(LZ_BLOCK);
+    if (!data || !block || !out) { CHECK(0); free(data); free(block); free(out); return; }
+
+    /* Codec: runs, random bytes, text, short inputs and mixtures */
+    memset(data, 'a', n);
+    CHECK(lz_roundtrip(data, n));
+    CHECK(lz_compress_block(data, LZ_BLOCK, block) < LZ_BLOCK / 100);   // Long runs collapse
+    corpus_fill(data, n, 20);
+    CHECK(lz_roundtrip(data, n));
+    int raw = 0;
+    CHECK(lz_compress_block(data, LZ_BLOCK, block) == LZ_HEADER + LZ_BLOCK);  // Random data stays raw
+    CHECK(lz_block_size(block, &raw) == LZ_BLOCK && raw);
+    for (size_t i = 0; i < n; i++)
+        data[i] = "steganography, "[i % 15] ^ (i % 997 == 0);  // Repeats with occasional breaks
+    CHECK(lz_roundtrip(data, n));
+    for (size_t len = 0; len <= 40; len++)
+        CHECK(lz_roundtrip(data + 3, len));
+    for (size_t i = 0; i < n; i += 4096)                               // Random islands in text
+        corpus_fill(data + i, 100, (uint)i);
+    CHECK(lz_roundtrip(data, n));
+
+    /* Damaged blocks are rejected, never overrun the output */
+    size_t size = lz_compress_block(data, LZ_BLOCK, block);
+    size_t stored = lz_block_size(block, &raw);
+    CHECK(!raw && stored == size - LZ_HEADER);
+    CHECK(lz_decompress_block(block + LZ_HEADER, stored, raw, out, LZ_BLOCK) == e_success);
+    CHECK(lz_decompress_block(block + LZ_HEADER, stored / 2, raw, out, LZ_BLOCK) == e_failure);
+    CHECK(lz_decompress_block(block + LZ_HEADER, stored, raw, out, LZ_BLOCK - 1) == e_failure);
+    CHECK(lz_decompress_block(block + LZ_HEADER, stored, 1, out, LZ_BLOCK) == e_failure);
+
+    free(data);
+    free(block);
+    free(out);
+
+    /* -z payloads: compressible text in every mode and depth, random data falls back to raw */
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], stego[PATH_MAX + 32], output[PATH_MAX + 48];
+    size_t secret_size, out_size;
+    StegInspect info;
+
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(secret, sizeof(secret), "secret.csv");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    CHECK(corpus_write_bmp(cover, 2001, 1800, 21) == e_success);        // Padded rows
+    CHECK(corpus_write_payload(secret, 3 * TILE_BYTES / 2 + 123, 22) == e_success);
+    char *secret_data = read_whole_file(secret, &secret_size);
+    CHECK(secret_data != NULL);
+    if (!secret_data) return;
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 1}) == e_failure);    // Fits at depth 1 only when compressed
+
+    static const struct { int use_mmap, threads; } modes[] = {{0, 0}, {1, 0}, {0, 3}, {1, 3}};
+    for (int depth = 1; depth <= LSB_MAX_DEPTH; depth++)
+    {
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+        {
+            CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.use_mmap = modes[m].use_mmap,
+                                                                  .threads = modes[m].threads,
+                                                                  .bit_depth = depth, .compress = 1}) == e_success);
+            CHECK(inspect_file(stego, &info) == inspect_stego);
+            CHECK((info.format_word & FORMAT_FLAG_LZ) && info.packed_size > 0 && info.packed_size < secret_size);
+
+            scratch_path(output, sizeof(output), "output.txt");
+            CHECK(decode_file(stego, output, modes[m].use_mmap, modes[m].threads, 0) == d_success);
+            char *decoded = read_whole_file(output, &out_size);
+            CHECK(decoded && out_size == secret_size && memcmp(decoded, secret_data, secret_size) == 0);
+            free(decoded);
+            unlink(output);
+        }
+    }
+    free(secret_data);
+
+    secret_data = malloc(200000);                                      // Incompressible secret
+    CHECK(secret_data != NULL);
+    if (secret_data)
+    {
+        corpus_fill(secret_data, 200000, 23);
+        FILE *fptr = fopen(secret, "wb");
+        CHECK(fptr && fwrite(secret_data, 1, 200000, fptr) == 200000);
+        if (fptr) fclose(fptr);
+        CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 2, .compress = 1}) == e_success);
+        CHECK(inspect_file(stego, &info) == inspect_stego);
+        CHECK(!(info.format_word & FORMAT_FLAG_LZ) && info.packed_size == 0);
+        scratch_path(output, sizeof(output), "output.txt");
+        CHECK(decode_file(stego, output, 0, 0, 0) == d_success);
+        char *decoded = read_whole_file(output, &out_size);
+        CHECK(decoded && out_size == 200000 && memcmp(decoded, secret_data, 200000) == 0);
+        free(decoded);
+        unlink(output);
+        free(secret_data);
+    }
+
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+}
+
+static Status write_file(const char *fname, const void *data, size_t n)
+{
+    FILE *fptr = fopen(fname, "wb");
+    if (!fptr) return e_failure;
+    size_t written = fwrite(data, 1, n, fptr);
+    fclose(fptr);
+    return written == n ? e_success : e_failure;
+}
+
+static void test_cipher(void)
+{
+    /* RFC 8439 section 2.4.2: payload offset 0 is block counter 1 */
+    static const char plain[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip "
+                                "for the future, sunscreen would be it.";
+    static const unsigned char expect[] = {
+        0x6e, 0x2e, 0x35, 0x9a, 0x25, 0x68, 0xf9, 0x80, 0x41, 0xba, 0x07, 0x28, 0xdd, 0x0d, 0x69, 0x81,
+        0xe9, 0x7e, 0x7a, 0xec, 0x1d, 0x43, 0x60, 0xc2, 0x0a, 0x27, 0xaf, 0xcc, 0xfd, 0x9f, 0xae, 0x0b,
+        0xf9, 0x1b, 0x65, 0xc5, 0x52, 0x47, 0x33, 0xab, 0x8f, 0x59, 0x3d, 0xab, 0xcd, 0x62, 0xb3, 0x57,
+        0x16, 0x39, 0xd6, 0x24, 0xe6, 0x51, 0x52, 0xab, 0x8f, 0x53, 0x0c, 0x35, 0x9f, 0x08, 0x61, 0xd8,
+        0x07, 0xca, 0x0d, 0xbf, 0x50, 0x0d, 0x6a, 0x61, 0x56, 0xa3, 0x8e, 0x08, 0x8a, 0x22, 0xb6, 0x5e,
+        0x52, 0xbc, 0x51, 0x4d, 0x16, 0xcc, 0xf8, 0x06, 0x81, 0x8c, 0xe9, 0x1a, 0xb7, 0x79, 0x37, 0x36,
+        0x5a, 0xf9, 0x0b, 0xbf, 0x74, 0xa3, 0x5b, 0xe6, 0xb4, 0x0b, 0x8e, 0xed, 0xf2, 0x78, 0x5e, 0x42,
+        0x87, 0x4d};
+    unsigned char key[CHACHA_KEY_BYTES], nonce[CHACHA_NONCE_BYTES] = {0, 0, 0, 0, 0, 0, 0, 0x4a};
+    char out[sizeof(expect)];
+    ChaCha cipher;
+
+    for (int i = 0; i < CHACHA_KEY_BYTES; i++)
+        key[i] = (unsigned char)i;
+    chacha_setup(&cipher, key, nonce);
+    chacha_select(lsb_isa_scalar);
+    chacha_xor(&cipher, 0, plain, out, sizeof(expect));
+    CHECK(memcmp(out, expect, sizeof(expect)) == 0);
+
+    /* Every variant, windows at any offset and length, against one scalar pass */
+    size_t n = 40000;
+    char *ref = calloc(n, 1), *data = calloc(n, 1);
+    if (!ref || !data) { CHECK(0); free(ref); free(data); return; }
+    chacha_xor(&cipher, 7, ref, ref, n);
+    for (int isa = lsb_isa_scalar; isa < lsb_isa_count; isa++)
+    {
+        if (!chacha_select((LsbIsa)isa))
+            continue;
+        memset(data, 0, n);
+        for (size_t pos = 0, step = 1; pos < n; pos += step, step = step * 3 % 2049 + 1)
+            chacha_xor(&cipher, 7 + pos, data + pos, data + pos, pos + step < n ? step : n - pos);
+        CHECK(memcmp(ref, data, n) == 0);
+    }
+    chacha_init();
+    free(ref);
+    free(data);
+
+    /* -K payloads in every mode; the image differs from a plain embed; wrong, missing and bad keys */
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], stego[PATH_MAX + 32], plain_stego[PATH_MAX + 32];
+    char key_file[PATH_MAX + 32], other_key[PATH_MAX + 32], output[PATH_MAX + 48];
+    size_t secret_size, out_size, a_size = 0, b_size = 0;
+    StegInspect info;
+
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(secret, sizeof(secret), "secret.csv");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    scratch_path(plain_stego, sizeof(plain_stego), "plain.bmp");
+    scratch_path(key_file, sizeof(key_file), "hex.key");
+    scratch_path(other_key, sizeof(other_key), "raw.key");
+    CHECK(corpus_write_bmp(cover, 1001, 1000, 30) == e_success);
+    CHECK(corpus_write_payload(secret, TILE_BYTES / 3 + 77, 31) == e_success);  // Tiles are not block aligned
+    CHECK(write_file(key_file, " 000102030405060708090a0b0c0d0e0f101112131415161718191A1B1C1D1E1F\n", 66) == e_success);
+    CHECK(write_file(other_key, key, CHACHA_KEY_BYTES) == e_success);           // Same key, raw
+    char *secret_data = read_whole_file(secret, &secret_size);
+    CHECK(secret_data != NULL);
+    if (!secret_data) return;
+
+    static const struct { int use_mmap, threads, depth, compress; } modes[] = {
+        {0, 0, 1, 0}, {1, 0, 2, 0}, {0, 3, 3, 0}, {1, 3, 4, 0}, {0, 0, 1, 1}, {1, 3, 2, 1}};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.use_mmap = modes[m].use_mmap,
+                                                              .threads = modes[m].threads,
+                                                              .bit_depth = modes[m].depth,
+                                                              .compress = modes[m].compress,
+                                                              .key_fname = key_file}) == e_success);
+        CHECK(inspect_file(stego, &info) == inspect_stego && (info.format_word & FORMAT_FLAG_CHACHA));
+        for (int threads = 0; threads <= 3; threads += 3)
+        {
+            scratch_path(output, sizeof(output), "output.txt");
+            CHECK(decode_file_key(stego, output, modes[m].use_mmap, threads, 0, other_key) == d_success);
+            char *decoded = read_whole_file(output, &out_size);
+            CHECK(decoded && out_size == secret_size && memcmp(decoded, secret_data, secret_size) == 0);
+            free(decoded);
+            unlink(output);
+        }
+    }
+
+    CHECK(encode_file(cover, secret, plain_stego, &(EncodeInfo){.bit_depth = 1}) == e_success);
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 1, .key_fname = key_file}) == e_success);
+    char *a = read_whole_file(plain_stego, &a_size), *b = read_whole_file(stego, &b_size);
+    CHECK(a && b && a_size == b_size);
+    if (a && b && a_size == b_size)                                  // Same cover, same secret: only the cipher differs
+        CHECK(memcmp(a + a_size / 4, b + b_size / 4, 4096) != 0);
+    free(a);
+    free(b);
+
+    scratch_path(output, sizeof(output), "output.txt");
+    CHECK(decode_file(stego, output, 0, 0, 0) == d_failure);        // No key
+    unlink(output);
+    key[0] ^= 1;
+    CHECK(write_file(other_key, key, CHACHA_KEY_BYTES) == e_success);
+    scratch_path(output, sizeof(output), "output.txt");
+    CHECK(write_file(output, "kept", 4) == e_success);
+    CHECK(decode_file_key(stego, output, 0, 0, 0, other_key) == d_failure);  // Wrong key
+    a = read_whole_file(output, &a_size);
+    CHECK(a && a_size == 4 && memcmp(a, "kept", 4) == 0);          // Rejected before the output is created
+    free(a);
+    unlink(output);
+    CHECK(write_file(other_key, key, CHACHA_KEY_BYTES - 1) == e_success);
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 1, .key_fname = other_key}) == e_failure);  // Short key
+
+    free(secret_data);
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+    unlink(plain_stego);
+    unlink(key_file);
+    unlink(other_key);
+}
+
+static void test_pipeline(void)
+{
+    char src[PATH_MAX + 32], dst[PATH_MAX + 32], secret[PATH_MAX + 32];
+    char cover[PATH_MAX + 32], first[PATH_MAX + 32], stego[PATH_MAX + 32];
+    size_t src_size, dst_size, first_size = 0, stego_size = 0;
+    PipeBlock *block;
+
+    /* Pass-through: every byte read once and written once at the same offset */
+    scratch_path(src, sizeof(src), "src.bin");
+    scratch_path(dst, sizeof(dst), "dst.bin");
+    CHECK(corpus_write_payload(src, 5 * PIPE_BLOCK / 2 + 17, 40) == e_success);
+    char *data = read_whole_file(src, &src_size);
+    FILE *in = fopen(src, "rb"), *out = fopen(dst, "wb");
+    CHECK(data && in && out);
+    if (!data || !in || !out) return;
+    Pipeline *pipeline = pipeline_open(fileno(in), 0, fileno(out));
+    CHECK(pipeline != NULL);
+    if (pipeline)
+    {
+        block = pipeline_next(pipeline);                 // Touch the first block, keep the second one held
+        CHECK(block && block->offset == 0 && block->len == PIPE_BLOCK);
+        if (block) block->data[5] ^= 1;
+        pipeline_release(pipeline, block);
+        block = pipeline_next(pipeline);
+        CHECK(block && block->offset == PIPE_BLOCK);
+        CHECK(pipeline_close(pipeline, 1) == e_success);
+    }
+    fclose(out);
+    char *copy = read_whole_file(dst, &dst_size);
+    data[5] ^= 1;
+    CHECK(copy && dst_size == src_size && memcmp(copy, data, src_size) == 0);
+    free(copy);
+
+    /* Read only, from an offset, stopped early */
+    pipeline = pipeline_open(fileno(in), PIPE_BLOCK + 3, -1);
+    CHECK(pipeline != NULL);
+    if (pipeline)
+    {
+        size_t offset = PIPE_BLOCK + 3;
+        while ((block = pipeline_next(pipeline)) != NULL)
+        {
+            CHECK(block->offset == offset && memcmp(block->data, data + offset, block->len) == 0);
+            offset += block->len;
+            pipeline_release(pipeline, block);
+        }
+        CHECK(offset == src_size);
+        CHECK(pipeline_close(pipeline, 0) == e_success);
+    }
+    pipeline = pipeline_open(fileno(in), 0, -1);
+    CHECK(pipeline && pipeline_next(pipeline) != NULL && pipeline_close(pipeline, 0) == e_success);
+    fclose(in);
+    free(data);
+    unlink(src);
+    unlink(dst);
+
+    /* Pipelined encode writes the same image as the single thread stdio path; padded rows and
+       alpha skipping make payload bytes straddle block boundaries */
+    static const struct { uint width, height; int bits, depth, use_alpha, compress; } covers[] = {
+        {1001, 700, 24, 1, 0, 0}, {1001, 700, 24, 3, 0, 0}, {977, 700, 32, 1, 0, 0},
+        {977, 700, 32, 2, 1, 0}, {1024, 512, 24, 4, 0, 0}, {1001, 700, 24, 2, 0, 1}};
+    scratch_path(secret, sizeof(secret), "secret.txt");
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(first, sizeof(first), "first.bmp");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    CHECK(corpus_write_payload(secret, 3 * PIPE_BLOCK / 16 + 5, 41) == e_success);
+    for (size_t c = 0; c < sizeof(covers) / sizeof(covers[0]); c++)
+    {
+        CHECK(corpus_write_bmp_format(cover, covers[c].width, covers[c].height, covers[c].bits, 40, 0, 42 + c) == e_success);
+        CHECK(encode_file(cover, secret, first, &(EncodeInfo){.bit_depth = covers[c].depth,
+                                                              .use_alpha = covers[c].use_alpha,
+                                                              .compress = covers[c].compress, .no_pipeline = 1}) == e_success);
+        CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = covers[c].depth,
+                                                              .use_alpha = covers[c].use_alpha,
+                                                              .compress = covers[c].compress}) == e_success);
+        char *a = read_whole_file(first, &first_size), *b = read_whole_file(stego, &stego_size);
+        CHECK(a && b && first_size == stego_size && memcmp(a, b, first_size) == 0);
+        free(a);
+        free(b);
+    }
+    CHECK(corpus_write_bmp(cover, 100, 100, 43) == e_success);     // Too small: fails, threads are stopped
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 1}) == e_failure);
+
+    unlink(secret);
+    unlink(cover);
+    unlink(first);
+    unlink(stego);
+}
+
+static void test_io(void)
+{
+    char data_file[PATH_MAX + 32], cover[PATH_MAX + 32], secret[PATH_MAX + 32], first[PATH_MAX + 32];
+    char stego[PATH_MAX + 32], output[PATH_MAX + 48];
+    size_t n = 3 * IO_CHUNK + IO_CHUNK / 3 + 5, first_size = 0, stego_size = 0, secret_size = 0, out_size = 0;
+    static const IoBackend backends[] = { io_backend_auto, io_backend_uring, io_backend_threads, io_backend_sync };
+    static const int depths[] = { 1, 3, 16 };
+    IoBackend parsed;
+
+    for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++)
+        CHECK(io_backend_parse(io_backend_name(backends[b]), &parsed) == e_success && parsed == backends[b]);
+    CHECK(io_backend_parse("aio", &parsed) == e_failure);
+
+    /* One write, then two overlapped reads of different windows, through every backend (NULL: plain pread/pwrite) */
+    scratch_path(data_file, sizeof(data_file), "io.bin");
+    char *src = malloc(n), *a = malloc(n), *b = malloc(n);
+    CHECK(src && a && b);
+    if (!src || !a || !b) { free(src); free(a); free(b); return; }
+    for (size_t i = 0; i < n; i++)
+        src[i] = (char)(i * 131 + (i >> 9));
+    for (size_t q = 0; q <= sizeof(backends) / sizeof(backends[0]) * 3; q++)
+    {
+        IoQueue *io = NULL;
+        if (q > 0)
+        {
+            io = io_queue_create(backends[(q - 1) / 3], depths[(q - 1) % 3]);
+            if (io == NULL)
+            {
+                CHECK(backends[(q - 1) / 3] == io_backend_uring);   // Only an explicit io_uring may be missing
+                continue;
+            }
+            CHECK(io_queue_backend(io) != io_backend_auto);
+        }
+        int fd = open(data_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        CHECK(fd >= 0);
+        if (fd < 0) { io_queue_destroy(io); continue; }
+        IoRequest out = { fd, 1, src, n, 0 };
+        CHECK(io_transfer(io, &out, 1) == e_success);
+        memset(a, 0, n);
+        memset(b, 0, n);
+        IoRequest in[2] = { { fd, 0, a, n - 7, 7 }, { fd, 0, b, IO_CHUNK + 1, n - IO_CHUNK - 1 } };
+        CHECK(io_transfer(io, in, 2) == e_success);
+        CHECK(memcmp(a, src + 7, n - 7) == 0 && memcmp(b, src + n - IO_CHUNK - 1, IO_CHUNK + 1) == 0);
+        IoRequest past = { fd, 0, a, IO_CHUNK, n - 10 };             // Reads past the end of the file fail
+        CHECK(io_transfer(io, &past, 1) == e_failure);
+        CHECK(io_transfer(io, in, 2) == e_success);                  // And the queue is still usable
+        close(fd);
+        io_queue_destroy(io);
+    }
+    free(src);
+    free(a);
+    free(b);
+    unlink(data_file);
+
+    /* -j encodes and decodes through each backend write the same image as the serial path */
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(secret, sizeof(secret), "secret.txt");
+    scratch_path(first, sizeof(first), "first.bmp");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    CHECK(corpus_write_bmp(cover, 1501, 1200, 50) == e_success);     // Padded rows, tail after the payload
+    CHECK(corpus_write_payload(secret, TILE_BYTES / 2 + 3 * IO_CHUNK + 11, 51) == e_success);
+    char *secret_data = read_whole_file(secret, &secret_size);
+    CHECK(encode_file(cover, secret, first, &(EncodeInfo){.bit_depth = 2}) == e_success);
+    char *expect = read_whole_file(first, &first_size);
+    for (size_t b2 = 0; b2 < sizeof(backends) / sizeof(backends[0]); b2++)
+    {
+        IoQueue *probe = io_queue_create(backends[b2], 1);
+        if (probe == NULL) continue;                                  // No io_uring here
+        io_queue_destroy(probe);
+
+        EncodeInfo encInfo = {0};
+        encInfo.src_image_fname = cover;
+        encInfo.secret_fname = secret;
+        encInfo.stego_image_fname = stego;
+        encInfo.threads = 3;
+        encInfo.bit_depth = 2;
+        encInfo.io_backend = backends[b2];
+        encInfo.io_depth = 4;
+        encInfo.quiet = 1;
+        CHECK(do_encoding(&encInfo) == e_success);
+        close_files(&encInfo);
+        char *got = read_whole_file(stego, &stego_size);
+        CHECK(expect && got && first_size == stego_size && memcmp(expect, got, first_size) == 0);
+        free(got);
+
+        DecodeInfo decInfo = {0};
+        scratch_path(output, sizeof(output), "output");
+        decInfo.stego_image_fname = stego;
+        decInfo.output_fname = output;
+        decInfo.threads = 3;
+        decInfo.io_backend = backends[b2];
+        decInfo.io_depth = 2;
+        decInfo.quiet = 1;
+        if (do_decoding(&decInfo) == d_failure)
+        {
+            CHECK(0);
+            close_files_decode(&decInfo);
+        }
+        char *decoded = read_whole_file(decInfo.output_path, &out_size);
+        CHECK(decoded && secret_data && out_size == secret_size && memcmp(decoded, secret_data, secret_size) == 0);
+        free(decoded);
+        unlink(decInfo.output_path);
+    }
+    free(expect);
+    free(secret_data);
+    unlink(cover);
+    unlink(secret);
+    unlink(first);
+    unlink(stego);
+}
+
+static void test_patch(void)
+{
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], first[PATH_MAX + 32], stego[PATH_MAX + 32], work[PATH_MAX + 32];
+    size_t cover_size = 0, first_size = 0, stego_size = 0;
+    CloneMethod method;
+    StegStats stats;
+
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(secret, sizeof(secret), "secret.txt");
+    scratch_path(first, sizeof(first), "first.bmp");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    scratch_path(work, sizeof(work), "work.bmp");
+    CHECK(corpus_write_bmp(cover, 3001, 2400, 60) == e_success);     // Padded rows, long tail after the payload
+    CHECK(corpus_write_payload(secret, TILE_BYTES + 1234, 61) == e_success);      // Two tiles with -j
+    char *cover_data = read_whole_file(cover, &cover_size);
+    CHECK(cover_data != NULL);
+    if (!cover_data) return;
+
+    /* Whole-file clone by whatever the filesystem supports */
+    int in = open(cover, O_RDONLY), out = open(stego, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK(in >= 0 && out >= 0 && clone_file(in, out, &method) == e_success);
+    CHECK(strlen(clone_method_name(method)) > 0);
+    if (in >= 0) close(in);
+    if (out >= 0) close(out);
+    char *got = read_whole_file(stego, &stego_size);
+    CHECK(got && stego_size == cover_size && memcmp(got, cover_data, cover_size) == 0);
+    free(got);
+
+    /* --clone and --inplace write the same image as a full copy, in every mode */
+    static const struct { int use_mmap, threads, depth; } modes[] = { {0, 0, 1}, {0, 0, 3}, {0, 3, 2}, {1, 0, 2}, {1, 3, 1} };
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        CHECK(encode_file(cover, secret, first, &(EncodeInfo){.use_mmap = modes[m].use_mmap,
+                                                              .threads = modes[m].threads,
+                                                              .bit_depth = modes[m].depth}) == e_success);
+        char *expect = read_whole_file(first, &first_size);
+
+        unlink(stego);
+        CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.patch = 1, .use_mmap = modes[m].use_mmap,
+                                                              .threads = modes[m].threads,
+                                                              .bit_depth = modes[m].depth}) == e_success);
+        got = read_whole_file(stego, &stego_size);
+        CHECK(expect && got && stego_size == first_size && memcmp(got, expect, first_size) == 0);
+        free(got);
+
+        CHECK(write_file(work, cover_data, cover_size) == e_success);
+        CHECK(encode_file(work, secret, NULL, &(EncodeInfo){.patch = 1, .in_place = 1,
+                                                            .use_mmap = modes[m].use_mmap,
+                                                            .threads = modes[m].threads,
+                                                            .bit_depth = modes[m].depth, .stats = &stats}) == e_success);
+        got = read_whole_file(work, &stego_size);
+        CHECK(expect && got && stego_size == first_size && memcmp(got, expect, first_size) == 0);
+        free(got);
+        if (!modes[m].use_mmap && access("/proc/self/io", R_OK) == 0)  // Only the payload span was written
+            CHECK(stats.io_total.write_bytes < cover_size / 2);
+        free(expect);
+    }
+
+    /* A cover too small for the secret is left untouched */
+    CHECK(corpus_write_bmp(work, 100, 100, 62) == e_success);
+    char *small = read_whole_file(work, &cover_size);
+    CHECK(encode_file(work, secret, NULL, &(EncodeInfo){.patch = 1, .in_place = 1, .bit_depth = 1}) == e_failure);
+    got = read_whole_file(work, &stego_size);
+    CHECK(small && got && stego_size == cover_size && memcmp(got, small, cover_size) == 0);
+    free(small);
+    free(got);
+
+    free(cover_data);
+    unlink(cover);
+    unlink(secret);
+    unlink(first);
+    unlink(stego);
+    unlink(work);
+}
+
+/* One thread of the concurrent library test: encode and decode its own buffers */
+typedef struct _LibraryJob
+{
+    const char *cover;
+    size_t cover_size;
+    char payload[20000];
+    char *out;
+    char decoded[20000];
+    int depth;
+    int ok;
+} LibraryJob;
+
+static void *library_job(void *arg)
+{
+    LibraryJob *job = arg;
+    StegParams params = {0};
+    size_t size = 0;
+
+    params.bit_depth = job->depth;
+    params.compress = job->depth & 1;
+    job->ok = 1;
+    for (int i = 0; i < 20 && job->ok; i++)
+    {
+        job->ok = steg_encode(job->cover, job->cover_size, job->payload, sizeof(job->payload), &params,
+                              job->out, job->cover_size) == e_success &&
+                  steg_decode(job->out, job->cover_size, NULL, job->decoded, sizeof(job->decoded), &size) == e_success &&
+                  size == sizeof(job->payload) && memcmp(job->decoded, job->payload, size) == 0;
+    }
+    return NULL;
+}
+
+static void test_library(void)
+{
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], stego[PATH_MAX + 32], key_file[PATH_MAX + 32];
+    char output[PATH_MAX + 48];
+    size_t cover_size = 0, secret_size = 0, stego_size = 0, size = 0;
+    unsigned char key[CHACHA_KEY_BYTES];
+    StegPayloadInfo info;
+
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(secret, sizeof(secret), "secret.txt");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    scratch_path(key_file, sizeof(key_file), "lib.key");
+    for (int i = 0; i < CHACHA_KEY_BYTES; i++)
+        key[i] = (unsigned char)(7 * i + 1);
+    CHECK(write_file(key_file, key, sizeof(key)) == e_success);
+    CHECK(corpus_write_payload(secret, 200000, 70) == e_success);
+    char *payload = read_whole_file(secret, &secret_size);
+
+    /* Byte-identical to the file encoder, and both decoders read the result */
+    static const struct { uint width, height; int bits, depth, use_alpha, compress; } cases[] = {
+        {1001, 700, 24, 1, 0, 0}, {1001, 700, 24, 3, 0, 1}, {1024, 768, 24, 1, 0, 0}, {977, 600, 32, 2, 1, 0},
+        {977, 600, 32, 4, 0, 1}};
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        StegParams params = {0};
+        params.bit_depth = cases[c].depth;
+        params.use_alpha = cases[c].use_alpha;
+        params.compress = cases[c].compress;
+        CHECK(corpus_write_bmp_format(cover, cases[c].width, cases[c].height, cases[c].bits, 40, 0, 71 + c) == e_success);
+        CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = cases[c].depth,
+                                                              .use_alpha = cases[c].use_alpha,
+                                                              .compress = cases[c].compress}) == e_success);
+        char *image = read_whole_file(cover, &cover_size), *expect = read_whole_file(stego, &stego_size);
+        char *out = malloc(steg_encoded_size(cover_size)), *decoded = malloc(secret_size);
+        CHECK(image && expect && out && decoded && payload);
+        if (!image || !expect || !out || !decoded || !payload) { free(image); free(expect); free(out); free(decoded); continue; }
+
+        CHECK(steg_capacity(image, cover_size, &params) >= (cases[c].compress ? 1 : secret_size));
+        CHECK(steg_encode(image, cover_size, payload, secret_size, &params, out, cover_size) == e_success);
+        CHECK(stego_size == cover_size && memcmp(out, expect, cover_size) == 0);
+        CHECK(steg_decode_info(expect, stego_size, &info) == e_success);
+        CHECK(info.payload_size == secret_size && info.bit_depth == cases[c].depth && !info.encrypted &&
+              strcmp(info.extn, ".txt") == 0 && ((info.format_word & FORMAT_FLAG_LZ) != 0) == cases[c].compress);
+        memset(decoded, 0, secret_size);
+        CHECK(steg_decode(expect, stego_size, NULL, decoded, secret_size, &size) == e_success);
+        CHECK(size == secret_size && memcmp(decoded, payload, secret_size) == 0);
+        CHECK(steg_decode(expect, stego_size, NULL, decoded, secret_size - 1, &size) == e_failure);  // Output too small
+
+        CHECK(steg_encode(image, cover_size, payload, secret_size, &params, image, cover_size) == e_success);  // In place
+        CHECK(memcmp(image, expect, cover_size) == 0);
+        free(image);
+        free(expect);
+        free(out);
+        free(decoded);
+    }
+
+    /* Sizing: exactly the capacity fits, one more byte does not; short output buffers and clean covers fail */
+    CHECK(corpus_write_bmp(cover, 203, 101, 80) == e_success);
+    char *image = read_whole_file(cover, &cover_size);
+    char *out = malloc(cover_size), *big = calloc(1, cover_size);
+    StegParams params = {0};
+    params.bit_depth = 2;
+    params.extn = ".csv";
+    size_t capacity = steg_capacity(image, cover_size, &params);
+    CHECK(image && out && big && capacity > 0 && capacity < cover_size);
+    if (image && out && big)
+    {
+        CHECK(steg_encode(image, cover_size, big, capacity, &params, out, cover_size) == e_success);
+        CHECK(steg_decode_info(out, cover_size, &info) == e_success && info.payload_size == capacity && strcmp(info.extn, ".csv") == 0);
+        CHECK(steg_encode(image, cover_size, big, capacity + 1, &params, out, cover_size) == e_failure);
+        CHECK(steg_encode(image, cover_size, big, 10, &params, out, cover_size - 1) == e_failure);
+        CHECK(steg_decode_info(image, cover_size, &info) == e_failure);
+        CHECK(steg_capacity(image, 40, &params) == 0);                              // Truncated header
+    }
+    free(big);
+
+    /* -K: library and file encoder/decoder interoperate; wrong and missing keys fail */
+    if (image && out && payload)
+    {
+        char *small = malloc(20000);
+        unsigned char wrong[CHACHA_KEY_BYTES];
+        memcpy(wrong, key, sizeof(wrong));
+        wrong[0] ^= 1;
+        params.key = key;
+        params.extn = ".txt";
+        CHECK(small && steg_encode(image, cover_size, payload, 5000, &params, out, cover_size) == e_success);
+        CHECK(steg_decode_info(out, cover_size, &info) == e_success && info.encrypted);
+        CHECK(small && steg_decode(out, cover_size, key, small, 20000, &size) == e_success && size == 5000 &&
+              memcmp(small, payload, 5000) == 0);
+        CHECK(small && steg_decode(out, cover_size, NULL, small, 20000, &size) == e_failure);
+        CHECK(small && steg_decode(out, cover_size, wrong, small, 20000, &size) == e_failure);
+
+        CHECK(write_file(stego, out, cover_size) == e_success);
+        scratch_path(output, sizeof(output), "output");
+        CHECK(decode_file_key(stego, output, 0, 0, 0, key_file) == d_success);
+        char *decoded = read_whole_file(output, &size);
+        CHECK(decoded && size == 5000 && memcmp(decoded, payload, 5000) == 0);
+        free(decoded);
+        unlink(output);
+
+        CHECK(corpus_write_bmp(cover, 1001, 700, 81) == e_success);
+        CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.threads = 3, .bit_depth = 2, .compress = 1,
+                                                              .key_fname = key_file}) == e_success);
+        char *file_stego = read_whole_file(stego, &stego_size);
+        char *all = malloc(secret_size);
+        CHECK(file_stego && all && steg_decode(file_stego, stego_size, key, all, secret_size, &size) == e_success &&
+              size == secret_size && memcmp(all, payload, secret_size) == 0);
+        free(all);
+        free(file_stego);
+        free(small);
+    }
+    free(out);
+    free(image);
+
+    /* Independent encodes and decodes on several threads at once */
+    CHECK(corpus_write_bmp(cover, 401, 300, 82) == e_success);
+    image = read_whole_file(cover, &cover_size);
+    LibraryJob jobs[4];
+    pthread_t threads[4];
+    for (int t = 0; image && t < 4; t++)
+    {
+        jobs[t].cover = image;
+        jobs[t].cover_size = cover_size;
+        corpus_fill(jobs[t].payload, sizeof(jobs[t].payload), 90 + t);
+        jobs[t].out = malloc(cover_size);
+        jobs[t].depth = 1 + t;
+        jobs[t].ok = 0;
+        CHECK(jobs[t].out && pthread_create(&threads[t], NULL, library_job, &jobs[t]) == 0);
+    }
+    for (int t = 0; image && t < 4; t++)
+    {
+        pthread_join(threads[t], NULL);
+        CHECK(jobs[t].ok);
+        free(jobs[t].out);
+    }
+    free(image);
+
+    free(payload);
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+    unlink(key_file);
+}
+
+/* --range decode of the file decoder into output, returns the decoder status */
+static Status1 decode_file_range(const char *stego, char *output, int use_mmap, const char *key, size_t offset, size_t length)
+{
+    DecodeInfo decInfo = {0};
+    decInfo.key_fname = key;
+    decInfo.stego_image_fname = (char *)stego;
+    decInfo.output_fname = output;
+    decInfo.use_mmap = use_mmap;
+    decInfo.range = 1;
+    decInfo.range_offset = offset;
+    decInfo.range_length = length;
+    decInfo.quiet = 1;
+    Status1 res = do_decoding(&decInfo);
+    if (res == d_failure)
+        close_files_decode(&decInfo);
+    else
+        strcpy(output, decInfo.output_path);
+    return res;
+}
+
+static void test_range(void)
+{
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], stego[PATH_MAX + 32], key_file[PATH_MAX + 32];
+    char output[PATH_MAX + 48];
+    size_t stego_size = 0, secret_size = 0, size = 0;
+    unsigned char key[STEG_KEY_BYTES];
+
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(secret, sizeof(secret), "secret.txt");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    scratch_path(key_file, sizeof(key_file), "range.key");
+    for (int i = 0; i < STEG_KEY_BYTES; i++)
+        key[i] = (unsigned char)(11 * i + 2);
+    CHECK(write_file(key_file, key, sizeof(key)) == e_success);
+    CHECK(corpus_write_payload(secret, 300000, 120) == e_success);
+    char *payload = read_whole_file(secret, &secret_size);
+    char *out = malloc(secret_size + 1);
+    CHECK(payload && out);
+    if (!payload || !out) { free(payload); free(out); return; }
+
+    /* Every layout, depth, -z and -K: slices at the start, across blocks and tiles, clipped at the end */
+    static const struct { uint width, height; int bits, depth, use_alpha, compress, keyed; } cases[] = {
+        {1200, 900, 24, 1, 0, 0, 0}, {1001, 700, 24, 3, 0, 0, 1}, {977, 600, 32, 2, 1, 0, 0},
+        {1001, 700, 24, 2, 0, 1, 0}, {977, 600, 32, 4, 1, 1, 1}};
+    static const struct { size_t offset, length; } slices[] = {
+        {0, 4096}, {12345, 1}, {LZ_BLOCK - 10, 20}, {LZ_BLOCK, LZ_BLOCK}, {70000, 150000}, {299000, 5000},
+        {300000, 10}, {0, (size_t)-1}};
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        CHECK(corpus_write_bmp_format(cover, cases[c].width, cases[c].height, cases[c].bits, 40, 0, 121 + c) == e_success);
+        CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = cases[c].depth,
+                                                              .use_alpha = cases[c].use_alpha,
+                                                              .compress = cases[c].compress,
+                                                              .key_fname = cases[c].keyed ? key_file : NULL}) == e_success);
+        char *image = read_whole_file(stego, &stego_size);
+        CHECK(image != NULL);
+        if (!image) continue;
+        const unsigned char *k = cases[c].keyed ? key : NULL;
+        for (size_t s = 0; s < sizeof(slices) / sizeof(slices[0]); s++)
+        {
+            size_t offset = slices[s].offset;
+            size_t expect = secret_size - offset < slices[s].length ? secret_size - offset : slices[s].length;
+            CHECK(steg_decode_range(image, stego_size, k, offset, slices[s].length, out, secret_size, &size) == e_success);
+            CHECK(size == expect && memcmp(out, payload + offset, expect) == 0);
+
+            for (int use_mmap = 0; use_mmap <= 1; use_mmap++)
+            {
+                scratch_path(output, sizeof(output), "slice");
+                CHECK(decode_file_range(stego, output, use_mmap, cases[c].keyed ? key_file : NULL, offset, slices[s].length) == d_success);
+                char *decoded = read_whole_file(output, &size);
+                CHECK(decoded && size == expect && memcmp(decoded, payload + offset, expect) == 0);
+                free(decoded);
+                unlink(output);
+            }
+        }
+        CHECK(steg_decode_range(image, stego_size, k, secret_size + 1, 1, out, secret_size, &size) == e_failure);
+        CHECK(steg_decode_range(image, stego_size, k, 100, 1000, out, 999, &size) == e_failure);   // Output too small
+        CHECK(steg_decode_range(image, stego_size, k, 100, 0, NULL, 0, &size) == e_success && size == 0);  // Empty slice
+        if (c == 0)                                                   // Empty payload, no buffer
+        {
+            StegParams params = {0};
+            params.checksum = 1;
+            char *made = malloc(stego_size);
+            CHECK(made && steg_encode(image, stego_size, NULL, 0, &params, made, stego_size) == e_success);
+            CHECK(made && steg_decode(made, stego_size, NULL, NULL, 0, &size) == e_success && size == 0);
+            CHECK(made && steg_encode(image, stego_size, NULL, 1, &params, made, stego_size) == e_failure);
+            free(made);
+        }
+        scratch_path(output, sizeof(output), "slice");
+        CHECK(decode_file_range(stego, output, 0, cases[c].keyed ? key_file : NULL, secret_size + 1, 1) == d_failure);
+        scratch_path(output, sizeof(output), "slice.txt");
+        unlink(output);
+        if (cases[c].keyed)
+            CHECK(steg_decode_range(image, stego_size, NULL, 0, 10, out, secret_size, &size) == e_failure);
+        free(image);
+    }
+
+    free(payload);
+    free(out);
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+    unlink(key_file);
+}
+
+static void test_archive(void)
+{
+    char cover[PATH_MAX + 32], stego[PATH_MAX + 32], key_file[PATH_MAX + 32], dir[PATH_MAX + 32];
+    char files[4][PATH_MAX + 32], path[2 * PATH_MAX + 64];
+    char *names[4];
+    static const size_t sizes[4] = {0, 1000, 150000, 70000};
+    char *data[4];
+    unsigned char key[STEG_KEY_BYTES];
+    size_t stego_size = 0, size = 0;
+    Archive archive;
+
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    scratch_path(key_file, sizeof(key_file), "archive.key");
+    scratch_path(dir, sizeof(dir), "out");
+    mkdir(dir, 0755);
+    for (int i = 0; i < STEG_KEY_BYTES; i++)
+        key[i] = (unsigned char)(5 * i + 9);
+    CHECK(write_file(key_file, key, sizeof(key)) == e_success);
+    for (int f = 0; f < 4; f++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "entry%d.%s", f, f == 2 ? "csv" : "bin");
+        scratch_path(files[f], sizeof(files[f]), name);
+        CHECK(corpus_write_payload(files[f], sizes[f], 130 + f) == e_success);
+        data[f] = read_whole_file(files[f], &size);
+        names[f] = files[f];
+    }
+    CHECK(corpus_write_bmp(cover, 1001, 700, 135) == e_success);
+
+    /* Plain, -z and -K archives: TOC, every entry alone, and -x of all or named entries */
+    for (int mode = 0; mode < 3; mode++)
+    {
+        EncodeInfo encInfo = {0};
+        StegOptions opts = {0};
+        unlink(stego);
+        encInfo.src_image_fname = cover;
+        encInfo.stego_image_fname = stego;
+        encInfo.archive_files = names;
+        encInfo.archive_count = 4;
+        encInfo.bit_depth = mode + 1;
+        encInfo.compress = mode == 1;
+        encInfo.key_fname = mode == 2 ? key_file : NULL;
+        encInfo.quiet = 1;
+        CHECK(do_encoding(&encInfo) == e_success);
+        close_files(&encInfo);
+
+        char *image = read_whole_file(stego, &stego_size);
+        const unsigned char *k = mode == 2 ? key : NULL;
+        CHECK(image && archive_read(image, stego_size, k, &archive) == e_success);
+        if (!image) continue;
+        CHECK(archive.count == 4);
+        for (size_t e = 0; e < archive.count && e < 4; e++)
+        {
+            CHECK(strcmp(archive.entries[e].name, strrchr(files[e], '/') + 1) == 0 && archive.entries[e].size == sizes[e]);
+            snprintf(path, sizeof(path), "%s/single", dir);
+            CHECK(archive_extract_entry(image, stego_size, k, &archive, e, path) == e_success);
+            char *got = read_whole_file(path, &size);
+            CHECK(got && size == sizes[e] && memcmp(got, data[e], size) == 0);
+            free(got);
+            unlink(path);
+        }
+        archive_free(&archive);
+        if (mode == 2)
+            CHECK(archive_read(image, stego_size, NULL, &archive) == e_failure);   // Key needed for the TOC
+
+        opts.quiet = 1;
+        opts.key_fname = mode == 2 ? key_file : NULL;
+        char *wanted[1] = {"entry2.csv"};
+        CHECK(run_archive_extract(stego, dir, wanted, 1, &opts) == e_success);
+        snprintf(path, sizeof(path), "%s/entry1.bin", dir);
+        CHECK(access(path, F_OK) != 0);                                              // Only the named entry
+        CHECK(run_archive_extract(stego, dir, NULL, 0, &opts) == e_success);
+        for (int f = 0; f < 4; f++)
+        {
+            snprintf(path, sizeof(path), "%s/%s", dir, strrchr(files[f], '/') + 1);
+            char *got = read_whole_file(path, &size);
+            CHECK(got && size == sizes[f] && memcmp(got, data[f], size) == 0);
+            free(got);
+            unlink(path);
+        }
+        char *missing[1] = {"nothere"};
+        CHECK(run_archive_extract(stego, dir, missing, 1, &opts) == e_failure);
+        free(image);
+    }
+
+    /* Duplicate names are refused; plain payloads and hostile TOCs are not archives */
+    char *twice[2] = {files[1], files[1]};
+    CHECK(archive_create(twice, 2) == NULL);
+    CHECK(archive_create(names, 0) == NULL);
+    char *image = read_whole_file(cover, &stego_size);
+    char *out = image ? malloc(stego_size) : NULL;
+    static const char forged[] = "SAR1\0\0\0\1\0\0\0\x1b\0\5ok.xx\0\0\0\0\0\0\0\2hi";
+    static const char hostile[] = "SAR1\0\0\0\1\0\0\0\x1b\0\5../xx\0\0\0\0\0\0\0\2hi";
+    StegParams params = {0};
+    params.extn = ARCHIVE_EXTN;
+    CHECK(out && steg_encode(image, stego_size, forged, sizeof(forged) - 1, &params, out, stego_size) == e_success);
+    CHECK(out && archive_read(out, stego_size, NULL, &archive) == e_success && archive.count == 1 &&
+          strcmp(archive.entries[0].name, "ok.xx") == 0 && archive.entries[0].offset == 27 && archive.entries[0].size == 2);
+    archive_free(&archive);
+    CHECK(out && steg_encode(image, stego_size, hostile, sizeof(hostile) - 1, &params, out, stego_size) == e_success);
+    CHECK(out && archive_read(out, stego_size, NULL, &archive) == e_failure);   // Would leave the directory
+    params.extn = ".txt";
+    CHECK(out && steg_encode(image, stego_size, data[2], sizes[2], &params, out, stego_size) == e_success);
+    CHECK(out && archive_read(out, stego_size, NULL, &archive) == e_failure);
+    free(out);
+    free(image);
+
+    for (int f = 0; f < 4; f++)
+    {
+        free(data[f]);
+        unlink(files[f]);
+    }
+    rmdir(dir);
+    unlink(cover);
+    unlink(stego);
+    unlink(key_file);
+}
+
+/* Daemon of the daemon test, on its own thread */
+typedef struct _DaemonRun
+{
+    char socket[PATH_MAX + 32];
+    Status res;
+} DaemonRun;
+
+static void *daemon_thread(void *arg)
+{
+    DaemonRun *run = arg;
+    StegOptions opts = {0};
+    opts.threads = 2;
+    opts.quiet = 1;
+    run->res = run_daemon(run->socket, &opts);
+    return NULL;
+}
+
+/* One request on named files (NULL: not passed), output files are created */
+static Status daemon_request(int sock, StegdRequest *req, const char *in0, const char *in1, const char *out, StegdReply *reply)
+{
+    int fds[STEGD_MAX_FDS], nfds = 0;
+    if (in0) fds[nfds++] = open(in0, O_RDONLY);
+    if (in1) fds[nfds++] = open(in1, O_RDONLY);
+    if (out) fds[nfds++] = open(out, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int opened = 1;
+    for (int i = 0; i < nfds; i++)
+        opened = opened && fds[i] >= 0;
+    req->version = STEGD_VERSION;
+    Status res = opened ? stegd_call(sock, req, fds, nfds, reply) : e_failure;
+    for (int i = 0; i < nfds; i++)
+        if (fds[i] >= 0) close(fds[i]);
+    return res;
+}
+
+static void test_daemon(void)
+{
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], stego[PATH_MAX + 32], output[PATH_MAX + 32];
+    size_t cover_size = 0, secret_size = 0, size = 0;
+    unsigned char key[STEG_KEY_BYTES];
+    DaemonRun run;
+    pthread_t thread;
+    int sock = -1;
+
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(secret, sizeof(secret), "secret.txt");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    scratch_path(output, sizeof(output), "output.txt");
+    scratch_path(run.socket, sizeof(run.socket), "stegd.sock");
+    for (int i = 0; i < STEG_KEY_BYTES; i++)
+        key[i] = (unsigned char)(3 * i + 5);
+    CHECK(write_file(output, key, sizeof(key)) == e_success);    // Only a socket file is ever replaced
+    StegOptions daemon_opts = {0};
+    daemon_opts.quiet = 1;
+    CHECK(run_daemon(output, &daemon_opts) == e_failure && access(output, F_OK) == 0);
+    unlink(output);
+    CHECK(pthread_create(&thread, NULL, daemon_thread, &run) == 0);
+    for (int i = 0; i < 500 && sock < 0; i++)                   // Until the daemon listens
+    {
+        sock = stegd_connect(run.socket);
+        if (sock < 0) usleep(10000);
+    }
+    CHECK(sock >= 0);
+    if (sock < 0)
+        return;
+    struct stat st;
+    CHECK(stat(run.socket, &st) == 0 && (st.st_mode & 0777) == 0600);   // Whatever the umask
+
+    /* Small (read into the worker buffers) and large (mapped) images, small and large payloads, keys */
+    static const struct { uint width, height; int depth, compress, keyed; size_t payload; } cases[] = {
+        {401, 300, 1, 0, 0, 20000}, {401, 300, 2, 1, 1, 20000}, {1001, 700, 3, 0, 0, 200000},
+        {1001, 700, 1, 1, 1, 100000}, {1500, 1000, 4, 0, 0, 1200000}};
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        StegdRequest req = {0};
+        StegdReply reply;
+        StegParams params = {0};
+        CHECK(corpus_write_bmp(cover, cases[c].width, cases[c].height, 100 + c) == e_success);
+        CHECK(corpus_write_payload(secret, cases[c].payload, 110 + c) == e_success);
+        char *image = read_whole_file(cover, &cover_size), *payload = read_whole_file(secret, &secret_size);
+        char *expect = malloc(cover_size);
+        CHECK(image && payload && expect);
+        if (!image || !payload || !expect) { free(image); free(payload); free(expect); continue; }
+
+        params.bit_depth = cases[c].depth;
+        params.compress = cases[c].compress;
+        params.key = cases[c].keyed ? key : NULL;
+        params.extn = ".bin";
+        req.id = 10 + c;
+        req.op = stegd_encode;
+        req.bit_depth = cases[c].depth;
+        req.compress = cases[c].compress;
+        req.has_key = cases[c].keyed;
+        memcpy(req.key, key, sizeof(key));
+        strcpy(req.extn, ".bin");
+        CHECK(daemon_request(sock, &req, cover, secret, stego, &reply) == e_success);
+        CHECK(reply.id == req.id && reply.size == cover_size);
+        char *stego_data = read_whole_file(stego, &size);
+        if (cases[c].keyed)                                     // Random nonce: the daemon's image must decode
+        {
+            char *decoded = malloc(secret_size);
+            size_t decoded_size = 0;
+            CHECK(stego_data && decoded && size == cover_size &&
+                  steg_decode(stego_data, size, key, decoded, secret_size, &decoded_size) == e_success &&
+                  decoded_size == secret_size && memcmp(decoded, payload, secret_size) == 0);
+            free(decoded);
+        }
+        else
+        {
+            CHECK(steg_encode(image, cover_size, payload, secret_size, &params, expect, cover_size) == e_success);
+            CHECK(stego_data && size == cover_size && memcmp(stego_data, expect, cover_size) == 0);
+        }
+        free(stego_data);
+
+        memset(&req, 0, sizeof(req));
+        req.id = 20 + c;
+        req.op = stegd_inspect;
+        CHECK(daemon_request(sock, &req, stego, NULL, NULL, &reply) == e_success);
+        CHECK(reply.id == req.id && reply.size == secret_size && reply.bit_depth == cases[c].depth &&
+              reply.encrypted == cases[c].keyed && strcmp(reply.extn, ".bin") == 0);
+
+        req.op = stegd_decode;
+        req.has_key = cases[c].keyed;
+        memcpy(req.key, key, sizeof(key));
+        CHECK(daemon_request(sock, &req, stego, NULL, output, &reply) == e_success);
+        char *decoded = read_whole_file(output, &size);
+        CHECK(reply.size == secret_size && decoded && size == secret_size && memcmp(decoded, payload, size) == 0);
+        free(decoded);
+        if (cases[c].keyed)
+        {
+            req.key[0] ^= 1;
+            CHECK(daemon_request(sock, &req, stego, NULL, output, &reply) == e_failure && reply.status == e_failure);
+        }
+        free(image);
+        free(payload);
+        free(expect);
+    }
+
+    /* Bad requests are answered with a failure and the daemon keeps serving */
+    StegdRequest req = {0};
+    StegdReply reply;
+    req.id = 30;
+    req.op = stegd_decode;                                      // Output descriptor missing
+    CHECK(daemon_request(sock, &req, stego, NULL, NULL, &reply) == e_failure && reply.id == 30);
+    req.op = 17;
+    CHECK(daemon_request(sock, &req, NULL, NULL, NULL, &reply) == e_failure);
+    req.op = stegd_inspect;
+    CHECK(daemon_request(sock, &req, cover, NULL, NULL, &reply) == e_failure);  // Clean cover
+    req.version = STEGD_VERSION + 1;
+    CHECK(stegd_call(sock, &req, NULL, 0, &reply) == e_failure);
+    CHECK(daemon_request(sock, &req, stego, NULL, NULL, &reply) == e_success && reply.size == 1200000);
+
+    /* Another user may not stop it, even through an opened up socket (as root only: the client drops to nobody) */
+    if (geteuid() == 0)
+    {
+        CHECK(chmod(run.socket, 0666) == 0 && chmod(scratch, 0711) == 0);
+        pid_t child = fork();
+        if (child == 0)
+        {
+            int stranger = setuid(65534) == 0 ? stegd_connect(run.socket) : -1;
+            req.op = stegd_shutdown;
+            _exit(stranger >= 0 && daemon_request(stranger, &req, NULL, NULL, NULL, &reply) == e_failure ? 0 : 1);
+        }
+        int status = -1;
+        CHECK(child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        CHECK(chmod(run.socket, 0600) == 0 && chmod(scratch, 0700) == 0);
+    }
+
+    /* A second client, then shutdown: the daemon returns and removes its socket */
+    int other = stegd_connect(run.socket);
+    CHECK(other >= 0);
+    req.op = stegd_shutdown;
+    CHECK(other >= 0 && daemon_request(other, &req, NULL, NULL, NULL, &reply) == e_success);
+    pthread_join(thread, NULL);
+    CHECK(run.res == e_success && access(run.socket, F_OK) != 0);
+    if (other >= 0) close(other);
+    close(sock);
+
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+    unlink(output);
+}
+
+/* Rebuild with the images of the covers in use[] (count of them) */
+static Status shard_rebuild(char images[][PATH_MAX + 32], const int *use, int count, const char *output, const char *key_file)
+{
+    char *names[8];
+    StegOptions opts = {0};
+    opts.quiet = 1;
+    opts.key_fname = key_file;
+    for (int i = 0; i < count; i++)
+        names[i] = images[use[i]];
+    return run_shard_decode(output, names, count, &opts);
+}
+
+static void test_shard(void)
+{
+    char covers[5][PATH_MAX + 32], images[5][PATH_MAX + 32], secret[PATH_MAX + 32], key_file[PATH_MAX + 32];
+    char dir[PATH_MAX + 32], output[PATH_MAX + 32], rebuilt[PATH_MAX + 32];
+    char *cover_names[5];
+    unsigned char key[STEG_KEY_BYTES];
+    size_t size = 0;
+
+    /* Reed-Solomon: every k of the n shards rebuild every data shard */
+    enum { K = 3, N = 6, L = 37 };
+    unsigned char shards[N][L], inv[K * K];
+    for (int s = 0; s < K; s++)
+        for (int b = 0; b < L; b++)
+            shards[s][b] = (unsigned char)(s * 71 + b * 13 + 1);
+    for (int s = K; s < N; s++)
+    {
+        memset(shards[s], 0, L);
+        for (int d = 0; d < K; d++)
+            erasure_mul_add(shards[s], shards[d], erasure_coef(K, s, d), L);
+    }
+    for (int mask = 0; mask < 1 << N; mask++)
+    {
+        int rows[N], count = 0;
+        for (int s = 0; s < N; s++)
+            if (mask & 1 << s) rows[count++] = s;
+        if (count != K) continue;
+        CHECK(erasure_invert(K, N, rows, inv) == e_success);
+        for (int d = 0; d < K; d++)
+        {
+            unsigned char got[L] = {0};
+            for (int j = 0; j < K; j++)
+                erasure_mul_add(got, shards[rows[j]], inv[d * K + j], L);
+            CHECK(memcmp(got, shards[d], L) == 0);
+        }
+    }
+    int twice[K] = {0, 4, 4};
+    CHECK(erasure_invert(K, N, twice, inv) == e_failure);
+
+    /* Header extensions end up in the output path: empty, no dot, '/' and unterminated ones are refused */
+    ShardHeader header = {0}, back;
+    unsigned char head[SHARD_HEADER];
+    header.n = 3;
+    header.k = 2;
+    header.secret_size = 1001;
+    header.shard_size = 501;
+    static const char *extns[] = {".csv", "", "csv", "./../x", ".123456789"};
+    for (size_t i = 0; i < sizeof(extns) / sizeof(extns[0]); i++)
+    {
+        shard_header_write(&header, head);
+        memcpy(head + 18, extns[i], strlen(extns[i]));                // Up to 10 bytes, like the field
+        CHECK((shard_header_read(head, &back) == e_success) == (i == 0));
+    }
+
+    scratch_path(secret, sizeof(secret), "secret.bin");
+    scratch_path(key_file, sizeof(key_file), "shard.key");
+    scratch_path(dir, sizeof(dir), "shards");
+    scratch_path(output, sizeof(output), "rebuilt.out");
+    scratch_path(rebuilt, sizeof(rebuilt), "rebuilt.bin");            // Stored extension replaces .out
+    mkdir(dir, 0755);
+    for (int i = 0; i < STEG_KEY_BYTES; i++)
+        key[i] = (unsigned char)(11 * i + 3);
+    CHECK(write_file(key_file, key, sizeof(key)) == e_success);
+    for (int c = 0; c < 5; c++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "cover%d.bmp", c);
+        scratch_path(covers[c], sizeof(covers[c]), name);
+        snprintf(name, sizeof(name), "shards/cover%d.bmp", c);
+        scratch_path(images[c], sizeof(images[c]), name);
+        CHECK(corpus_write_bmp(covers[c], 400 + 8 * c, 300, 140 + c) == e_success);
+        cover_names[c] = covers[c];
+    }
+
+    /* Plain, -z, -K with parity; any k of the images rebuild the secret, fewer do not */
+    static const size_t sizes[4] = {100001, 90000, 0, 7};
+    for (int mode = 0; mode < 4; mode++)
+    {
+        StegOptions opts = {0};
+        opts.quiet = 1;
+        opts.threads = mode == 0 ? 1 : 0;
+        opts.parity = mode == 0 ? 0 : 2;
+        opts.bit_depth = mode == 2 ? 2 : 1;
+        opts.compress = mode == 1;
+        opts.key_fname = mode == 2 ? key_file : NULL;
+        CHECK(corpus_write_payload(secret, sizes[mode], 150 + mode) == e_success);
+        char *data = read_whole_file(secret, &size);
+        CHECK(run_shard_encode(secret, dir, cover_names, 5, &opts) == e_success);
+
+        static const int all[5] = {4, 3, 2, 1, 0}, data_lost[3] = {4, 1, 3}, parity_lost[3] = {2, 0, 1};
+        const int *sets[3] = {all, data_lost, parity_lost};
+        int k = 5 - opts.parity;
+        for (int t = 0; t < (opts.parity ? 3 : 1); t++)                  // Lost covers need parity
+        {
+            unlink(rebuilt);
+            CHECK(shard_rebuild(images, sets[t], t == 0 ? 5 : k, output, opts.key_fname) == e_success);
+            char *got = read_whole_file(rebuilt, &size);
+            CHECK(got && size == sizes[mode] && (size == 0 || memcmp(got, data, size) == 0));
+            free(got);
+        }
+        CHECK(shard_rebuild(images, all, k - 1, output, opts.key_fname) == e_failure);
+        if (mode == 2)
+            CHECK(shard_rebuild(images, all, 5, output, NULL) == e_failure);   // Key needed
+        free(data);
+    }
+
+    /* Shards of another secret are ignored; plain stego images are not shards */
+    StegOptions opts = {0};
+    opts.quiet = 1;
+    opts.parity = 1;
+    CHECK(run_shard_encode(secret, dir, cover_names, 4, &opts) == e_success);   // Covers 0..3, image 4 is older
+    static const int mixed[4] = {4, 0, 1, 2};
+    CHECK(shard_rebuild(images, mixed, 3, output, NULL) == e_failure);         // Image 4 picks its own set
+    CHECK(shard_rebuild(images, mixed + 1, 3, output, NULL) == e_success);
+    char dotted[PATH_MAX + 32], dotted_out[PATH_MAX + 48];                      // A dot in the output's directory
+    scratch_path(dotted, sizeof(dotted), "my.dir");
+    CHECK(mkdir(dotted, 0700) == 0);
+    snprintf(dotted_out, sizeof(dotted_out), "%s/out", dotted);
+    CHECK(shard_rebuild(images, mixed + 1, 3, dotted_out, NULL) == e_success);
+    snprintf(dotted_out, sizeof(dotted_out), "%s/out.bin", dotted);
+    CHECK(access(dotted_out, F_OK) == 0);
+    unlink(dotted_out);
+    rmdir(dotted);
+    char *plain[1] = {covers[0]};
+    CHECK(run_shard_decode(output, plain, 1, &opts) == e_failure);
+
+    /* Bad splits: parity as large as the covers, one output name twice, covers too small */
+    opts.parity = 5;
+    CHECK(run_shard_encode(secret, dir, cover_names, 5, &opts) == e_failure);
+    opts.parity = 0;
+    char *same[2] = {covers[1], covers[1]};
+    CHECK(run_shard_encode(secret, dir, same, 2, &opts) == e_failure);
+    CHECK(corpus_write_payload(secret, 200000, 160) == e_success);
+    CHECK(run_shard_encode(secret, dir, cover_names, 2, &opts) == e_failure);
+
+    for (int c = 0; c < 5; c++)
+    {
+        unlink(covers[c]);
+        unlink(images[c]);
+    }
+    rmdir(dir);
+    unlink(secret);
+    unlink(rebuilt);
+    unlink(key_file);
+}
+
+static void test_checksum(void)
+{
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], stego[PATH_MAX + 32], key_file[PATH_MAX + 32];
+    char output[PATH_MAX + 48];
+    unsigned char key[STEG_KEY_BYTES];
+    char data[1001];
+    size_t secret_size = 0, stego_size = 0, out_size = 0;
+    StegInspect info;
+    StegPayloadInfo payload;
+
+    /* Check value of the standard test string, both variants, pieces joined with crc32c_combine() */
+    int hardware = crc32c_hardware();
+    corpus_fill(data, sizeof(data), 170);
+    for (int variant = 0; variant <= 1; variant++)
+    {
+        if (!crc32c_select(variant))
+            continue;                                // No SSE4.2 on this CPU
+        CHECK(crc32c_update(0, "123456789", 9) == 0xE3069283u);
+        CHECK(crc32c_update(0, data, 0) == 0);
+        uint32_t whole = crc32c_update(0, data + 1, 1000);    // Odd offset: unaligned loads
+        for (size_t cut = 0; cut <= 1000; cut += 37)
+        {
+            CHECK(crc32c_update(crc32c_update(0, data + 1, cut), data + 1 + cut, 1000 - cut) == whole);
+            CHECK(crc32c_combine(crc32c_update(0, data + 1, cut), crc32c_update(0, data + 1 + cut, 1000 - cut), 1000 - cut) == whole);
+        }
+    }
+    crc32c_select(hardware);
+
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(secret, sizeof(secret), "secret.bin");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    scratch_path(key_file, sizeof(key_file), "crc.key");
+    for (int i = 0; i < STEG_KEY_BYTES; i++)
+        key[i] = (unsigned char)(5 * i + 9);
+    CHECK(write_file(key_file, key, sizeof(key)) == e_success);
+    CHECK(corpus_write_cover(cover, 5, 171) == e_success);
+    CHECK(corpus_write_payload(secret, 3 * TILE_BYTES / 2 + 5, 172) == e_success);  // Two tiles, odd tail
+    char *secret_data = read_whole_file(secret, &secret_size);
+
+    /* One flipped payload bit is caught by decode and --verify in every mode */
+    static const struct { int use_mmap, threads, compress, keyed; } modes[] = {
+        {0, 0, 0, 0}, {1, 0, 0, 0}, {0, 3, 0, 0}, {1, 3, 0, 0}, {0, 0, 1, 0}, {0, 3, 1, 0}, {0, 0, 0, 1}, {1, 3, 1, 1}};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        const char *keyed = modes[m].keyed ? key_file : NULL;
+        CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.use_mmap = modes[m].use_mmap,
+                                                              .threads = modes[m].threads, .bit_depth = 1,
+                                                              .compress = modes[m].compress,
+                                                              .key_fname = keyed, .use_crc = 1}) == e_success);
+        scratch_path(output, sizeof(output), "output");
+        CHECK(decode_file_key(stego, output, modes[m].use_mmap, modes[m].threads, 0, keyed) == d_success);
+        char *out = read_whole_file(output, &out_size);
+        CHECK(out && out_size == secret_size && memcmp(out, secret_data, secret_size) == 0);
+        free(out);
+        unlink(output);
+
+        CHECK(inspect_file(stego, &info) == inspect_stego && (info.format_word & FORMAT_FLAG_CRC));
+        CHECK(inspect_verify(stego, modes[m].keyed ? key : NULL, &info) == inspect_stego && info.verified);
+        char *image = read_whole_file(stego, &stego_size);
+        CHECK(image && steg_verify(image, stego_size, modes[m].keyed ? key : NULL, &payload) == e_success && payload.checksum);
+        if (modes[m].keyed)
+        {
+            CHECK(inspect_file(stego, &info) == inspect_stego && inspect_verify(stego, NULL, &info) == inspect_stego);
+            CHECK(!info.verified);                                    // Encrypted: not checked without the key
+        }
+        if (image)
+        {
+            image[info.payload_offset + 8 * 1000] ^= 1;               // One bit of payload byte 1000
+            CHECK(write_file(stego, image, stego_size) == e_success);
+            CHECK(steg_verify(image, stego_size, modes[m].keyed ? key : NULL, NULL) == e_failure);
+        }
+        scratch_path(output, sizeof(output), "output");
+        CHECK(decode_file_key(stego, output, modes[m].use_mmap, modes[m].threads, 0, keyed) == d_failure);
+        scratch_path(output, sizeof(output), "output.bin");
+        CHECK(access(output, F_OK) != 0);                            // Damaged output removed
+        CHECK(inspect_file(stego, &info) == inspect_stego);          // Header fields still consistent
+        CHECK(inspect_verify(stego, modes[m].keyed ? key : NULL, &info) == inspect_broken);
+        if (!modes[m].keyed)                                          // -i --verify fails, plain -i does not
+        {
+            StegOptions opts = {0};
+            char *paths[] = {stego};
+            opts.threads = 1;
+            opts.quiet = 1;
+            CHECK(run_inspect(1, paths, &opts) == e_success);
+            opts.verify = 1;
+            CHECK(run_inspect(1, paths, &opts) == e_failure);
+        }
+        free(image);
+    }
+
+    /* Without --crc: original format, decodes as before and has nothing to verify */
+    CHECK(encode_file(cover, secret, stego, NULL) == e_success);
+    CHECK(inspect_file(stego, &info) == inspect_stego && info.format_word == 0);
+    CHECK(inspect_verify(stego, NULL, &info) == inspect_stego && !info.verified);
+    scratch_path(output, sizeof(output), "output");
+    CHECK(decode_file(stego, output, 0, 0, 0) == d_success);
+    char *out = read_whole_file(output, &out_size);
+    CHECK(out && out_size == secret_size && memcmp(out, secret_data, secret_size) == 0);
+    free(out);
+    unlink(output);
+
+    free(secret_data);
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+    unlink(key_file);
+}
+
+static void test_scatter(void)
+{
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], stego[PATH_MAX + 32], key_file[PATH_MAX + 32];
+    char output[PATH_MAX + 48];
+    unsigned char key[STEG_KEY_BYTES], nonce[CHACHA_NONCE_BYTES] = {1, 2, 3};
+    size_t secret_size = 0, stego_size = 0, cover_size = 0, out_size = 0;
+    StegInspect info;
+
+    /* Run permutation: whole runs after the base go to distinct whole runs, header slots and the tail stay */
+    enum { RUNS = 100, BASE = 1000, TAIL = 777 };
+    BmpLayout layout;
+    ChaCha cipher;
+    char seen[RUNS] = {0};
+    int moved = 0;
+    for (int i = 0; i < STEG_KEY_BYTES; i++)
+        key[i] = (unsigned char)(7 * i + 1);
+    chacha_setup(&cipher, key, nonce);
+    bmp_layout_linear(0, BASE + (size_t)RUNS * BMP_SCATTER_RUN + TAIL, &layout);
+    bmp_layout_scatter(&layout, BASE, &cipher);
+    CHECK(layout.scatter_runs == RUNS);
+    for (size_t r = 0; r < RUNS; r++)
+    {
+        size_t at = bmp_slot_offset(&layout, BASE + r * BMP_SCATTER_RUN);
+        CHECK(at >= BASE && (at - BASE) % BMP_SCATTER_RUN == 0 && (at - BASE) / BMP_SCATTER_RUN < RUNS);
+        if (at >= BASE && (at - BASE) / BMP_SCATTER_RUN < RUNS)
+            seen[(at - BASE) / BMP_SCATTER_RUN]++;
+        CHECK(bmp_slot_offset(&layout, BASE + r * BMP_SCATTER_RUN + BMP_SCATTER_RUN - 1) == at + BMP_SCATTER_RUN - 1);
+        moved += at != BASE + r * BMP_SCATTER_RUN;
+    }
+    for (size_t r = 0; r < RUNS; r++)
+        CHECK(seen[r] == 1);
+    CHECK(moved > RUNS / 2);
+    CHECK(bmp_slot_offset(&layout, BASE - 1) == BASE - 1);
+    CHECK(bmp_slot_offset(&layout, BASE + (size_t)RUNS * BMP_SCATTER_RUN + 5) == BASE + (size_t)RUNS * BMP_SCATTER_RUN + 5);
+
+    /* Embed / extract across run boundaries at every depth */
+    size_t image_bytes = BASE + (size_t)RUNS * BMP_SCATTER_RUN + TAIL;
+    char *image = malloc(image_bytes), data[5000], back[5000];
+    corpus_fill(data, sizeof(data), 180);
+    for (int depth = 1; image && depth <= LSB_MAX_DEPTH; depth++)
+    {
+        size_t slot = BASE + lsb_cover_bytes(depth) * 1001;
+        corpus_fill(image, image_bytes, 181);
+        bmp_embed(&layout, image, 0, slot, data, sizeof(data), depth);
+        bmp_extract(&layout, image, 0, slot, back, sizeof(back), depth);
+        CHECK(memcmp(back, data, sizeof(data)) == 0);
+    }
+    free(image);
+
+    scratch_path(cover, sizeof(cover), "cover.bmp");
+    scratch_path(secret, sizeof(secret), "secret.bin");
+    scratch_path(stego, sizeof(stego), "stego.bmp");
+    scratch_path(key_file, sizeof(key_file), "scatter.key");
+    CHECK(write_file(key_file, key, sizeof(key)) == e_success);
+
+    /* Round trips: serial and -j, every depth, -z, padded rows and alpha, full and --range decodes */
+    static const struct { int width, height, bits, threads, depth, use_alpha, compress; size_t size; } cases[] = {
+        {2048, 1000, 24, 0, 1, 0, 0, 200001}, {2048, 1000, 24, 3, 1, 0, 0, 200001}, {2048, 1000, 24, 3, 3, 0, 1, 400000},
+        {2048, 1000, 24, 0, 4, 0, 1, 700000}, {333, 250, 24, 0, 2, 0, 0, 30000}, {333, 250, 32, 3, 2, 1, 0, 60000}};
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        CHECK(corpus_write_bmp_format(cover, cases[c].width, cases[c].height, cases[c].bits, 40, 0, 182 + c) == e_success);
+        CHECK(corpus_write_payload(secret, cases[c].size, 190 + c) == e_success);
+        char *secret_data = read_whole_file(secret, &secret_size);
+        CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.scatter = 1, .use_crc = 1,
+                                                              .threads = cases[c].threads,
+                                                              .bit_depth = cases[c].depth,
+                                                              .use_alpha = cases[c].use_alpha,
+                                                              .compress = cases[c].compress,
+                                                              .key_fname = key_file}) == e_success);
+        CHECK(inspect_file(stego, &info) == inspect_stego && (info.format_word & FORMAT_FLAG_SCATTER));
+        CHECK(inspect_verify(stego, key, &info) == inspect_stego && info.verified);
+        for (int m = 0; m < 3; m++)                                   // stdio (switches to the mapping), mmap, -j
+        {
+            scratch_path(output, sizeof(output), "output");
+            CHECK(decode_file_key(stego, output, m == 1, m == 2 ? 3 : 0, 0, key_file) == d_success);
+            char *out = read_whole_file(output, &out_size);
+            CHECK(out && out_size == secret_size && memcmp(out, secret_data, secret_size) == 0);
+            free(out);
+            unlink(output);
+        }
+        scratch_path(output, sizeof(output), "output");
+        CHECK(decode_file_range(stego, output, 0, key_file, 12345, 10000) == d_success);
+        char *out = read_whole_file(output, &out_size);
+        CHECK(out && out_size == 10000 && memcmp(out, secret_data + 12345, 10000) == 0);
+        free(out);
+        unlink(output);
+        scratch_path(output, sizeof(output), "output");
+        CHECK(decode_file(stego, output, 0, 0, 0) == d_failure);     // The run order needs the key
+        unlink(output);
+        free(secret_data);
+    }
+
+    /* A small payload reaches the second half of the image; no key, no scatter */
+    CHECK(corpus_write_bmp(cover, 2048, 1000, 200) == e_success);
+    CHECK(corpus_write_payload(secret, 65536, 201) == e_success);
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.scatter = 1, .use_crc = 1, .bit_depth = 1,
+                                                          .key_fname = key_file}) == e_success);
+    char *plain = read_whole_file(cover, &cover_size), *scattered = read_whole_file(stego, &stego_size);
+    size_t last = 0;
+    for (size_t i = 0; plain && scattered && i < cover_size && i < stego_size; i++)
+        if (plain[i] != scattered[i]) last = i;
+    CHECK(plain && scattered && cover_size == stego_size && last > cover_size / 2);
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.scatter = 1, .use_crc = 1, .bit_depth = 1}) == e_failure);
+
+    /* Library: same format, decode, range and verify with the key */
+    StegParams params = {0};
+    StegPayloadInfo payload;
+    char *secret_data = read_whole_file(secret, &secret_size), *decoded = malloc(65536), *made = malloc(cover_size);
+    params.scatter = 1;
+    CHECK(plain && made && steg_encode(plain, cover_size, secret_data, secret_size, &params, made, cover_size) == e_failure);
+    params.key = key;
+    CHECK(plain && made && steg_encode(plain, cover_size, secret_data, secret_size, &params, made, cover_size) == e_success);
+    CHECK(steg_decode(made, cover_size, key, decoded, 65536, &out_size) == e_success && out_size == secret_size &&
+          memcmp(decoded, secret_data, secret_size) == 0);
+    CHECK(steg_decode(scattered, stego_size, key, decoded, 65536, &out_size) == e_success &&
+          memcmp(decoded, secret_data, secret_size) == 0);           // Tool images decode through the library
+    CHECK(steg_decode_range(made, cover_size, key, 40000, 5000, decoded, 5000, &out_size) == e_success &&
+          out_size == 5000 && memcmp(decoded, secret_data + 40000, 5000) == 0);
+    CHECK(steg_verify(made, cover_size, key, &payload) == e_success && (payload.format_word & FORMAT_FLAG_SCATTER));
+    free(decoded);
+    free(made);
+    free(secret_data);
+    free(plain);
+    free(scattered);
+
+    /* Small covers: shorter runs, most of them still moved; no two runs to swap refuses --scatter */
+    bmp_layout_linear(0, 64 * 48 * 3, &layout);
+    CHECK(bmp_layout_scatter(&layout, BASE, &cipher) == e_success);
+    CHECK(layout.scatter_run < BMP_SCATTER_RUN && layout.scatter_runs >= BMP_SCATTER_MIN_RUNS);
+    moved = 0;
+    for (size_t r = 0; r < layout.scatter_runs; r++)
+        moved += bmp_slot_offset(&layout, BASE + r * layout.scatter_run) != BASE + r * layout.scatter_run;
+    CHECK(moved > (int)layout.scatter_runs / 2);
+    bmp_layout_linear(0, BASE + 2 * BMP_SCATTER_RUN_MIN - 1, &layout);
+    CHECK(bmp_layout_scatter(&layout, BASE, &cipher) == e_failure && layout.scatter_runs == 0);
+    CHECK(corpus_write_bmp(cover, 64, 48, 202) == e_success);
+    CHECK(corpus_write_payload(secret, 1000, 203) == e_success);
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.scatter = 1, .use_crc = 1, .bit_depth = 1,
+                                                          .key_fname = key_file}) == e_success);
+    scratch_path(output, sizeof(output), "output");
+    CHECK(decode_file_key(stego, output, 0, 0, 0, key_file) == d_success);
+    char *small = read_whole_file(secret, &secret_size), *small_out = read_whole_file(output, &out_size);
+    CHECK(small && small_out && out_size == secret_size && memcmp(small, small_out, secret_size) == 0);
+    free(small);
+    free(small_out);
+    unlink(output);
+
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+    unlink(key_file);
+}
+
+/* Overwrite bytes of a file at offset */
+static void patch_file(const char *fname, long offset, const void *data, size_t n)
+{
+    FILE *fptr = fopen(fname, "r+b");
+    CHECK(fptr && fseek(fptr, offset, SEEK_SET) == 0 && fwrite(data, 1, n, fptr) == n);
+    if (fptr) fclose(fptr);
+}
+
+/* Data length of the PNG chunk starting at p */
+static size_t png_chunk_length(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return (size_t)u[0] << 24 | (size_t)u[1] << 16 | (size_t)u[2] << 8 | u[3];
+}
+
+/* Recompute the CRC of the PNG chunk whose length field is at offset */
+static void png_fix_crc(const char *fname, long offset)
+{
+    size_t size = 0;
+    char *data = read_whole_file(fname, &size);
+    unsigned char crc[4];
+    size_t length = data ? png_chunk_length(data + offset) : 0;
+    uLong value = data ? crc32(crc32(0, NULL, 0), (const unsigned char *)data + offset + 4, (uInt)(4 + length)) : 0;
+    for (int i = 0; i < 4; i++)
+        crc[i] = (unsigned char)(value >> (24 - 8 * i));
+    CHECK(data && (size_t)offset + 12 + length <= size);
+    patch_file(fname, offset + 8 + (long)length, crc, sizeof(crc));
+    free(data);
+}
+
+static void test_cover(void)
+{
+    static const struct { const char *name; int tga, bits, top_down, use_alpha, depth; size_t payload; uint flags; } cases[] = {
+        {"cover.ppm", 0, 24, 1, 0, 1, 4000, 0},                          // P6 with a comment line
+        {"cover.pgm", 0, 8, 1, 0, 3, 3000, 0},                           // P5 grey
+        {"cover.tga", 1, 24, 0, 0, 2, 5000, 0},                          // Bottom-up BGR
+        {"cover.tga", 1, 32, 1, 0, 4, 6000, FORMAT_FLAG_ROWS},           // Top-down BGRA, alpha skipped
+        {"cover.tga", 1, 32, 0, 1, 4, 8000, FORMAT_FLAG_ALPHA},          // Alpha used (-a)
+        {"cover.tga", 1, 8, 0, 0, 1, 900, 0},                            // Type 3 grey
+        {"cover.ppm", 0, 24, 1, 0, 4, 3 * TILE_BYTES / 2 + 77, 0},       // Several tiles
+    };
+    static const struct { int use_mmap, threads; } modes[] = {{0, 0}, {1, 0}, {0, 3}, {1, 3}};
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], stego[PATH_MAX + 32], first[PATH_MAX + 32];
+    char output[PATH_MAX + 48], decoded[PATH_MAX + 32], key_file[PATH_MAX + 32];
+    unsigned char key[STEG_KEY_BYTES];
+    size_t cover_size = 0, secret_size = 0, stego_size = 0, first_size = 0, decoded_size = 0;
+    BmpInfo bmp;
+    StegInspect info;
+
+    scratch_path(secret, sizeof(secret), "secret.csv");
+    scratch_path(decoded, sizeof(decoded), "decoded.csv");
+    scratch_path(key_file, sizeof(key_file), "cover.key");
+    for (int i = 0; i < STEG_KEY_BYTES; i++)
+        key[i] = (unsigned char)(5 * i + 3);
+    CHECK(write_file(key_file, key, sizeof(key)) == e_success);
+
+    /* Every backend in every mode: same image, only the slots change, decodes and inspects */
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        const char *extn = strrchr(cases[c].name, '.');
+        uint width = 211 + 40 * (uint)c, height = 97;
+        if (cases[c].payload > TILE_BYTES)
+            width = 1500, height = 1200;
+        scratch_path(cover, sizeof(cover), cases[c].name);
+        snprintf(stego, sizeof(stego), "%s/stego%s", scratch, extn);
+        snprintf(first, sizeof(first), "%s/first%s", scratch, extn);
+
+        CHECK((cases[c].tga ? corpus_write_tga(cover, width, height, cases[c].bits, cases[c].top_down, (uint)c + 90)
+                            : corpus_write_pnm(cover, width, height, cases[c].bits / 8, c == 0 ? "renderer frame 1" : NULL,
+                                               (uint)c + 90)) == e_success);
+        CHECK(corpus_write_payload(secret, cases[c].payload, (uint)c + 95) == e_success);
+        char *cover_data = read_whole_file(cover, &cover_size);
+        char *secret_data = read_whole_file(secret, &secret_size);
+        CHECK(cover_data && cover_parse((unsigned char *)cover_data, cover_size, cover_size, &bmp) == e_success);
+        CHECK(bmp.format == (cases[c].tga ? cover_tga : cover_pnm) && bmp.bits_per_pixel == cases[c].bits &&
+              bmp.top_down == cases[c].top_down && bmp.width == width && bmp.height == height &&
+              bmp.stride == (size_t)width * (cases[c].bits / 8) && bmp.data_offset + bmp.stride * height == cover_size);
+        FILE *fptr = fopen(cover, "rb");
+        CHECK(fptr && get_image_size_for_cover(fptr) == (size_t)width * height * (cases[c].bits == 8 ? 1 : 3));
+        if (fptr) fclose(fptr);
+
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+        {
+            CHECK(encode_file(cover, secret, m == 0 ? first : stego, &(EncodeInfo){.use_mmap = modes[m].use_mmap,
+                                                                                   .threads = modes[m].threads,
+                                                                                   .bit_depth = cases[c].depth,
+                                                                                   .use_alpha = cases[c].use_alpha}) == e_success);
+            if (m > 0)                                               // Every mode writes the same image
+            {
+                char *a = read_whole_file(first, &first_size), *b = read_whole_file(stego, &stego_size);
+                CHECK(a && b && first_size == stego_size && memcmp(a, b, first_size) == 0);
+                free(a);
+                free(b);
+            }
+            snprintf(output, sizeof(output), "%s/decoded.txt", scratch);
+            CHECK(decode_file(m == 0 ? first : stego, output, modes[m].use_mmap, modes[m].threads, 0) == d_success);
+            char *out = read_whole_file(decoded, &decoded_size);
+            CHECK(out && decoded_size == secret_size && memcmp(out, secret_data, secret_size) == 0);
+            free(out);
+        }
+
+        char *stego_data = read_whole_file(first, &stego_size);
+        CHECK(stego_data && stego_size == cover_size && cover_data &&
+              only_slots_changed(cover_data, stego_data, cover_size, &bmp, cases[c].use_alpha));
+        CHECK(inspect_file(first, &info) == inspect_stego);
+        CHECK(info.bit_depth == cases[c].depth && info.size_secret_file == cases[c].payload &&
+              (info.format_word & (FORMAT_FLAG_ROWS | FORMAT_FLAG_ALPHA)) == cases[c].flags);
+
+        /* Library on the same cover bytes gives the same image */
+        StegParams params = {0};
+        StegPayloadInfo payload;
+        char *made = malloc(cover_size);
+        params.bit_depth = cases[c].depth;
+        params.use_alpha = cases[c].use_alpha;
+        params.extn = ".csv";
+        CHECK(made && cover_data && secret_data &&
+              steg_encode(cover_data, cover_size, secret_data, secret_size, &params, made, cover_size) == e_success);
+        CHECK(made && stego_data && memcmp(made, stego_data, cover_size) == 0);
+        CHECK(made && steg_verify(made, cover_size, NULL, &payload) == e_success && payload.payload_size == secret_size);
+        free(made);
+        free(stego_data);
+        free(cover_data);
+        free(secret_data);
+        unlink(cover);
+        unlink(stego);
+        unlink(first);
+    }
+
+    /* -K --scatter and --inplace go through the same layout */
+    scratch_path(cover, sizeof(cover), "cover.ppm");
+    scratch_path(stego, sizeof(stego), "stego.ppm");
+    snprintf(output, sizeof(output), "%s/decoded.txt", scratch);
+    CHECK(corpus_write_pnm(cover, 800, 600, 3, NULL, 97) == e_success);
+    CHECK(corpus_write_payload(secret, 100000, 98) == e_success);
+    char *secret_data = read_whole_file(secret, &secret_size);
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.scatter = 1, .use_crc = 1, .threads = 2,
+                                                          .bit_depth = 2, .compress = 1, .key_fname = key_file}) == e_success);
+    CHECK(decode_file_key(stego, output, 0, 2, 0, key_file) == d_success);
+    char *out = read_whole_file(decoded, &decoded_size);
+    CHECK(out && secret_data && decoded_size == secret_size && memcmp(out, secret_data, secret_size) == 0);
+    free(out);
+    CHECK(encode_file(cover, secret, NULL, &(EncodeInfo){.patch = 1, .in_place = 1, .bit_depth = 1}) == e_success);       // --inplace
+    snprintf(output, sizeof(output), "%s/decoded.txt", scratch);
+    CHECK(decode_file(cover, output, 1, 0, 0) == d_success);
+    out = read_whole_file(decoded, &decoded_size);
+    CHECK(out && secret_data && decoded_size == secret_size && memcmp(out, secret_data, secret_size) == 0);
+    free(out);
+    free(secret_data);
+
+    /* File names: any case of a known extension, the stego image keeps the cover's format */
+    EncodeInfo encInfo = {0};
+    char *names[][5] = {{"steg", "-e", "in.PPM", "s.txt", NULL}, {"steg", "-e", "in.tga", "s.txt", "out.tga"},
+                        {"steg", "-e", "in.ppm", "s.txt", "out.pgm"}, {"steg", "-e", "in.ppm", "s.txt", "out.bmp"},
+                        {"steg", "-e", "in.png", "s.txt", NULL}, {"steg", "-e", "in.gif", "s.txt", NULL}};
+    CHECK(read_and_validate_encode_args(names[0], &encInfo) == e_success && strcmp(encInfo.stego_image_fname, "default.ppm") == 0);
+    CHECK(read_and_validate_encode_args(names[1], &encInfo) == e_success);
+    CHECK(read_and_validate_encode_args(names[2], &encInfo) == e_success);      // Both PNM
+    CHECK(read_and_validate_encode_args(names[3], &encInfo) == e_failure);
+    CHECK(read_and_validate_encode_args(names[4], &encInfo) == e_success && strcmp(encInfo.stego_image_fname, "default.png") == 0);
+    CHECK(read_and_validate_encode_args(names[5], &encInfo) == e_failure);
+
+    /* Unsupported headers are refused instead of being written over */
+    CHECK(corpus_write_payload(secret, 10, 2) == e_success);
+    CHECK(corpus_write_pnm(cover, 64, 48, 3, NULL, 3) == e_success);
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 1}) == e_success);
+    patch_file(cover, 1, "3", 1);                                    // P3: ASCII samples
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 1}) == e_failure);
+    CHECK(corpus_write_pnm(cover, 64, 48, 3, NULL, 3) == e_success);
+    patch_file(cover, 9, "100", 3);                                  // "P6\n64 48\n255": maxval 100
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 1}) == e_failure);
+    CHECK(corpus_write_pnm(cover, 64, 480, 3, NULL, 3) == e_success);
+    CHECK(truncate(cover, 64 * 3 * 479) == 0);                       // Pixels past the end of the file
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 1}) == e_failure);
+    unlink(cover);
+
+    scratch_path(cover, sizeof(cover), "cover.tga");
+    static const struct { long offset; unsigned char value; } tga_bad[] = {
+        {2, 10},                                                     // RLE true-colour
+        {2, 1},                                                      // Colour mapped
+        {16, 16},                                                    // 16 bits per pixel
+        {17, 0xC0},                                                  // Interleaved rows
+    };
+    for (size_t i = 0; i < sizeof(tga_bad) / sizeof(tga_bad[0]); i++)
+    {
+        CHECK(corpus_write_tga(cover, 64, 48, 24, 0, 4) == e_success);
+        patch_file(cover, tga_bad[i].offset, &tga_bad[i].value, 1);
+        CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 1}) == e_failure);
+        CHECK(inspect_file(cover, &info) == inspect_unreadable);
+    }
+
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+    unlink(decoded);
+    unlink(key_file);
+}
+
+static int png_paeth(int a, int b, int c)
+{
+    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+/* Unfiltered rows of a PNG (every chunk CRC checked, one zlib stream over its IDAT chunks), filter types into types */
+static unsigned char *png_rows(const char *fname, uint height, size_t row_bytes, int channels, unsigned char *types)
+{
+    size_t size = 0, pos = 8, idat_size = 0, filtered = (row_bytes + 1) * height;
+    uLongf raw_size = filtered;
+    char *data = read_whole_file(fname, &size);
+    unsigned char *idat = malloc(size + 1), *raw = malloc(filtered), *rows = calloc(height + 1, row_bytes);
+    int ok = data && idat && raw && rows;
+
+    while (ok && pos + 12 <= size)
+    {
+        const unsigned char *chunk = (const unsigned char *)data + pos;
+        size_t n = (size_t)chunk[0] << 24 | chunk[1] << 16 | chunk[2] << 8 | chunk[3];
+        ok = pos + 12 + n <= size;
+        if (ok)
+        {
+            const unsigned char *end = chunk + 8 + n;
+            ok = crc32(0, chunk + 4, (uInt)n + 4) == ((uLong)end[0] << 24 | end[1] << 16 | end[2] << 8 | end[3]);
+            if (memcmp(chunk + 4, "IDAT", 4) == 0)
+            {
+                memcpy(idat + idat_size, chunk + 8, n);
+                idat_size += n;
+            }
+        }
+        pos += 12 + n;
+    }
+    ok = ok && pos == size && uncompress(raw, &raw_size, idat, idat_size) == Z_OK && raw_size == filtered;
+    for (uint y = 0; ok && y < height; y++)                  // rows[0] is the zero row above the image
+    {
+        const unsigned char *in = raw + y * (row_bytes + 1) + 1;
+        unsigned char *row = rows + (y + 1) * row_bytes, *prev = row - row_bytes;
+        types[y] = in[-1];
+        for (size_t i = 0; i < row_bytes; i++)
+        {
+            int a = i >= (size_t)channels ? row[i - channels] : 0, b = prev[i], c = i >= (size_t)channels ? prev[i - channels] : 0;
+            int pred = types[y] == 1 ? a : types[y] == 2 ? b : types[y] == 3 ? (a + b) >> 1 : types[y] == 4 ? png_paeth(a, b, c) : 0;
+            row[i] = (unsigned char)(in[i] + pred);
+        }
+    }
+    free(data);
+    free(idat);
+    free(raw);
+    if (!ok) { free(rows); return NULL; }
+    return rows;
+}
+
+static void test_png(void)
+{
+    static const struct { int channels, depth, use_alpha, compress, keyed; uint width, height; size_t payload; } cases[] = {
+        {3, 1, 0, 0, 0, 211, 97, 4000},                              // RGB, every filter type
+        {1, 2, 0, 0, 0, 37, 300, 2000},                              // Grey, narrow rows: a byte spans rows
+        {4, 3, 0, 0, 0, 120, 90, 6000},                              // RGBA, alpha skipped
+        {4, 4, 1, 1, 1, 120, 90, 9000},                              // Alpha used, -z, -K
+        {3, 4, 0, 1, 0, 700, 400, 3 * LZ_BLOCK + 77},                // Several -z blocks, window moves
+        {1, 1, 0, 0, 1, 1, 2000, 200},                               // One pixel per row
+    };
+    char cover[PATH_MAX + 32], secret[PATH_MAX + 32], stego[PATH_MAX + 32], output[PATH_MAX + 48];
+    char decoded[PATH_MAX + 32], key_file[PATH_MAX + 32], bad_key[PATH_MAX + 32];
+    unsigned char key[STEG_KEY_BYTES];
+    size_t secret_size = 0, decoded_size = 0, stego_size = 0;
+    StegInspect info;
+
+    scratch_path(cover, sizeof(cover), "cover.png");
+    scratch_path(stego, sizeof(stego), "stego.png");
+    scratch_path(secret, sizeof(secret), "secret.csv");
+    scratch_path(decoded, sizeof(decoded), "decoded.csv");
+    scratch_path(key_file, sizeof(key_file), "png.key");
+    scratch_path(bad_key, sizeof(bad_key), "png_bad.key");
+    for (int i = 0; i < STEG_KEY_BYTES; i++)
+        key[i] = (unsigned char)(7 * i + 1);
+    CHECK(write_file(key_file, key, sizeof(key)) == e_success);
+    key[0] ^= 1;
+    CHECK(write_file(bad_key, key, sizeof(key)) == e_success);
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+    {
+        uint height = cases[c].height;
+        size_t row_bytes = (size_t)cases[c].width * cases[c].channels;
+        const char *key_name = cases[c].keyed ? key_file : NULL;
+        CHECK(corpus_write_png(cover, cases[c].width, height, cases[c].channels, (uint)c + 40) == e_success);
+        CHECK(corpus_write_payload(secret, cases[c].payload, (uint)c + 45) == e_success);
+        CHECK(png_file(cover) && cover_name_format(cover) == cover_png);
+        CHECK(inspect_file(cover, &info) == inspect_clean);
+
+        CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.use_mmap = 1, .threads = 3,   // -m and -j do not apply: streamed anyway
+                                                              .bit_depth = cases[c].depth,
+                                                              .use_alpha = cases[c].use_alpha,
+                                                              .compress = cases[c].compress,
+                                                              .key_fname = key_name, .use_crc = 1}) == e_success);
+        snprintf(output, sizeof(output), "%s/decoded.txt", scratch);
+        CHECK(decode_file_key(stego, output, 0, 0, 0, key_name) == d_success && strcmp(output, decoded) == 0);
+        char *secret_data = read_whole_file(secret, &secret_size);
+        char *out = read_whole_file(decoded, &decoded_size);
+        CHECK(out && secret_data && decoded_size == secret_size && memcmp(out, secret_data, secret_size) == 0);
+        free(out);
+
+        /* Valid PNG, same chunks and filter types, only the payload LSBs of the raw rows changed */
+        unsigned char *cover_types = malloc(height), *stego_types = malloc(height);
+        unsigned char *a = png_rows(cover, height, row_bytes, cases[c].channels, cover_types);
+        unsigned char *b = png_rows(stego, height, row_bytes, cases[c].channels, stego_types);
+        CHECK(a && b && memcmp(cover_types, stego_types, height) == 0);
+        size_t changed = 0, outside = 0;
+        for (size_t i = 0; a && b && i < row_bytes * (height + 1); i++)
+        {
+            int lane_kept = cases[c].channels == 4 && !cases[c].use_alpha && i % 4 == 3;
+            changed += a[i] != b[i];
+            outside += ((a[i] ^ b[i]) & ~((1 << cases[c].depth) - 1)) != 0 || (lane_kept && a[i] != b[i]);
+        }
+        CHECK(changed > 0 && outside == 0);
+        char *stego_data = read_whole_file(stego, &stego_size);
+        CHECK(stego_data && stego_size > 40 && memcmp(stego_data + 37, "tEXtComment", 11) == 0 &&
+              memcmp(stego_data + stego_size - 8, "IEND", 4) == 0);
+        free(stego_data);
+        free(a);
+        free(b);
+        free(cover_types);
+        free(stego_types);
+
+        /* Inspect reads the fields from the first rows, --verify the whole payload */
+        CHECK(inspect_file(stego, &info) == inspect_stego && info.bit_depth == cases[c].depth &&
+              info.size_secret_file == cases[c].payload && strcmp(info.extn, ".csv") == 0 &&
+              ((info.format_word & FORMAT_FLAG_LZ) != 0) == cases[c].compress);
+        if (cases[c].keyed)
+        {
+            CHECK(inspect_verify(stego, key, &info) == inspect_broken);           // key holds the wrong key
+            CHECK(inspect_file(stego, &info) == inspect_stego);
+            key[0] ^= 1;
+            CHECK(inspect_verify(stego, key, &info) == inspect_stego && info.verified);
+            key[0] ^= 1;
+            CHECK(decode_file_key(stego, output, 0, 0, 0, NULL) == d_failure);
+            CHECK(decode_file_key(stego, output, 0, 0, 0, bad_key) == d_failure);
+        }
+        else
+            CHECK(inspect_verify(stego, NULL, &info) == inspect_stego && info.verified);
+
+        /* --range: only the slice, rows after it are not inflated */
+        size_t offset = cases[c].payload / 3, length = cases[c].payload / 4 + 1;
+        snprintf(output, sizeof(output), "%s/decoded.txt", scratch);
+        CHECK(decode_file_range(stego, output, 0, key_name, offset, length) == d_success);
+        out = read_whole_file(decoded, &decoded_size);
+        CHECK(out && secret_data && decoded_size == length && memcmp(out, secret_data + offset, length) == 0);
+        free(out);
+        snprintf(output, sizeof(output), "%s/decoded.txt", scratch);
+        CHECK(decode_file_range(stego, output, 0, key_name, cases[c].payload + 1, 1) == d_failure);
+        free(secret_data);
+    }
+
+    /* Refused: palette, 16-bit, interlaced, too small, --scatter, --clone; the first three are not inspected either */
+    static const struct { long offset; unsigned char value; } bad[] = {{25, 3}, {24, 16}, {28, 1}};
+    CHECK(corpus_write_payload(secret, 3000, 50) == e_success);
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        CHECK(corpus_write_png(cover, 64, 48, 3, 51) == e_success);
+        patch_file(cover, bad[i].offset, &bad[i].value, 1);
+        png_fix_crc(cover, 8);                                        // Refused for the pixel format, not the IHDR CRC
+        CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 1}) == e_failure);
+        CHECK(inspect_file(cover, &info) == inspect_unreadable);
+    }
+
+    /* Chunk CRCs: IHDR, the tEXt chunk before the image data and the IDAT chunks are checked */
+    CHECK(corpus_write_png(cover, 64, 48, 3, 53) == e_success);
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 4}) == e_success);  // 3000 bytes at depth 4: 6000 of 9216 slots
+    char *image = read_whole_file(stego, &stego_size);
+    size_t idat = 33;
+    while (image && idat + 8 < stego_size && memcmp(image + idat + 4, "IDAT", 4) != 0)
+        idat += 12 + png_chunk_length(image + idat);
+    CHECK(image && idat > 33 && idat + 8 < stego_size);
+    size_t idat_crc = image ? idat + 8 + png_chunk_length(image + idat) : 0;
+    size_t flips[] = {29, 33 + 8 + 3, idat_crc + 1};                 // IHDR CRC, tEXt data, IDAT CRC (zlib data intact)
+    for (size_t i = 0; image && i < sizeof(flips) / sizeof(flips[0]); i++)
+    {
+        image[flips[i]] ^= 0x20;
+        CHECK(write_file(cover, image, stego_size) == e_success);
+        image[flips[i]] ^= 0x20;
+        CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 4}) == e_failure);
+        if (i < 2)                                                    // Decoding stops at the payload, before the IDAT CRC
+        {
+            snprintf(output, sizeof(output), "%s/decoded.txt", scratch);
+            CHECK(decode_file_key(cover, output, 0, 0, 0, NULL) == d_failure);
+        }
+    }
+    free(image);
+
+    CHECK(corpus_write_png(cover, 50, 50, 3, 52) == e_success);     // 7500 slots: 900 bytes at depth 1
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 1}) == e_failure);
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 4}) == e_success);
+    EncodeInfo encInfo = {0};
+    encInfo.src_image_fname = cover;
+    encInfo.secret_fname = secret;
+    encInfo.stego_image_fname = stego;
+    encInfo.key_fname = key_file;
+    encInfo.scatter = 1;
+    encInfo.quiet = 1;
+    CHECK(do_encoding(&encInfo) == e_failure);
+    encInfo.scatter = 0;
+    encInfo.patch = 1;
+    CHECK(do_encoding(&encInfo) == e_failure);
+
+    /* A secret past the 32-bit size field is refused, not embedded with a truncated size (sparse file) */
+    CHECK(truncate(secret, (off_t)UINT_MAX + 1) == 0);
+    CHECK(encode_file(cover, secret, stego, &(EncodeInfo){.bit_depth = 4}) == e_failure);
+
+    unlink(cover);
+    unlink(secret);
+    unlink(stego);
+    unlink(decoded);
+    unlink(key_file);
+    unlink(bad_key);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct { const char *name; void (*fn)(void); } groups[] = {
+        {"kernels", test_kernels}, {"legacy", test_legacy},
+        {"roundtrip", test_roundtrip}, {"format", test_format}, {"stats", test_stats},
+        {"inspect", test_inspect}, {"bmp", test_bmp}, {"lz", test_lz}, {"cipher", test_cipher}, {"pipeline", test_pipeline}, {"io", test_io},
+        {"patch", test_patch}, {"library", test_library}, {"daemon", test_daemon},
+        {"range", test_range}, {"archive", test_archive},
+        {"shard", test_shard}, {"checksum", test_checksum},
+        {"scatter", test_scatter}, {"cover", test_cover}, {"png", test_png}};
+    int ran = 0;
+
+    snprintf(scratch, sizeof(scratch), "/tmp/steg_tests_XXXXXX");
+    if (!mkdtemp(scratch)) { perror("mkdtemp"); return 1; }
+    lsb_init();
+
+    for (size_t g = 0; g < sizeof(groups) / sizeof(groups[0]); g++)
+    {
+        if (argc > 1 && strcmp(argv[1], groups[g].name) != 0)
+            continue;                                // Run one group, or all without an argument
+        int before = failures;
+        groups[g].fn();
+        printf("%s %s\n", failures == before ? "PASS" : "FAIL", groups[g].name);
+        ran++;
+    }
+
+    rmdir(scratch);
+    if (ran == 0) { printf("Error: Unknown test group %s\n", argv[1]); return 1; }
+    return failures ? 1 : 0;
+}
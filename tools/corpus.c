@@ -0,0 +1,286 @@
+#include <stdio.h>                // File output
+#include <stdlib.h>               // malloc, strtoull
+#include <string.h>               // memcpy
+#include <math.h>                 // sqrt
+#include <stdint.h>               // Fixed width generator state
+#include <zlib.h>                 // PNG image data and chunk CRCs
+#include "corpus.h"               // Corpus generator declarations
+
+#define CORPUS_BLOCK (1024 * 1024) // Bytes generated per fwrite
+
+/* xorshift64* generator, never seeded with 0 */
+static uint64_t rng_next(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t rng_seed(uint seed, uint stream)
+{
+    return ((uint64_t)seed << 32 | stream) * 0x9E3779B97F4A7C15ULL | 1; // Odd, so never 0
+}
+
+void corpus_fill(char *buf, size_t n, uint seed)
+{
+    uint64_t state = rng_seed(seed, 0xF111);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)                       // 8 bytes per step
+    {
+        uint64_t v = rng_next(&state);
+        memcpy(buf + i, &v, 8);
+    }
+    if (i < n)
+    {
+        uint64_t v = rng_next(&state);
+        memcpy(buf + i, &v, n - i);
+    }
+}
+
+/* Smooth gradient plus a little noise, pixel_bytes 1 (grey), 3 or 4 (mostly opaque alpha) */
+static void fill_row(unsigned char *row, uint width, uint y, uint height, uint pixel_bytes, uint64_t *state)
+{
+    for (uint x = 0; x < width; x++)
+    {
+        uint noise = (uint)(rng_next(state) >> 40);
+        unsigned char *pixel = row + (size_t)pixel_bytes * x;
+        pixel[0] = (unsigned char)((x * 255u / width) + (noise & 7));
+        if (pixel_bytes == 1)
+            continue;
+        pixel[1] = (unsigned char)((y * 255u / height) + ((noise >> 3) & 7));
+        pixel[2] = (unsigned char)(((x + y) >> 2) + ((noise >> 6) & 7));
+        if (pixel_bytes == 4)
+            pixel[3] = (unsigned char)(0xF0 | (noise >> 9 & 0xF));
+    }
+}
+
+/* Write header, then height rows of width pixels */
+static Status write_image(const char *fname, const unsigned char *header, size_t header_size, uint width, uint height,
+                          uint pixel_bytes, size_t stride, uint seed)
+{
+    FILE *fptr = fopen(fname, "wb");
+    if (!fptr) { perror("fopen"); return e_failure; }
+    unsigned char *row = calloc(stride, 1);
+    if (!row) { fclose(fptr); return e_failure; }
+
+    Status res = fwrite(header, header_size, 1, fptr) == 1 ? e_success : e_failure;
+    uint64_t state = rng_seed(seed, 0xB3);
+    for (uint y = 0; y < height && res == e_success; y++)
+    {
+        fill_row(row, width, y, height, pixel_bytes, &state);
+        if (fwrite(row, 1, stride, fptr) != stride)
+            res = e_failure;
+    }
+
+    free(row);
+    if (fclose(fptr) != 0) res = e_failure;
+    return res;
+}
+
+/* Little endian fields of the BMP header */
+static void put_le32(unsigned char *p, uint v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+Status corpus_write_bmp_format(const char *fname, uint width, uint height, int bits_per_pixel,
+                              uint dib_size, int top_down, uint seed)
+{
+    uint pixel_bytes = bits_per_pixel / 8;
+    uint offset = 14 + dib_size;                              // Pixel data right after the headers
+    size_t stride = ((size_t)width * pixel_bytes + 3) & ~(size_t)3;  // Rows are padded to 4 bytes
+    size_t image_size = stride * height;
+    if (width == 0 || height == 0 || image_size + offset > 0xFFFFFFFFu || height > 0x7FFFFFFFu ||
+        (bits_per_pixel != 24 && bits_per_pixel != 32) || (dib_size != 40 && dib_size != 108 && dib_size != 124))
+        return e_failure;                                     // BMP size fields are 32 bits
+
+    unsigned char header[14 + 124] = {'B', 'M'};
+    put_le32(header + 2, (uint)(image_size + offset));        // File size
+    put_le32(header + 10, offset);                            // Pixel data offset
+    put_le32(header + 14, dib_size);                          // BITMAPINFOHEADER, V4 or V5
+    put_le32(header + 18, width);
+    put_le32(header + 22, top_down ? (uint)-(int)height : height);  // Negative height: first row is the top
+    header[26] = 1;                                           // Planes
+    header[28] = (unsigned char)bits_per_pixel;               // Bits per pixel
+    put_le32(header + 34, (uint)image_size);
+    if (dib_size > 40)
+    {
+        if (bits_per_pixel == 32)                             // BI_BITFIELDS: BGRA byte order
+        {
+            put_le32(header + 30, 3);
+            put_le32(header + 54, 0x00FF0000);                // Red, green, blue and alpha masks
+            put_le32(header + 58, 0x0000FF00);
+            put_le32(header + 62, 0x000000FF);
+            put_le32(header + 66, 0xFF000000);
+        }
+        put_le32(header + 70, 0x73524742);                    // LCS_sRGB
+    }
+
+    return write_image(fname, header, offset, width, height, pixel_bytes, stride, seed);
+}
+
+Status corpus_write_pnm(const char *fname, uint width, uint height, int channels, const char *comment, uint seed)
+{
+    char header[256];                                         // Magic, comment, size and maxval lines
+    if (width == 0 || height == 0 || (channels != 1 && channels != 3))
+        return e_failure;
+    int len = snprintf(header, sizeof(header), "P%c\n%s%s%s%u %u\n255\n", channels == 3 ? '6' : '5',
+                       comment ? "# " : "", comment ? comment : "", comment ? "\n" : "", width, height);
+    if (len < 0 || len >= (int)sizeof(header))
+        return e_failure;
+    return write_image(fname, (unsigned char *)header, len, width, height, channels, (size_t)width * channels, seed);
+}
+
+Status corpus_write_tga(const char *fname, uint width, uint height, int bits_per_pixel, int top_down, uint seed)
+{
+    static const char id[] = "corpus";                        // Image id field between header and pixels
+    unsigned char header[18 + sizeof(id) - 1] = {sizeof(id) - 1};
+    if (width == 0 || height == 0 || width > 0xFFFF || height > 0xFFFF ||
+        (bits_per_pixel != 8 && bits_per_pixel != 24 && bits_per_pixel != 32))
+        return e_failure;                                     // TGA sizes are 16 bits
+
+    header[2] = bits_per_pixel == 8 ? 3 : 2;                  // Uncompressed grey / true-colour
+    header[12] = width; header[13] = width >> 8;
+    header[14] = height; header[15] = height >> 8;
+    header[16] = (unsigned char)bits_per_pixel;
+    header[17] = (bits_per_pixel == 32 ? 8 : 0) | (top_down ? 0x20 : 0);  // Alpha bits, origin top left
+    memcpy(header + 18, id, sizeof(id) - 1);
+    return write_image(fname, header, sizeof(header), width, height, bits_per_pixel / 8,
+                       (size_t)width * (bits_per_pixel / 8), seed);
+}
+
+/* One PNG chunk: length, type, data, CRC */
+static Status write_chunk(FILE *fptr, const char *type, const unsigned char *data, size_t n)
+{
+    unsigned char word[4];
+    uLong crc = crc32(crc32(0, (const Bytef *)type, 4), data, (uInt)n);
+    Status res = e_success;
+
+    for (int i = 0; i < 4; i++) word[i] = (unsigned char)(n >> (24 - 8 * i));
+    if (fwrite(word, 1, 4, fptr) != 4 || fwrite(type, 1, 4, fptr) != 4 || (n && fwrite(data, 1, n, fptr) != n))
+        res = e_failure;
+    for (int i = 0; i < 4; i++) word[i] = (unsigned char)(crc >> (24 - 8 * i));
+    if (fwrite(word, 1, 4, fptr) != 4) res = e_failure;
+    return res;
+}
+
+static int paeth(int a, int b, int c)
+{
+    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+Status corpus_write_png(const char *fname, uint width, uint height, int channels, uint seed)
+{
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    static const char text[] = "Comment\0corpus";
+    unsigned char ihdr[13] = {0};
+    if (width == 0 || height == 0 || (channels != 1 && channels != 3 && channels != 4))
+        return e_failure;
+    size_t row_bytes = (size_t)width * channels, filtered = (row_bytes + 1) * height;
+    uLongf packed = compressBound(filtered);
+    unsigned char *rows = calloc(2 * row_bytes, 1), *raw = malloc(filtered), *z = malloc(packed);
+    if (!rows || !raw || !z) { free(rows); free(raw); free(z); return e_failure; }
+
+    uint64_t state = rng_seed(seed, 0x96);
+    for (uint y = 0; y < height; y++)                         // Filter type y % 5: None, Sub, Up, Average, Paeth
+    {
+        unsigned char *row = rows + (y & 1) * row_bytes, *prev = rows + !(y & 1) * row_bytes, *out = raw + y * (row_bytes + 1);
+        fill_row(row, width, y, height, channels, &state);
+        out[0] = y % 5;
+        for (size_t i = 0; i < row_bytes; i++)
+        {
+            int a = i >= (size_t)channels ? row[i - channels] : 0, b = prev[i], c = i >= (size_t)channels ? prev[i - channels] : 0;
+            int pred = out[0] == 1 ? a : out[0] == 2 ? b : out[0] == 3 ? (a + b) >> 1 : out[0] == 4 ? paeth(a, b, c) : 0;
+            out[1 + i] = (unsigned char)(row[i] - pred);
+        }
+    }
+    Status res = compress2(z, &packed, raw, filtered, 6) == Z_OK ? e_success : e_failure;
+
+    for (int i = 0; i < 4; i++)
+    {
+        ihdr[i] = (unsigned char)(width >> (24 - 8 * i));
+        ihdr[4 + i] = (unsigned char)(height >> (24 - 8 * i));
+    }
+    ihdr[8] = 8;                                              // Bit depth
+    ihdr[9] = channels == 1 ? 0 : channels == 3 ? 2 : 6;     // Grey, RGB, RGBA
+    FILE *fptr = res == e_success ? fopen(fname, "wb") : NULL;
+    if (!fptr) res = e_failure;
+    if (res == e_success && fwrite(signature, 1, 8, fptr) != 8) res = e_failure;
+    if (res == e_success) res = write_chunk(fptr, "IHDR", ihdr, sizeof(ihdr));
+    if (res == e_success) res = write_chunk(fptr, "tEXt", (const unsigned char *)text, sizeof(text) - 1);
+    for (uLongf done = 0; res == e_success && done < packed; done += 4096)   // Small chunks: reads cross IDAT boundaries
+        res = write_chunk(fptr, "IDAT", z + done, packed - done < 4096 ? packed - done : 4096);
+    if (res == e_success) res = write_chunk(fptr, "IEND", (const unsigned char *)"", 0);
+
+    free(rows);
+    free(raw);
+    free(z);
+    if (fptr && fclose(fptr) != 0) res = e_failure;
+    return res;
+}
+
+Status corpus_write_bmp(const char *fname, uint width, uint height, uint seed)
+{
+    return corpus_write_bmp_format(fname, width, height, 24, 40, 0, seed);
+}
+
+Status corpus_write_cover(const char *fname, double megapixels, uint seed)
+{
+    double pixels = megapixels * 1e6;
+    uint width = ((uint)sqrt(pixels * 4 / 3) + 3) & ~3u;       // 4:3 landscape, multiple of 4
+    if (width < 4) width = 4;
+    uint height = (uint)((pixels + width - 1) / width);
+    return corpus_write_bmp(fname, width, height ? height : 1, seed);
+}
+
+Status corpus_write_payload(const char *fname, size_t bytes, uint seed)
+{
+    static const char *words[] = {"alpha", "bravo", "charlie", "delta", "echo", "foxtrot",
+                                  "golf", "hotel", "india", "juliet", "kilo", "lima"};
+    FILE *fptr = fopen(fname, "wb");
+    if (!fptr) { perror("fopen"); return e_failure; }
+    char *block = malloc(CORPUS_BLOCK + 128);
+    if (!block) { fclose(fptr); return e_failure; }
+
+    Status res = e_success;
+    uint64_t state = rng_seed(seed, 0xC5);
+    unsigned long long line = 0;
+    size_t fill = 0;
+    while (bytes > 0 && res == e_success)
+    {
+        while (fill < CORPUS_BLOCK)                           // CSV rows: id,word,number,fraction
+        {
+            uint64_t r = rng_next(&state);
+            fill += sprintf(block + fill, "%llu,%s,%u,%u.%02u\n", line++, words[r % 12],
+                            (uint)(r >> 8) % 100000, (uint)(r >> 32) % 1000, (uint)(r >> 48) % 100);
+        }
+        size_t count = bytes < CORPUS_BLOCK ? bytes : CORPUS_BLOCK;
+        if (fwrite(block, 1, count, fptr) != count)
+            res = e_failure;
+        memmove(block, block + CORPUS_BLOCK, fill - CORPUS_BLOCK);  // Keep the partial row
+        fill -= CORPUS_BLOCK;
+        bytes -= count;
+    }
+
+    free(block);
+    if (fclose(fptr) != 0) res = e_failure;
+    return res;
+}
+
+size_t corpus_parse_size(const char *text)
+{
+    char *end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text) return 0;
+    switch (*end)
+    {
+        case 'k': case 'K': value <<= 10; end++; break;
+        case 'm': case 'M': value <<= 20; end++; break;
+        case 'g': case 'G': value <<= 30; end++; break;
+    }
+    return *end == '\0' ? (size_t)value : 0;
+}
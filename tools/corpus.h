@@ -0,0 +1,43 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include <stddef.h>         // size_t
+#include "types.h"          // Status
+
+/*
+ * Synthetic test corpus
+ * Covers are 24-bit BMPs (32-bit and V4/V5 headers, PGM/PPM, TGA and PNG
+ * for tests) and payloads are CSV-like text, both generated from a seed so the
+ * same arguments always give byte-identical files (benchmark numbers stay comparable
+ * between commits and machines)
+ */
+
+/* Write a width x height 24-bit BMP (rows padded to 4 bytes) */
+Status corpus_write_bmp(const char *fname, uint width, uint height, uint seed);
+
+/* Same with 24 or 32 bits per pixel, a 40, 108 (V4) or 124 (V5) byte DIB header and optionally top-down rows */
+Status corpus_write_bmp_format(const char *fname, uint width, uint height, int bits_per_pixel,
+                               uint dib_size, int top_down, uint seed);
+
+/* Write a binary PGM (channels 1) or PPM (channels 3) with maxval 255 and an optional # comment line */
+Status corpus_write_pnm(const char *fname, uint width, uint height, int channels, const char *comment, uint seed);
+
+/* Write an uncompressed TGA: 8-bit grey, 24-bit or 32-bit BGRA, bottom-up or top-down rows */
+Status corpus_write_tga(const char *fname, uint width, uint height, int bits_per_pixel, int top_down, uint seed);
+
+/* Write an 8-bit grey (channels 1), RGB (3) or RGBA (4) PNG: every filter type in turn, a tEXt chunk, small IDAT chunks */
+Status corpus_write_png(const char *fname, uint width, uint height, int channels, uint seed);
+
+/* Write a BMP of about megapixels million pixels, width kept a multiple of 4 (no row padding) */
+Status corpus_write_cover(const char *fname, double megapixels, uint seed);
+
+/* Write a payload of exactly bytes bytes */
+Status corpus_write_payload(const char *fname, size_t bytes, uint seed);
+
+/* Fill buf with n deterministic pseudo-random bytes */
+void corpus_fill(char *buf, size_t n, uint seed);
+
+/* Parse a size such as 4096, 64K, 16M or 1G (binary units), returns 0 on error */
+size_t corpus_parse_size(const char *text);
+
+#endif
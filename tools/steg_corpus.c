@@ -0,0 +1,72 @@
+#include <stdio.h>                // printf, snprintf
+#include <stdlib.h>               // atof, atoi
+#include <string.h>               // strcmp
+#include <limits.h>               // PATH_MAX
+#include <sys/stat.h>             // mkdir
+#include <errno.h>                // EEXIST
+#include "corpus.h"               // Corpus generator
+
+/*
+ * Generate the benchmark corpus:
+ *   cover_<N>mp.bmp   for N in 1, 4, 16, 64, 256, 500 (up to --max-cover)
+ *   payload_<S>.csv   for S in 1K, 16K, 256K, 4M, 64M, 1G (up to --max-payload)
+ */
+
+static const double cover_ladder[] = {1, 4, 16, 64, 256, 500};
+static const char *payload_ladder[] = {"1K", "16K", "256K", "4M", "64M", "1G"};
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s <out_dir> [--max-cover MP] [--max-payload SIZE] [--seed N]\n", prog);
+    printf("  --max-cover MP      largest cover in megapixels (default 16, ladder 1..500)\n");
+    printf("  --max-payload SIZE  largest payload, e.g. 64M or 1G (default 4M, ladder 1K..1G)\n");
+    printf("  --seed N            generator seed (default 1)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    double max_cover = 16;
+    size_t max_payload = corpus_parse_size("4M");
+    uint seed = 1;
+
+    if (argc < 2) { usage(argv[0]); return 1; }
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--max-cover") == 0 && i + 1 < argc)
+            max_cover = atof(argv[++i]);
+        else if (strcmp(argv[i], "--max-payload") == 0 && i + 1 < argc)
+            max_payload = corpus_parse_size(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = (uint)atoi(argv[++i]);
+        else { usage(argv[0]); return 1; }
+    }
+
+    if (mkdir(argv[1], 0755) != 0 && errno != EEXIST) { perror("mkdir"); return 1; }
+
+    char fname[PATH_MAX];
+    for (size_t i = 0; i < sizeof(cover_ladder) / sizeof(cover_ladder[0]); i++)
+    {
+        if (cover_ladder[i] > max_cover) break;
+        snprintf(fname, sizeof(fname), "%s/cover_%gmp.bmp", argv[1], cover_ladder[i]);
+        if (corpus_write_cover(fname, cover_ladder[i], seed + i) == e_failure)
+        {
+            printf("Error: Cannot write %s\n", fname);
+            return 1;
+        }
+        printf("%s\n", fname);
+    }
+
+    for (size_t i = 0; i < sizeof(payload_ladder) / sizeof(payload_ladder[0]); i++)
+    {
+        size_t bytes = corpus_parse_size(payload_ladder[i]);
+        if (bytes > max_payload) break;
+        snprintf(fname, sizeof(fname), "%s/payload_%s.csv", argv[1], payload_ladder[i]);
+        if (corpus_write_payload(fname, bytes, seed + 100 + i) == e_failure)
+        {
+            printf("Error: Cannot write %s\n", fname);
+            return 1;
+        }
+        printf("%s\n", fname);
+    }
+    return 0;
+}
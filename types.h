@@ -1,6 +1,8 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include <stddef.h>                       // size_t
+
 /* Define an unsigned int type alias */
 typedef unsigned int uint;                // 'uint' can be used instead of 'unsigned int'
 
@@ -16,7 +18,41 @@ typedef enum
 {
     e_encode,                              // Encoding operation
     e_decode,                              // Decoding operation
+    e_batch,                               // Batch of jobs from a manifest
+    e_inspect,                             // Header-only check of files and directory trees
+    e_daemon,                              // stegd: serve requests on a Unix socket
+    e_archive,                             // Many secret files into one archive payload
+    e_list,                                // List the entries of an archive payload
+    e_extract,                             // Extract entries of an archive payload
+    e_shard,                               // One secret split over many covers
+    e_rebuild,                             // Rebuild a split secret from its shard images
     e_unsupported                          // Unsupported or invalid operation
 } OperationType;
 
+/* Command line options shared by encoding and decoding */
+typedef struct _StegOptions
+{
+    int use_mmap;                          // -m : memory mapped (zero-copy) encode/decode
+    int preallocate;                       // -p : reserve the decoded file size before writing
+    int clone;                             // --clone : clone the cover (reflink) and write only the payload span
+    int in_place;                          // --inplace : embed into the cover itself
+    int threads;                           // -j N : worker threads for the payload region
+    int io_backend;                        // --io=auto|uring|threads|sync : IoBackend of the tile transfers
+    int io_depth;                          // --qd N : I/O requests in flight per thread (0 for the default)
+    int bit_depth;                         // -k N : LSBs per cover byte when encoding (1..4)
+    int use_alpha;                         // -a : also embed in the alpha byte of 32-bit covers
+    int compress;                          // -z : LZ compress the payload before embedding
+    const char *key_fname;                 // -K keyfile : ChaCha20 key to encrypt / decrypt the payload
+    int checksum;                          // --crc : CRC32C trailer after the payload (extended "#+" format)
+    int scatter;                           // --scatter : payload runs in keyed order over the whole image (needs -K)
+    int verify;                            // --verify : -i also checks the payload checksums
+    int quiet;                             // -q : no per-stage success messages
+    int parity;                            // --parity M : parity shards among the -s covers
+    int range;                             // --range offset:length : decode only that slice (-1: malformed)
+    size_t range_offset;                   // First secret byte of --range
+    size_t range_length;                   // Bytes of --range (SIZE_MAX: to the end)
+    int stats;                             // --stats=json[:file] : per-stage timing and counters
+    const char *stats_file;                // File for the stats JSON, NULL for stderr
+} StegOptions;
+
 #endif